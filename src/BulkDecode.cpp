@@ -0,0 +1,305 @@
+
+#include "pch.h"
+#include "BulkDecode.h"
+#include "SIMD.h"
+
+
+const char* SIMDLevelToString(SIMDLevel l)
+{
+	switch (l)
+	{
+	case SIMDLevel::SSE2: return "SSE2";
+	case SIMDLevel::AVX2: return "AVX2";
+	default: return "scalar";
+	}
+}
+
+SIMDLevel GetSupportedSIMDLevel()
+{
+#if BDAT_SIMD_X86
+#  ifdef _MSC_VER
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] >= 7)
+	{
+		__cpuid(regs, 1);
+		bool osxsave = (regs[2] & (1 << 27)) != 0;
+		bool avx = (regs[2] & (1 << 28)) != 0;
+		__cpuidex(regs, 7, 0);
+		bool avx2 = (regs[1] & (1 << 5)) != 0;
+		// the OS must also save the YMM registers
+		if (osxsave && avx && avx2 && (_xgetbv(0) & 6) == 6)
+			return SIMDLevel::AVX2;
+	}
+#  else
+	if (__builtin_cpu_supports("avx2"))
+		return SIMDLevel::AVX2;
+#  endif
+	return SIMDLevel::SSE2;
+#else
+	return SIMDLevel::Scalar;
+#endif
+}
+
+SIMDLevel g_bulkDecodeSIMDLevel = GetSupportedSIMDLevel();
+
+
+// byte swapping
+
+template <class T> static void ByteSwapScalar(uint8_t* data, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		T v;
+		memcpy(&v, data + i * sizeof(T), sizeof(T));
+		EndiannessAdjust(v, Endianness::Big);
+		memcpy(data + i * sizeof(T), &v, sizeof(T));
+	}
+}
+
+#if BDAT_SIMD_X86
+// SSE2 has no byte shuffle so the bytes are swapped within 16-bit words and then the words are reordered
+static UI_FORCEINLINE __m128i SwapBytesInWords(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static size_t ByteSwapSSE2(uint8_t* data, size_t count, size_t elemSize)
+{
+	size_t n = count * elemSize / 16 * 16;
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__m128i v = SwapBytesInWords(_mm_loadu_si128((const __m128i*)(data + i)));
+		if (elemSize == 4)
+		{
+			v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+			v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		}
+		else if (elemSize == 8)
+		{
+			v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+			v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		}
+		_mm_storeu_si128((__m128i*)(data + i), v);
+	}
+	return n / elemSize;
+}
+
+BDAT_TARGET_AVX2 static size_t ByteSwapAVX2(uint8_t* data, size_t count, size_t elemSize)
+{
+	__m256i mask;
+	if (elemSize == 2)
+		mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	else if (elemSize == 4)
+		mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	else
+		mask = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+	size_t n = count * elemSize / 32 * 32;
+	for (size_t i = 0; i < n; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+		_mm256_storeu_si256((__m256i*)(data + i), _mm256_shuffle_epi8(v, mask));
+	}
+	return n / elemSize;
+}
+#endif
+
+void ByteSwapArray(void* data, size_t count, size_t elemSize)
+{
+	if (elemSize != 2 && elemSize != 4 && elemSize != 8)
+		return;
+
+	uint8_t* p = (uint8_t*)data;
+	size_t done = 0;
+#if BDAT_SIMD_X86
+	if (g_bulkDecodeSIMDLevel >= SIMDLevel::AVX2)
+		done = ByteSwapAVX2(p, count, elemSize);
+	else if (g_bulkDecodeSIMDLevel >= SIMDLevel::SSE2)
+		done = ByteSwapSSE2(p, count, elemSize);
+#endif
+	p += done * elemSize;
+	count -= done;
+
+	switch (elemSize)
+	{
+	case 2: ByteSwapScalar<uint16_t>(p, count); break;
+	case 4: ByteSwapScalar<uint32_t>(p, count); break;
+	case 8: ByteSwapScalar<uint64_t>(p, count); break;
+	}
+}
+
+
+// gathering
+
+template <size_t N> static void GatherFixed(const uint8_t* src, size_t stride, size_t count, uint8_t* out)
+{
+	// fixed size copies compile to single unaligned loads/stores
+	for (size_t i = 0; i < count; i++)
+		memcpy(out + i * N, src + i * stride, N);
+}
+
+void GatherElements(const void* src, size_t stride, size_t count, size_t elemSize, void* out)
+{
+	auto* s = (const uint8_t*)src;
+	auto* o = (uint8_t*)out;
+	if (stride == elemSize)
+	{
+		memcpy(o, s, count * elemSize);
+		return;
+	}
+	switch (elemSize)
+	{
+	case 1: GatherFixed<1>(s, stride, count, o); break;
+	case 2: GatherFixed<2>(s, stride, count, o); break;
+	case 4: GatherFixed<4>(s, stride, count, o); break;
+	case 8: GatherFixed<8>(s, stride, count, o); break;
+	default:
+		for (size_t i = 0; i < count; i++)
+			memcpy(o + i * elemSize, s + i * stride, elemSize);
+		break;
+	}
+}
+
+
+// widening to float
+
+template <class T> static void ConvertToFloatScalar(const T* src, size_t count, float* out)
+{
+	for (size_t i = 0; i < count; i++)
+		out[i] = float(src[i]);
+}
+
+#if BDAT_SIMD_X86
+// 16 x 8-bit -> 16 x 32-bit
+template <bool Signed> static size_t Convert8SSE2(const uint8_t* src, size_t count, float* out)
+{
+	size_t n = count / 16 * 16;
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i w[2];
+		if (Signed)
+		{
+			// putting the byte in the top half and shifting it back down extends the sign
+			w[0] = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+			w[1] = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+		}
+		else
+		{
+			w[0] = _mm_unpacklo_epi8(v, _mm_setzero_si128());
+			w[1] = _mm_unpackhi_epi8(v, _mm_setzero_si128());
+		}
+		for (int j = 0; j < 2; j++)
+		{
+			__m128i lo = Signed ? _mm_srai_epi32(_mm_unpacklo_epi16(w[j], w[j]), 16) : _mm_unpacklo_epi16(w[j], _mm_setzero_si128());
+			__m128i hi = Signed ? _mm_srai_epi32(_mm_unpackhi_epi16(w[j], w[j]), 16) : _mm_unpackhi_epi16(w[j], _mm_setzero_si128());
+			_mm_storeu_ps(out + i + j * 8, _mm_cvtepi32_ps(lo));
+			_mm_storeu_ps(out + i + j * 8 + 4, _mm_cvtepi32_ps(hi));
+		}
+	}
+	return n;
+}
+
+// 8 x 16-bit -> 8 x 32-bit
+template <bool Signed> static size_t Convert16SSE2(const uint16_t* src, size_t count, float* out)
+{
+	size_t n = count / 8 * 8;
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i lo = Signed ? _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16) : _mm_unpacklo_epi16(v, _mm_setzero_si128());
+		__m128i hi = Signed ? _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16) : _mm_unpackhi_epi16(v, _mm_setzero_si128());
+		_mm_storeu_ps(out + i, _mm_cvtepi32_ps(lo));
+		_mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(hi));
+	}
+	return n;
+}
+
+// there is no unsigned conversion so the two 16-bit halves are converted separately
+// (both are exact and so is the scaling, so the final add is the only rounding step)
+static UI_FORCEINLINE __m128 ConvertU32x4(__m128i v)
+{
+	__m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 16)), _mm_set1_ps(65536.0f));
+	__m128 lo = _mm_cvtepi32_ps(_mm_and_si128(v, _mm_set1_epi32(0xffff)));
+	return _mm_add_ps(hi, lo);
+}
+
+template <bool Signed> static size_t Convert32SSE2(const uint32_t* src, size_t count, float* out)
+{
+	size_t n = count / 4 * 4;
+	for (size_t i = 0; i < n; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_ps(out + i, Signed ? _mm_cvtepi32_ps(v) : ConvertU32x4(v));
+	}
+	return n;
+}
+
+template <bool Signed> BDAT_TARGET_AVX2 static size_t Convert8AVX2(const uint8_t* src, size_t count, float* out)
+{
+	size_t n = count / 8 * 8;
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__m128i v = _mm_loadl_epi64((const __m128i*)(src + i));
+		__m256i w = Signed ? _mm256_cvtepi8_epi32(v) : _mm256_cvtepu8_epi32(v);
+		_mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(w));
+	}
+	return n;
+}
+
+template <bool Signed> BDAT_TARGET_AVX2 static size_t Convert16AVX2(const uint16_t* src, size_t count, float* out)
+{
+	size_t n = count / 8 * 8;
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m256i w = Signed ? _mm256_cvtepi16_epi32(v) : _mm256_cvtepu16_epi32(v);
+		_mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(w));
+	}
+	return n;
+}
+
+template <bool Signed> BDAT_TARGET_AVX2 static size_t Convert32AVX2(const uint32_t* src, size_t count, float* out)
+{
+	size_t n = count / 8 * 8;
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256 f;
+		if (Signed)
+			f = _mm256_cvtepi32_ps(v);
+		else
+		{
+			__m256 hi = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(v, 16)), _mm256_set1_ps(65536.0f));
+			__m256 lo = _mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xffff)));
+			f = _mm256_add_ps(hi, lo);
+		}
+		_mm256_storeu_ps(out + i, f);
+	}
+	return n;
+}
+#endif
+
+#if BDAT_SIMD_X86
+#  define CONVERT_WITH_KERNELS(T, UT, bits, sgn) \
+	size_t done = 0; \
+	if (g_bulkDecodeSIMDLevel >= SIMDLevel::AVX2) \
+		done = Convert##bits##AVX2<sgn>((const UT*)src, count, out); \
+	else if (g_bulkDecodeSIMDLevel >= SIMDLevel::SSE2) \
+		done = Convert##bits##SSE2<sgn>((const UT*)src, count, out); \
+	ConvertToFloatScalar(src + done, count - done, out + done)
+#else
+#  define CONVERT_WITH_KERNELS(T, UT, bits, sgn) ConvertToFloatScalar(src, count, out)
+#endif
+
+void ConvertToFloat(const int8_t* src, size_t count, float* out) { CONVERT_WITH_KERNELS(int8_t, uint8_t, 8, true); }
+void ConvertToFloat(const uint8_t* src, size_t count, float* out) { CONVERT_WITH_KERNELS(uint8_t, uint8_t, 8, false); }
+void ConvertToFloat(const int16_t* src, size_t count, float* out) { CONVERT_WITH_KERNELS(int16_t, uint16_t, 16, true); }
+void ConvertToFloat(const uint16_t* src, size_t count, float* out) { CONVERT_WITH_KERNELS(uint16_t, uint16_t, 16, false); }
+void ConvertToFloat(const int32_t* src, size_t count, float* out) { CONVERT_WITH_KERNELS(int32_t, uint32_t, 32, true); }
+void ConvertToFloat(const uint32_t* src, size_t count, float* out) { CONVERT_WITH_KERNELS(uint32_t, uint32_t, 32, false); }
+void ConvertToFloat(const int64_t* src, size_t count, float* out) { ConvertToFloatScalar(src, count, out); }
+void ConvertToFloat(const uint64_t* src, size_t count, float* out) { ConvertToFloatScalar(src, count, out); }
+void ConvertToFloat(const float* src, size_t count, float* out) { memcpy(out, src, count * sizeof(float)); }
+void ConvertToFloat(const double* src, size_t count, float* out) { ConvertToFloatScalar(src, count, out); }
@@ -0,0 +1,48 @@
+#pragma once
+#include "pch.h"
+#include "Common.h"
+#include "FileReaders.h"
+#include "SIMD.h"
+
+
+// bulk conversion of number arrays, using SIMD kernels where the CPU supports them
+
+// the kernels used by the functions below (defaults to the supported level, can be lowered to test the fallbacks)
+extern SIMDLevel g_bulkDecodeSIMDLevel;
+
+// reverses the bytes of each of the `count` elements (element sizes other than 2/4/8 are left as is)
+void ByteSwapArray(void* data, size_t count, size_t elemSize);
+// copies `count` elements of `elemSize` bytes placed `stride` bytes apart into a contiguous array
+void GatherElements(const void* src, size_t stride, size_t count, size_t elemSize, void* out);
+
+void ConvertToFloat(const int8_t* src, size_t count, float* out);
+void ConvertToFloat(const uint8_t* src, size_t count, float* out);
+void ConvertToFloat(const int16_t* src, size_t count, float* out);
+void ConvertToFloat(const uint16_t* src, size_t count, float* out);
+void ConvertToFloat(const int32_t* src, size_t count, float* out);
+void ConvertToFloat(const uint32_t* src, size_t count, float* out);
+void ConvertToFloat(const int64_t* src, size_t count, float* out);
+void ConvertToFloat(const uint64_t* src, size_t count, float* out);
+void ConvertToFloat(const float* src, size_t count, float* out);
+void ConvertToFloat(const double* src, size_t count, float* out);
+
+// converts the elements of `data` from the given endianness to the native (little) one in place
+template <class T> inline void DecodeArray(T* data, size_t count, Endianness e)
+{
+	if (sizeof(T) > 1 && e == Endianness::Big)
+		ByteSwapArray(data, count, sizeof(T));
+}
+
+// decodes `count` values of type T placed `stride` bytes apart in memory (the values need not be aligned)
+template <class T> inline void DecodeStrided(const void* src, size_t stride, size_t count, Endianness e, T* out)
+{
+	GatherElements(src, stride, count, sizeof(T), out);
+	DecodeArray(out, count, e);
+}
+
+// decodes `count` values of type T placed `stride` bytes apart in the data source
+template <class T> inline void ReadDecoded(IDataSource* ds, uint64_t off, uint64_t stride, size_t count, Endianness e, T* out)
+{
+	ds->ReadStrided(off, stride, count, sizeof(T), out);
+	DecodeArray(out, count, e);
+}
@@ -0,0 +1,351 @@
+#include "pch.h"
+#include "BulkFileReader.h"
+#include "Threading.h"
+
+#if defined(__linux__)
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#  include <errno.h>
+#  include <sched.h>
+#endif
+
+
+static void ZeroFillRest(DataReadRequest& R, size_t done)
+{
+	if (done < R.size)
+		memset((char*)R.out + done, 0, R.size - done);
+}
+
+
+struct ThreadPoolBulkFileReader : IBulkFileReader
+{
+	ThreadPoolBulkFileReader(FILE* fp, unsigned numThreads) : _fp(fp), _pool(ui::max(numThreads, 2U) - 1)
+	{
+	}
+	void ReadAll(DataReadRequest* reqs, size_t count) override
+	{
+		_pool.ParallelFor(count, [this, reqs](size_t i)
+		{
+			auto& R = reqs[i];
+			ZeroFillRest(R, ReadFileAt(_fp, R.at, R.size, R.out));
+		});
+	}
+	const char* GetName() override { return "thread pool"; }
+
+	FILE* _fp;
+	WorkerPool _pool;
+};
+
+IBulkFileReader* CreateThreadPoolBulkFileReader(FILE* fp, unsigned numThreads)
+{
+	return new ThreadPoolBulkFileReader(fp, numThreads);
+}
+
+
+#if defined(__linux__) && defined(IORING_OFF_SQ_RING)
+
+// how many times submitting is retried when the kernel is out of resources and there are no reads to wait for
+static const unsigned IOURING_MAX_BUSY_RETRIES = 64;
+
+struct IOUringBulkFileReader : IBulkFileReader
+{
+	IOUringBulkFileReader(FILE* fp) : _fp(fp), _fd(fileno(fp))
+	{
+	}
+	~IOUringBulkFileReader()
+	{
+		if (_sqes != MAP_FAILED)
+			munmap(_sqes, _sqesSize);
+		if (_cqRing != MAP_FAILED && _cqRing != _sqRing)
+			munmap(_cqRing, _cqRingSize);
+		if (_sqRing != MAP_FAILED)
+			munmap(_sqRing, _sqRingSize);
+		if (_ringFd >= 0)
+			close(_ringFd);
+	}
+
+	bool Init(unsigned entries)
+	{
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		_ringFd = int(syscall(__NR_io_uring_setup, entries, &p));
+		if (_ringFd < 0)
+			return false; // ENOSYS on old kernels, EPERM when disabled by policy/seccomp
+		_entries = p.sq_entries;
+
+		_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single)
+			_sqRingSize = _cqRingSize = ui::max(_sqRingSize, _cqRingSize);
+
+		_sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+		if (_sqRing == MAP_FAILED)
+			return false;
+		_cqRing = single ? _sqRing : mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+		if (_cqRing == MAP_FAILED)
+			return false;
+		_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+		_sqes = (io_uring_sqe*)mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+		if (_sqes == MAP_FAILED)
+			return false;
+
+		char* sq = (char*)_sqRing;
+		_sqTail = (unsigned*)(sq + p.sq_off.tail);
+		_sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+		_sqArray = (unsigned*)(sq + p.sq_off.array);
+		char* cq = (char*)_cqRing;
+		_cqHead = (unsigned*)(cq + p.cq_off.head);
+		_cqTail = (unsigned*)(cq + p.cq_off.tail);
+		_cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+		_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+		return true;
+	}
+
+	void ReadAll(DataReadRequest* reqs, size_t count) override
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_failed)
+		{
+			// the ring stopped working earlier, everything is read the slow way from then on
+			for (size_t i = 0; i < count; i++)
+				ZeroFillRest(reqs[i], ReadFileAt(_fp, reqs[i].at, reqs[i].size, reqs[i].out));
+			return;
+		}
+
+		std::vector<size_t> done(count, 0);
+		std::vector<size_t> resubmit; // short reads and interrupted ones
+		size_t nextNew = 0;
+		size_t remaining = count;
+		unsigned queued = 0; // in the submission ring but not taken by the kernel yet
+		unsigned inFlight = 0; // taken by the kernel, not completed yet
+		unsigned busyRetries = 0;
+
+		auto reapCompletions = [&]()
+		{
+			unsigned head = *_cqHead;
+			unsigned cqTail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+			for (; head != cqTail; head++)
+			{
+				io_uring_cqe* cqe = &_cqes[head & *_cqMask];
+				size_t i = size_t(cqe->user_data);
+				int res = cqe->res;
+				inFlight--;
+
+				auto& R = reqs[i];
+				if (res == -EAGAIN || res == -EINTR)
+				{
+					resubmit.push_back(i);
+					continue;
+				}
+				if (res > 0)
+				{
+					done[i] += res;
+					if (done[i] < R.size)
+					{
+						resubmit.push_back(i);
+						continue;
+					}
+				}
+				else if (res < 0)
+				{
+					// e.g. IORING_OP_READ not supported by this kernel
+					done[i] += ReadFileAt(_fp, R.at + done[i], R.size - done[i], (char*)R.out + done[i]);
+				}
+				// res == 0 is the end of the file
+				ZeroFillRest(R, done[i]);
+				done[i] = SIZE_MAX;
+				remaining--;
+			}
+			__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+		};
+
+		while (remaining)
+		{
+			unsigned tail = *_sqTail;
+			while (inFlight + queued < _entries)
+			{
+				size_t i;
+				if (!resubmit.empty())
+				{
+					i = resubmit.back();
+					resubmit.pop_back();
+				}
+				else if (nextNew < count)
+					i = nextNew++;
+				else
+					break;
+
+				auto& R = reqs[i];
+				unsigned slot = tail & *_sqMask;
+				io_uring_sqe* sqe = &_sqes[slot];
+				memset(sqe, 0, sizeof(*sqe));
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = _fd;
+				sqe->off = R.at + done[i];
+				sqe->addr = uint64_t(uintptr_t((char*)R.out + done[i]));
+				sqe->len = unsigned(ui::min(R.size - done[i], size_t(1) << 30));
+				sqe->user_data = i;
+				_sqArray[slot] = slot;
+				tail++;
+				queued++;
+			}
+			__atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+
+			long ret;
+			do
+				ret = syscall(__NR_io_uring_enter, _ringFd, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			while (ret < 0 && errno == EINTR);
+			if (ret >= 0)
+			{
+				// the kernel may take only some of the entries, the rest stay queued for the next call
+				queued -= unsigned(ret);
+				inFlight += unsigned(ret);
+				busyRetries = 0;
+			}
+			else if ((errno == EAGAIN || errno == EBUSY) && (inFlight || ++busyRetries < IOURING_MAX_BUSY_RETRIES))
+			{
+				// out of resources or the completion ring is full, which clears up as the reads complete
+				if (inFlight)
+					syscall(__NR_io_uring_enter, _ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+				else
+					sched_yield();
+			}
+			else
+			{
+				// the ring is unusable, the reads it has taken still write to the buffers so they're waited for
+				// (completions are also posted while returning from any other syscall)
+				_failed = true;
+				while (inFlight)
+				{
+					reapCompletions();
+					if (inFlight && syscall(__NR_io_uring_enter, _ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0)
+						sched_yield();
+				}
+				for (size_t i = 0; i < count; i++)
+				{
+					if (done[i] == SIZE_MAX)
+						continue;
+					auto& R = reqs[i];
+					done[i] += ReadFileAt(_fp, R.at + done[i], R.size - done[i], (char*)R.out + done[i]);
+					ZeroFillRest(R, done[i]);
+				}
+				return;
+			}
+
+			reapCompletions();
+		}
+	}
+	const char* GetName() override { return "io_uring"; }
+
+	FILE* _fp;
+	int _fd;
+	int _ringFd = -1;
+	unsigned _entries = 0;
+	bool _failed = false;
+	std::mutex _mutex;
+
+	void* _sqRing = MAP_FAILED;
+	size_t _sqRingSize = 0;
+	void* _cqRing = MAP_FAILED;
+	size_t _cqRingSize = 0;
+	io_uring_sqe* _sqes = (io_uring_sqe*)MAP_FAILED;
+	size_t _sqesSize = 0;
+
+	unsigned* _sqTail = nullptr;
+	unsigned* _sqMask = nullptr;
+	unsigned* _sqArray = nullptr;
+	unsigned* _cqHead = nullptr;
+	unsigned* _cqTail = nullptr;
+	unsigned* _cqMask = nullptr;
+	io_uring_cqe* _cqes = nullptr;
+};
+
+IBulkFileReader* CreateIOUringBulkFileReader(FILE* fp, unsigned queueDepth)
+{
+	auto* R = new IOUringBulkFileReader(fp);
+	if (R->Init(queueDepth))
+		return R;
+	delete R;
+	return nullptr;
+}
+
+#else
+
+IBulkFileReader* CreateIOUringBulkFileReader(FILE* fp, unsigned queueDepth)
+{
+	return nullptr;
+}
+
+#endif
+
+
+IBulkFileReader* CreateBulkFileReader(FILE* fp, unsigned queueDepth)
+{
+	if (auto* R = CreateIOUringBulkFileReader(fp, queueDepth))
+		return R;
+	return CreateThreadPoolBulkFileReader(fp, ui::min(queueDepth, 8U));
+}
+
+
+#if 0
+// set BDAT_BENCH_FILE to a large file (ideally not in the page cache) to compare the read paths
+struct BulkFileReaderBenchmark
+{
+	BulkFileReaderBenchmark()
+	{
+		if (const char* path = getenv("BDAT_BENCH_FILE"))
+		{
+			Run(path);
+			exit(0);
+		}
+	}
+	static double Now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	void Report(const char* name, uint64_t bytes, double t)
+	{
+		printf("%-12s %8.2f s %8.1f MB/s\n", name, t, bytes / t / (1024 * 1024));
+	}
+	void Run(const char* path)
+	{
+		const size_t blockSize = 1024 * 1024;
+		const size_t batch = 64;
+		std::vector<char> buf(blockSize * batch);
+
+		FILE* fp = fopen(path, "rb");
+		if (!fp)
+			return;
+		_fseeki64(fp, 0, SEEK_END);
+		uint64_t size = _ftelli64(fp);
+		_fseeki64(fp, 0, SEEK_SET);
+
+		double t0 = Now();
+		while (fread(buf.data(), 1, blockSize, fp) == blockSize) {}
+		Report("fread", size, Now() - t0);
+
+		auto runBulk = [&](IBulkFileReader* R)
+		{
+			if (!R)
+				return;
+			double t0 = Now();
+			DataReadRequest reqs[batch];
+			for (uint64_t off = 0; off < size; off += blockSize * batch)
+			{
+				for (size_t i = 0; i < batch; i++)
+					reqs[i] = { off + i * blockSize, blockSize, &buf[i * blockSize] };
+				R->ReadAll(reqs, batch);
+			}
+			Report(R->GetName(), size, Now() - t0);
+			delete R;
+		};
+		runBulk(CreateThreadPoolBulkFileReader(fp, 8));
+		runBulk(CreateIOUringBulkFileReader(fp, 32));
+		fclose(fp);
+	}
+}
+gBulkFileReaderBenchmark;
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+#include "pch.h"
+#include "FileReaders.h"
+
+
+// keeps many positional reads on one file in flight at once
+struct IBulkFileReader
+{
+	virtual ~IBulkFileReader() {}
+	// performs all of the reads (in any order) and returns when they're done, zero-filling past the end of the file
+	// safe to call from multiple threads, calls are serialized
+	virtual void ReadAll(DataReadRequest* reqs, size_t count) = 0;
+	virtual const char* GetName() = 0;
+};
+
+// io_uring on Linux if the kernel allows it, otherwise a pool of threads doing positional reads
+IBulkFileReader* CreateBulkFileReader(FILE* fp, unsigned queueDepth = 32);
+IBulkFileReader* CreateThreadPoolBulkFileReader(FILE* fp, unsigned numThreads);
+IBulkFileReader* CreateIOUringBulkFileReader(FILE* fp, unsigned queueDepth); // null if unavailable
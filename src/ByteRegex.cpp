@@ -0,0 +1,726 @@
+
+#include "pch.h"
+#include "ByteRegex.h"
+#include <bitset>
+#include <climits>
+
+
+static const unsigned REGEX_MAX_REPEAT = 1000;
+static const size_t REGEX_MAX_NFA_STATES = 10000;
+// per DFA cache (each state has 1 KB of transitions plus its NFA state list), it's cleared when full
+static const size_t REGEX_DFA_CACHE_SIZE = 2 * 1024 * 1024;
+
+typedef std::bitset<256> ByteSet;
+
+// the expression is parsed into a tree first, so that repetitions can be compiled into several copies
+// and the reversed NFA (for finding the starts of matches) can be made from the same tree
+struct RegexNode
+{
+	enum Type : uint8_t
+	{
+		Set,
+		Concat,
+		Alt,
+		Repeat,
+	};
+
+	Type type = Set;
+	ByteSet set;
+	std::vector<int> children;
+	unsigned min = 0;
+	unsigned max = 0; // UINT_MAX = unbounded
+};
+
+struct RegexParser
+{
+	RegexParser(ui::StringView t, std::vector<RegexNode>& n) : text(t), nodes(n) {}
+
+	int Fail(const char* msg)
+	{
+		if (error.empty())
+			error = ui::Format("%s at %zu", msg, pos);
+		return -1;
+	}
+	int Add(RegexNode&& node)
+	{
+		nodes.push_back(std::move(node));
+		return int(nodes.size() - 1);
+	}
+	bool AtEnd() const { return pos >= text.size(); }
+
+	int ParseAlt();
+	int ParseConcat();
+	int ParseRepeat();
+	int ParseAtom();
+	int ParseClass();
+	// sets `single` to the byte value if the escape is for one byte, -1 otherwise
+	bool ParseEscape(ByteSet& set, int& single);
+	bool ParseNumber(unsigned& out);
+
+	ui::StringView text;
+	size_t pos = 0;
+	std::string error;
+	std::vector<RegexNode>& nodes;
+};
+
+int RegexParser::ParseAlt()
+{
+	int first = ParseConcat();
+	if (first < 0)
+		return -1;
+	if (AtEnd() || text[pos] != '|')
+		return first;
+
+	RegexNode alt;
+	alt.type = RegexNode::Alt;
+	alt.children.push_back(first);
+	while (!AtEnd() && text[pos] == '|')
+	{
+		pos++;
+		int c = ParseConcat();
+		if (c < 0)
+			return -1;
+		alt.children.push_back(c);
+	}
+	return Add(std::move(alt));
+}
+
+int RegexParser::ParseConcat()
+{
+	RegexNode cat;
+	cat.type = RegexNode::Concat;
+	while (!AtEnd() && text[pos] != '|' && text[pos] != ')')
+	{
+		int r = ParseRepeat();
+		if (r < 0)
+			return -1;
+		cat.children.push_back(r);
+	}
+	if (cat.children.size() == 1)
+		return cat.children[0];
+	return Add(std::move(cat));
+}
+
+int RegexParser::ParseRepeat()
+{
+	int atom = ParseAtom();
+	if (atom < 0)
+		return -1;
+
+	while (!AtEnd())
+	{
+		unsigned min, max;
+		char c = text[pos];
+		if (c == '*' || c == '+' || c == '?')
+		{
+			min = c == '+' ? 1 : 0;
+			max = c == '?' ? 1 : UINT_MAX;
+			pos++;
+		}
+		else if (c == '{')
+		{
+			pos++;
+			if (!ParseNumber(min))
+				return Fail("expected a number");
+			max = min;
+			if (!AtEnd() && text[pos] == ',')
+			{
+				pos++;
+				if (!AtEnd() && text[pos] == '}')
+					max = UINT_MAX;
+				else if (!ParseNumber(max))
+					return Fail("expected a number");
+			}
+			if (AtEnd() || text[pos] != '}')
+				return Fail("expected '}'");
+			pos++;
+			if (max < min)
+				return Fail("the maximum is less than the minimum");
+			if (min > REGEX_MAX_REPEAT || (max != UINT_MAX && max > REGEX_MAX_REPEAT))
+				return Fail("too many repetitions");
+		}
+		else
+			break;
+
+		// the longest match is always used, so there's no difference between greedy and lazy
+		if (!AtEnd() && text[pos] == '?')
+			return Fail("lazy repetition is not supported");
+
+		RegexNode rep;
+		rep.type = RegexNode::Repeat;
+		rep.children.push_back(atom);
+		rep.min = min;
+		rep.max = max;
+		atom = Add(std::move(rep));
+	}
+	return atom;
+}
+
+int RegexParser::ParseAtom()
+{
+	RegexNode node;
+	char c = text[pos];
+	switch (c)
+	{
+	case '(': {
+		pos++;
+		if (!AtEnd() && text[pos] == '?')
+		{
+			if (pos + 1 >= text.size() || text[pos + 1] != ':')
+				return Fail("unsupported group type");
+			pos += 2;
+		}
+		int inner = ParseAlt();
+		if (inner < 0)
+			return -1;
+		if (AtEnd() || text[pos] != ')')
+			return Fail("expected ')'");
+		pos++;
+		return inner; }
+	case '*':
+	case '+':
+	case '?':
+	case '{':
+		return Fail("nothing to repeat");
+	case '[':
+		return ParseClass();
+	case '.':
+		node.set.set();
+		pos++;
+		break;
+	case '\\': {
+		int single;
+		if (!ParseEscape(node.set, single))
+			return -1;
+		break; }
+	default:
+		node.set.set(uint8_t(c));
+		pos++;
+		break;
+	}
+	return Add(std::move(node));
+}
+
+int RegexParser::ParseClass()
+{
+	size_t start = pos++;
+	RegexNode node;
+	bool negate = false;
+	if (!AtEnd() && text[pos] == '^')
+	{
+		negate = true;
+		pos++;
+	}
+	for (bool first = true;; first = false)
+	{
+		if (AtEnd())
+		{
+			pos = start;
+			return Fail("unterminated set");
+		}
+		// `]` right after the opening bracket is a member
+		if (text[pos] == ']' && !first)
+		{
+			pos++;
+			break;
+		}
+
+		ByteSet set;
+		int lo;
+		if (text[pos] == '\\')
+		{
+			if (!ParseEscape(set, lo))
+				return -1;
+		}
+		else
+			lo = uint8_t(text[pos++]);
+
+		if (lo >= 0 && pos + 1 < text.size() && text[pos] == '-' && text[pos + 1] != ']')
+		{
+			pos++;
+			int hi;
+			if (text[pos] == '\\')
+			{
+				ByteSet tmp;
+				if (!ParseEscape(tmp, hi))
+					return -1;
+			}
+			else
+				hi = uint8_t(text[pos++]);
+			if (hi < lo)
+				return Fail("invalid range");
+			for (int b = lo; b <= hi; b++)
+				node.set.set(b);
+		}
+		else if (lo >= 0)
+			node.set.set(lo);
+		else
+			node.set |= set;
+	}
+	if (negate)
+		node.set.flip();
+	return Add(std::move(node));
+}
+
+static int HexDigitValue(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool RegexParser::ParseEscape(ByteSet& set, int& single)
+{
+	pos++;
+	if (AtEnd())
+	{
+		Fail("unfinished escape sequence");
+		return false;
+	}
+	single = -1;
+	char c = text[pos++];
+	switch (c)
+	{
+	case 'x': {
+		int hi = pos < text.size() ? HexDigitValue(text[pos]) : -1;
+		int lo = pos + 1 < text.size() ? HexDigitValue(text[pos + 1]) : -1;
+		if (hi < 0 || lo < 0)
+		{
+			Fail("expected two hex digits");
+			return false;
+		}
+		pos += 2;
+		single = hi * 16 + lo;
+		break; }
+	case 'n': single = '\n'; break;
+	case 'r': single = '\r'; break;
+	case 't': single = '\t'; break;
+	case 'f': single = '\f'; break;
+	case 'v': single = '\v'; break;
+	case '0': single = 0; break;
+	case 'd':
+	case 'D':
+		for (int b = '0'; b <= '9'; b++)
+			set.set(b);
+		if (c == 'D')
+			set.flip();
+		break;
+	case 'w':
+	case 'W':
+		for (int b = 0; b < 256; b++)
+			if ((b >= '0' && b <= '9') || (b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z') || b == '_')
+				set.set(b);
+		if (c == 'W')
+			set.flip();
+		break;
+	case 's':
+	case 'S':
+		for (char b : { ' ', '\t', '\n', '\v', '\f', '\r' })
+			set.set(uint8_t(b));
+		if (c == 'S')
+			set.flip();
+		break;
+	default:
+		// letters and digits are reserved for more escapes
+		if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+		{
+			pos--;
+			Fail("unknown escape sequence");
+			return false;
+		}
+		single = uint8_t(c);
+		break;
+	}
+	if (single >= 0)
+		set.set(single);
+	return true;
+}
+
+bool RegexParser::ParseNumber(unsigned& out)
+{
+	size_t start = pos;
+	out = 0;
+	while (!AtEnd() && text[pos] >= '0' && text[pos] <= '9')
+	{
+		out = ui::min(out * 10 + unsigned(text[pos] - '0'), REGEX_MAX_REPEAT + 1);
+		pos++;
+	}
+	return pos != start;
+}
+
+static bool IsNullable(const std::vector<RegexNode>& nodes, int node)
+{
+	const RegexNode& N = nodes[node];
+	switch (N.type)
+	{
+	case RegexNode::Set:
+		return false;
+	case RegexNode::Concat:
+		for (int c : N.children)
+			if (!IsNullable(nodes, c))
+				return false;
+		return true;
+	case RegexNode::Alt:
+		for (int c : N.children)
+			if (IsNullable(nodes, c))
+				return true;
+		return false;
+	case RegexNode::Repeat:
+		return N.min == 0 || IsNullable(nodes, N.children[0]);
+	}
+	return false;
+}
+
+
+// Thompson NFA: Byte states consume one byte from a set, Split states branch without consuming anything
+struct RegexNFA
+{
+	enum StateType : uint8_t
+	{
+		Byte,
+		Split,
+		Match,
+	};
+	struct State
+	{
+		StateType type;
+		int out;
+		int out1;
+		int set;
+	};
+
+	// returns false if the NFA would be too big
+	bool Build(const std::vector<RegexNode>& nodes, int root, bool reverse);
+	int _Compile(int node, int next);
+	int _AddState(StateType type, int out, int out1, int set);
+
+	std::vector<State> states;
+	std::vector<ByteSet> sets;
+	int start = -1;
+
+	// only used while building
+	const std::vector<RegexNode>* _nodes = nullptr;
+	std::vector<int> _nodeSets;
+	bool _reverse = false;
+	bool _tooBig = false;
+};
+
+bool RegexNFA::Build(const std::vector<RegexNode>& nodes, int root, bool reverse)
+{
+	_nodes = &nodes;
+	_nodeSets.assign(nodes.size(), -1);
+	_reverse = reverse;
+	int match = _AddState(Match, -1, -1, -1);
+	start = _Compile(root, match);
+	_nodes = nullptr;
+	_nodeSets.clear();
+	return !_tooBig;
+}
+
+// compiles the node so that it continues to `next`, returns its start state
+int RegexNFA::_Compile(int node, int next)
+{
+	if (_tooBig)
+		return 0;
+	const RegexNode& N = (*_nodes)[node];
+	switch (N.type)
+	{
+	case RegexNode::Set:
+		if (_nodeSets[node] < 0)
+		{
+			_nodeSets[node] = int(sets.size());
+			sets.push_back(N.set);
+		}
+		return _AddState(Byte, next, -1, _nodeSets[node]);
+	case RegexNode::Concat:
+		// built from the end, which is the start of the reversed expression
+		if (_reverse)
+		{
+			for (size_t i = 0; i < N.children.size(); i++)
+				next = _Compile(N.children[i], next);
+		}
+		else
+		{
+			for (size_t i = N.children.size(); i-- > 0;)
+				next = _Compile(N.children[i], next);
+		}
+		return next;
+	case RegexNode::Alt: {
+		int s = _Compile(N.children[0], next);
+		for (size_t i = 1; i < N.children.size(); i++)
+			s = _AddState(Split, s, _Compile(N.children[i], next), -1);
+		return s; }
+	case RegexNode::Repeat: {
+		int s = next;
+		if (N.max == UINT_MAX)
+		{
+			int loop = _AddState(Split, -1, next, -1);
+			int body = _Compile(N.children[0], loop);
+			if (_tooBig)
+				return 0;
+			states[loop].out = body;
+			s = loop;
+		}
+		else
+		{
+			// x{2,4} = xx(x?)(x?)
+			for (unsigned i = N.min; i < N.max && !_tooBig; i++)
+				s = _AddState(Split, _Compile(N.children[0], s), s, -1);
+		}
+		for (unsigned i = 0; i < N.min && !_tooBig; i++)
+			s = _Compile(N.children[0], s);
+		return s; }
+	}
+	return 0;
+}
+
+int RegexNFA::_AddState(StateType type, int out, int out1, int set)
+{
+	if (states.size() >= REGEX_MAX_NFA_STATES)
+	{
+		_tooBig = true;
+		return 0;
+	}
+	states.push_back({ type, out, out1, set });
+	return int(states.size() - 1);
+}
+
+
+// a DFA state is the set of NFA Byte/Match states reachable after the input so far
+// unanchored = a match can start anywhere (the start states are added after every byte)
+struct RegexDFA
+{
+	RegexDFA(const RegexNFA& nfa, bool unanchored) : _nfa(nfa), _unanchored(unanchored)
+	{
+		_marks.resize(nfa.states.size());
+		_AddClosure(nfa.start, _startSet);
+		std::sort(_startSet.begin(), _startSet.end());
+		_Reset();
+	}
+
+	int32_t Start() const { return 0; }
+	UI_FORCEINLINE int32_t Next(int32_t state, uint8_t byte)
+	{
+		int32_t t = _trans[size_t(state) * 256 + byte];
+		return t >= 0 ? t : _Compute(state, byte);
+	}
+	bool IsAccepting(int32_t state) const { return _accepting[state] != 0; }
+	bool IsDead(int32_t state) const { return _sets[state].empty(); }
+
+	void _Reset()
+	{
+		_trans.clear();
+		_sets.clear();
+		_accepting.clear();
+		_lookup.clear();
+		_memUsed = 0;
+		_AddState(std::vector<int32_t>(_startSet));
+	}
+	int32_t _AddState(std::vector<int32_t>&& set)
+	{
+		int32_t id = int32_t(_sets.size());
+		bool accepting = false;
+		for (int32_t s : set)
+			if (_nfa.states[s].type == RegexNFA::Match)
+				accepting = true;
+		_memUsed += 256 * sizeof(int32_t) + set.size() * sizeof(int32_t) * 2 + 64;
+		_trans.resize(_trans.size() + 256, -1);
+		_accepting.push_back(accepting);
+		_lookup.emplace(set, id);
+		_sets.push_back(std::move(set));
+		return id;
+	}
+	void _AddClosure(int state, std::vector<int32_t>& out)
+	{
+		_markGen++;
+		_stack.push_back(state);
+		while (!_stack.empty())
+		{
+			int s = _stack.back();
+			_stack.pop_back();
+			if (s < 0 || _marks[s] == _markGen)
+				continue;
+			_marks[s] = _markGen;
+			const auto& S = _nfa.states[s];
+			if (S.type == RegexNFA::Split)
+			{
+				_stack.push_back(S.out1);
+				_stack.push_back(S.out);
+			}
+			else
+				out.push_back(s);
+		}
+	}
+	int32_t _Compute(int32_t state, uint8_t byte)
+	{
+		std::vector<int32_t> next;
+		for (int32_t s : _sets[state])
+		{
+			const auto& S = _nfa.states[s];
+			if (S.type == RegexNFA::Byte && _nfa.sets[S.set][byte])
+				_AddClosure(S.out, next);
+		}
+		if (_unanchored)
+			next.insert(next.end(), _startSet.begin(), _startSet.end());
+		std::sort(next.begin(), next.end());
+		next.erase(std::unique(next.begin(), next.end()), next.end());
+
+		auto it = _lookup.find(next);
+		if (it != _lookup.end())
+		{
+			_trans[size_t(state) * 256 + byte] = it->second;
+			return it->second;
+		}
+		if (_memUsed >= REGEX_DFA_CACHE_SIZE)
+		{
+			// the current state is gone too, so the transition isn't stored
+			_Reset();
+			return _AddState(std::move(next));
+		}
+		int32_t id = _AddState(std::move(next));
+		_trans[size_t(state) * 256 + byte] = id;
+		return id;
+	}
+
+	const RegexNFA& _nfa;
+	bool _unanchored;
+	std::vector<int32_t> _trans; // state * 256 + byte -> state (-1 = not computed yet)
+	std::vector<std::vector<int32_t>> _sets;
+	std::vector<uint8_t> _accepting;
+	std::map<std::vector<int32_t>, int32_t> _lookup;
+	std::vector<int32_t> _startSet;
+	size_t _memUsed = 0;
+
+	std::vector<uint32_t> _marks;
+	uint32_t _markGen = 0;
+	std::vector<int> _stack;
+};
+
+
+ByteRegex::ByteRegex()
+{
+}
+
+ByteRegex::~ByteRegex()
+{
+}
+
+bool ByteRegex::Parse(ui::StringView text, std::string& error)
+{
+	{
+		std::lock_guard<std::mutex> lock(_dfaMutex);
+		_freeForwardDFAs.clear();
+		_freeReverseDFAs.clear();
+	}
+	_forward = nullptr;
+	_reverse = nullptr;
+	error.clear();
+
+	std::vector<RegexNode> nodes;
+	RegexParser parser(text, nodes);
+	int root = parser.ParseAlt();
+	if (root >= 0 && !parser.AtEnd())
+		root = parser.Fail("unmatched ')'");
+	if (root < 0)
+	{
+		error = parser.error;
+		return false;
+	}
+	if (IsNullable(nodes, root))
+	{
+		error = "the expression can match an empty string";
+		return false;
+	}
+
+	std::unique_ptr<RegexNFA> fwd(new RegexNFA);
+	std::unique_ptr<RegexNFA> rev(new RegexNFA);
+	if (!fwd->Build(nodes, root, false) || !rev->Build(nodes, root, true))
+	{
+		error = "the expression is too big";
+		return false;
+	}
+	_forward = std::move(fwd);
+	_reverse = std::move(rev);
+	return true;
+}
+
+void ByteRegex::FindAllStarts(const void* data, size_t size, size_t numStarts, uint64_t base, std::vector<uint64_t>& out) const
+{
+	if (!_reverse)
+		return;
+
+	// the reversed expression is run backwards from the end, so it's in an accepting state
+	// exactly at the positions where a match of the original one starts
+	auto dfa = _AcquireDFA(true);
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	size_t first = out.size();
+	int32_t s = dfa->Start();
+	size_t i = size;
+	for (; i > numStarts; i--)
+		s = dfa->Next(s, bytes[i - 1]);
+	for (; i > 0; i--)
+	{
+		s = dfa->Next(s, bytes[i - 1]);
+		if (dfa->IsAccepting(s))
+			out.push_back(base + i - 1);
+	}
+	std::reverse(out.begin() + first, out.end());
+	_ReleaseDFA(std::move(dfa), true);
+}
+
+size_t ByteRegex::GetLongestMatch(const void* data, size_t size) const
+{
+	if (!_forward)
+		return 0;
+
+	auto dfa = _AcquireDFA(false);
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	size_t longest = 0;
+	int32_t s = dfa->Start();
+	for (size_t i = 0; i < size; i++)
+	{
+		s = dfa->Next(s, bytes[i]);
+		if (dfa->IsDead(s))
+			break;
+		if (dfa->IsAccepting(s))
+			longest = i + 1;
+	}
+	_ReleaseDFA(std::move(dfa), false);
+	return longest;
+}
+
+size_t ByteRegex::GetLongestMatch(IDataSource* ds, uint64_t off) const
+{
+	uint64_t size = ds->GetSize();
+	if (off >= size)
+		return 0;
+	size_t readSize = size_t(ui::min(uint64_t(REGEX_MAX_MATCH_SIZE), size - off));
+	std::vector<char> buf(readSize);
+	DataSpan span = ds->ViewOrRead(off, readSize, buf.data());
+	return GetLongestMatch(span.data, span.size);
+}
+
+std::unique_ptr<RegexDFA> ByteRegex::_AcquireDFA(bool reverse) const
+{
+	{
+		std::lock_guard<std::mutex> lock(_dfaMutex);
+		auto& list = reverse ? _freeReverseDFAs : _freeForwardDFAs;
+		if (!list.empty())
+		{
+			auto dfa = std::move(list.back());
+			list.pop_back();
+			return dfa;
+		}
+	}
+	return std::unique_ptr<RegexDFA>(new RegexDFA(reverse ? *_reverse : *_forward, reverse));
+}
+
+void ByteRegex::_ReleaseDFA(std::unique_ptr<RegexDFA>&& dfa, bool reverse) const
+{
+	std::lock_guard<std::mutex> lock(_dfaMutex);
+	(reverse ? _freeReverseDFAs : _freeForwardDFAs).push_back(std::move(dfa));
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "pch.h"
+#include <memory>
+#include "FileReaders.h"
+
+
+// matches longer than this may not be found (the chunks of a search overlap by this much)
+static const size_t REGEX_MAX_MATCH_SIZE = 16 * 1024;
+
+struct RegexNFA;
+struct RegexDFA;
+
+// regular expressions over raw bytes, e.g. `HDR[\x00-\x0f].{4}(ab|cd)+`:
+// - any other byte = itself, `.` = any byte (including newlines)
+// - `\xHH`, `\n`, `\r`, `\t`, `\0` = that byte, `\` before any other punctuation = that character
+// - `[...]`/`[^...]` = a set of bytes, with ranges (`a-z`, `\x80-\xff`)
+// - `\d`, `\w`, `\s` (and `\D`, `\W`, `\S`) = ASCII digits, word characters, whitespace (and everything else)
+// - `(...)`, `(?:...)` = group, `|` = alternation
+// - `*`, `+`, `?`, `{n}`, `{n,}`, `{n,m}` = repetition (the longest match is always used)
+// it's compiled to an NFA, and the DFA states are built lazily while scanning, in a cache of limited size
+// (so any expression runs in linear time, even if its full DFA would be huge)
+struct ByteRegex
+{
+	ByteRegex();
+	~ByteRegex();
+
+	// returns false and sets `error` if the expression could not be parsed or could match an empty string
+	bool Parse(ui::StringView text, std::string& error);
+
+	// appends the offsets where a match starts, before `numStarts`, in order
+	// (every such offset is reported once, even if it's inside an earlier match)
+	// matches that would need data past `size` are not found
+	void FindAllStarts(const void* data, size_t size, size_t numStarts, uint64_t base, std::vector<uint64_t>& out) const;
+	// the size of the longest match starting at data[0] (0 if there's none)
+	size_t GetLongestMatch(const void* data, size_t size) const;
+	// same, reading up to REGEX_MAX_MATCH_SIZE bytes from `ds`
+	size_t GetLongestMatch(IDataSource* ds, uint64_t off) const;
+
+	// the scans are thread-safe, each one takes a DFA cache from these lists (or makes a new one)
+	std::unique_ptr<RegexDFA> _AcquireDFA(bool reverse) const;
+	void _ReleaseDFA(std::unique_ptr<RegexDFA>&& dfa, bool reverse) const;
+
+	std::unique_ptr<RegexNFA> _forward;
+	std::unique_ptr<RegexNFA> _reverse;
+	mutable std::mutex _dfaMutex;
+	mutable std::vector<std::unique_ptr<RegexDFA>> _freeForwardDFAs;
+	mutable std::vector<std::unique_ptr<RegexDFA>> _freeReverseDFAs;
+};
@@ -0,0 +1,386 @@
+
+#include "pch.h"
+#include "ByteStats.h"
+#include "SearchKernels.h"
+#include "Threading.h"
+
+
+// a task of the worker pool covers this many bytes (or one block, if they're bigger)
+static const uint64_t BYTESTATS_TASK_SIZE = 256 * 1024;
+static const uint64_t BYTESTATS_CHUNK_SIZE = 32 * 1024 * 1024;
+
+
+ui::MulticastDelegate<const ByteStatsMap*> OnByteStatsMapChanged;
+
+static UI_FORCEINLINE uint8_t QuantizeEntropy(double e)
+{
+	return uint8_t(ui::min(e * (255.0 / 8.0) + 0.5, 255.0));
+}
+
+static UI_FORCEINLINE uint8_t QuantizeRatio(double r)
+{
+	return uint8_t(ui::min(r * 255.0 + 0.5, 255.0));
+}
+
+static ByteStatsMap::Node MakeBlockNode(const uint32_t hist[256], size_t size)
+{
+	double entropy = 0;
+	uint32_t printable = hist['\t'] + hist['\n'] + hist['\r'];
+	for (int v = 0; v < 256; v++)
+	{
+		if (hist[v])
+		{
+			double p = double(hist[v]) / size;
+			entropy -= p * log2(p);
+		}
+		if (v >= 0x20 && v <= 0x7e)
+			printable += hist[v];
+	}
+
+	ByteStatsMap::Node N;
+	N.entropy = QuantizeEntropy(entropy);
+	N.minEntropy = N.entropy;
+	N.maxEntropy = N.entropy;
+	N.zeroRatio = QuantizeRatio(double(hist[0]) / size);
+	N.printableRatio = QuantizeRatio(double(printable) / size);
+	return N;
+}
+
+static UI_FORCEINLINE uint8_t WeightedMean(uint8_t a, uint64_t wa, uint8_t b, uint64_t wb)
+{
+	return uint8_t((a * wa + b * wb + (wa + wb) / 2) / (wa + wb));
+}
+
+
+void ByteStats::Merge(const ByteStats& o)
+{
+	if (o.size == 0)
+		return;
+	if (size == 0)
+	{
+		*this = o;
+		return;
+	}
+	float wa = float(double(size) / (size + o.size));
+	float wb = 1 - wa;
+	entropy = entropy * wa + o.entropy * wb;
+	minEntropy = ui::min(minEntropy, o.minEntropy);
+	maxEntropy = ui::max(maxEntropy, o.maxEntropy);
+	zeroRatio = zeroRatio * wa + o.zeroRatio * wb;
+	printableRatio = printableRatio * wa + o.printableRatio * wb;
+	size += o.size;
+}
+
+
+ByteStatsMap::ByteStatsMap(IDataSource* src) : _src(src)
+{
+	_eventTarget = std::make_shared<ByteStatsMap*>(this);
+}
+
+ByteStatsMap::~ByteStatsMap()
+{
+	_StopThread();
+	*_eventTarget = nullptr;
+}
+
+void ByteStatsMap::StartBuild(uint64_t blockSize)
+{
+	_StopThread();
+
+	_blockSize = BYTESTATS_MIN_BLOCK_SIZE;
+	while (_blockSize < blockSize && _blockSize < BYTESTATS_MAX_BLOCK_SIZE)
+		_blockSize *= 2;
+	_dataSize = _src->GetSize();
+	uint64_t numBlocks = (_dataSize + _blockSize - 1) / _blockSize;
+
+	_levels.clear();
+	_levels.emplace_back(size_t(numBlocks));
+	_histogramLevel = 0;
+	while (((numBlocks + (1ULL << _histogramLevel) - 1) >> _histogramLevel) > BYTESTATS_MAX_HISTOGRAMS)
+		_histogramLevel++;
+	_histograms.assign(size_t((numBlocks + (1ULL << _histogramLevel) - 1) >> _histogramLevel) * 256, 0);
+	// the new build reads the edited data anyway
+	_dirty.clear();
+
+	_progress = 0;
+	_SetState(ByteStatsMapState::Building);
+	_thread = std::thread([this]() { _BuildThreadProc(); });
+}
+
+void ByteStatsMap::CancelBuild()
+{
+	if (GetState() != ByteStatsMapState::Building)
+		return;
+	_StopThread();
+	_SetState(ByteStatsMapState::None);
+}
+
+void ByteStatsMap::Update(uint64_t from, uint64_t to)
+{
+	// without a build there's nothing to update
+	if (GetState() == ByteStatsMapState::None || from >= to)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(_dirtyMutex);
+		_dirty.push_back({ from, to });
+	}
+	_dirtyCond.notify_one();
+}
+
+void ByteStatsMap::Sample(uint64_t from, uint64_t to, size_t count, ByteStats* out)
+{
+	for (size_t i = 0; i < count; i++)
+		out[i] = {};
+	if (GetState() != ByteStatsMapState::Ready)
+		return;
+
+	to = ui::min(to, _dataSize);
+	if (from >= to)
+		return;
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t pfrom = from + uint64_t(double(to - from) * i / count);
+		uint64_t pto = i + 1 == count ? to : from + uint64_t(double(to - from) * (i + 1) / count);
+		// parts smaller than a byte still show the byte they're in
+		pto = ui::max(pto, pfrom + 1);
+
+		// the coarsest level whose nodes aren't bigger than the part, so that only a few of them are needed
+		size_t level = 0;
+		while (level + 1 < _levels.size() && _GetNodeSize(level + 1) <= pto - pfrom)
+			level++;
+		uint64_t nodeSize = _GetNodeSize(level);
+		for (uint64_t n = pfrom / nodeSize; n * nodeSize < pto; n++)
+			_AddNode(level, size_t(n), pfrom, pto, out[i]);
+	}
+}
+
+ByteStats ByteStatsMap::GetStats(uint64_t from, uint64_t to)
+{
+	ByteStats bs;
+	Sample(from, to, 1, &bs);
+	return bs;
+}
+
+void ByteStatsMap::GetHistogram(uint64_t from, uint64_t to, uint64_t out[256], uint64_t& outFrom, uint64_t& outTo)
+{
+	memset(out, 0, sizeof(*out) * 256);
+	outFrom = outTo = 0;
+	if (GetState() != ByteStatsMapState::Ready)
+		return;
+
+	to = ui::min(to, _dataSize);
+	if (from >= to)
+		return;
+	uint64_t nodeSize = _GetNodeSize(_histogramLevel);
+	size_t first = size_t(from / nodeSize);
+	size_t last = size_t((to - 1) / nodeSize);
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (size_t n = first; n <= last; n++)
+	{
+		const uint64_t* H = &_histograms[n * 256];
+		for (int v = 0; v < 256; v++)
+			out[v] += H[v];
+	}
+	outFrom = first * nodeSize;
+	outTo = ui::min((last + 1) * nodeSize, _dataSize);
+}
+
+void ByteStatsMap::_StopThread()
+{
+	if (!_thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(_dirtyMutex);
+		_cancel = true;
+	}
+	_dirtyCond.notify_all();
+	_thread.join();
+	_cancel = false;
+}
+
+void ByteStatsMap::_SetState(ByteStatsMapState s)
+{
+	_state = s;
+	// may be called from the build thread, the handlers only run on the UI thread
+	auto target = _eventTarget;
+	ui::Application::PushEvent([target]()
+	{
+		if (*target)
+			OnByteStatsMapChanged.Call(*target);
+	});
+}
+
+void ByteStatsMap::_BuildThreadProc()
+{
+	uint64_t blockSize = _blockSize;
+	uint64_t histNodeSize = _GetNodeSize(_histogramLevel);
+	// all powers of two, so the chunks and tasks never straddle a histogram node
+	uint64_t taskSize = ui::min(ui::max(blockSize, BYTESTATS_TASK_SIZE), histNodeSize);
+	size_t chunkSize = size_t(ui::max(BYTESTATS_CHUNK_SIZE, taskSize));
+
+	auto& pool = GetWorkerPool();
+	int lastPercent = 0;
+	ReadAheadReader reader(_src, 0, _dataSize, chunkSize, 0);
+	ReadAheadReader::Chunk chunk;
+	while (!_cancel && reader.NextChunk(chunk))
+	{
+		size_t numTasks = size_t((chunk.size + taskSize - 1) / taskSize);
+		pool.ParallelFor(numTasks, [&](size_t t)
+		{
+			size_t start = size_t(t * taskSize);
+			size_t end = size_t(ui::min(start + taskSize, uint64_t(chunk.size)));
+			uint32_t taskHist[256] = {};
+			for (size_t b = start; b < end; b += size_t(blockSize))
+			{
+				size_t bsize = size_t(ui::min(uint64_t(end - b), blockSize));
+				uint32_t hist[256] = {};
+				CountByteValues(chunk.data + b, bsize, hist);
+				_levels[0][size_t((chunk.offset + b) / blockSize)] = MakeBlockNode(hist, bsize);
+				for (int v = 0; v < 256; v++)
+					taskHist[v] += hist[v];
+			}
+
+			uint64_t* H = &_histograms[size_t((chunk.offset + start) / histNodeSize) * 256];
+			std::lock_guard<std::mutex> lock(_mutex);
+			for (int v = 0; v < 256; v++)
+				H[v] += taskHist[v];
+		});
+
+		_progress = float(double(chunk.offset + chunk.size) / _dataSize);
+		int percent = int(_progress * 100);
+		if (percent != lastPercent)
+		{
+			lastPercent = percent;
+			_SetState(ByteStatsMapState::Building);
+		}
+	}
+	if (_cancel)
+		return;
+
+	_BuildLevels();
+	_SetState(ByteStatsMapState::Ready);
+
+	// then the thread stays around to apply the edits
+	for (;;)
+	{
+		std::vector<std::pair<uint64_t, uint64_t>> ranges;
+		{
+			std::unique_lock<std::mutex> lock(_dirtyMutex);
+			_dirtyCond.wait(lock, [this]() { return _cancel || !_dirty.empty(); });
+			if (_cancel)
+				return;
+			ranges.swap(_dirty);
+		}
+		_UpdateRanges(ranges);
+		if (_cancel)
+			return;
+		_SetState(ByteStatsMapState::Ready);
+	}
+}
+
+void ByteStatsMap::_BuildLevels()
+{
+	while (_levels.back().size() > 1)
+	{
+		size_t level = _levels.size() - 1;
+		std::vector<Node> P((_levels[level].size() + 1) / 2);
+		for (size_t i = 0; i < P.size(); i++)
+			P[i] = _MergeNodes(level, i);
+		_levels.push_back(std::move(P));
+	}
+}
+
+ByteStatsMap::Node ByteStatsMap::_MergeNodes(size_t level, size_t parent)
+{
+	const auto& C = _levels[level];
+	const Node& a = C[parent * 2];
+	if (parent * 2 + 1 >= C.size())
+		return a;
+	const Node& b = C[parent * 2 + 1];
+	// only the last node can be partial
+	uint64_t childSize = _GetNodeSize(level);
+	uint64_t wb = ui::min(childSize, _dataSize - (parent * 2 + 1) * childSize);
+	Node P;
+	P.entropy = WeightedMean(a.entropy, childSize, b.entropy, wb);
+	P.minEntropy = ui::min(a.minEntropy, b.minEntropy);
+	P.maxEntropy = ui::max(a.maxEntropy, b.maxEntropy);
+	P.zeroRatio = WeightedMean(a.zeroRatio, childSize, b.zeroRatio, wb);
+	P.printableRatio = WeightedMean(a.printableRatio, childSize, b.printableRatio, wb);
+	return P;
+}
+
+void ByteStatsMap::_UpdateRanges(std::vector<std::pair<uint64_t, uint64_t>>& ranges)
+{
+	// the old bytes are gone so the histograms can't be adjusted, whole histogram nodes are rescanned instead
+	// (they're at most 1/BYTESTATS_MAX_HISTOGRAMS of the data, or a single block)
+	uint64_t histNodeSize = _GetNodeSize(_histogramLevel);
+	std::vector<size_t> histNodes;
+	for (auto& R : ranges)
+	{
+		uint64_t to = ui::min(R.second, _dataSize);
+		for (uint64_t n = R.first / histNodeSize; n * histNodeSize < to; n++)
+			histNodes.push_back(size_t(n));
+	}
+	std::sort(histNodes.begin(), histNodes.end());
+	histNodes.erase(std::unique(histNodes.begin(), histNodes.end()), histNodes.end());
+
+	// both are powers of two so the reads never split a block
+	std::vector<uint8_t> buf(size_t(ui::min(histNodeSize, BYTESTATS_CHUNK_SIZE)));
+	std::vector<Node> blocks;
+	for (size_t n : histNodes)
+	{
+		if (_cancel)
+			return;
+		uint64_t from = n * histNodeSize;
+		uint64_t to = ui::min(from + histNodeSize, _dataSize);
+		uint64_t hist[256] = {};
+		blocks.clear();
+		for (uint64_t off = from; off < to; off += buf.size())
+		{
+			size_t size = size_t(ui::min(uint64_t(buf.size()), to - off));
+			_src->Read(off, size, buf.data());
+			for (size_t b = 0; b < size; b += size_t(_blockSize))
+			{
+				size_t bsize = size_t(ui::min(uint64_t(size - b), _blockSize));
+				uint32_t blockHist[256] = {};
+				CountByteValues(buf.data() + b, bsize, blockHist);
+				blocks.push_back(MakeBlockNode(blockHist, bsize));
+				for (int v = 0; v < 256; v++)
+					hist[v] += blockHist[v];
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		size_t first = size_t(from / _blockSize);
+		std::copy(blocks.begin(), blocks.end(), _levels[0].begin() + first);
+		memcpy(&_histograms[n * 256], hist, sizeof(hist));
+		// and the ancestors of the rescanned blocks
+		size_t lo = first, hi = first + blocks.size() - 1;
+		for (size_t level = 0; level + 1 < _levels.size(); level++)
+		{
+			lo /= 2;
+			hi /= 2;
+			for (size_t p = lo; p <= hi; p++)
+				_levels[level + 1][p] = _MergeNodes(level, p);
+		}
+	}
+}
+
+void ByteStatsMap::_AddNode(size_t level, size_t index, uint64_t from, uint64_t to, ByteStats& out)
+{
+	uint64_t nodeSize = _GetNodeSize(level);
+	uint64_t nfrom = index * nodeSize;
+	uint64_t nto = ui::min(nfrom + nodeSize, _dataSize);
+	uint64_t overlap = ui::min(to, nto) - ui::max(from, nfrom);
+
+	const Node& N = _levels[level][index];
+	ByteStats bs;
+	bs.size = overlap;
+	bs.entropy = N.entropy * (8.0f / 255.0f);
+	bs.minEntropy = N.minEntropy * (8.0f / 255.0f);
+	bs.maxEntropy = N.maxEntropy * (8.0f / 255.0f);
+	bs.zeroRatio = N.zeroRatio * (1.0f / 255.0f);
+	bs.printableRatio = N.printableRatio * (1.0f / 255.0f);
+	out.Merge(bs);
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "pch.h"
+#include "FileReaders.h"
+
+
+struct ByteStatsMap;
+
+extern ui::MulticastDelegate<const ByteStatsMap*> OnByteStatsMapChanged;
+
+static const uint64_t BYTESTATS_MIN_BLOCK_SIZE = 512;
+static const uint64_t BYTESTATS_MAX_BLOCK_SIZE = 16 * 1024 * 1024;
+static const uint64_t BYTESTATS_DEFAULT_BLOCK_SIZE = 64 * 1024;
+// 8 MB of histograms at most
+static const size_t BYTESTATS_MAX_HISTOGRAMS = 4096;
+
+// summary of the bytes in a range of the data
+struct ByteStats
+{
+	uint64_t size = 0;
+	// Shannon entropy in bits per byte (0-8), the mean of the blocks' values if there are several
+	float entropy = 0;
+	float minEntropy = 0;
+	float maxEntropy = 0;
+	float zeroRatio = 0;
+	// ASCII 0x20-0x7e, tab, CR and LF
+	float printableRatio = 0;
+
+	// combines the stats of another range, weighted by size
+	void Merge(const ByteStats& o);
+};
+
+enum class ByteStatsMapState : uint8_t
+{
+	None,
+	Building,
+	Ready,
+};
+
+// per-block byte statistics of the whole data, built on a background thread (the blocks are scanned on the worker pool)
+// and kept as a pyramid where each level halves the number of nodes, so that a summary of any range at any
+// resolution costs a few node lookups per output value instead of a rescan
+// the byte histograms are only kept for the nodes of the coarser levels (with up to BYTESTATS_MAX_HISTOGRAMS of them)
+// edits are applied with Update, which rescans only the affected histogram nodes on the same thread once the build is done
+struct ByteStatsMap : ui::RefCountedST
+{
+	ByteStatsMap(IDataSource* src);
+	~ByteStatsMap();
+
+	// `blockSize` (the finest resolution) is a power of two between the min/max block sizes
+	void StartBuild(uint64_t blockSize = BYTESTATS_DEFAULT_BLOCK_SIZE);
+	void CancelBuild();
+	// queues [from, to) to be rescanned after it was edited, the map stays usable in the meantime
+	void Update(uint64_t from, uint64_t to);
+
+	ByteStatsMapState GetState() { return _state; }
+	float GetBuildProgress() { return _progress; }
+	uint64_t GetBlockSize() const { return _blockSize; }
+	uint64_t GetDataSize() const { return _dataSize; }
+
+	// the following only work once the map is ready
+	// stats of `count` equal parts of [from, to), each one is made of the nodes of the level closest to its size
+	// (so the node boundaries don't match the parts exactly if they're not block-aligned)
+	void Sample(uint64_t from, uint64_t to, size_t count, ByteStats* out);
+	ByteStats GetStats(uint64_t from, uint64_t to);
+	// sets `out` to the byte counts of the histogram nodes overlapping [from, to) and [outFrom, outTo) to the range they cover
+	void GetHistogram(uint64_t from, uint64_t to, uint64_t out[256], uint64_t& outFrom, uint64_t& outTo);
+
+	struct Node
+	{
+		// quantized to 0-255
+		uint8_t entropy;
+		uint8_t minEntropy;
+		uint8_t maxEntropy;
+		uint8_t zeroRatio;
+		uint8_t printableRatio;
+	};
+
+	void _StopThread();
+	void _SetState(ByteStatsMapState s);
+	void _BuildThreadProc();
+	void _BuildLevels();
+	Node _MergeNodes(size_t level, size_t parent);
+	void _UpdateRanges(std::vector<std::pair<uint64_t, uint64_t>>& ranges);
+	uint64_t _GetNodeSize(size_t level) const { return _blockSize << level; }
+	void _AddNode(size_t level, size_t index, uint64_t from, uint64_t to, ByteStats& out);
+
+	ui::RCHandle<IDataSource> _src;
+	uint64_t _blockSize = BYTESTATS_DEFAULT_BLOCK_SIZE;
+	uint64_t _dataSize = 0;
+	// [0] = the blocks, [i + 1] = pairs of [i]
+	std::vector<std::vector<Node>> _levels;
+	size_t _histogramLevel = 0;
+	std::vector<uint64_t> _histograms; // 256 for each node of _histogramLevel
+	// guards the histograms while building and the nodes while updating a ready map
+	std::mutex _mutex;
+
+	std::atomic<ByteStatsMapState> _state{ ByteStatsMapState::None };
+	std::atomic<float> _progress{ 0 };
+	std::atomic_bool _cancel{ false };
+	std::thread _thread;
+	// edited ranges that haven't been rescanned yet
+	std::vector<std::pair<uint64_t, uint64_t>> _dirty;
+	std::mutex _dirtyMutex;
+	std::condition_variable _dirtyCond;
+	// the queued state change events can outlive the map, they skip it once it's destroyed
+	std::shared_ptr<ByteStatsMap*> _eventTarget;
+};
@@ -0,0 +1,84 @@
+
+#include "pch.h"
+#include "CompactOffsetList.h"
+
+
+void CompactOffsetList::Clear()
+{
+	_deltas.clear();
+	_blockFirst.clear();
+	_blockPos.clear();
+	_count = 0;
+	_last = 0;
+	_cachedBlock = SIZE_MAX;
+}
+
+void CompactOffsetList::Append(uint64_t off)
+{
+	size_t block = _count / OFFSET_LIST_BLOCK_SIZE;
+	if (_count % OFFSET_LIST_BLOCK_SIZE == 0)
+	{
+		_blockFirst.push_back(off);
+		_blockPos.push_back(_deltas.size());
+	}
+	else
+	{
+		int64_t delta = int64_t(off - _last);
+		uint64_t v = (uint64_t(delta) << 1) ^ uint64_t(delta >> 63);
+		while (v >= 0x80)
+		{
+			_deltas.push_back(uint8_t(v) | 0x80);
+			v >>= 7;
+		}
+		_deltas.push_back(uint8_t(v));
+	}
+	_last = off;
+	_count++;
+
+	if (_cachedBlock == block)
+		_cachedBlock = SIZE_MAX;
+}
+
+void CompactOffsetList::Append(const uint64_t* offs, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		Append(offs[i]);
+}
+
+uint64_t CompactOffsetList::operator [] (size_t i) const
+{
+	assert(i < _count);
+	size_t block = i / OFFSET_LIST_BLOCK_SIZE;
+	if (block != _cachedBlock)
+		_DecodeBlock(block);
+	return _cache[i % OFFSET_LIST_BLOCK_SIZE];
+}
+
+size_t CompactOffsetList::GetMemoryUsage() const
+{
+	return _deltas.capacity() + _blockFirst.capacity() * sizeof(uint64_t) + _blockPos.capacity() * sizeof(size_t);
+}
+
+void CompactOffsetList::_DecodeBlock(size_t block) const
+{
+	size_t num = ui::min(_count - block * OFFSET_LIST_BLOCK_SIZE, OFFSET_LIST_BLOCK_SIZE);
+	const uint8_t* p = _deltas.data() + _blockPos[block];
+	uint64_t off = _blockFirst[block];
+	_cache[0] = off;
+	for (size_t i = 1; i < num; i++)
+	{
+		uint64_t v = 0;
+		unsigned shift = 0;
+		for (;;)
+		{
+			uint8_t b = *p++;
+			v |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				break;
+			shift += 7;
+		}
+		off += (v >> 1) ^ (0 - (v & 1));
+		_cache[i] = off;
+	}
+	_cachedBlock = block;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "pch.h"
+
+
+// a list of offsets stored as variable-length deltas (zigzag-encoded, so any order works, but increasing offsets
+// close to each other take only a byte or two), in blocks of OFFSET_LIST_BLOCK_SIZE with the first offset of each
+// block and the position of its deltas kept separately so that any item can be found by decoding a single block
+static const size_t OFFSET_LIST_BLOCK_SIZE = 64;
+
+struct CompactOffsetList
+{
+	void Clear();
+	void Append(uint64_t off);
+	void Append(const uint64_t* offs, size_t count);
+
+	size_t Size() const { return _count; }
+	bool Empty() const { return _count == 0; }
+	// the last decoded block is cached, so reading nearby items (e.g. the visible rows of a table) is cheap
+	// (not thread-safe, even though it's const)
+	uint64_t operator [] (size_t i) const;
+	size_t GetMemoryUsage() const;
+
+	void _DecodeBlock(size_t block) const;
+
+	std::vector<uint8_t> _deltas;
+	std::vector<uint64_t> _blockFirst;
+	std::vector<size_t> _blockPos;
+	size_t _count = 0;
+	uint64_t _last = 0;
+
+	mutable uint64_t _cache[OFFSET_LIST_BLOCK_SIZE];
+	mutable size_t _cachedBlock = SIZE_MAX;
+};
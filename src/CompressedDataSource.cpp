@@ -0,0 +1,897 @@
+#include "pch.h"
+#include "CompressedDataSource.h"
+
+
+uint64_t g_inflateCheckpointInterval = 4 * 1024 * 1024;
+
+ui::MulticastDelegate<const CompressedDataSource*> OnCompressedIndexingProgress;
+
+static const size_t INFLATE_WINDOW_SIZE = 32 * 1024;
+static const size_t INFLATE_INPUT_BUFFER_SIZE = 64 * 1024;
+// decoded data is kept around for nearby reads until there's this much of it
+static const size_t INFLATE_OUTPUT_BUFFER_SIZE = 4 * 1024 * 1024;
+// streams are measured with a look at this much of the data first, since most of the candidates are not compressed data
+static const uint64_t INFLATE_MEASURE_PROBE_SIZE = 4 * 1024;
+
+
+const char* CompressionFormatToString(CompressionFormat fmt)
+{
+	switch (fmt)
+	{
+	case CompressionFormat::Deflate: return "deflate";
+	case CompressionFormat::Zlib: return "zlib";
+	case CompressionFormat::Gzip: return "gzip";
+	default: return "";
+	}
+}
+
+CompressionFormat CompressionFormatFromString(ui::StringView s)
+{
+	if (s == "deflate") return CompressionFormat::Deflate;
+	if (s == "zlib") return CompressionFormat::Zlib;
+	if (s == "gzip") return CompressionFormat::Gzip;
+	return CompressionFormat::Unknown;
+}
+
+CompressionFormat DetectCompressionFormat(IDataSource* src, uint64_t off)
+{
+	uint8_t hdr[3];
+	if (src->Read(off, sizeof(hdr), hdr) < 2)
+		return CompressionFormat::Unknown;
+	if (hdr[0] == 0x1f && hdr[1] == 0x8b && hdr[2] == 8)
+		return CompressionFormat::Gzip;
+	if ((hdr[0] & 0xf) == 8 && (hdr[0] >> 4) <= 7 && (hdr[0] * 256 + hdr[1]) % 31 == 0)
+		return CompressionFormat::Zlib;
+	return CompressionFormat::Unknown;
+}
+
+
+static const uint16_t g_lengthBase[29] =
+{
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t g_lengthExtra[29] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t g_distBase[30] =
+{
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t g_distExtra[30] =
+{
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+static const uint8_t g_codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static unsigned BitReverse(unsigned v, unsigned bits)
+{
+	v = ((v & 0xaaaa) >> 1) | ((v & 0x5555) << 1);
+	v = ((v & 0xcccc) >> 2) | ((v & 0x3333) << 2);
+	v = ((v & 0xf0f0) >> 4) | ((v & 0x0f0f) << 4);
+	v = ((v & 0xff00) >> 8) | ((v & 0x00ff) << 8);
+	return v >> (16 - bits);
+}
+
+struct Crc32Table
+{
+	uint32_t t[256];
+
+	Crc32Table()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			t[i] = c;
+		}
+	}
+};
+
+static uint32_t UpdateCrc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+	static const Crc32Table table;
+	for (size_t i = 0; i < size; i++)
+		crc = table.t[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static void UpdateAdler32(uint32_t& a, uint32_t& b, const uint8_t* data, size_t size)
+{
+	// the sums can't overflow in 5552 bytes, so the modulo is only needed once per run of them
+	while (size)
+	{
+		size_t n = std::min(size, size_t(5552));
+		for (size_t i = 0; i < n; i++)
+		{
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		data += n;
+		size -= n;
+	}
+}
+
+// canonical Huffman decoding table with a direct lookup for the short codes
+struct InflateHuffman
+{
+	enum { FAST_BITS = 9, FAST_MASK = (1 << FAST_BITS) - 1, MAX_SYMBOLS = 288 };
+
+	uint16_t fast[1 << FAST_BITS]; // (length << 9) | symbol, 0 if the code is longer
+	uint16_t firstCode[16];
+	uint16_t firstSymbol[16];
+	uint32_t maxCode[17]; // shifted up to 16 bits
+	uint8_t size[MAX_SYMBOLS];
+	uint16_t value[MAX_SYMBOLS];
+
+	bool Build(const uint8_t* lengths, unsigned count)
+	{
+		unsigned sizes[17] = {};
+		unsigned nextCode[16];
+		memset(fast, 0, sizeof(fast));
+		for (unsigned i = 0; i < count; i++)
+			sizes[lengths[i]]++;
+		sizes[0] = 0;
+		for (unsigned i = 1; i < 16; i++)
+			if (sizes[i] > (1U << i))
+				return false;
+
+		unsigned code = 0, k = 0;
+		for (unsigned i = 1; i < 16; i++)
+		{
+			nextCode[i] = code;
+			firstCode[i] = uint16_t(code);
+			firstSymbol[i] = uint16_t(k);
+			code += sizes[i];
+			if (sizes[i] && code - 1 >= (1U << i))
+				return false;
+			maxCode[i] = code << (16 - i);
+			code <<= 1;
+			k += sizes[i];
+		}
+		maxCode[16] = 0x10000;
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			unsigned s = lengths[i];
+			if (!s)
+				continue;
+			unsigned c = nextCode[s] - firstCode[s] + firstSymbol[s];
+			size[c] = uint8_t(s);
+			value[c] = uint16_t(i);
+			if (s <= FAST_BITS)
+			{
+				uint16_t fv = uint16_t((s << 9) | i);
+				for (unsigned j = BitReverse(nextCode[s], s); j < (1U << FAST_BITS); j += 1U << s)
+					fast[j] = fv;
+			}
+			nextCode[s]++;
+		}
+		return true;
+	}
+};
+
+
+struct InflateDecoder
+{
+	enum State
+	{
+		Header, // of the next stream/member
+		Blocks,
+		Done,
+	};
+
+	IDataSource* src;
+	uint64_t off;
+	uint64_t srcSize;
+	CompressionFormat format;
+
+	// input
+	std::vector<uint8_t> inBuf;
+	uint64_t inBufStart = 0;
+	uint64_t inPos = 0; // of the next byte to go into bitBuf (can run past the end, those bytes are zeroes)
+	uint64_t bitBuf = 0;
+	unsigned bitCount = 0;
+
+	// output, covering [outStart, outStart + out.size())
+	std::vector<uint8_t> out;
+	uint64_t outStart = 0;
+
+	State state = Header;
+	bool error = false;
+	InflateHuffman lit;
+	InflateHuffman dist;
+
+	// the trailers are only checked if this is set, since that needs all of the output to be decoded in order
+	bool verify = false;
+	bool checksumError = false;
+	uint32_t adlerA = 1;
+	uint32_t adlerB = 0;
+	uint32_t crc = 0xffffffff;
+	uint64_t checked = 0; // the output before this is included in the checksum
+	uint64_t memberStart = 0; // for the gzip size
+
+	InflateDecoder(IDataSource* s, uint64_t o, uint64_t size, CompressionFormat fmt) : src(s), off(o), srcSize(size), format(fmt)
+	{
+	}
+
+	uint64_t GetBitPos() const { return inPos * 8 - bitCount; }
+	uint64_t GetOutEnd() const { return outStart + out.size(); }
+
+	void Reset()
+	{
+		SeekBits(0);
+		out.clear();
+		outStart = 0;
+		state = Header;
+		error = false;
+		ResetChecksum();
+		checksumError = false;
+	}
+
+	void ResetChecksum()
+	{
+		adlerA = 1;
+		adlerB = 0;
+		crc = 0xffffffff;
+		checked = GetOutEnd();
+		memberStart = GetOutEnd();
+	}
+
+	void UpdateChecksum()
+	{
+		if (!verify || checked >= GetOutEnd())
+			return;
+		const uint8_t* data = &out[size_t(checked - outStart)];
+		size_t size = size_t(GetOutEnd() - checked);
+		if (format == CompressionFormat::Zlib)
+			UpdateAdler32(adlerA, adlerB, data, size);
+		else if (format == CompressionFormat::Gzip)
+			crc = UpdateCrc32(crc, data, size);
+		checked = GetOutEnd();
+	}
+
+	void SeekBits(uint64_t pos)
+	{
+		inPos = pos / 8;
+		bitBuf = 0;
+		bitCount = 0;
+		if (pos % 8)
+			Bits(pos % 8);
+	}
+
+	uint8_t NextByte()
+	{
+		uint64_t pos = inPos++;
+		if (pos >= srcSize)
+			return 0;
+		if (pos < inBufStart || pos >= inBufStart + inBuf.size())
+		{
+			inBuf.resize(size_t(std::min(uint64_t(INFLATE_INPUT_BUFFER_SIZE), srcSize - pos)));
+			src->Read(off + pos, inBuf.size(), inBuf.data());
+			inBufStart = pos;
+		}
+		return inBuf[size_t(pos - inBufStart)];
+	}
+
+	void Refill()
+	{
+		while (bitCount <= 56)
+		{
+			bitBuf |= uint64_t(NextByte()) << bitCount;
+			bitCount += 8;
+		}
+	}
+
+	unsigned Bits(unsigned n)
+	{
+		if (bitCount < n)
+			Refill();
+		unsigned v = unsigned(bitBuf & ((1ULL << n) - 1));
+		bitBuf >>= n;
+		bitCount -= n;
+		return v;
+	}
+
+	void AlignToByte()
+	{
+		Bits(bitCount % 8);
+	}
+
+	int Decode(const InflateHuffman& h)
+	{
+		if (bitCount < 16)
+			Refill();
+		unsigned fv = h.fast[bitBuf & InflateHuffman::FAST_MASK];
+		if (fv)
+		{
+			unsigned s = fv >> 9;
+			bitBuf >>= s;
+			bitCount -= s;
+			return fv & 511;
+		}
+
+		unsigned k = BitReverse(unsigned(bitBuf & 0xffff), 16);
+		unsigned s = InflateHuffman::FAST_BITS + 1;
+		while (k >= h.maxCode[s])
+			s++;
+		if (s >= 16)
+			return -1;
+		unsigned b = (k >> (16 - s)) - h.firstCode[s] + h.firstSymbol[s];
+		if (b >= InflateHuffman::MAX_SYMBOLS || h.size[b] != s)
+			return -1;
+		bitBuf >>= s;
+		bitCount -= s;
+		return h.value[b];
+	}
+
+	bool ReadHeader()
+	{
+		uint64_t bytePos = GetBitPos() / 8;
+		switch (format)
+		{
+		case CompressionFormat::Zlib: {
+			if (bytePos + 2 > srcSize)
+				return false;
+			unsigned cmf = Bits(8);
+			unsigned flg = Bits(8);
+			// preset dictionaries are not supported
+			return (cmf & 0xf) == 8 && (cmf * 256 + flg) % 31 == 0 && !(flg & 0x20); }
+		case CompressionFormat::Gzip: {
+			if (bytePos + 18 > srcSize)
+				return false;
+			if (Bits(8) != 0x1f || Bits(8) != 0x8b || Bits(8) != 8)
+				return false;
+			unsigned flg = Bits(8);
+			for (int i = 0; i < 6; i++)
+				Bits(8); // mtime, xfl, os
+			if (flg & 4) // FEXTRA
+			{
+				unsigned xlen = Bits(16);
+				for (unsigned i = 0; i < xlen; i++)
+					Bits(8);
+			}
+			if (flg & 8) // FNAME
+				while (Bits(8) && GetBitPos() < srcSize * 8) {}
+			if (flg & 16) // FCOMMENT
+				while (Bits(8) && GetBitPos() < srcSize * 8) {}
+			if (flg & 2) // FHCRC
+				Bits(16);
+			return GetBitPos() < srcSize * 8; }
+		default:
+			return true;
+		}
+	}
+
+	void ReadTrailer()
+	{
+		UpdateChecksum();
+		AlignToByte();
+		if (format == CompressionFormat::Zlib)
+		{
+			// big endian, unlike everything else
+			uint32_t adler = 0;
+			for (int i = 0; i < 4; i++)
+				adler = (adler << 8) | Bits(8);
+			if (verify && adler != ((adlerB << 16) | adlerA))
+				checksumError = true;
+		}
+		else if (format == CompressionFormat::Gzip)
+		{
+			uint32_t crc32 = Bits(32);
+			uint32_t size = Bits(32); // modulo 2^32
+			if (verify && (crc32 != ~crc || size != uint32_t(GetOutEnd() - memberStart)))
+				checksumError = true;
+			ResetChecksum();
+		}
+	}
+
+	bool ReadDynamicTables()
+	{
+		unsigned hlit = Bits(5) + 257;
+		unsigned hdist = Bits(5) + 1;
+		unsigned hclen = Bits(4) + 4;
+		if (hlit > 286 || hdist > 30)
+			return false;
+
+		uint8_t clLengths[19] = {};
+		for (unsigned i = 0; i < hclen; i++)
+			clLengths[g_codeLengthOrder[i]] = uint8_t(Bits(3));
+		InflateHuffman cl;
+		if (!cl.Build(clLengths, 19))
+			return false;
+
+		uint8_t lengths[286 + 30];
+		unsigned n = 0;
+		while (n < hlit + hdist)
+		{
+			int c = Decode(cl);
+			if (c < 0 || c >= 19)
+				return false;
+			if (c < 16)
+			{
+				lengths[n++] = uint8_t(c);
+				continue;
+			}
+			unsigned rep;
+			uint8_t fill = 0;
+			if (c == 16)
+			{
+				if (n == 0)
+					return false;
+				rep = Bits(2) + 3;
+				fill = lengths[n - 1];
+			}
+			else if (c == 17)
+				rep = Bits(3) + 3;
+			else
+				rep = Bits(7) + 11;
+			if (n + rep > hlit + hdist)
+				return false;
+			memset(lengths + n, fill, rep);
+			n += rep;
+		}
+		return lit.Build(lengths, hlit) && dist.Build(lengths + hlit, hdist);
+	}
+
+	void SetFixedTables()
+	{
+		uint8_t lengths[288];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		lit.Build(lengths, 288);
+		memset(lengths, 5, 30);
+		dist.Build(lengths, 30);
+	}
+
+	bool DecodeHuffmanBlock()
+	{
+		for (;;)
+		{
+			int sym = Decode(lit);
+			if (sym < 256)
+			{
+				if (sym < 0)
+					return false;
+				out.push_back(uint8_t(sym));
+				continue;
+			}
+			if (sym == 256)
+				return true;
+
+			sym -= 257;
+			if (sym >= 29)
+				return false;
+			unsigned len = g_lengthBase[sym] + Bits(g_lengthExtra[sym]);
+			int dsym = Decode(dist);
+			if (dsym < 0 || dsym >= 30)
+				return false;
+			size_t d = g_distBase[dsym] + Bits(g_distExtra[dsym]);
+			if (d > out.size())
+				return false;
+
+			size_t from = out.size() - d;
+			out.resize(out.size() + len);
+			uint8_t* p = &out[out.size() - len];
+			const uint8_t* s = &out[from];
+			for (unsigned i = 0; i < len; i++)
+				p[i] = s[i]; // can overlap
+			if (GetBitPos() > srcSize * 8)
+				return false;
+		}
+	}
+
+	bool DecodeStoredBlock()
+	{
+		AlignToByte();
+		unsigned len = Bits(16);
+		unsigned nlen = Bits(16);
+		if ((len ^ 0xffff) != nlen)
+			return false;
+		for (unsigned i = 0; i < len; i++)
+			out.push_back(uint8_t(Bits(8)));
+		return true;
+	}
+
+	// decodes the next block (and any stream headers/trailers around it), returns false when there's nothing more
+	bool Next()
+	{
+		if (state == Header)
+		{
+			if (!ReadHeader())
+			{
+				// not an error if there was a previous member/stream (trailing padding and such)
+				error = error || GetOutEnd() == 0;
+				state = Done;
+				return false;
+			}
+			state = Blocks;
+		}
+		if (state != Blocks)
+			return false;
+
+		size_t blockStart = out.size();
+		bool final = Bits(1) != 0;
+		bool ok;
+		switch (Bits(2))
+		{
+		case 0: ok = DecodeStoredBlock(); break;
+		case 1: SetFixedTables(); ok = DecodeHuffmanBlock(); break;
+		case 2: ok = ReadDynamicTables() && DecodeHuffmanBlock(); break;
+		default: ok = false; break;
+		}
+		if (!ok || GetBitPos() > srcSize * 8)
+		{
+			// a truncated/corrupted block could have produced anything
+			out.resize(blockStart);
+			error = true;
+			state = Done;
+			return false;
+		}
+
+		if (final)
+		{
+			ReadTrailer();
+			state = format == CompressionFormat::Gzip ? Header : Done;
+		}
+		return true;
+	}
+
+	// keeps only the last window of the output once the buffer grows past `maxSize`
+	void TrimOutput(size_t maxSize)
+	{
+		if (out.size() <= maxSize)
+			return;
+		UpdateChecksum();
+		size_t drop = out.size() - INFLATE_WINDOW_SIZE;
+		out.erase(out.begin(), out.begin() + drop);
+		outStart += drop;
+	}
+};
+
+
+bool MeasureCompressedStream(IDataSource* src, uint64_t off, CompressionFormat fmt, uint64_t maxSize, uint64_t& compressedSize, uint64_t& size)
+{
+	uint64_t srcSize = src->GetSize();
+	if (off >= srcSize)
+		return false;
+	srcSize -= off;
+
+	// the first block only, from a small read (running out of data there just means that the block is bigger)
+	if (srcSize > INFLATE_MEASURE_PROBE_SIZE)
+	{
+		InflateDecoder probe(src, off, INFLATE_MEASURE_PROBE_SIZE, fmt);
+		if (!probe.Next() && probe.error && probe.GetBitPos() <= INFLATE_MEASURE_PROBE_SIZE * 8)
+			return false;
+	}
+
+	compressedSize = 0;
+	size = 0;
+	InflateDecoder D(src, off, srcSize, fmt);
+	// the trailer is checked too (the checksum of all the output, and the size for gzip)
+	D.verify = true;
+	while (D.Next())
+	{
+		if (D.GetOutEnd() > maxSize)
+			return true;
+		D.TrimOutput(INFLATE_WINDOW_SIZE);
+		if (D.state != InflateDecoder::Blocks)
+			break;
+	}
+	if (D.error || D.checksumError || D.state == InflateDecoder::Blocks || D.GetBitPos() > srcSize * 8)
+		return false;
+
+	compressedSize = D.GetBitPos() / 8;
+	size = D.GetOutEnd();
+	return true;
+}
+
+
+CompressedDataSource::CompressedDataSource(IDataSource* src, uint64_t off, uint64_t size, CompressionFormat fmt, const char* indexPath, uint64_t knownSize) :
+	_src(src),
+	_off(off),
+	_srcSize(std::min(size, src->GetSize() - std::min(off, src->GetSize()))),
+	_format(fmt == CompressionFormat::Unknown ? CompressionFormat::Deflate : fmt),
+	_knownSize(knownSize)
+{
+	_ioStats.type = "compressed";
+	_ioStats.desc = CompressionFormatToString(_format);
+	_eventTarget = std::make_shared<CompressedDataSource*>(this);
+	_decoder = new InflateDecoder(src, _off, _srcSize, _format);
+	if (indexPath)
+		LoadIndex(indexPath);
+}
+
+CompressedDataSource::~CompressedDataSource()
+{
+	if (_indexingThread.joinable())
+	{
+		_cancelIndexing = true;
+		_indexingThread.join();
+	}
+	*_eventTarget = nullptr;
+	delete _decoder;
+}
+
+size_t CompressedDataSource::Read(uint64_t at, size_t size, void* out)
+{
+	IOStatsScope ios(_ioStats, at, size);
+	std::lock_guard<std::mutex> lock(_mutex);
+	_EnsureIndex();
+
+	auto& D = *_decoder;
+	size_t nw = 0;
+	size_t toRead = at < _size ? size_t(std::min(uint64_t(size), _size - at)) : 0;
+	while (nw < toRead)
+	{
+		uint64_t pos = at + nw;
+		if (pos >= D.outStart && pos < D.GetOutEnd())
+		{
+			size_t n = size_t(std::min(uint64_t(toRead - nw), D.GetOutEnd() - pos));
+			memcpy((char*)out + nw, &D.out[size_t(pos - D.outStart)], n);
+			nw += n;
+			continue;
+		}
+
+		// continue decoding from where the last read stopped if that's no further back than the nearest checkpoint
+		auto it = std::upper_bound(_checkpoints.begin(), _checkpoints.end(), pos, [](uint64_t p, const Checkpoint& cp) { return p < cp.outPos; });
+		const Checkpoint& cp = *(it - 1);
+		if (D.state == InflateDecoder::Done || D.GetOutEnd() > pos || D.GetOutEnd() < cp.outPos)
+			_Restore(cp);
+
+		while (D.GetOutEnd() <= pos)
+		{
+			D.TrimOutput(INFLATE_OUTPUT_BUFFER_SIZE);
+			if (!D.Next())
+				break;
+		}
+		if (D.GetOutEnd() <= pos)
+			break;
+	}
+	if (nw < size)
+		memset((char*)out + nw, 0, size - nw);
+	return nw;
+}
+
+uint64_t CompressedDataSource::GetSize()
+{
+	// the checkpoints are then only made on the first read
+	if (_knownSize != UINT64_MAX)
+		return _knownSize;
+	std::lock_guard<std::mutex> lock(_mutex);
+	_EnsureIndex();
+	return _size;
+}
+
+bool CompressedDataSource::IsCorrupted()
+{
+	// set together with the index, before _indexed
+	return _indexed && _corrupted;
+}
+
+void CompressedDataSource::StartIndexing()
+{
+	if (_indexed || _indexingThread.joinable())
+		return;
+	// the lock is held for the whole time, so that any reads wait for the index instead of building it again
+	_indexingThread = std::thread([this]()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_EnsureIndex(true);
+		if (!_cancelIndexing)
+			_PostProgress();
+	});
+}
+
+void CompressedDataSource::_EnsureIndex(bool postProgress)
+{
+	// allocated on first use, so that it's cheap to have many streams open that are never read
+	if (_decoder->out.capacity() == 0)
+		_decoder->out.reserve(INFLATE_OUTPUT_BUFFER_SIZE + INFLATE_WINDOW_SIZE);
+	if (!_indexed)
+		_BuildIndex(postProgress);
+}
+
+void CompressedDataSource::_BuildIndex(bool postProgress)
+{
+	auto& D = *_decoder;
+	D.Reset();
+	// the index pass is the only one that decodes everything in order
+	D.verify = true;
+	_checkpoints.clear();
+	_checkpoints.push_back({});
+
+	uint64_t lastCheckpoint = 0;
+	int lastPercent = 0;
+	for (;;)
+	{
+		if (_cancelIndexing)
+		{
+			D.verify = false;
+			return;
+		}
+		_indexingProgress = float(double(D.GetBitPos() / 8) / std::max(_srcSize, uint64_t(1)));
+		int percent = int(_indexingProgress * 100);
+		if (percent != lastPercent && postProgress)
+		{
+			lastPercent = percent;
+			_PostProgress();
+		}
+
+		if (D.state == InflateDecoder::Blocks && D.GetOutEnd() - lastCheckpoint >= g_inflateCheckpointInterval)
+		{
+			Checkpoint cp;
+			cp.inBitPos = D.GetBitPos();
+			cp.outPos = D.GetOutEnd();
+			size_t wsize = std::min(D.out.size(), INFLATE_WINDOW_SIZE);
+			cp.window.assign(D.out.end() - wsize, D.out.end());
+			_checkpoints.push_back(std::move(cp));
+			lastCheckpoint = D.GetOutEnd();
+		}
+		if (!D.Next())
+			break;
+		D.TrimOutput(INFLATE_WINDOW_SIZE);
+	}
+	_size = D.GetOutEnd();
+	// the data can also decode fine but not match the checksum in the trailer
+	_corrupted = D.error || D.checksumError;
+	_indexed = true;
+	_indexSavedTo.clear();
+	D.verify = false;
+	D.Reset();
+}
+
+void CompressedDataSource::_PostProgress()
+{
+	auto target = _eventTarget;
+	ui::Application::PushEvent([target]()
+	{
+		if (*target)
+			OnCompressedIndexingProgress.Call(*target);
+	});
+}
+
+void CompressedDataSource::_Restore(const Checkpoint& cp)
+{
+	auto& D = *_decoder;
+	if (cp.outPos == 0)
+	{
+		D.Reset();
+		return;
+	}
+	D.SeekBits(cp.inBitPos);
+	D.out.assign(cp.window.begin(), cp.window.end());
+	D.outStart = cp.outPos - cp.window.size();
+	D.state = InflateDecoder::Blocks;
+	D.error = false;
+}
+
+uint64_t CompressedDataSource::_GetDataHash()
+{
+	// FNV-1a of the beginning and the end, together with the size that's enough to tell files apart
+	uint8_t buf[4096];
+	uint64_t h = 0xcbf29ce484222325ULL ^ _srcSize;
+	uint64_t positions[2] = { 0, _srcSize - std::min(_srcSize, uint64_t(sizeof(buf))) };
+	for (uint64_t p : positions)
+	{
+		size_t n = _src->Read(_off + p, sizeof(buf), buf);
+		for (size_t i = 0; i < n; i++)
+			h = (h ^ buf[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static const char g_indexMagic[8] = { 'B', 'D', 'A', 'T', 'Z', 'I', 'D', 'X' };
+static const uint32_t INDEX_VERSION = 1;
+
+struct CompressedIndexHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t format;
+	uint64_t srcSize;
+	uint64_t dataHash;
+	uint64_t size;
+	uint64_t numCheckpoints;
+	uint32_t corrupted;
+	uint32_t reserved;
+};
+
+bool CompressedDataSource::LoadIndex(const char* path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+
+	bool ok = false;
+	CompressedIndexHeader hdr;
+	if (fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		memcmp(hdr.magic, g_indexMagic, sizeof(g_indexMagic)) == 0 &&
+		hdr.version == INDEX_VERSION &&
+		hdr.format == uint32_t(_format) &&
+		hdr.srcSize == _srcSize &&
+		hdr.dataHash == _GetDataHash() &&
+		hdr.numCheckpoints > 0)
+	{
+		std::vector<Checkpoint> cps;
+		ok = true;
+		for (uint64_t i = 0; i < hdr.numCheckpoints && ok; i++)
+		{
+			Checkpoint cp;
+			uint32_t wsize = 0;
+			ok = fread(&cp.inBitPos, sizeof(cp.inBitPos), 1, fp) == 1 &&
+				fread(&cp.outPos, sizeof(cp.outPos), 1, fp) == 1 &&
+				fread(&wsize, sizeof(wsize), 1, fp) == 1 &&
+				wsize <= INFLATE_WINDOW_SIZE &&
+				wsize <= cp.outPos &&
+				(i == 0) == (cp.outPos == 0) &&
+				(i == 0 || cp.outPos > cps.back().outPos);
+			if (ok)
+			{
+				cp.window.resize(wsize);
+				ok = !wsize || fread(cp.window.data(), 1, wsize, fp) == wsize;
+			}
+			cps.push_back(std::move(cp));
+		}
+		if (ok)
+		{
+			_checkpoints = std::move(cps);
+			_size = hdr.size;
+			_corrupted = hdr.corrupted != 0;
+			_indexed = true;
+			_indexSavedTo = path;
+			_decoder->Reset();
+		}
+	}
+	fclose(fp);
+	return ok;
+}
+
+bool CompressedDataSource::SaveIndex(const char* path)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_indexed)
+		return false;
+	if (_indexSavedTo == path)
+		return true;
+
+	FILE* fp = fopen(path, "wb");
+	if (!fp)
+		return false;
+
+	CompressedIndexHeader hdr;
+	memcpy(hdr.magic, g_indexMagic, sizeof(g_indexMagic));
+	hdr.version = INDEX_VERSION;
+	hdr.format = uint32_t(_format);
+	hdr.srcSize = _srcSize;
+	hdr.dataHash = _GetDataHash();
+	hdr.size = _size;
+	hdr.numCheckpoints = _checkpoints.size();
+	hdr.corrupted = _corrupted;
+	hdr.reserved = 0;
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+	for (auto& cp : _checkpoints)
+	{
+		uint32_t wsize = uint32_t(cp.window.size());
+		ok = ok &&
+			fwrite(&cp.inBitPos, sizeof(cp.inBitPos), 1, fp) == 1 &&
+			fwrite(&cp.outPos, sizeof(cp.outPos), 1, fp) == 1 &&
+			fwrite(&wsize, sizeof(wsize), 1, fp) == 1 &&
+			(!wsize || fwrite(cp.window.data(), 1, wsize, fp) == wsize);
+	}
+	ok = fclose(fp) == 0 && ok;
+	if (ok)
+		_indexSavedTo = path;
+	return ok;
+}
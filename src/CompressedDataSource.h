@@ -0,0 +1,90 @@
+#pragma once
+#include "pch.h"
+#include "FileReaders.h"
+
+
+enum class CompressionFormat
+{
+	Unknown,
+	Deflate, // raw, without any header
+	Zlib,
+	Gzip, // can have multiple members
+};
+
+const char* CompressionFormatToString(CompressionFormat fmt);
+CompressionFormat CompressionFormatFromString(ui::StringView s);
+// raw deflate has no header so it's never detected
+CompressionFormat DetectCompressionFormat(IDataSource* src, uint64_t off = 0);
+
+// decodes the stream at `off` once (only the first member of gzip data) to find where it ends
+// returns false if it's not valid compressed data (if it decompresses to more than `maxSize` bytes, it's assumed to be valid
+// but the sizes are left at 0)
+bool MeasureCompressedStream(IDataSource* src, uint64_t off, CompressionFormat fmt, uint64_t maxSize, uint64_t& compressedSize, uint64_t& size);
+
+// how much uncompressed data there is between inflate checkpoints (each one also stores a 32 KB window)
+extern uint64_t g_inflateCheckpointInterval;
+
+struct InflateDecoder;
+struct CompressedDataSource;
+
+// called on the UI thread as the indexing progresses and once it's done in the background
+extern ui::MulticastDelegate<const CompressedDataSource*> OnCompressedIndexingProgress;
+
+// decompresses [off, off + size) of `src` on the fly
+// the whole stream is decoded once to find its size and record checkpoints,
+// after which a random read costs one checkpoint restore plus at most one interval of decompression
+// (the first GetSize/Read does that unless StartIndexing was used to do it on a background thread, then they wait for it)
+// if the size of the decompressed data is already known, GetSize doesn't need the index
+struct CompressedDataSource : IDataSource
+{
+	struct Checkpoint
+	{
+		uint64_t inBitPos = 0; // start of a deflate block (the first checkpoint is at the start of the stream instead)
+		uint64_t outPos = 0;
+		std::vector<uint8_t> window; // the output preceding outPos (up to 32 KB)
+	};
+
+	CompressedDataSource(IDataSource* src, uint64_t off, uint64_t size, CompressionFormat fmt, const char* indexPath = nullptr, uint64_t knownSize = UINT64_MAX);
+	~CompressedDataSource();
+
+	size_t Read(uint64_t at, size_t size, void* out) override;
+	uint64_t GetSize() override;
+
+	// the index is only accepted if it was made from the same compressed data
+	bool LoadIndex(const char* path);
+	bool SaveIndex(const char* path);
+	// the stream had decoding errors or didn't match its checksum (only known once it's indexed)
+	bool IsCorrupted();
+
+	void StartIndexing();
+	bool IsIndexed() { return _indexed; }
+	// how much of the compressed data has been indexed (0-1)
+	float GetIndexingProgress() { return _indexingProgress; }
+
+	// only the indexing thread reports progress, so that nothing is posted without a UI (--headless)
+	void _EnsureIndex(bool postProgress = false);
+	void _BuildIndex(bool postProgress);
+	void _PostProgress();
+	void _Restore(const Checkpoint& cp);
+	uint64_t _GetDataHash();
+
+	ui::RCHandle<IDataSource> _src;
+	uint64_t _off;
+	uint64_t _srcSize;
+	CompressionFormat _format;
+	std::mutex _mutex;
+
+	std::atomic_bool _indexed{ false };
+	std::atomic<float> _indexingProgress{ 0 };
+	std::atomic_bool _cancelIndexing{ false };
+	std::thread _indexingThread;
+	// the queued progress events can outlive the source, they skip it once it's destroyed
+	std::shared_ptr<CompressedDataSource*> _eventTarget;
+	bool _corrupted = false;
+	uint64_t _size = 0;
+	uint64_t _knownSize;
+	std::vector<Checkpoint> _checkpoints;
+	std::string _indexSavedTo;
+
+	InflateDecoder* _decoder;
+};
@@ -2,11 +2,15 @@
 #include "pch.h"
 #include "DataDesc.h"
 #include "FileReaders.h"
+#include "CompressedDataSource.h"
+#include "SearchIndex.h"
+#include "ByteStats.h"
 #include "ImageParsers.h"
 
 
 ui::MulticastDelegate<DataDesc*, DDStruct*> OnCurStructChanged;
 ui::MulticastDelegate<DataDesc*, DDStructInst*> OnCurStructInstChanged;
+ui::MulticastDelegate<DataDesc*> OnInstanceListChanged;
 
 
 OffModResult OffModRanges::TransformOffset(uint64_t pos, uint64_t val, uint64_t validLimit)
@@ -737,6 +741,7 @@ DDStructInst* DataDesc::AddInstance(const DDStructInst& src)
 	copy->id = instIDAlloc++;
 	copy->OnEdit();
 	instances.push_back(copy);
+	OnInstanceListChanged.Call(this);
 	return copy;
 }
 
@@ -745,6 +750,7 @@ void DataDesc::DeleteInstance(DDStructInst* inst)
 	delete inst;
 	_OnDeleteInstance(inst);
 	instances.erase(std::remove_if(instances.begin(), instances.end(), [inst](DDStructInst* SI) { return inst == SI; }), instances.end());
+	OnInstanceListChanged.Call(this);
 }
 
 void DataDesc::SetCurrentInstance(DDStructInst* inst)
@@ -792,6 +798,7 @@ void DataDesc::DeleteAllInstances(DDFile* filterFile, DDStruct* filterStruct)
 		delete SI;
 		return true;
 	}), instances.end());
+	OnInstanceListChanged.Call(this);
 }
 
 DataDesc::Image DataDesc::GetInstanceImage(const DDStructInst& SI)
@@ -860,6 +867,37 @@ DDFile* DataDesc::FindFileByID(uint64_t id)
 	return nullptr;
 }
 
+void DataDesc::OnDataEdited(IDataSource* origDataSource, uint64_t off, uint64_t size)
+{
+	// the files sharing the data (subviews) see the edit relative to their starting points
+	uint64_t absOff = off;
+	uint64_t absEnd = off + size;
+	for (auto* SI : instances)
+	{
+		auto* F = SI->file;
+		if (!F || F->origDataSource.get_ptr() != origDataSource || absEnd <= F->off)
+			continue;
+		int64_t editStart = int64_t(absOff > F->off ? absOff - F->off : 0);
+		int64_t editEnd = int64_t(absEnd - F->off);
+		if (SI->off >= editEnd)
+			continue;
+		if (SI->cachedSize != F_NO_VALUE && SI->off + SI->cachedSize <= editStart)
+			continue;
+		SI->OnEdit();
+	}
+	OnInstanceListChanged.Call(this);
+
+	// only the edited parts of the overviews are rescanned, in the background
+	for (auto* F : files)
+	{
+		if (!F->byteStats || F->origDataSource.get_ptr() != origDataSource || absEnd <= F->off)
+			continue;
+		if (F->size != UINT64_MAX && absOff >= F->off + F->size)
+			continue;
+		F->byteStats->Update(absOff > F->off ? absOff - F->off : 0, absEnd - F->off);
+	}
+}
+
 DDStruct* DataDesc::CreateNewStruct(const std::string& name)
 {
 	assert(structs.count(name) == 0);
@@ -912,8 +950,19 @@ void DataDesc::Load(const char* key, NamedTextSerializeReader& r)
 		F->id = r.ReadUInt64("id");
 		F->name = r.ReadString("name");
 		F->path = r.ReadString("path");
+		r.BeginArray("moreParts");
+		for (auto E2 : r.GetCurrentRange())
+		{
+			r.BeginEntry(E2);
+			F->moreParts.push_back(r.ReadString(""));
+			r.EndEntry();
+		}
+		r.EndArray();
 		F->off = r.ReadUInt64("off");
 		F->size = r.ReadUInt64("size", UINT64_MAX);
+		F->compression = r.ReadString("compression");
+		F->compOff = r.ReadUInt64("compOff");
+		F->compSize = r.ReadUInt64("compSize", UINT64_MAX);
 		F->markerData.Load("markerData", r);
 		F->offModRanges.Load("offMod", r);
 
@@ -1042,10 +1091,24 @@ void DataDesc::Save(const char* key, NamedTextSerializeWriter& w)
 		w.WriteInt("id", F->id);
 		w.WriteString("name", F->name);
 		w.WriteString("path", F->path);
+		if (!F->moreParts.empty())
+		{
+			w.BeginArray("moreParts");
+			for (const auto& P : F->moreParts)
+				w.WriteString("", P);
+			w.EndArray();
+		}
 		if (F->off != 0)
 			w.WriteInt("off", F->off);
 		if (F->size != UINT64_MAX)
 			w.WriteInt("size", F->size);
+		if (!F->compression.empty())
+		{
+			w.WriteString("compression", F->compression);
+			w.WriteInt("compOff", F->compOff);
+			if (F->compSize != UINT64_MAX)
+				w.WriteInt("compSize", F->compSize);
+		}
 		F->markerData.Save("markerData", w);
 		F->offModRanges.Save("offMod", w);
 
@@ -49,10 +49,24 @@ struct DDFile
 	uint64_t id = UINT64_MAX;
 	std::string name;
 	std::string path;
+	// the files that follow `path` if the data is split into several (`data.000`, `data.001`, ...)
+	std::vector<std::string> moreParts;
 	uint64_t off = 0;
 	uint64_t size = UINT64_MAX;
+	// if set, [compOff, compOff + compSize) of the file is decompressed on the fly and off/size apply to the result
+	std::string compression;
+	uint64_t compOff = 0;
+	uint64_t compSize = UINT64_MAX;
 	ui::RCHandle<struct IDataSource> dataSource;
 	ui::RCHandle<struct IDataSource> origDataSource;
+	// the top layer of origDataSource, where edits are made
+	ui::RCHandle<struct OverlayDataSource> editOverlay;
+	// set if the data is compressed
+	ui::RCHandle<struct CompressedDataSource> decompressor;
+	// optional, for faster fragment searches
+	ui::RCHandle<struct SearchIndex> searchIndex;
+	// optional, built when an overview of the data is needed
+	ui::RCHandle<struct ByteStatsMap> byteStats;
 	MarkerData markerData;
 	MarkerDataSource mdSrc;
 	OffModRanges offModRanges;
@@ -68,6 +82,8 @@ struct DDFile
 
 extern ui::MulticastDelegate<DataDesc*, DDStruct*> OnCurStructChanged;
 extern ui::MulticastDelegate<DataDesc*, DDStructInst*> OnCurStructInstChanged;
+// instances were added, removed or may have changed size
+extern ui::MulticastDelegate<DataDesc*> OnInstanceListChanged;
 struct DataDesc
 {
 	struct Image
@@ -125,6 +141,8 @@ struct DataDesc
 	void Clear();
 	DDFile* CreateNewFile();
 	DDFile* FindFileByID(uint64_t id);
+	// drops the cached values of struct instances that overlap the edited range of an origDataSource
+	void OnDataEdited(IDataSource* origDataSource, uint64_t off, uint64_t size);
 	DDStruct* CreateNewStruct(const std::string& name);
 	DDStruct* FindStructByName(const std::string& name);
 	DDStructInst* FindInstanceByID(int64_t id);
@@ -210,18 +228,34 @@ struct CachedImage
 			if (imgDesc.file == curImgDesc.file &&
 				imgDesc.info == curImgDesc.info &&
 				imgDesc.format == curImgDesc.format &&
-				expSettings == curImgDesc._savedSettings)
+				expSettings == curImgDesc._savedSettings &&
+				!WasDataEdited())
 			{
 				return curImg;
 			}
 		}
 
-		curImg = CreateImageFrom(imgDesc.file->dataSource, imgDesc.format.c_str(), &settings, imgDesc.info);
+		// remember which bytes were used so that only edits to those cause a reload
+		ReadExtentDataSource extent(imgDesc.file->dataSource);
+		curImg = CreateImageFrom(&extent, imgDesc.format.c_str(), &settings, imgDesc.info);
 		curImgDesc = imgDesc;
 		curImgDesc._savedSettings = expSettings;
+		curReadOff = extent.minOff;
+		curReadEnd = extent.maxEnd;
+		curEditGeneration = imgDesc.file->editOverlay ? imgDesc.file->editOverlay->GetEditGeneration() : 0;
 		return curImg;
 	}
+	bool WasDataEdited()
+	{
+		auto* F = curImgDesc.file;
+		if (!F->editOverlay || curReadOff >= curReadEnd)
+			return false;
+		return F->editOverlay->WasEditedSince(curEditGeneration, F->off + curReadOff, curReadEnd - curReadOff);
+	}
 
 	ui::draw::ImageHandle curImg;
 	DataDesc::Image curImgDesc;
+	uint64_t curReadOff = 0;
+	uint64_t curReadEnd = 0;
+	uint64_t curEditGeneration = 0;
 };
@@ -883,9 +883,9 @@ bool DDStructInst::_ReadFieldValues(size_t i, size_t n) const
 
 		CFV.off = CF.readOff;
 		__declspec(align(8)) char bfr[8];
-		file->dataSource->Read(CF.readOff, BTI.size, bfr);
-		CFV.intVal = BTI.get_int64(bfr);
-		BTI.append_to_str(bfr, CFV.preview);
+		DataSpan span = file->dataSource->ViewOrRead(CF.readOff, BTI.size, bfr);
+		CFV.intVal = BTI.get_int64(span.data);
+		BTI.append_to_str(span.data, CFV.preview);
 
 		CF.readOff += BTI.size;
 	}
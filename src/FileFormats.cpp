@@ -0,0 +1,799 @@
+
+#include "pch.h"
+#include "FileFormats.h"
+#include "CompressedDataSource.h"
+
+
+// compressed streams are decoded to find their size, up to this much
+static const uint64_t FORMAT_MAX_DECOMPRESSED_SIZE = 1024ULL * 1024 * 1024;
+// for the formats made of a list of chunks/pages, to stop early on garbage
+static const unsigned FORMAT_MAX_CHUNKS = 1000000;
+
+static uint16_t GetLE16(const uint8_t* p) { return uint16_t(p[0] | (p[1] << 8)); }
+static uint32_t GetLE32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24); }
+static uint64_t GetLE64(const uint8_t* p) { return GetLE32(p) | (uint64_t(GetLE32(p + 4)) << 32); }
+static uint16_t GetBE16(const uint8_t* p) { return uint16_t((p[0] << 8) | p[1]); }
+static uint32_t GetBE32(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static uint64_t GetBE64(const uint8_t* p) { return (uint64_t(GetBE32(p)) << 32) | GetBE32(p + 4); }
+
+static bool IsFourCCChar(char c)
+{
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == ' ';
+}
+
+// reads the data in blocks for walking through many small fields
+struct FormatByteReader
+{
+	FormatByteReader(IDataSource* ds, uint64_t pos) : _ds(ds), _pos(pos), _end(ds->GetSize()) {}
+
+	bool AtEnd() const { return _pos >= _end; }
+	uint64_t GetPos() const { return _pos; }
+	void Skip(uint64_t n) { _pos += n; }
+	uint8_t NextByte()
+	{
+		if (_pos < _bufStart || _pos >= _bufStart + _bufSize)
+		{
+			_bufStart = _pos;
+			_bufSize = _ds->Read(_pos, sizeof(_buf), _buf);
+			if (_bufSize == 0)
+			{
+				_pos++;
+				return 0;
+			}
+		}
+		return _buf[_pos++ - _bufStart];
+	}
+
+	IDataSource* _ds;
+	uint64_t _pos;
+	uint64_t _end;
+	uint64_t _bufStart = 0;
+	size_t _bufSize = 0;
+	uint8_t _buf[4096];
+};
+
+
+static bool FileFormatDescFunc_DDS(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	using u = unsigned;
+	using DWORD = uint32_t;
+	struct DDS_PIXELFORMAT
+	{
+		DWORD dwSize;
+		DWORD dwFlags;
+		DWORD dwFourCC;
+		DWORD dwRGBBitCount;
+		DWORD dwRBitMask;
+		DWORD dwGBitMask;
+		DWORD dwBBitMask;
+		DWORD dwABitMask;
+	};
+	struct DDS_HEADER
+	{
+		DWORD           dwSize;
+		DWORD           dwFlags;
+		DWORD           dwHeight;
+		DWORD           dwWidth;
+		DWORD           dwPitchOrLinearSize;
+		DWORD           dwDepth;
+		DWORD           dwMipMapCount;
+		DWORD           dwReserved1[11];
+		DDS_PIXELFORMAT ddspf;
+		DWORD           dwCaps;
+		DWORD           dwCaps2;
+		DWORD           dwCaps3;
+		DWORD           dwCaps4;
+		DWORD           dwReserved2;
+	};
+	using DXGI_FORMAT = uint32_t;
+	using D3D10_RESOURCE_DIMENSION = uint32_t;
+	using UINT = uint32_t;
+	struct DDS_HEADER_DXT10
+	{
+		DXGI_FORMAT              dxgiFormat;
+		D3D10_RESOURCE_DIMENSION resourceDimension;
+		UINT                     miscFlag;
+		UINT                     arraySize;
+		UINT                     miscFlags2;
+	};
+
+	DDS_HEADER h;
+	ds->Read(off + 4, sizeof(h), &h);
+
+	char fourcc[4];
+	memcpy(&fourcc, &h.ddspf.dwFourCC, 4);
+
+	fi.desc.add(ui::Format("DDS %ux%ux%u (p/ls=%u, mips=%u) fourcc=%c%c%c%c",
+		u(h.dwWidth), u(h.dwHeight), u(h.dwDepth),
+		u(h.dwPitchOrLinearSize), u(h.dwMipMapCount),
+		fourcc[0], fourcc[1], fourcc[2], fourcc[3]));
+
+	if (h.dwSize != 124)
+	{
+		fi.err.add(ui::Format("bad header size: %u (need 124)", u(h.dwSize)));
+		return true;
+	}
+
+	// the size, for the block compressed formats and the uncompressed ones with a bit count
+	uint64_t headerSize = 4 + sizeof(h);
+	unsigned blockBytes = 0;
+	unsigned bitCount = 0;
+	unsigned faces = 1;
+	if (h.ddspf.dwFlags & 0x4) // DDPF_FOURCC
+	{
+		if (!memcmp(fourcc, "DXT1", 4) || !memcmp(fourcc, "ATI1", 4) || !memcmp(fourcc, "BC4U", 4) || !memcmp(fourcc, "BC4S", 4))
+			blockBytes = 8;
+		else if (!memcmp(fourcc, "DXT2", 4) || !memcmp(fourcc, "DXT3", 4) || !memcmp(fourcc, "DXT4", 4) || !memcmp(fourcc, "DXT5", 4) ||
+			!memcmp(fourcc, "ATI2", 4) || !memcmp(fourcc, "BC5U", 4) || !memcmp(fourcc, "BC5S", 4))
+			blockBytes = 16;
+		else if (!memcmp(fourcc, "DX10", 4))
+		{
+			DDS_HEADER_DXT10 h10;
+			ds->Read(off + headerSize, sizeof(h10), &h10);
+			headerSize += sizeof(h10);
+			u f = h10.dxgiFormat;
+			if ((f >= 70 && f <= 72) || (f >= 79 && f <= 81)) // BC1, BC4
+				blockBytes = 8;
+			else if ((f >= 73 && f <= 78) || (f >= 82 && f <= 84) || (f >= 94 && f <= 99)) // BC2, BC3, BC5, BC6H, BC7
+				blockBytes = 16;
+			faces = ui::max(h10.arraySize, 1U) * (h10.miscFlag & 0x4 ? 6 : 1); // D3D10_RESOURCE_MISC_TEXTURECUBE
+			fi.misc.add(ui::Format("DXGI format %u", f));
+		}
+	}
+	else
+		bitCount = h.ddspf.dwRGBBitCount;
+	if (h.dwCaps2 & 0x200) // DDSCAPS2_CUBEMAP
+	{
+		faces = 0;
+		for (u bit = 0x400; bit <= 0x8000; bit <<= 1)
+			faces += (h.dwCaps2 & bit) ? 1 : 0;
+	}
+
+	if (blockBytes || bitCount)
+	{
+		uint64_t size = 0;
+		u w = ui::max(u(h.dwWidth), 1U);
+		u ht = ui::max(u(h.dwHeight), 1U);
+		u d = (h.dwCaps2 & 0x200000) ? ui::max(u(h.dwDepth), 1U) : 1; // DDSCAPS2_VOLUME
+		for (u mip = 0; mip < ui::max(u(h.dwMipMapCount), 1U) && mip < 32; mip++)
+		{
+			if (blockBytes)
+				size += uint64_t((w + 3) / 4) * ((ht + 3) / 4) * blockBytes * d;
+			else
+				size += (uint64_t(w) * bitCount + 7) / 8 * ht * d;
+			w = ui::max(w / 2, 1U);
+			ht = ui::max(ht / 2, 1U);
+			d = ui::max(d / 2, 1U);
+		}
+		fi.size = headerSize + size * faces;
+	}
+	return true;
+}
+
+static bool FileFormatDescFunc_PNG(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	// the signature and the IHDR chunk, which must be the first one
+	uint8_t h[33];
+	if (ds->Read(off, sizeof(h), h) < sizeof(h) || GetBE32(h + 8) != 13 || memcmp(h + 12, "IHDR", 4))
+		return false;
+	fi.desc.add(ui::Format("PNG %ux%u, %u bits, color type %u%s",
+		unsigned(GetBE32(h + 16)), unsigned(GetBE32(h + 20)), h[24], h[25], h[28] ? ", interlaced" : ""));
+
+	// the file ends with the IEND chunk
+	uint64_t pos = off + 8;
+	for (unsigned i = 0; i < FORMAT_MAX_CHUNKS; i++)
+	{
+		uint8_t ch[8];
+		if (ds->Read(pos, sizeof(ch), ch) < sizeof(ch))
+		{
+			fi.err.add("truncated");
+			return true;
+		}
+		uint32_t len = GetBE32(ch);
+		if (len > 0x7fffffff)
+		{
+			fi.err.add(ui::Format("bad chunk size at %" PRIu64, pos));
+			return true;
+		}
+		pos += 12 + uint64_t(len);
+		if (!memcmp(ch + 4, "IEND", 4))
+		{
+			fi.size = pos - off;
+			return true;
+		}
+	}
+	fi.err.add("too many chunks");
+	return true;
+}
+
+static bool FileFormatDescFunc_RIFF(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	uint8_t h[12];
+	if (ds->Read(off, sizeof(h), h) < sizeof(h))
+		return false;
+	uint32_t riffSize = GetLE32(h + 4);
+	if (riffSize < 4)
+		return false;
+	fi.size = 8 + uint64_t(riffSize);
+	fi.desc.add(ui::Format("RIFF %c%c%c%c", h[8], h[9], h[10], h[11]));
+
+	if (!memcmp(h + 8, "WAVE", 4))
+	{
+		// the format and the size of the samples are in separate chunks
+		uint64_t end = off + fi.size;
+		uint64_t pos = off + 12;
+		unsigned channels = 0, rate = 0, bits = 0, tag = 0, blockAlign = 0;
+		uint64_t dataSize = 0;
+		for (unsigned i = 0; i < 64 && pos + 8 <= end; i++)
+		{
+			uint8_t ch[24];
+			size_t n = ds->Read(pos, sizeof(ch), ch);
+			if (n < 8)
+				break;
+			uint32_t len = GetLE32(ch + 4);
+			if (!memcmp(ch, "fmt ", 4) && len >= 16 && n >= 24)
+			{
+				tag = GetLE16(ch + 8);
+				channels = GetLE16(ch + 10);
+				rate = GetLE32(ch + 12);
+				blockAlign = GetLE16(ch + 20);
+				bits = GetLE16(ch + 22);
+			}
+			else if (!memcmp(ch, "data", 4))
+				dataSize = len;
+			pos += 8 + uint64_t(len) + (len & 1);
+		}
+		if (rate)
+		{
+			fi.desc.add(ui::Format("format %u, %u ch., %u Hz, %u bits", tag, channels, rate, bits));
+			if (dataSize && blockAlign)
+				fi.desc.add(ui::Format("%.2f s", double(dataSize / blockAlign) / rate));
+		}
+	}
+
+	if (off + fi.size > ds->GetSize())
+		fi.err.add("truncated");
+	return true;
+}
+
+static bool FileFormatDescFunc_OGG(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	// a stream is all the pages until every logical stream started in it has ended
+	std::vector<uint32_t> openStreams;
+	uint64_t pos = off;
+	unsigned pages = 0;
+	const char* codec = nullptr;
+	for (; pages < FORMAT_MAX_CHUNKS; pages++)
+	{
+		uint8_t h[27 + 255];
+		if (ds->Read(pos, 27, h) < 27 || memcmp(h, "OggS", 4) || h[4] != 0)
+			break;
+		unsigned numSegs = h[26];
+		if (ds->Read(pos + 27, numSegs, h + 27) < numSegs)
+			break;
+		uint64_t bodySize = 0;
+		for (unsigned i = 0; i < numSegs; i++)
+			bodySize += h[27 + i];
+
+		uint32_t serial = GetLE32(h + 14);
+		if (h[5] & 2) // beginning of stream
+		{
+			openStreams.push_back(serial);
+			if (!codec)
+			{
+				uint8_t id[8] = {};
+				ds->Read(pos + 27 + numSegs, sizeof(id), id);
+				if (!memcmp(id, "\x01vorbis", 7)) codec = "Vorbis";
+				else if (!memcmp(id, "OpusHead", 8)) codec = "Opus";
+				else if (!memcmp(id, "\x80theora", 7)) codec = "Theora";
+				else if (!memcmp(id, "\x7f" "FLAC", 5)) codec = "FLAC";
+				else if (!memcmp(id, "Speex   ", 8)) codec = "Speex";
+				else codec = "unknown codec";
+			}
+		}
+		pos += 27 + numSegs + bodySize;
+		if (h[5] & 4) // end of stream
+		{
+			openStreams.erase(std::remove(openStreams.begin(), openStreams.end(), serial), openStreams.end());
+			if (openStreams.empty())
+			{
+				pages++;
+				break;
+			}
+		}
+	}
+	if (pages == 0)
+		return false;
+
+	fi.desc.add(ui::Format("Ogg %s, %u pages", codec ? codec : "", pages));
+	fi.size = pos - off;
+	if (!openStreams.empty())
+		fi.err.add("truncated");
+	return true;
+}
+
+static bool DescribeCompressedStream(IDataSource* ds, uint64_t off, CompressionFormat fmt, FileInfo& fi)
+{
+	uint64_t compressedSize, size;
+	if (!MeasureCompressedStream(ds, off, fmt, FORMAT_MAX_DECOMPRESSED_SIZE, compressedSize, size))
+		return false;
+	fi.size = compressedSize;
+	fi.decompressedSize = size;
+	if (compressedSize)
+		fi.desc.add(ui::Format("%s, %" PRIu64 " -> %" PRIu64 " bytes", CompressionFormatToString(fmt), compressedSize, size));
+	else
+		fi.desc.add(ui::Format("%s, over %" PRIu64 " bytes decompressed", CompressionFormatToString(fmt), FORMAT_MAX_DECOMPRESSED_SIZE));
+	return true;
+}
+
+static bool FileFormatDescFunc_Zlib(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	return DescribeCompressedStream(ds, off, CompressionFormat::Zlib, fi);
+}
+
+static bool FileFormatDescFunc_Gzip(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	if (!DescribeCompressedStream(ds, off, CompressionFormat::Gzip, fi))
+		return false;
+
+	// the original file name
+	uint8_t h[10 + 2 + 256];
+	size_t n = ds->Read(off, sizeof(h), h);
+	if (h[3] & 8) // FNAME
+	{
+		size_t pos = 10;
+		if (h[3] & 4) // FEXTRA
+			pos += 2 + GetLE16(h + 10);
+		size_t end = pos;
+		while (end < n && h[end])
+			end++;
+		if (end < n)
+			fi.misc.add(ui::Format("\"%.*s\"", int(end - pos), (const char*)h + pos));
+	}
+	return true;
+}
+
+static const char* GetZipMethodName(unsigned method)
+{
+	switch (method)
+	{
+	case 0: return "stored";
+	case 8: return "deflate";
+	case 9: return "deflate64";
+	case 12: return "bzip2";
+	case 14: return "LZMA";
+	case 93: return "zstd";
+	case 95: return "xz";
+	case 98: return "PPMd";
+	case 99: return "AES";
+	default: return nullptr;
+	}
+}
+
+static bool FileFormatDescFunc_ZIP(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	// local file header
+	uint8_t h[30 + 256];
+	size_t n = ds->Read(off, sizeof(h), h);
+	if (n < 30)
+		return false;
+	unsigned flags = GetLE16(h + 6);
+	unsigned method = GetLE16(h + 8);
+	uint64_t compSize = GetLE32(h + 18);
+	uint64_t size = GetLE32(h + 22);
+	unsigned nameLen = GetLE16(h + 26);
+	unsigned extraLen = GetLE16(h + 28);
+	const char* methodName = GetZipMethodName(method);
+	if (!methodName)
+		return false;
+
+	unsigned shownNameLen = unsigned(ui::min(size_t(nameLen), n - 30));
+	fi.desc.add(ui::Format("ZIP entry \"%.*s\", %s", int(shownNameLen), (const char*)h + 30, methodName));
+	if (flags & 1)
+		fi.misc.add("encrypted");
+
+	uint64_t dataStart = off + 30 + nameLen + extraLen;
+	if (compSize == 0xffffffff || size == 0xffffffff)
+	{
+		// ZIP64: the sizes that didn't fit are in an extra field, in this order
+		std::vector<uint8_t> extra(extraLen);
+		ds->Read(off + 30 + nameLen, extraLen, extra.data());
+		for (size_t pos = 0; pos + 4 <= extra.size();)
+		{
+			unsigned id = GetLE16(&extra[pos]);
+			unsigned len = GetLE16(&extra[pos + 2]);
+			size_t end = ui::min(pos + 4 + len, extra.size());
+			if (id == 1)
+			{
+				size_t at = pos + 4;
+				if (size == 0xffffffff && at + 8 <= end)
+				{
+					size = GetLE64(&extra[at]);
+					at += 8;
+				}
+				if (compSize == 0xffffffff && at + 8 <= end)
+					compSize = GetLE64(&extra[at]);
+				break;
+			}
+			pos = end;
+		}
+	}
+
+	if ((flags & 8) && compSize == 0)
+	{
+		// the sizes are in a data descriptor after the data, so deflated data has to be decoded to find it
+		uint64_t decompSize;
+		if (method != 8 || !MeasureCompressedStream(ds, dataStart, CompressionFormat::Deflate, FORMAT_MAX_DECOMPRESSED_SIZE, compSize, decompSize) || !compSize)
+		{
+			fi.misc.add("size unknown (in the data descriptor)");
+			return true;
+		}
+		size = decompSize;
+		// the descriptor may or may not have a signature
+		uint8_t sig[4] = {};
+		ds->Read(dataStart + compSize, 4, sig);
+		fi.size = dataStart + compSize + (memcmp(sig, "PK\x07\x08", 4) ? 12 : 16) - off;
+	}
+	else
+		fi.size = dataStart + compSize - off;
+
+	fi.desc.add(ui::Format("%" PRIu64 " -> %" PRIu64 " bytes", compSize, size));
+	if (off + fi.size > ds->GetSize())
+		fi.err.add("truncated");
+	return true;
+}
+
+static const char* GetELFMachineName(unsigned machine)
+{
+	switch (machine)
+	{
+	case 3: return "x86";
+	case 8: return "MIPS";
+	case 20: return "PowerPC";
+	case 21: return "PowerPC64";
+	case 40: return "ARM";
+	case 62: return "x86-64";
+	case 183: return "AArch64";
+	case 243: return "RISC-V";
+	default: return nullptr;
+	}
+}
+
+static bool FileFormatDescFunc_ELF(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	uint8_t h[64];
+	size_t n = ds->Read(off, sizeof(h), h);
+	if (n < 52)
+		return false;
+	bool is64 = h[4] == 2;
+	// the 64-bit header is bigger
+	if (is64 && n < 64)
+		return false;
+	bool be = h[5] == 2;
+	auto U16 = [be](const uint8_t* p) -> uint64_t { return be ? GetBE16(p) : GetLE16(p); };
+	auto U32 = [be](const uint8_t* p) -> uint64_t { return be ? GetBE32(p) : GetLE32(p); };
+	auto Addr = [be, is64](const uint8_t* p) -> uint64_t { return is64 ? (be ? GetBE64(p) : GetLE64(p)) : (be ? GetBE32(p) : GetLE32(p)); };
+
+	unsigned type = unsigned(U16(h + 16));
+	unsigned machine = unsigned(U16(h + 18));
+	size_t a = is64 ? 8 : 4;
+	uint64_t phoff = Addr(h + 24 + a);
+	uint64_t shoff = Addr(h + 24 + a * 2);
+	const uint8_t* p = h + 24 + a * 3 + 4; // after e_flags
+	uint64_t ehsize = U16(p);
+	uint64_t phentsize = U16(p + 2);
+	uint64_t phnum = U16(p + 4);
+	uint64_t shentsize = U16(p + 6);
+	uint64_t shnum = U16(p + 8);
+	if (ehsize < (is64 ? 64U : 52U) || type > 4 || phentsize > 256 || shentsize > 256)
+		return false;
+
+	static const char* typeNames[] = { "none", "relocatable", "executable", "shared object", "core dump" };
+	const char* machineName = GetELFMachineName(machine);
+	fi.desc.add(ui::Format("ELF%s %s, %s endian, %s", is64 ? "64" : "32", typeNames[type], be ? "big" : "little",
+		machineName ? machineName : ui::Format("machine %u", machine).c_str()));
+
+	// the end of the last of the headers, segments and sections
+	uint64_t end = ehsize;
+	if (phnum && phentsize >= (is64 ? 56U : 32U))
+	{
+		end = ui::max(end, phoff + phnum * phentsize);
+		std::vector<uint8_t> ph(size_t(phnum * phentsize));
+		if (ds->Read(off + phoff, ph.size(), ph.data()) < ph.size())
+			fi.err.add("truncated program headers");
+		for (uint64_t i = 0; i < phnum; i++)
+		{
+			const uint8_t* e = &ph[size_t(i * phentsize)];
+			uint64_t segOff = is64 ? Addr(e + 8) : U32(e + 4);
+			uint64_t segSize = is64 ? Addr(e + 32) : U32(e + 16);
+			end = ui::max(end, segOff + segSize);
+		}
+	}
+	if (shnum && shentsize >= (is64 ? 64U : 40U))
+	{
+		end = ui::max(end, shoff + shnum * shentsize);
+		std::vector<uint8_t> sh(size_t(shnum * shentsize));
+		if (ds->Read(off + shoff, sh.size(), sh.data()) < sh.size())
+			fi.err.add("truncated section headers");
+		for (uint64_t i = 0; i < shnum; i++)
+		{
+			const uint8_t* e = &sh[size_t(i * shentsize)];
+			if (U32(e + 4) == 8) // SHT_NOBITS
+				continue;
+			uint64_t secOff = is64 ? Addr(e + 24) : U32(e + 16);
+			uint64_t secSize = is64 ? Addr(e + 32) : U32(e + 20);
+			end = ui::max(end, secOff + secSize);
+		}
+	}
+	fi.size = end;
+	if (off + end > ds->GetSize())
+		fi.err.add("truncated");
+	return true;
+}
+
+static bool FileFormatDescFunc_BMP(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	uint8_t h[54];
+	size_t n = ds->Read(off, sizeof(h), h);
+	if (n < 26)
+		return false;
+	uint32_t fileSize = GetLE32(h + 2);
+	uint32_t dataOffset = GetLE32(h + 10);
+	uint32_t dibSize = GetLE32(h + 14);
+	// the other headers go at least up to the compression field
+	if (dibSize != 12 && n < 34)
+		return false;
+	int64_t width, height;
+	unsigned planes, bpp, compression = 0;
+	if (dibSize == 12)
+	{
+		width = GetLE16(h + 18);
+		height = GetLE16(h + 20);
+		planes = GetLE16(h + 22);
+		bpp = GetLE16(h + 24);
+	}
+	else
+	{
+		width = int32_t(GetLE32(h + 18));
+		height = int32_t(GetLE32(h + 22));
+		planes = GetLE16(h + 26);
+		bpp = GetLE16(h + 28);
+		compression = GetLE32(h + 30);
+	}
+	if (planes != 1 || width <= 0 || height == 0 || (bpp != 1 && bpp != 2 && bpp != 4 && bpp != 8 && bpp != 16 && bpp != 24 && bpp != 32 && bpp != 64))
+		return false;
+
+	fi.desc.add(ui::Format("BMP %" PRId64 "x%" PRId64 ", %u bits", width, height < 0 ? -height : height, bpp));
+	if (compression)
+		fi.desc.add(ui::Format("compression %u", compression));
+	// the size field is sometimes left at 0 for uncompressed images
+	if (fileSize)
+		fi.size = fileSize;
+	else if (compression == 0)
+		fi.size = dataOffset + (uint64_t(width) * bpp + 31) / 32 * 4 * uint64_t(height < 0 ? -height : height);
+	if (fi.size && fi.size < dataOffset)
+		return false;
+	if (off + fi.size > ds->GetSize())
+		fi.err.add("truncated");
+	return true;
+}
+
+static bool FileFormatDescFunc_TGA(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	uint8_t h[18];
+	if (ds->Read(off, sizeof(h), h) < sizeof(h))
+		return false;
+	unsigned type = h[2];
+	unsigned cmapLength = GetLE16(h + 5);
+	unsigned cmapBits = h[7];
+	unsigned width = GetLE16(h + 12);
+	unsigned height = GetLE16(h + 14);
+	unsigned bpp = h[16];
+	fi.desc.add(ui::Format("TGA %ux%u, %u bits, %s%s", width, height, bpp,
+		(type & 3) == 1 ? "color mapped" : (type & 3) == 2 ? "true color" : "grayscale",
+		type & 8 ? ", RLE" : ""));
+
+	uint64_t pixelBytes = (bpp + 7) / 8;
+	uint64_t pos = off + sizeof(h) + h[0] + uint64_t(cmapLength) * ((cmapBits + 7) / 8);
+	uint64_t numPixels = uint64_t(width) * height;
+	if (type & 8)
+	{
+		// each packet is a header byte with the count, followed by one pixel (repeated) or `count` pixels
+		FormatByteReader r(ds, pos);
+		for (uint64_t n = 0; n < numPixels;)
+		{
+			if (r.AtEnd())
+			{
+				fi.err.add("truncated");
+				return true;
+			}
+			uint8_t ph = r.NextByte();
+			unsigned count = (ph & 0x7f) + 1;
+			r.Skip(ph & 0x80 ? pixelBytes : pixelBytes * count);
+			n += count;
+		}
+		pos = r.GetPos();
+	}
+	else
+		pos += numPixels * pixelBytes;
+
+	// a TGA 2.0 footer right after the image
+	char footer[18];
+	if (ds->Read(pos + 8, sizeof(footer), footer) == sizeof(footer) && !memcmp(footer, "TRUEVISION-XFILE.", 18))
+		pos += 26;
+	fi.size = pos - off;
+	if (pos > ds->GetSize())
+		fi.err.add("truncated");
+	return true;
+}
+
+static bool FileFormatDescFunc_KTX(IDataSource* ds, uint64_t off, FileInfo& fi)
+{
+	uint8_t h[80];
+	size_t n = ds->Read(off, sizeof(h), h);
+	if (n < (h[5] == '1' ? 64U : 80U))
+		return false;
+
+	if (h[5] == '1')
+	{
+		uint32_t endianness = GetLE32(h + 12);
+		if (endianness != 0x04030201 && endianness != 0x01020304)
+			return false;
+		bool be = endianness == 0x01020304;
+		auto U32 = [be](const uint8_t* p) { return be ? GetBE32(p) : GetLE32(p); };
+		unsigned internalFormat = U32(h + 28);
+		unsigned width = U32(h + 36);
+		unsigned height = U32(h + 40);
+		unsigned depth = U32(h + 44);
+		unsigned arrayElements = U32(h + 48);
+		unsigned faces = U32(h + 52);
+		unsigned levels = ui::max(U32(h + 56), 1U);
+		uint32_t kvdSize = U32(h + 60);
+		fi.desc.add(ui::Format("KTX %ux%ux%u, %u levels, %u faces, internal format 0x%x", width, height, depth, levels, faces, internalFormat));
+
+		// each level starts with its size, then the data (of each face, for non-array cubemaps) padded to 4 bytes
+		uint64_t pos = off + 64 + kvdSize;
+		for (unsigned i = 0; i < levels && i < 32; i++)
+		{
+			uint8_t sz[4];
+			if (ds->Read(pos, 4, sz) < 4)
+			{
+				fi.err.add("truncated");
+				return true;
+			}
+			uint64_t imageSize = (uint64_t(U32(sz)) + 3) & ~uint64_t(3);
+			pos += 4 + (arrayElements == 0 && faces == 6 ? imageSize * 6 : imageSize);
+		}
+		fi.size = pos - off;
+	}
+	else
+	{
+		// KTX2 has an index of the levels and the other parts
+		unsigned vkFormat = GetLE32(h + 12);
+		unsigned levels = ui::max(GetLE32(h + 40), 1U);
+		fi.desc.add(ui::Format("KTX2 %ux%ux%u, %u levels, %u faces, VkFormat %u, supercompression %u",
+			unsigned(GetLE32(h + 20)), unsigned(GetLE32(h + 24)), unsigned(GetLE32(h + 28)),
+			levels, unsigned(GetLE32(h + 36)), vkFormat, unsigned(GetLE32(h + 44))));
+
+		uint64_t end = ui::max(uint64_t(GetLE32(h + 48)) + GetLE32(h + 52), uint64_t(GetLE32(h + 56)) + GetLE32(h + 60));
+		end = ui::max(end, GetLE64(h + 64) + GetLE64(h + 72));
+		std::vector<uint8_t> index(size_t(ui::min(levels, 32U)) * 24);
+		if (ds->Read(off + 80, index.size(), index.data()) < index.size())
+		{
+			fi.err.add("truncated");
+			return true;
+		}
+		for (size_t i = 0; i < index.size(); i += 24)
+			end = ui::max(end, GetLE64(&index[i]) + GetLE64(&index[i + 8]));
+		fi.size = end;
+	}
+	if (off + fi.size > ds->GetSize())
+		fi.err.add("truncated");
+	return true;
+}
+
+
+#define CHECK4(b, c0, c1, c2, c3) (b[0] == c0 && b[1] == c1 && b[2] == c2 && b[3] == c3)
+const FileFormatInfo g_formats[] =
+{
+	{ "DDS", ".dds", { 0x4444 }, 4, [](const char* b) { return CHECK4(b, 'D', 'D', 'S', ' '); }, FileFormatDescFunc_DDS },
+	{ "PNG", ".png", { 0x8950 }, 8, [](const char* b) { return !memcmp(b, "\x89PNG\r\n\x1a\n", 8); }, FileFormatDescFunc_PNG },
+	{ "RIFF", ".riff", { 0x5249 }, 12, [](const char* b)
+	{
+		return CHECK4(b, 'R', 'I', 'F', 'F') && IsFourCCChar(b[8]) && IsFourCCChar(b[9]) && IsFourCCChar(b[10]) && IsFourCCChar(b[11]);
+	}, FileFormatDescFunc_RIFF },
+	// only the first page of a stream
+	{ "OGG", ".ogg", { 0x4f67 }, 6, [](const char* b) { return CHECK4(b, 'O', 'g', 'g', 'S') && b[4] == 0 && (uint8_t(b[5]) & 0xf9) == 0 && (b[5] & 2); }, FileFormatDescFunc_OGG },
+	// the usual 32 KB window (the header checksum makes the second byte one of these for each compression level)
+	{ "zlib", ".zlib", { 0x7801, 0x785e, 0x789c, 0x78da }, 3, [](const char* b) { return ((uint8_t(b[2]) >> 1) & 3) != 3; }, FileFormatDescFunc_Zlib },
+	{ "gzip", ".gz", { 0x1f8b }, 4, [](const char* b) { return b[2] == 8 && (uint8_t(b[3]) & 0xe0) == 0; }, FileFormatDescFunc_Gzip },
+	// the local file headers of each entry
+	{ "ZIP", ".zip", { 0x504b }, 30, [](const char* b)
+	{
+		uint16_t nameLen = GetLE16((const uint8_t*)b + 26);
+		return CHECK4(b, 'P', 'K', 3, 4) && uint8_t(b[4]) <= 63 && b[5] == 0 && nameLen > 0 && nameLen <= 1024;
+	}, FileFormatDescFunc_ZIP },
+	{ "ELF", ".elf", { 0x7f45 }, 16, [](const char* b)
+	{
+		static const char zeroes[7] = {};
+		return CHECK4(b, 0x7f, 'E', 'L', 'F') && (b[4] == 1 || b[4] == 2) && (b[5] == 1 || b[5] == 2) && b[6] == 1 && !memcmp(b + 9, zeroes, 7);
+	}, FileFormatDescFunc_ELF },
+	{ "BMP", ".bmp", { 0x424d }, 18, [](const char* b)
+	{
+		auto* u = (const uint8_t*)b;
+		uint32_t dibSize = GetLE32(u + 14);
+		uint32_t dataOffset = GetLE32(u + 10);
+		return GetLE32(u + 6) == 0 && dataOffset >= 14 + dibSize && dataOffset < 0x10000 &&
+			(dibSize == 12 || dibSize == 40 || dibSize == 52 || dibSize == 56 || dibSize == 108 || dibSize == 124);
+	}, FileFormatDescFunc_BMP },
+	// there's no signature, so it's only a guess from the header values, and only without an image ID
+	{ "TGA", ".tga", { 0x0000, 0x0001 }, 18, [](const char* b)
+	{
+		auto* u = (const uint8_t*)b;
+		unsigned type = u[2];
+		unsigned bpp = u[16];
+		bool colorMapped = (type & ~8U) == 1;
+		if (u[1] != (colorMapped ? 1 : 0))
+			return false;
+		if (colorMapped)
+		{
+			if (GetLE16(u + 5) == 0 || (u[7] != 15 && u[7] != 16 && u[7] != 24 && u[7] != 32) || (bpp != 8 && bpp != 16))
+				return false;
+		}
+		else if ((type & ~8U) == 2)
+		{
+			if (bpp != 15 && bpp != 16 && bpp != 24 && bpp != 32)
+				return false;
+		}
+		else if ((type & ~8U) == 3)
+		{
+			if (bpp != 8 && bpp != 16)
+				return false;
+		}
+		else
+			return false;
+		// the origin is almost always 0, the reserved descriptor bits must be
+		return (colorMapped || GetLE32(u + 3) == 0) && GetLE32(u + 8) == 0 &&
+			GetLE16(u + 12) != 0 && GetLE16(u + 14) != 0 && (u[17] & 0xc0) == 0 && (u[17] & 0xf) <= 8;
+	}, FileFormatDescFunc_TGA },
+	{ "KTX", ".ktx", { 0xab4b }, 12, [](const char* b)
+	{
+		return !memcmp(b, "\xabKTX 11\xbb\r\n\x1a\n", 12) || !memcmp(b, "\xabKTX 20\xbb\r\n\x1a\n", 12);
+	}, FileFormatDescFunc_KTX },
+};
+const size_t g_numFormats = sizeof(g_formats) / sizeof(g_formats[0]);
+
+
+void FileFormatDispatcher::Build(uint32_t formatMask)
+{
+	_start.assign(0x10001, 0);
+	_formats.clear();
+	_minPrefixBytes = SIZE_MAX;
+	_maxPrefixBytes = 0;
+
+	// counted first, then placed at the end of each list (which keeps them in the same order as g_formats)
+	for (size_t i = 0; i < g_numFormats; i++)
+	{
+		if (!(formatMask & (1U << i)))
+			continue;
+		const auto& F = g_formats[i];
+		for (uint16_t v : F.firstBytes)
+			_start[v + 1]++;
+		_minPrefixBytes = ui::min(_minPrefixBytes, F.prefixBytes);
+		_maxPrefixBytes = ui::max(_maxPrefixBytes, F.prefixBytes);
+	}
+	for (size_t v = 0; v < 0x10000; v++)
+		_start[v + 1] += _start[v];
+	_formats.resize(_start[0x10000]);
+
+	std::vector<uint16_t> next(_start.begin(), _start.end() - 1);
+	for (size_t i = 0; i < g_numFormats; i++)
+	{
+		if (!(formatMask & (1U << i)))
+			continue;
+		for (uint16_t v : g_formats[i].firstBytes)
+			_formats[next[v]++] = uint8_t(i);
+	}
+	if (_maxPrefixBytes == 0)
+		_minPrefixBytes = 0;
+}
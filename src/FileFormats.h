@@ -0,0 +1,67 @@
+#pragma once
+#include "pch.h"
+#include "FileReaders.h"
+
+
+struct CSString : std::string
+{
+	void add(const std::string& s)
+	{
+		if (!empty())
+			*this += ", ";
+		*this += s;
+	}
+};
+
+struct FileInfo
+{
+	CSString desc;
+	CSString misc;
+	CSString err;
+	// of the whole file (from the headers), 0 if it's not known
+	uint64_t size = 0;
+	// of the decoded data if the whole file is a compressed stream, 0 if it's not known
+	uint64_t decompressedSize = 0;
+};
+
+// checks the first `prefixBytes` bytes (which must be enough to rule out most of the data that only has the first two)
+typedef bool FileFormatCheckFunc(const char* bytes);
+// describes the file at `off` and finds its size, returns false if the headers show that it's not one after all
+typedef bool FileFormatDescFunc(IDataSource* ds, uint64_t off, FileInfo& fi);
+struct FileFormatInfo
+{
+	const char* name;
+	const char* ext;
+	// every file of this format starts with one of these (first byte << 8 | second byte)
+	std::vector<uint16_t> firstBytes;
+	size_t prefixBytes;
+	FileFormatCheckFunc* checkFunc;
+	FileFormatDescFunc* descFunc;
+};
+
+extern const FileFormatInfo g_formats[];
+extern const size_t g_numFormats;
+
+// the formats to check for each value of the first two bytes, so that a position costs one lookup
+// (and usually nothing more) no matter how many formats there are
+struct FileFormatDispatcher
+{
+	// only includes the formats with their bit set in `formatMask`
+	void Build(uint32_t formatMask);
+	bool IsEmpty() const { return _maxPrefixBytes == 0; }
+	size_t GetMinPrefixBytes() const { return _minPrefixBytes; }
+	size_t GetMaxPrefixBytes() const { return _maxPrefixBytes; }
+
+	// the indices (in g_formats) of the formats that can start with the two bytes
+	UI_FORCEINLINE const uint8_t* GetCandidates(const char* bytes, size_t& count) const
+	{
+		unsigned v = (unsigned(uint8_t(bytes[0])) << 8) | uint8_t(bytes[1]);
+		count = _start[v + 1] - _start[v];
+		return _formats.data() + _start[v];
+	}
+
+	std::vector<uint16_t> _start; // first bytes -> the first of its formats in _formats, one more than the values
+	std::vector<uint8_t> _formats;
+	size_t _minPrefixBytes = 0;
+	size_t _maxPrefixBytes = 0;
+};
@@ -1,7 +1,245 @@
 
 #include "pch.h"
 #include "FileReaders.h"
+#include "BulkFileReader.h"
 
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  define NOMINMAX
+#  include <windows.h>
+#  include <io.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#  include <errno.h>
+#endif
+
+
+size_t ReadFileAt(FILE* fp, uint64_t at, size_t size, void* out)
+{
+	// positional reads don't touch a shared file cursor so they're safe to do from multiple threads
+	size_t rd = 0;
+#ifdef _WIN32
+	HANDLE fh = (HANDLE)_get_osfhandle(_fileno(fp));
+	while (rd < size)
+	{
+		OVERLAPPED ov = {};
+		uint64_t pos = at + rd;
+		ov.Offset = DWORD(pos);
+		ov.OffsetHigh = DWORD(pos >> 32);
+		DWORD toRead = DWORD(std::min(size - rd, size_t(1) << 30));
+		DWORD numRead = 0;
+		if (!::ReadFile(fh, (char*)out + rd, toRead, &numRead, &ov) || numRead == 0)
+			break;
+		rd += numRead;
+	}
+#else
+	int fd = fileno(fp);
+	while (rd < size)
+	{
+		ssize_t numRead = pread(fd, (char*)out + rd, size - rd, off_t(at + rd));
+		if (numRead < 0 && errno == EINTR)
+			continue;
+		if (numRead <= 0)
+			break;
+		rd += size_t(numRead);
+	}
+#endif
+	return rd;
+}
+
+bool GetFileStamp(const char* path, uint64_t& size, uint64_t& mtime)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &info))
+		return false;
+	size = (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+	mtime = (uint64_t(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+	size = uint64_t(st.st_size);
+	mtime = uint64_t(st.st_mtime);
+#endif
+	return true;
+}
+
+bool IsSameFile(const char* a, const char* b)
+{
+#ifdef _WIN32
+	BY_HANDLE_FILE_INFORMATION info[2];
+	const char* paths[2] = { a, b };
+	for (int i = 0; i < 2; i++)
+	{
+		HANDLE fh = CreateFileA(paths[i], 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+		if (fh == INVALID_HANDLE_VALUE)
+			return false;
+		BOOL ok = GetFileInformationByHandle(fh, &info[i]);
+		CloseHandle(fh);
+		if (!ok)
+			return false;
+	}
+	return info[0].dwVolumeSerialNumber == info[1].dwVolumeSerialNumber &&
+		info[0].nFileIndexHigh == info[1].nFileIndexHigh &&
+		info[0].nFileIndexLow == info[1].nFileIndexLow;
+#else
+	struct stat sa, sb;
+	if (stat(a, &sa) != 0 || stat(b, &sb) != 0)
+		return false;
+	return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+
+DataSpan IDataSource::ViewOrRead(uint64_t at, size_t size, void* buf)
+{
+	DataSpan view = GetView(at, size);
+	if (view.data && view.size == size)
+		return view;
+
+	DataSpan ret;
+	ret.data = buf;
+	ret.size = Read(at, size, buf);
+	return ret;
+}
+
+static const size_t MAX_MERGED_READ = 1024 * 1024;
+static const size_t MAX_MERGE_GAP = 4096;
+// reads this big are streaming-sized and go around the cache so that scans don't evict everything
+static const size_t MAX_CACHED_READ = MAX_MERGED_READ;
+
+static bool IsDenseStride(uint64_t stride, size_t elemSize)
+{
+	return stride <= elemSize * 4 || stride <= 64;
+}
+
+// copies elements out of contiguous memory, zero-filling the ones that are (partially) past `avail`
+static void GatherStrided(const char* src, size_t avail, uint64_t stride, size_t count, size_t elemSize, char* out)
+{
+	for (size_t i = 0; i < count; i++, out += elemSize)
+	{
+		uint64_t off = i * stride;
+		if (off + elemSize <= avail)
+		{
+			memcpy(out, src + off, elemSize);
+			continue;
+		}
+		size_t nc = off < avail ? avail - off : 0;
+		memcpy(out, src + off, nc);
+		memset(out + nc, 0, elemSize - nc);
+	}
+}
+
+// serves the requests in offset order, reading runs of nearby ranges with a single call
+// (the runs are handed to `bulk` all at once if there is one, so they can be in flight together)
+static void ReadManyMerged(IDataSource* src, DataReadRequest* reqs, size_t count, IBulkFileReader* bulk = nullptr)
+{
+	std::vector<DataReadRequest*> order;
+	order.reserve(count);
+	for (size_t i = 0; i < count; i++)
+		order.push_back(&reqs[i]);
+	std::sort(order.begin(), order.end(), [](const DataReadRequest* a, const DataReadRequest* b) { return a->at < b->at; });
+
+	struct Run
+	{
+		size_t first, last;
+		size_t tmpOff;
+	};
+	std::vector<Run> runs;
+	std::vector<DataReadRequest> runReqs;
+	size_t tmpSize = 0;
+	for (size_t i = 0; i < count;)
+	{
+		uint64_t runStart = order[i]->at;
+		uint64_t runEnd = runStart + order[i]->size;
+		size_t j = i + 1;
+		for (; j < count; j++)
+		{
+			const auto* R = order[j];
+			if (R->at > runEnd + MAX_MERGE_GAP)
+				break;
+			uint64_t newEnd = std::max(runEnd, R->at + R->size);
+			if (newEnd - runStart > MAX_MERGED_READ)
+				break;
+			runEnd = newEnd;
+		}
+
+		// single requests are read directly into their destination
+		runs.push_back({ i, j, j == i + 1 ? SIZE_MAX : tmpSize });
+		runReqs.push_back({ runStart, size_t(runEnd - runStart), order[i]->out });
+		if (j != i + 1)
+			tmpSize += size_t(runEnd - runStart);
+		i = j;
+	}
+
+	std::vector<char> tmp(tmpSize);
+	for (size_t r = 0; r < runs.size(); r++)
+		if (runs[r].tmpOff != SIZE_MAX)
+			runReqs[r].out = &tmp[runs[r].tmpOff];
+
+	if (bulk)
+		bulk->ReadAll(runReqs.data(), runReqs.size());
+	else
+	{
+		for (auto& R : runReqs)
+			src->Read(R.at, R.size, R.out);
+	}
+
+	for (size_t r = 0; r < runs.size(); r++)
+	{
+		if (runs[r].tmpOff == SIZE_MAX)
+			continue;
+		for (size_t k = runs[r].first; k < runs[r].last; k++)
+			memcpy(order[k]->out, &tmp[runs[r].tmpOff + size_t(order[k]->at - runReqs[r].at)], order[k]->size);
+	}
+}
+
+static void ReadStridedFromView(DataSpan view, uint64_t stride, size_t count, size_t elemSize, void* out)
+{
+	GatherStrided((const char*)view.data, view.size, stride, count, elemSize, (char*)out);
+}
+
+
+void IDataSource::ReadMany(DataReadRequest* reqs, size_t count)
+{
+	ReadManyMerged(this, reqs, count);
+}
+
+void IDataSource::ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out)
+{
+	if (!count || !elemSize)
+		return;
+
+	char* dst = (char*)out;
+	if (IsDenseStride(stride, elemSize))
+	{
+		// read whole runs of elements at once and pick them out
+		size_t perChunk = stride ? size_t(std::max(MAX_MERGED_READ / stride, uint64_t(1))) : count;
+		std::vector<char> tmp;
+		for (size_t i = 0; i < count; i += perChunk)
+		{
+			size_t n = std::min(perChunk, count - i);
+			size_t span = size_t((n - 1) * stride + elemSize);
+			tmp.resize(span);
+			DataSpan data = ViewOrRead(at + i * stride, span, tmp.data());
+			GatherStrided((const char*)data.data, span, stride, n, elemSize, dst + i * elemSize);
+		}
+	}
+	else
+	{
+		DataReadRequest reqs[256];
+		for (size_t i = 0; i < count; i += 256)
+		{
+			size_t n = std::min(count - i, size_t(256));
+			for (size_t j = 0; j < n; j++)
+				reqs[j] = { at + (i + j) * stride, elemSize, dst + (i + j) * elemSize };
+			ReadMany(reqs, n);
+		}
+	}
+}
 
 void IDataSource::GetASCIIText(char* buf, size_t bufsz, uint64_t pos, char fallback)
 {
@@ -86,6 +324,7 @@ void IDataSource::GetFloat64Text(char* buf, size_t bufsz, uint64_t pos, Endianne
 
 MemoryDataSource::MemoryDataSource(void* mem, size_t size, bool own) : _mem(mem), _size(size), _own(own)
 {
+	_ioStats.type = "memory";
 }
 
 MemoryDataSource::~MemoryDataSource()
@@ -96,6 +335,7 @@ MemoryDataSource::~MemoryDataSource()
 
 size_t MemoryDataSource::Read(uint64_t at, size_t size, void* out)
 {
+	IOStatsScope ios(_ioStats, at, size);
 	size_t from = std::min(at, uint64_t(_size));
 	size_t end = std::min(at + size, uint64_t(_size));
 	size_t nw = end - from;
@@ -110,38 +350,113 @@ uint64_t MemoryDataSource::GetSize()
 	return _size;
 }
 
+DataSpan MemoryDataSource::GetView(uint64_t at, size_t size)
+{
+	size_t from = std::min(at, uint64_t(_size));
+	size_t end = std::min(at + size, uint64_t(_size));
+	return { (char*)_mem + from, end - from };
+}
+
+void MemoryDataSource::ReadMany(DataReadRequest* reqs, size_t count)
+{
+	IOStatsScope ios(_ioStats, reqs, count);
+	for (size_t i = 0; i < count; i++)
+		Read(reqs[i].at, reqs[i].size, reqs[i].out);
+}
+
+void MemoryDataSource::ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out)
+{
+	IOStatsScope ios(_ioStats, at, at + stride * count, count * elemSize);
+	if (!count)
+		return;
+	ReadStridedFromView(GetView(at, size_t((count - 1) * stride + elemSize)), stride, count, elemSize, out);
+}
+
 
 FileDataSource::FileDataSource(const char* path)
 {
+	_ioStats.type = "file";
+	_ioStats.desc = path;
 	_fp = fopen(path, "rb");
 	if (_fp)
 	{
 		_fseeki64(_fp, 0, SEEK_END);
 		_size = _ftelli64(_fp);
 		_fseeki64(_fp, 0, SEEK_SET);
+		_MapFile();
 	}
 }
 
 FileDataSource::~FileDataSource()
 {
+	delete _bulkReader;
+	_UnmapFile();
 	if (_fp)
 		fclose(_fp);
 }
 
+bool FileDataSource::_MapFile()
+{
+	// mapping a multi-GB file would exhaust the address space of a 32-bit process
+	if (sizeof(void*) < 8 || _size == 0 || _size > SIZE_MAX)
+		return false;
+	if (_size > g_maxMappedFileSize)
+		return false;
+
+#ifdef _WIN32
+	HANDLE fh = (HANDLE)_get_osfhandle(_fileno(_fp));
+	if (fh == INVALID_HANDLE_VALUE || GetFileType(fh) != FILE_TYPE_DISK)
+		return false;
+	HANDLE mh = CreateFileMappingA(fh, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mh)
+		return false;
+	void* mem = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+	if (!mem)
+	{
+		CloseHandle(mh);
+		return false;
+	}
+	_mapHandle = mh;
+#else
+	void* mem = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fileno(_fp), 0);
+	if (mem == MAP_FAILED)
+		return false;
+#endif
+	_mapped = (const char*)mem;
+	return true;
+}
+
+void FileDataSource::_UnmapFile()
+{
+	if (!_mapped)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(_mapped);
+	CloseHandle(_mapHandle);
+	_mapHandle = nullptr;
+#else
+	munmap((void*)_mapped, _size);
+#endif
+	_mapped = nullptr;
+}
+
 size_t FileDataSource::Read(uint64_t at, size_t size, void* out)
 {
+	IOStatsScope ios(_ioStats, at, size);
+	if (_mapped)
+	{
+		DataSpan view = GetView(at, size);
+		memcpy(out, view.data, view.size);
+		if (view.size < size)
+			memset((char*)out + view.size, 0, size - view.size);
+		return view.size;
+	}
+
 	size_t rd = 0;
-	if (_fp)
+	if (_fp && at < _size)
 	{
-		if (_pos != at)
-		{
-			if (at > _size)
-				at = _size;
-			if (!_fseeki64(_fp, at, SEEK_SET))
-				_pos = at;
-		}
-		rd = fread(out, 1, size, _fp);
-		_pos += rd;
+		size_t toRead = size_t(std::min(uint64_t(size), _size - at));
+		rd = ReadFileAt(_fp, at, toRead, out);
 	}
 	if (rd < size)
 		memset((char*)out + rd, 0, size - rd);
@@ -153,14 +468,280 @@ uint64_t FileDataSource::GetSize()
 	return _size;
 }
 
+DataSpan FileDataSource::GetView(uint64_t at, size_t size)
+{
+	if (!_mapped)
+		return {};
+	uint64_t from = std::min(at, _size);
+	uint64_t end = std::min(from + size, _size);
+	return { _mapped + from, size_t(end - from) };
+}
+
+void FileDataSource::ReadMany(DataReadRequest* reqs, size_t count)
+{
+	IOStatsScope ios(_ioStats, reqs, count);
+	if (_mapped)
+	{
+		for (size_t i = 0; i < count; i++)
+			Read(reqs[i].at, reqs[i].size, reqs[i].out);
+	}
+	else
+		ReadManyMerged(this, reqs, count, _GetBulkReader());
+}
+
+IBulkFileReader* FileDataSource::_GetBulkReader()
+{
+	if (!_fp)
+		return nullptr;
+	std::call_once(_bulkReaderOnce, [this]() { _bulkReader = CreateBulkFileReader(_fp); });
+	return _bulkReader;
+}
+
+void FileDataSource::ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out)
+{
+	IOStatsScope ios(_ioStats, at, at + stride * count, count * elemSize);
+	if (_mapped && count)
+		ReadStridedFromView(GetView(at, size_t((count - 1) * stride + elemSize)), stride, count, elemSize, out);
+	else
+		IDataSource::ReadStrided(at, stride, count, elemSize, out);
+}
+
 FileDataSource* GetFileDataSource(const char* path)
 {
 	return new FileDataSource(path);
 }
 
 
+size_t g_dataCacheBlockSize = 64 * 1024;
+size_t g_dataCacheMemoryBudget = 64 * 1024 * 1024;
+uint64_t g_maxMappedFileSize = 1024 * 1024 * 1024;
+
+CachedDataSource::CachedDataSource(IDataSource* src, size_t blockSize, size_t memoryBudget) :
+	_src(src),
+	_size(src->GetSize()),
+	_blockSize(blockSize)
+{
+	_ioStats.type = "cache";
+	SetMemoryBudget(memoryBudget);
+}
+
+CachedDataSource::~CachedDataSource()
+{
+}
+
+size_t CachedDataSource::Read(uint64_t at, size_t size, void* out)
+{
+	IOStatsScope ios(_ioStats, at, size);
+	std::unique_lock<std::mutex> lock(_mutex);
+	return _ReadLocked(lock, at, size, out);
+}
+
+size_t CachedDataSource::_ReadLocked(std::unique_lock<std::mutex>& lock, uint64_t at, size_t size, void* out)
+{
+	size_t nw = 0;
+	if (at < _size)
+	{
+		size_t toRead = std::min(uint64_t(size), _size - at);
+
+		// don't let huge reads wipe out the entire cache
+		if (toRead >= MAX_CACHED_READ)
+		{
+			lock.unlock();
+			nw = _src->Read(at, toRead, out);
+			lock.lock();
+			_stats.misses++;
+			_stats.bytesRead += nw;
+		}
+		else
+		{
+			while (nw < toRead)
+			{
+				uint64_t pos = at + nw;
+				size_t blkSize = 0;
+				// the block can only be evicted once the lock is released again, so it's copied right away
+				char* blk = _GetBlock(lock, pos / _blockSize, blkSize);
+				size_t blkOff = pos % _blockSize;
+				if (blkOff >= blkSize)
+					break;
+				size_t ncopy = std::min(toRead - nw, blkSize - blkOff);
+				memcpy((char*)out + nw, blk + blkOff, ncopy);
+				nw += ncopy;
+			}
+		}
+	}
+	if (nw < size)
+		memset((char*)out + nw, 0, size - nw);
+	return nw;
+}
+
+uint64_t CachedDataSource::GetSize()
+{
+	return _size;
+}
+
+DataSpan CachedDataSource::GetView(uint64_t at, size_t size)
+{
+	// cached blocks can be evicted at any time so only the source's own views are stable
+	return _src->GetView(at, size);
+}
+
+void CachedDataSource::ReadMany(DataReadRequest* reqs, size_t count)
+{
+	IOStatsScope ios(_ioStats, reqs, count);
+	std::vector<DataReadRequest*> order;
+	order.reserve(count);
+	for (size_t i = 0; i < count; i++)
+		order.push_back(&reqs[i]);
+	std::sort(order.begin(), order.end(), [](const DataReadRequest* a, const DataReadRequest* b) { return a->at < b->at; });
+
+	// streaming-sized pieces don't go through the cache so that scans don't evict everything
+	size_t numSmall = std::stable_partition(order.begin(), order.end(), [](const DataReadRequest* R) { return R->size < MAX_CACHED_READ; }) - order.begin();
+	if (numSmall < count)
+	{
+		std::vector<DataReadRequest> big;
+		for (size_t i = numSmall; i < count; i++)
+			big.push_back(*order[i]);
+		_src->ReadMany(big.data(), big.size());
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto& R : big)
+		{
+			_stats.misses++;
+			_stats.bytesRead += R.at < _size ? std::min(uint64_t(R.size), _size - R.at) : 0;
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	for (size_t i = 0; i < numSmall; i++)
+		_ReadLocked(lock, order[i]->at, order[i]->size, order[i]->out);
+}
+
+void CachedDataSource::ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out)
+{
+	IOStatsScope ios(_ioStats, at, at + stride * count, count * elemSize);
+	if (IsDenseStride(stride, elemSize))
+		return IDataSource::ReadStrided(at, stride, count, elemSize, out);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	for (size_t i = 0; i < count; i++)
+		_ReadLocked(lock, at + i * stride, elemSize, (char*)out + i * elemSize);
+}
+
+bool CachedDataSource::GetCacheStats(DataCacheStats& out)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	out = _stats;
+	out.blockSize = _blockSize;
+	out.memoryBudget = _maxBlocks * _blockSize;
+	out.memoryUsed = _blockMap.size() * _blockSize;
+	return true;
+}
+
+void CachedDataSource::SetMemoryBudget(size_t bytes)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_Clear(lock);
+	_maxBlocks = std::max(bytes / _blockSize, size_t(4));
+	_blocks.resize(_maxBlocks);
+	_memory.resize(_maxBlocks * _blockSize);
+}
+
+void CachedDataSource::Clear()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_Clear(lock);
+}
+
+void CachedDataSource::_Clear(std::unique_lock<std::mutex>& lock)
+{
+	// the blocks being loaded are written to outside the lock
+	_loadedCond.wait(lock, [this]() { return _numLoading == 0; });
+	for (auto& B : _blocks)
+		B = {};
+	_blockMap.clear();
+	_clockHand = 0;
+}
+
+char* CachedDataSource::_GetBlock(std::unique_lock<std::mutex>& lock, uint64_t index, size_t& outSize)
+{
+	for (;;)
+	{
+		auto it = _blockMap.find(index);
+		if (it == _blockMap.end())
+			break;
+		auto& B = _blocks[it->second];
+		if (B.loading)
+		{
+			// another thread is reading it, the slot may be reused by the time it's done so look it up again
+			_loadedCond.wait(lock);
+			continue;
+		}
+		B.referenced = true;
+		_stats.hits++;
+		outSize = B.size;
+		return &_memory[it->second * _blockSize];
+	}
+
+	// CLOCK: skip (and clear) recently used blocks
+	size_t slot;
+	for (size_t n = 0;; n++)
+	{
+		// two full rounds without a candidate means that all of them are being loaded
+		if (n == _maxBlocks * 2)
+		{
+			_loadedCond.wait(lock);
+			return _GetBlock(lock, index, outSize);
+		}
+		slot = _clockHand;
+		_clockHand = (_clockHand + 1) % _maxBlocks;
+		if (_blocks[slot].loading)
+			continue;
+		if (!_blocks[slot].referenced)
+			break;
+		_blocks[slot].referenced = false;
+	}
+
+	auto& B = _blocks[slot];
+	if (B.index != UINT64_MAX)
+		_blockMap.erase(B.index);
+	B.index = index;
+	B.size = 0;
+	B.loading = true;
+	_blockMap[index] = slot;
+	_numLoading++;
+
+	// other threads can keep using the rest of the cache in the meantime
+	char* mem = &_memory[slot * _blockSize];
+	lock.unlock();
+	size_t size = _src->Read(index * _blockSize, _blockSize, mem);
+	lock.lock();
+
+	B.size = size;
+	B.loading = false;
+	B.referenced = true;
+	_numLoading--;
+	_loadedCond.notify_all();
+
+	_stats.misses++;
+	_stats.bytesRead += size;
+	outSize = size;
+	return mem;
+}
+
+IDataSource* OpenFileDataSource(const char* path)
+{
+	auto* fds = GetFileDataSource(path);
+	// the OS already caches mapped pages for us
+	if (fds->_mapped)
+		return fds;
+	return new CachedDataSource(fds, g_dataCacheBlockSize, g_dataCacheMemoryBudget);
+}
+
+
 SliceDataSource::SliceDataSource(IDataSource* src, uint64_t off, uint64_t size) : _src(src), _off(off), _size(size)
 {
+	_ioStats.type = "slice";
+	_ioStats.desc = ui::Format("%" PRIu64 "-%" PRIu64, off, off + size);
 }
 
 SliceDataSource::~SliceDataSource()
@@ -169,6 +750,7 @@ SliceDataSource::~SliceDataSource()
 
 size_t SliceDataSource::Read(uint64_t at, size_t size, void* out)
 {
+	IOStatsScope ios(_ioStats, at, size);
 	auto from = std::min(at, _size);
 	auto end = std::min(from + size, _size);
 	size_t nw = _src->Read(from + _off, end - from, out);
@@ -182,10 +764,682 @@ uint64_t SliceDataSource::GetSize()
 	return _size;
 }
 
+DataSpan SliceDataSource::GetView(uint64_t at, size_t size)
+{
+	auto from = std::min(at, _size);
+	auto end = std::min(from + size, _size);
+	return _src->GetView(from + _off, end - from);
+}
+
+void SliceDataSource::ReadMany(DataReadRequest* reqs, size_t count)
+{
+	IOStatsScope ios(_ioStats, reqs, count);
+	std::vector<DataReadRequest> fwd;
+	fwd.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		auto& R = reqs[i];
+		auto from = std::min(R.at, _size);
+		auto end = std::min(from + R.size, _size);
+		size_t nr = size_t(end - from);
+		if (nr < R.size)
+			memset((char*)R.out + nr, 0, R.size - nr);
+		if (nr)
+			fwd.push_back({ from + _off, nr, R.out });
+	}
+	_src->ReadMany(fwd.data(), fwd.size());
+}
+
+void SliceDataSource::ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out)
+{
+	IOStatsScope ios(_ioStats, at, at + stride * count, count * elemSize);
+	if (!count)
+		return;
+	uint64_t end = at + (count - 1) * stride + elemSize;
+	if (end <= _size)
+		_src->ReadStrided(at + _off, stride, count, elemSize, out);
+	else
+		IDataSource::ReadStrided(at, stride, count, elemSize, out);
+}
+
 
 IDataSource* GetSlice(IDataSource* src, uint64_t off, uint64_t size)
 {
-	if (off == 0 && size >= src->GetSize())
+	// the size of the whole source isn't needed when it's taken as is
+	if (off == 0 && (size == UINT64_MAX || size >= src->GetSize()))
 		return src;
 	return new SliceDataSource(src, off, size);
 }
+
+
+ConcatDataSource::ConcatDataSource(IDataSource* const* parts, size_t count)
+{
+	_ioStats.type = "concat";
+	_ioStats.desc = ui::Format("%zu parts", count);
+	uint64_t pos = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		_parts.push_back(parts[i]);
+		_starts.push_back(pos);
+		pos += parts[i]->GetSize();
+	}
+	_starts.push_back(pos);
+}
+
+ConcatDataSource::~ConcatDataSource()
+{
+}
+
+size_t ConcatDataSource::_FindPart(uint64_t at)
+{
+	// the last part that starts at or before `at` (empty parts are skipped by that)
+	return size_t(std::upper_bound(_starts.begin(), _starts.end() - 1, at) - _starts.begin()) - 1;
+}
+
+size_t ConcatDataSource::Read(uint64_t at, size_t size, void* out)
+{
+	IOStatsScope ios(_ioStats, at, size);
+	uint64_t total = _starts.back();
+	size_t toRead = at < total ? size_t(std::min(uint64_t(size), total - at)) : 0;
+	size_t nw = 0;
+	if (toRead)
+	{
+		for (size_t i = _FindPart(at); nw < toRead; i++)
+		{
+			uint64_t pos = at + nw;
+			size_t n = size_t(std::min(uint64_t(toRead - nw), _starts[i + 1] - pos));
+			_parts[i]->Read(pos - _starts[i], n, (char*)out + nw);
+			nw += n;
+		}
+	}
+	if (nw < size)
+		memset((char*)out + nw, 0, size - nw);
+	return nw;
+}
+
+uint64_t ConcatDataSource::GetSize()
+{
+	return _starts.back();
+}
+
+DataSpan ConcatDataSource::GetView(uint64_t at, size_t size)
+{
+	if (at >= _starts.back())
+		return {};
+	size_t i = _FindPart(at);
+	uint64_t end = std::min(at + size, _starts.back());
+	if (end > _starts[i + 1])
+		return {}; // the parts aren't contiguous in memory
+	return _parts[i]->GetView(at - _starts[i], size_t(end - at));
+}
+
+void ConcatDataSource::ReadMany(DataReadRequest* reqs, size_t count)
+{
+	IOStatsScope ios(_ioStats, reqs, count);
+	// split at part boundaries and forward each part's requests together
+	std::vector<std::vector<DataReadRequest>> perPart(_parts.size());
+	uint64_t total = _starts.back();
+	for (size_t r = 0; r < count; r++)
+	{
+		auto& R = reqs[r];
+		size_t toRead = R.at < total ? size_t(std::min(uint64_t(R.size), total - R.at)) : 0;
+		if (toRead < R.size)
+			memset((char*)R.out + toRead, 0, R.size - toRead);
+		size_t nw = 0;
+		for (size_t i = toRead ? _FindPart(R.at) : 0; nw < toRead; i++)
+		{
+			uint64_t pos = R.at + nw;
+			size_t n = size_t(std::min(uint64_t(toRead - nw), _starts[i + 1] - pos));
+			perPart[i].push_back({ pos - _starts[i], n, (char*)R.out + nw });
+			nw += n;
+		}
+	}
+	for (size_t i = 0; i < _parts.size(); i++)
+		if (!perPart[i].empty())
+			_parts[i]->ReadMany(perPart[i].data(), perPart[i].size());
+}
+
+void ConcatDataSource::ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out)
+{
+	IOStatsScope ios(_ioStats, at, at + stride * count, count * elemSize);
+	if (!count)
+		return;
+	uint64_t end = at + (count - 1) * stride + elemSize;
+	size_t i = at < _starts.back() ? _FindPart(at) : 0;
+	if (at < _starts.back() && end <= _starts[i + 1])
+		_parts[i]->ReadStrided(at - _starts[i], stride, count, elemSize, out);
+	else
+		IDataSource::ReadStrided(at, stride, count, elemSize, out);
+}
+
+bool ConcatDataSource::GetCacheStats(DataCacheStats& out)
+{
+	bool any = false;
+	DataCacheStats sum;
+	for (auto& P : _parts)
+	{
+		DataCacheStats cs;
+		if (!P->GetCacheStats(cs))
+			continue;
+		sum.hits += cs.hits;
+		sum.misses += cs.misses;
+		sum.bytesRead += cs.bytesRead;
+		sum.blockSize = cs.blockSize;
+		sum.memoryBudget += cs.memoryBudget;
+		sum.memoryUsed += cs.memoryUsed;
+		any = true;
+	}
+	if (any)
+		out = sum;
+	return any;
+}
+
+std::vector<std::string> FindNumberedFileParts(const std::string& path)
+{
+	std::vector<std::string> parts;
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos || dot + 1 == path.size() || path.find_first_of("/\\", dot) != std::string::npos)
+		return parts;
+	size_t numDigits = path.size() - dot - 1;
+	if (numDigits > 9 || path.find_first_not_of("0123456789", dot + 1) != std::string::npos)
+		return parts;
+
+	for (unsigned num = unsigned(atoi(path.c_str() + dot + 1)) + 1; ; num++)
+	{
+		char digits[16];
+		snprintf(digits, sizeof(digits), "%0*u", int(numDigits), num);
+		if (strlen(digits) != numDigits)
+			break;
+		std::string next = path.substr(0, dot + 1) + digits;
+		FILE* fp = fopen(next.c_str(), "rb");
+		if (!fp)
+			break;
+		fclose(fp);
+		parts.push_back(next);
+	}
+	return parts;
+}
+
+
+OverlayDataSource::OverlayDataSource(IDataSource* src) : _src(src)
+{
+	_ioStats.type = "overlay";
+}
+
+OverlayDataSource::~OverlayDataSource()
+{
+}
+
+size_t OverlayDataSource::Read(uint64_t at, size_t size, void* out)
+{
+	IOStatsScope ios(_ioStats, at, size);
+	uint64_t srcSize = GetSize();
+	size_t toRead = at < srcSize ? size_t(std::min(uint64_t(size), srcSize - at)) : 0;
+	if (toRead < size)
+		memset((char*)out + toRead, 0, size - toRead);
+	if (!toRead)
+		return 0;
+
+	// copy the edited bytes and collect the gaps, reading those after unlocking
+	std::vector<DataReadRequest> gaps;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_pieces.empty())
+			gaps.push_back({ at, toRead, out });
+		else
+		{
+			uint64_t end = at + toRead;
+			auto it = _pieces.upper_bound(at);
+			if (it != _pieces.begin() && std::prev(it)->first + std::prev(it)->second.size > at)
+				--it;
+			uint64_t pos = at;
+			for (; it != _pieces.end() && it->first < end; ++it)
+			{
+				if (it->first > pos)
+					gaps.push_back({ pos, size_t(it->first - pos), (char*)out + (pos - at) });
+				uint64_t from = std::max(pos, it->first);
+				uint64_t to = std::min(end, it->first + it->second.size);
+				memcpy((char*)out + (from - at), &_added[it->second.dataOff + size_t(from - it->first)], size_t(to - from));
+				pos = to;
+			}
+			if (pos < end)
+				gaps.push_back({ pos, size_t(end - pos), (char*)out + (pos - at) });
+		}
+	}
+	if (gaps.size() == 1)
+		_src->Read(gaps[0].at, gaps[0].size, gaps[0].out);
+	else if (!gaps.empty())
+		_src->ReadMany(gaps.data(), gaps.size());
+	return toRead;
+}
+
+uint64_t OverlayDataSource::GetSize()
+{
+	// only asked for when it's first needed, since finding it can take a full pass over the source (compressed data)
+	uint64_t size = _size;
+	if (size == UINT64_MAX)
+		_size = size = _src->GetSize();
+	return size;
+}
+
+DataSpan OverlayDataSource::GetView(uint64_t at, size_t size)
+{
+	// the source's views stay valid, they just can't be used over edits
+	if (_HasEditsIn(at, size))
+		return {};
+	return _src->GetView(at, size);
+}
+
+void OverlayDataSource::ReadMany(DataReadRequest* reqs, size_t count)
+{
+	IOStatsScope ios(_ioStats, reqs, count);
+	if (GetEditedRangeCount() == 0)
+		_src->ReadMany(reqs, count);
+	else
+		IDataSource::ReadMany(reqs, count);
+}
+
+void OverlayDataSource::ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out)
+{
+	IOStatsScope ios(_ioStats, at, at + stride * count, count * elemSize);
+	if (count && !_HasEditsIn(at, (count - 1) * stride + elemSize))
+		_src->ReadStrided(at, stride, count, elemSize, out);
+	else
+		IDataSource::ReadStrided(at, stride, count, elemSize, out);
+}
+
+bool OverlayDataSource::GetCacheStats(DataCacheStats& out)
+{
+	return _src->GetCacheStats(out);
+}
+
+void OverlayDataSource::Write(uint64_t at, const void* data, size_t size)
+{
+	uint64_t srcSize = GetSize();
+	if (at >= srcSize)
+		return;
+	size = size_t(std::min(uint64_t(size), srcSize - at));
+	if (!size)
+		return;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_RemovePieces(at, size);
+
+	size_t dataOff = _added.size();
+	_added.insert(_added.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+
+	// typing over consecutive bytes extends the previous piece
+	auto it = _pieces.lower_bound(at);
+	if (it != _pieces.begin())
+	{
+		auto& prev = *std::prev(it);
+		if (prev.first + prev.second.size == at && prev.second.dataOff + prev.second.size == dataOff)
+		{
+			prev.second.size += size;
+			_editLog.push_back({ at, size });
+			return;
+		}
+	}
+	_pieces.insert(it, { at, { size, dataOff } });
+	_editLog.push_back({ at, size });
+}
+
+void OverlayDataSource::Revert(uint64_t at, uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_RemovePieces(at, size);
+	_editLog.push_back({ at, size });
+}
+
+void OverlayDataSource::RevertAll()
+{
+	uint64_t size = GetSize();
+	std::lock_guard<std::mutex> lock(_mutex);
+	_pieces.clear();
+	_added.clear();
+	_editLog.push_back({ 0, size });
+}
+
+size_t OverlayDataSource::GetEditedRangeCount()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _pieces.size();
+}
+
+void OverlayDataSource::GetEditedRanges(std::vector<EditRecord>& out)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	out.clear();
+	out.reserve(_pieces.size());
+	for (const auto& P : _pieces)
+		out.push_back({ P.first, P.second.size });
+}
+
+uint64_t OverlayDataSource::GetEditGeneration()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _editLog.size();
+}
+
+bool OverlayDataSource::WasEditedSince(uint64_t generation, uint64_t at, uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (size_t i = size_t(generation); i < _editLog.size(); i++)
+	{
+		const auto& E = _editLog[i];
+		if (E.at < at + size && at < E.at + E.size)
+			return true;
+	}
+	return false;
+}
+
+OverlayDataSource* OverlayDataSource::CreateSnapshot()
+{
+	auto* S = new OverlayDataSource(_src);
+	S->_size = _size.load();
+	std::lock_guard<std::mutex> lock(_mutex);
+	S->_pieces = _pieces;
+	S->_added = _added;
+	S->_editLog = _editLog;
+	return S;
+}
+
+bool OverlayDataSource::SaveToFile(const char* path, std::atomic<float>* progress, const std::atomic_bool* cancel)
+{
+	FILE* fp = fopen(path, "wb");
+	if (!fp)
+		return false;
+
+	bool ok = true;
+	uint64_t size = GetSize();
+	ReadAheadReader reader(this, 0, size, 1024 * 1024, 0);
+	ReadAheadReader::Chunk chunk;
+	while (ok && reader.NextChunk(chunk))
+	{
+		ok = fwrite(chunk.data, 1, chunk.size, fp) == chunk.size;
+		if (progress)
+			*progress = float(double(chunk.offset + chunk.size) / size);
+		if (cancel && *cancel)
+			ok = false;
+	}
+	ok = fclose(fp) == 0 && ok;
+	// don't leave a partial copy around
+	if (!ok)
+		remove(path);
+	return ok;
+}
+
+void OverlayDataSource::_RemovePieces(uint64_t at, uint64_t size)
+{
+	uint64_t end = at + size;
+	auto it = _pieces.lower_bound(at);
+	if (it != _pieces.begin())
+	{
+		// cut the piece that starts before the range, keeping its tail if it extends past it
+		auto prev = std::prev(it);
+		uint64_t prevEnd = prev->first + prev->second.size;
+		if (prevEnd > at)
+		{
+			prev->second.size = at - prev->first;
+			if (prevEnd > end)
+			{
+				_pieces.insert(it, { end, { prevEnd - end, prev->second.dataOff + size_t(end - prev->first) } });
+				return;
+			}
+		}
+	}
+	while (it != _pieces.end() && it->first < end)
+	{
+		uint64_t pieceEnd = it->first + it->second.size;
+		if (pieceEnd > end)
+		{
+			Piece tail = { pieceEnd - end, it->second.dataOff + size_t(end - it->first) };
+			_pieces.erase(it);
+			_pieces.insert({ end, tail });
+			break;
+		}
+		it = _pieces.erase(it);
+	}
+}
+
+bool OverlayDataSource::_HasEditsIn(uint64_t at, uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _pieces.lower_bound(at);
+	if (it != _pieces.end() && it->first < at + size)
+		return true;
+	return it != _pieces.begin() && std::prev(it)->first + std::prev(it)->second.size > at;
+}
+
+
+size_t ReadExtentDataSource::Read(uint64_t at, size_t size, void* out)
+{
+	IOStatsScope ios(_ioStats, at, size);
+	_Add(at, size);
+	return _src->Read(at, size, out);
+}
+
+uint64_t ReadExtentDataSource::GetSize()
+{
+	return _src->GetSize();
+}
+
+DataSpan ReadExtentDataSource::GetView(uint64_t at, size_t size)
+{
+	_Add(at, size);
+	return _src->GetView(at, size);
+}
+
+void ReadExtentDataSource::ReadMany(DataReadRequest* reqs, size_t count)
+{
+	IOStatsScope ios(_ioStats, reqs, count);
+	for (size_t i = 0; i < count; i++)
+		_Add(reqs[i].at, reqs[i].size);
+	_src->ReadMany(reqs, count);
+}
+
+void ReadExtentDataSource::ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out)
+{
+	IOStatsScope ios(_ioStats, at, at + stride * count, count * elemSize);
+	if (count)
+		_Add(at, (count - 1) * stride + elemSize);
+	_src->ReadStrided(at, stride, count, elemSize, out);
+}
+
+void ReadExtentDataSource::_Add(uint64_t at, uint64_t size)
+{
+	minOff = std::min(minOff, at);
+	maxEnd = std::max(maxEnd, at + size);
+}
+
+
+ReadAheadReader::ReadAheadReader(IDataSource* src, uint64_t from, uint64_t to, size_t chunkSize, size_t overlap, unsigned numBuffers) :
+	_src(src),
+	_from(from),
+	_to(std::max(from, std::min(to, src->GetSize()))),
+	_chunkSize(std::max(chunkSize, size_t(1))),
+	_overlap(overlap)
+{
+	_numChunks = (_to - _from + _chunkSize - 1) / _chunkSize;
+	if (_numChunks == 0)
+		return;
+
+	DataSpan view = src->GetView(_from, size_t(std::min(_to - _from, uint64_t(SIZE_MAX))));
+	if (view.data && view.size == _to - _from)
+	{
+		_useViews = true;
+		return;
+	}
+
+	_buffers.resize(ui::max(numBuffers, 2U));
+	for (auto& B : _buffers)
+		B.data.resize(_chunkSize + _overlap);
+	_thread = std::thread([this]() { _ThreadProc(); });
+}
+
+ReadAheadReader::~ReadAheadReader()
+{
+	if (_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_cond.notify_all();
+		_thread.join();
+	}
+}
+
+bool ReadAheadReader::NextChunk(Chunk& out)
+{
+	if (_useViews)
+	{
+		if (_nextChunk >= _numChunks)
+			return false;
+		uint64_t start, end;
+		_GetChunkRange(_nextChunk++, start, end);
+		out.offset = start;
+		out.data = (const char*)_src->GetView(start, size_t(end - start)).data;
+		out.size = size_t(end - start);
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	if (_holding)
+	{
+		// the previously returned buffer can be refilled now
+		_buffers[(_nextChunk - 1) % _buffers.size()].filled = false;
+		_holding = false;
+		_cond.notify_all();
+	}
+	if (_nextChunk >= _numChunks)
+		return false;
+
+	auto& B = _buffers[_nextChunk % _buffers.size()];
+	_cond.wait(lock, [&B]() { return B.filled; });
+	out = B.chunk;
+	_nextChunk++;
+	_holding = true;
+	return true;
+}
+
+void ReadAheadReader::_GetChunkRange(uint64_t index, uint64_t& start, uint64_t& end)
+{
+	uint64_t base = _from + index * _chunkSize;
+	start = index ? std::max(base - _overlap, _from) : _from;
+	end = std::min(base + _chunkSize, _to);
+}
+
+void ReadAheadReader::_ThreadProc()
+{
+	for (uint64_t i = 0; i < _numChunks; i++)
+	{
+		auto& B = _buffers[i % _buffers.size()];
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this, &B]() { return _stop || !B.filled; });
+			if (_stop)
+				return;
+		}
+
+		uint64_t start, end;
+		_GetChunkRange(i, start, end);
+		size_t size = size_t(end - start);
+		if (size <= MAX_MERGED_READ)
+			_src->Read(start, size, B.data.data());
+		else
+		{
+			// in pieces so that a bulk reader can have several of them in flight
+			std::vector<DataReadRequest> pieces;
+			for (size_t off = 0; off < size; off += MAX_MERGED_READ)
+				pieces.push_back({ start + off, std::min(size - off, MAX_MERGED_READ), B.data.data() + off });
+			_src->ReadMany(pieces.data(), pieces.size());
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			B.chunk.offset = start;
+			B.chunk.data = B.data.data();
+			B.chunk.size = size;
+			B.filled = true;
+		}
+		_cond.notify_all();
+	}
+}
+
+#if 0
+// set BDAT_TEST_THREADED_READS to a writable directory to stress the file and cache read paths from many threads
+// (every read is checked against the written data, including the zero fill past the end)
+struct ThreadedReadTest
+{
+	ThreadedReadTest()
+	{
+		if (const char* dir = getenv("BDAT_TEST_THREADED_READS"))
+		{
+			Run(dir);
+			exit(0);
+		}
+	}
+	void Run(const char* dir)
+	{
+		std::string path = ui::to_string(dir, "/bdat_threaded_reads.bin");
+		std::vector<char> data(3000017);
+		uint32_t seed = 1;
+		for (auto& c : data)
+		{
+			seed = seed * 1664525 + 1013904223;
+			c = char(seed >> 24);
+		}
+		FILE* fp = fopen(path.c_str(), "wb");
+		if (!fp)
+			return;
+		fwrite(data.data(), 1, data.size(), fp);
+		fclose(fp);
+
+		auto* fds = GetFileDataSource(path.c_str());
+		// the pread path is the one with the shared state
+		fds->_UnmapFile();
+		ui::RCHandle<IDataSource> file = fds;
+		ui::RCHandle<IDataSource> cache = new CachedDataSource(fds, 4096, 256 * 1024);
+
+		std::atomic<int> fails{ 0 };
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 16; t++)
+		{
+			threads.emplace_back([&, t]()
+			{
+				uint32_t r = t * 7919 + 1;
+				std::vector<char> buf(70000);
+				for (int i = 0; i < 20000; i++)
+				{
+					r = r * 1103515245 + 12345;
+					uint64_t at = (r >> 2) % 3100000;
+					r = r * 1103515245 + 12345;
+					size_t size = (r >> 3) % 70000;
+					IDataSource* src = i & 1 ? file.get_ptr() : cache.get_ptr();
+					size_t num = src->Read(at, size, buf.data());
+					size_t expected = at < data.size() ? size_t(std::min<uint64_t>(size, data.size() - at)) : 0;
+					if (num != expected || memcmp(buf.data(), data.data() + at, num) != 0)
+						fails++;
+					for (size_t k = num; k < size; k++)
+					{
+						if (buf[k])
+						{
+							fails++;
+							break;
+						}
+					}
+				}
+			});
+		}
+		for (auto& t : threads)
+			t.join();
+		printf("%d failed reads\n", fails.load());
+
+		cache = nullptr;
+		file = nullptr;
+		remove(path.c_str());
+	}
+}
+gThreadedReadTest;
+#endif
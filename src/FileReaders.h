@@ -2,13 +2,54 @@
 #pragma once
 #include "pch.h"
 #include "Common.h"
+#include "IOStats.h"
 
 
+struct IBulkFileReader;
+
+// reads from an absolute file position without using/changing the FILE* cursor
+size_t ReadFileAt(FILE* fp, uint64_t at, size_t size, void* out);
+// the size and last write time (in platform-specific units) of a file, returns false if it can't be accessed
+bool GetFileStamp(const char* path, uint64_t& size, uint64_t& mtime);
+// whether both paths lead to the same existing file (through links or different spellings of the path too)
+bool IsSameFile(const char* a, const char* b);
+
+struct DataSpan
+{
+	const void* data = nullptr;
+	size_t size = 0;
+};
+
+struct DataReadRequest
+{
+	uint64_t at;
+	size_t size;
+	void* out;
+};
+
+// Read, GetView, GetSize and GetCacheStats may be called from multiple threads at once
+// (the reference count is not atomic, so handles must still be created/released on one thread)
 struct IDataSource : ui::RefCountedST
 {
 	virtual ~IDataSource() {}
 	virtual size_t Read(uint64_t at, size_t size, void* out) = 0;
 	virtual uint64_t GetSize() = 0;
+	// read-only view of the range (clipped to the end of the source) that stays valid while the source is alive
+	// returns an empty span if the data cannot be accessed without copying
+	virtual DataSpan GetView(uint64_t at, size_t size) { return {}; }
+
+	// returns a view if possible, otherwise reads into `buf` (zero-filling past the end) and returns that
+	// the returned data always has `size` readable bytes, span.size is the number of valid ones
+	DataSpan ViewOrRead(uint64_t at, size_t size, void* buf);
+
+	// batch reads (bytes past the end are zeroed, same as Read)
+	// the default versions merge nearby ranges into a few big reads
+	virtual void ReadMany(DataReadRequest* reqs, size_t count);
+	// reads `count` elements of `elemSize` bytes that are `stride` bytes apart into a packed array
+	virtual void ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out);
+
+	// returns false if there is no cache at this level
+	virtual bool GetCacheStats(struct DataCacheStats& out) { return false; }
 
 	void GetASCIIText(char* buf, size_t bufsz, uint64_t pos, char fallback = '?');
 	void GetInt8Text(char* buf, size_t bufsz, uint64_t pos, bool sign);
@@ -17,6 +58,9 @@ struct IDataSource : ui::RefCountedST
 	void GetInt64Text(char* buf, size_t bufsz, uint64_t pos, Endianness endianness, bool sign);
 	void GetFloat32Text(char* buf, size_t bufsz, uint64_t pos, Endianness endianness);
 	void GetFloat64Text(char* buf, size_t bufsz, uint64_t pos, Endianness endianness);
+
+	// read counters/timings, each implementation of Read/ReadMany/ReadStrided records into these
+	IOStats _ioStats;
 };
 
 struct MemoryDataSource : IDataSource
@@ -26,6 +70,9 @@ struct MemoryDataSource : IDataSource
 
 	size_t Read(uint64_t at, size_t size, void* out) override;
 	uint64_t GetSize() override;
+	DataSpan GetView(uint64_t at, size_t size) override;
+	void ReadMany(DataReadRequest* reqs, size_t count) override;
+	void ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out) override;
 
 	void* _mem;
 	size_t _size;
@@ -39,13 +86,87 @@ struct FileDataSource : IDataSource
 
 	size_t Read(uint64_t at, size_t size, void* out) override;
 	uint64_t GetSize() override;
+	DataSpan GetView(uint64_t at, size_t size) override;
+	void ReadMany(DataReadRequest* reqs, size_t count) override;
+	void ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out) override;
+
+	bool _MapFile();
+	void _UnmapFile();
+	IBulkFileReader* _GetBulkReader();
 
 	FILE* _fp;
-	uint64_t _pos = 0;
 	uint64_t _size = 0;
+	// the whole file, if it could be mapped (not for pipes/devices or when out of address space)
+	const char* _mapped = nullptr;
+#ifdef _WIN32
+	void* _mapHandle = nullptr;
+#endif
+	// for batched reads when not mapped, created on first use
+	IBulkFileReader* _bulkReader = nullptr;
+	std::once_flag _bulkReaderOnce;
 };
 
+struct DataCacheStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t bytesRead = 0; // from the underlying source
+	size_t blockSize = 0;
+	size_t memoryBudget = 0;
+	size_t memoryUsed = 0;
+};
+
+// fixed-size aligned block cache with CLOCK eviction
+struct CachedDataSource : IDataSource
+{
+	CachedDataSource(IDataSource* src, size_t blockSize, size_t memoryBudget);
+	~CachedDataSource();
+
+	size_t Read(uint64_t at, size_t size, void* out) override;
+	uint64_t GetSize() override;
+	DataSpan GetView(uint64_t at, size_t size) override;
+	void ReadMany(DataReadRequest* reqs, size_t count) override;
+	void ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out) override;
+	bool GetCacheStats(DataCacheStats& out) override;
+
+	void SetMemoryBudget(size_t bytes);
+	void Clear();
+	void _Clear(std::unique_lock<std::mutex>& lock);
+	// `lock` is released while the source is being read
+	size_t _ReadLocked(std::unique_lock<std::mutex>& lock, uint64_t at, size_t size, void* out);
+	char* _GetBlock(std::unique_lock<std::mutex>& lock, uint64_t index, size_t& outSize);
+
+	struct Block
+	{
+		uint64_t index = UINT64_MAX;
+		size_t size = 0;
+		bool referenced = false;
+		bool loading = false; // being read into by another thread, can't be evicted
+	};
+
+	ui::RCHandle<IDataSource> _src;
+	uint64_t _size;
+	size_t _blockSize;
+	size_t _maxBlocks = 0;
+	size_t _clockHand = 0;
+	std::vector<Block> _blocks;
+	std::vector<char> _memory;
+	std::unordered_map<uint64_t, size_t> _blockMap; // block index -> slot
+	DataCacheStats _stats;
+	size_t _numLoading = 0;
+	std::mutex _mutex;
+	std::condition_variable _loadedCond;
+};
+
+extern size_t g_dataCacheBlockSize;
+extern size_t g_dataCacheMemoryBudget;
+// bigger files aren't mapped, so that scans over them have several reads in flight through the bulk reader
+// instead of waiting for one page fault at a time (only applies to files opened after it's changed)
+extern uint64_t g_maxMappedFileSize;
+
 FileDataSource* GetFileDataSource(const char* path);
+// opens the file and puts a block cache in front of it if it can't be mapped
+IDataSource* OpenFileDataSource(const char* path);
 
 struct SliceDataSource : IDataSource
 {
@@ -54,6 +175,9 @@ struct SliceDataSource : IDataSource
 
 	size_t Read(uint64_t at, size_t size, void* out) override;
 	uint64_t GetSize() override;
+	DataSpan GetView(uint64_t at, size_t size) override;
+	void ReadMany(DataReadRequest* reqs, size_t count) override;
+	void ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out) override;
 
 	IDataSource* _src;
 	uint64_t _off;
@@ -62,3 +186,139 @@ struct SliceDataSource : IDataSource
 
 IDataSource* GetSlice(IDataSource* src, uint64_t off, uint64_t size);
 
+// several sources one after another in a single address space
+struct ConcatDataSource : IDataSource
+{
+	ConcatDataSource(IDataSource* const* parts, size_t count);
+	~ConcatDataSource();
+
+	size_t Read(uint64_t at, size_t size, void* out) override;
+	uint64_t GetSize() override;
+	DataSpan GetView(uint64_t at, size_t size) override;
+	void ReadMany(DataReadRequest* reqs, size_t count) override;
+	void ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out) override;
+	bool GetCacheStats(DataCacheStats& out) override;
+
+	size_t _FindPart(uint64_t at);
+
+	std::vector<ui::RCHandle<IDataSource>> _parts;
+	std::vector<uint64_t> _starts; // one more than parts, the last one is the total size
+};
+
+// for a path like `data.000`/`data.001`, finds the consecutively numbered files that follow it
+std::vector<std::string> FindNumberedFileParts(const std::string& path);
+
+// non-destructive byte edits layered over another source (a piece table)
+// edits overwrite bytes and don't change the size, unedited ranges are read straight from the source
+struct OverlayDataSource : IDataSource
+{
+	struct Piece
+	{
+		uint64_t size;
+		size_t dataOff; // in _added
+	};
+	struct EditRecord
+	{
+		uint64_t at;
+		uint64_t size;
+	};
+
+	OverlayDataSource(IDataSource* src);
+	~OverlayDataSource();
+
+	size_t Read(uint64_t at, size_t size, void* out) override;
+	uint64_t GetSize() override;
+	DataSpan GetView(uint64_t at, size_t size) override;
+	void ReadMany(DataReadRequest* reqs, size_t count) override;
+	void ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out) override;
+	bool GetCacheStats(DataCacheStats& out) override;
+
+	void Write(uint64_t at, const void* data, size_t size);
+	void Revert(uint64_t at, uint64_t size);
+	void RevertAll();
+	size_t GetEditedRangeCount();
+	// the ranges that currently differ from the source, in order
+	void GetEditedRanges(std::vector<EditRecord>& out);
+	// counts Write/Revert calls, for checking if anything was edited since
+	uint64_t GetEditGeneration();
+	bool WasEditedSince(uint64_t generation, uint64_t at, uint64_t size);
+	// a copy of the current edits over the same source, which later edits don't change
+	OverlayDataSource* CreateSnapshot();
+	// streams the edited data out to a new file (which must not be the source file, see IsSameFile)
+	// can be called from any thread, the partial file is deleted if it fails or is cancelled
+	bool SaveToFile(const char* path, std::atomic<float>* progress = nullptr, const std::atomic_bool* cancel = nullptr);
+
+	void _RemovePieces(uint64_t at, uint64_t size);
+	bool _HasEditsIn(uint64_t at, uint64_t size);
+
+	ui::RCHandle<IDataSource> _src;
+	std::atomic<uint64_t> _size{ UINT64_MAX }; // UINT64_MAX until it's first needed
+	std::map<uint64_t, Piece> _pieces; // edited ranges by offset, never overlapping
+	std::vector<uint8_t> _added; // append-only
+	std::vector<EditRecord> _editLog;
+	std::mutex _mutex;
+};
+
+// forwards reads and remembers the range they covered
+struct ReadExtentDataSource : IDataSource
+{
+	ReadExtentDataSource(IDataSource* src) : _src(src) { _ioStats.type = "read extent"; }
+
+	size_t Read(uint64_t at, size_t size, void* out) override;
+	uint64_t GetSize() override;
+	DataSpan GetView(uint64_t at, size_t size) override;
+	void ReadMany(DataReadRequest* reqs, size_t count) override;
+	void ReadStrided(uint64_t at, uint64_t stride, size_t count, size_t elemSize, void* out) override;
+
+	void _Add(uint64_t at, uint64_t size);
+
+	IDataSource* _src;
+	uint64_t minOff = UINT64_MAX;
+	uint64_t maxEnd = 0;
+};
+
+
+
+// sequential reader that fetches the next chunks on a background thread while the current one is processed
+// each chunk after the first one starts with the last `overlap` bytes of the previous one
+// (mappable sources are handed out directly as views, without a thread)
+struct ReadAheadReader
+{
+	struct Chunk
+	{
+		uint64_t offset = 0;
+		const char* data = nullptr;
+		size_t size = 0;
+	};
+
+	ReadAheadReader(IDataSource* src, uint64_t from, uint64_t to, size_t chunkSize, size_t overlap, unsigned numBuffers = 3);
+	~ReadAheadReader();
+
+	// the returned data is valid until the next call
+	bool NextChunk(Chunk& out);
+
+	void _GetChunkRange(uint64_t index, uint64_t& start, uint64_t& end);
+	void _ThreadProc();
+
+	struct Buffer
+	{
+		std::vector<char> data;
+		Chunk chunk;
+		bool filled = false;
+	};
+
+	IDataSource* _src;
+	uint64_t _from;
+	uint64_t _to;
+	size_t _chunkSize;
+	size_t _overlap;
+	uint64_t _numChunks;
+	uint64_t _nextChunk = 0;
+	bool _useViews = false;
+	bool _holding = false;
+	bool _stop = false;
+	std::vector<Buffer> _buffers;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::thread _thread;
+};
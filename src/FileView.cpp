@@ -7,14 +7,22 @@
 #include "DataDesc.h"
 #include "ImageParsers.h"
 #include "Workspace.h"
+#include "CompressedDataSource.h"
+#include "ByteStats.h"
 
 
 static bool viewSettingsOpen = false;
+static float hsplitMinimap[1] = { 0.92f };
 void FileView::Build()
 {
 	ui::Push<ui::EdgeSliceLayoutElement>();
 
 	ui::BuildMulticastDelegateAddNoArgs(OnHexViewerStateChanged, [this]() { Rebuild(); });
+	ui::BuildMulticastDelegateAdd(OnByteStatsMapChanged, [this](const ByteStatsMap* m)
+	{
+		if (m == of->ddFile->byteStats.get_ptr())
+			Rebuild();
+	});
 
 	ui::Push<ui::StackLTRLayoutElement>();
 	{
@@ -43,6 +51,11 @@ void FileView::Build()
 	}
 	ui::Pop();
 
+	// the decoded data is still shown, but it can't be trusted
+	auto* D = of->ddFile->decompressor.get_ptr();
+	if (D && D->IsIndexed() && D->IsCorrupted())
+		ui::MakeWithText<ui::LabelFrame>("Warning: the compressed data is corrupted (invalid or truncated stream, or the checksum doesn't match)");
+
 	ui::imm::EditBool(viewSettingsOpen, "View settings", {}, ui::imm::TreeStateToggleSkin());
 
 	ui::Push<ui::StackTopDownLayoutElement>(); // tree stabilization box
@@ -54,16 +67,49 @@ void FileView::Build()
 	}
 	ui::Pop(); // end tree stabilization box
 
-	auto& hv = ui::Make<HexViewer>();
-	curHexViewer = &hv;
-	hv.Init(&workspace->desc, of->ddFile, &of->hexViewerState, &of->highlightSettings);
-	hv.HandleEvent(ui::EventType::ButtonUp) = [this](ui::Event& e)
+	// the overview is built the first time the file is viewed
+	auto* F = of->ddFile;
+	if (!F->byteStats)
+	{
+		F->byteStats = new ByteStatsMap(F->dataSource);
+		F->byteStats->StartBuild();
+	}
+
+	ui::Push<ui::SplitPane>().Init(ui::Direction::Horizontal, hsplitMinimap);
 	{
-		if (e.GetButton() == ui::MouseButton::Right)
+		auto& hv = ui::Make<HexViewer>();
+		curHexViewer = &hv;
+		hv.Init(&workspace->desc, of->ddFile, &of->hexViewerState, &of->highlightSettings);
+		hv.HandleEvent(ui::EventType::ButtonUp) = [this](ui::Event& e)
 		{
-			HexViewer_OnRightClick();
-		}
-	};
+			if (e.GetButton() == ui::MouseButton::Right)
+			{
+				HexViewer_OnRightClick();
+			}
+		};
+
+		auto& minimap = ui::Make<HexViewerMinimap>();
+		minimap.Init(&workspace->desc, of->ddFile, &of->hexViewerState);
+		ui::BuildMulticastDelegateAdd(OnMarkerListChange, [this, &minimap](const MarkerData* md)
+		{
+			if (md == &of->ddFile->markerData)
+			{
+				minimap.InvalidateCoverage();
+				Rebuild();
+			}
+		});
+		ui::BuildMulticastDelegateAdd(OnMarkerChange, [this, &minimap](const Marker*)
+		{
+			minimap.InvalidateCoverage();
+			Rebuild();
+		});
+		ui::BuildMulticastDelegateAdd(OnInstanceListChanged, [this, &minimap](DataDesc*)
+		{
+			minimap.InvalidateCoverage();
+			Rebuild();
+		});
+	}
+	ui::Pop();
 	ui::Pop();
 }
 
@@ -181,6 +227,7 @@ void FileView::HexViewer_OnRightClick()
 		ui::MenuItem("Highlight offset as int32", txt_pos + 2).Func([this, pos]() { of->highlightSettings.AddCustomInt32(pos); }),
 		ui::MenuItem::Separator(),
 		ui::MenuItem("Create a subview", txt_pos).Func([this, pos]() { CreateSubviewAt(pos); }),
+		ui::MenuItem("Decompress from here", txt_pos, !of->ddFile->compression.empty()).Func([this, pos]() { CreateDecompressedViewAt(pos); }),
 		ui::MenuItem("Create off.mod.range", txt_sel).Func([this, pos, size]() { of->ddFile->offModRanges.ranges.push_back({ uint64_t(pos), uint64_t(size) }); }),
 	};
 	ui::Menu menu(items);
@@ -261,9 +308,15 @@ void FileView::CreateSubviewAt(uint64_t pos)
 	uint64_t end = srcf->dataSource->GetSize();
 	F->name = srcf->name;
 	F->path = srcf->path;
+	F->moreParts = srcf->moreParts;
 	F->off = srcf->off + pos;
 	F->size = end - pos;
+	F->compression = srcf->compression;
+	F->compOff = srcf->compOff;
+	F->compSize = srcf->compSize;
 	F->origDataSource = srcf->origDataSource;
+	F->editOverlay = srcf->editOverlay;
+	F->decompressor = srcf->decompressor;
 	F->dataSource = GetSlice(srcf->origDataSource, F->off, F->size);
 	F->mdSrc.dataSource = F->dataSource;
 	for (auto& m : srcf->markerData.markers)
@@ -301,3 +354,30 @@ void FileView::CreateSubviewAt(uint64_t pos)
 	workspace->curOpenedFile = workspace->openedFiles.size() - 1;
 	OnCurrentFileChanged.Call(nof);
 }
+
+void FileView::CreateDecompressedViewAt(uint64_t pos)
+{
+	// a zlib/gzip header is detected, otherwise it's assumed to be raw deflate
+	auto* srcf = of->ddFile;
+	auto fmt = DetectCompressionFormat(srcf->dataSource, pos);
+	if (fmt == CompressionFormat::Unknown)
+		fmt = CompressionFormat::Deflate;
+
+	auto* F = workspace->desc.CreateNewFile();
+	F->name = ui::Format("%s@%" PRIu64 " (%s)", srcf->name.c_str(), pos, CompressionFormatToString(fmt));
+	F->path = srcf->path;
+	F->moreParts = srcf->moreParts;
+	F->compression = CompressionFormatToString(fmt);
+	F->compOff = srcf->off + pos;
+	if (srcf->size != UINT64_MAX)
+		F->compSize = srcf->size - pos;
+	OpenDDFileDataSources(F);
+
+	auto* nof = new OpenedFile;
+	nof->ddFile = F;
+	nof->fileID = F->id;
+	nof->highlightSettings = of->highlightSettings;
+	workspace->openedFiles.push_back(nof);
+	workspace->curOpenedFile = workspace->openedFiles.size() - 1;
+	OnCurrentFileChanged.Call(nof);
+}
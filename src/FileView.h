@@ -19,6 +19,7 @@ struct FileView : ui::Buildable
 	void CreateImage(int64_t pos, ui::StringView fmt);
 	void GoToOffset(int64_t pos, Endianness endianness);
 	void CreateSubviewAt(uint64_t pos);
+	void CreateDecompressedViewAt(uint64_t pos);
 
 	Workspace* workspace = nullptr;
 	OpenedFile* of = nullptr;
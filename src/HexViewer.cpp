@@ -1,6 +1,7 @@
 
 #include "pch.h"
 #include "HexViewer.h"
+#include "BulkDecode.h"
 
 
 uint64_t HexViewerState::GetInspectPos()
@@ -258,7 +259,7 @@ static bool IsASCII(uint8_t v)
 	return v >= 0x20 && v < 0x7f;
 }
 
-static void Highlight(HighlightSettings* hs, HexViewerState* hvs, DataDesc* desc, DDFile* file, uint64_t basePos, Endianness endianness, ByteColors* outColors, uint8_t* bytes, size_t numBytes)
+static void Highlight(HighlightSettings* hs, HexViewerState* hvs, DataDesc* desc, DDFile* file, uint64_t basePos, Endianness endianness, ByteColors* outColors, const uint8_t* bytes, size_t numBytes)
 {
 	hvs->highlightList.items.clear();
 
@@ -300,6 +301,26 @@ static void Highlight(HighlightSettings* hs, HexViewerState* hvs, DataDesc* desc
 	}
 
 	// auto highlights
+	// the values starting at every byte are decoded in bulk, once for each size
+	std::vector<uint16_t> vals16;
+	std::vector<uint32_t> vals32;
+	std::vector<uint64_t> vals64;
+	if (hs->enableInt16 && numBytes >= 2)
+	{
+		vals16.resize(numBytes - 1);
+		DecodeStrided(bytes, 1, vals16.size(), endianness, vals16.data());
+	}
+	if ((!hs->customInt32.empty() || hs->enableFloat32 || hs->enableInt32 || hs->enableNearFileSize32) && numBytes >= 4)
+	{
+		vals32.resize(numBytes - 3);
+		DecodeStrided(bytes, 1, vals32.size(), endianness, vals32.data());
+	}
+	if (hs->enableNearFileSize64 && numBytes >= 8)
+	{
+		vals64.resize(numBytes - 7);
+		DecodeStrided(bytes, 1, vals64.size(), endianness, vals64.data());
+	}
+
 	if (hs->enableNearFileSize64)
 	{
 		for (size_t i = 0; i + 8 < numBytes; i++)
@@ -326,9 +347,7 @@ static void Highlight(HighlightSettings* hs, HexViewerState* hvs, DataDesc* desc
 
 			if (hs->enableNearFileSize64)
 			{
-				uint64_t v;
-				memcpy(&v, &bytes[i], 8);
-				EndiannessAdjust(v, endianness);
+				uint64_t v = vals64[i];
 				auto fsz = file->dataSource->GetSize();
 				if (v >= fsz * (hs->nearFileSizePercent * 0.01f) && v <= fsz)
 				{
@@ -355,9 +374,7 @@ static void Highlight(HighlightSettings* hs, HexViewerState* hvs, DataDesc* desc
 			if (hs->excludeZeroes && bytes[i] == 0 && bytes[i + 1] == 0 && bytes[i + 2] == 0 && bytes[i + 3] == 0)
 				continue;
 
-			int32_t i32v;
-			memcpy(&i32v, &bytes[i], 4);
-			EndiannessAdjust(i32v, endianness);
+			int32_t i32v = int32_t(vals32[i]);
 
 			for (const auto& h : hs->customInt32)
 			{
@@ -390,15 +407,12 @@ static void Highlight(HighlightSettings* hs, HexViewerState* hvs, DataDesc* desc
 			if (hs->excludeZeroes && bytes[i] == 0 && bytes[i + 1] == 0 && bytes[i + 2] == 0 && bytes[i + 3] == 0)
 				continue;
 
-			int32_t i32v;
-			memcpy(&i32v, &bytes[i], 4);
-			EndiannessAdjust(i32v, endianness);
+			int32_t i32v = int32_t(vals32[i]);
 
 			if (hs->enableFloat32)
 			{
 				float v;
-				memcpy(&v, &bytes[i], 4);
-				EndiannessAdjust(v, endianness);
+				memcpy(&v, &vals32[i], 4);
 				if ((v >= hs->minFloat32 && v <= hs->maxFloat32) || (v >= -hs->maxFloat32 && v <= -hs->minFloat32))
 				{
 					for (int j = 0; j < 4; j++)
@@ -412,9 +426,7 @@ static void Highlight(HighlightSettings* hs, HexViewerState* hvs, DataDesc* desc
 
 			if (hs->enableNearFileSize32)
 			{
-				uint32_t v;
-				memcpy(&v, &bytes[i], 4);
-				EndiannessAdjust(v, endianness);
+				uint32_t v = vals32[i];
 				auto fsz = file->dataSource->GetSize();
 				if (v >= fsz * (hs->nearFileSizePercent * 0.01f) && v <= fsz)
 				{
@@ -452,9 +464,7 @@ static void Highlight(HighlightSettings* hs, HexViewerState* hvs, DataDesc* desc
 			if (hs->excludeZeroes && bytes[i] == 0 && bytes[i + 1] == 0)
 				continue;
 
-			int16_t v;
-			memcpy(&v, &bytes[i], 2);
-			EndiannessAdjust(v, endianness);
+			int16_t v = int16_t(vals16[i]);
 			if (v >= hs->minInt16 && v <= hs->maxInt16)
 			{
 				outColors[i].hexColor.BlendOver(colorInt32);
@@ -634,10 +644,12 @@ void HexViewer::OnPaint(const ui::UIPaintContext& ctx)
 	auto minSel = std::min(state->selectionStart, state->selectionEnd);
 	auto maxSel = std::max(state->selectionStart, state->selectionEnd);
 
-	uint8_t buf[256 * 64];
+	uint8_t rdbuf[256 * 64];
 	static ByteColors bcol[256 * 64];
 	memset(&bcol, 0, sizeof(bcol));
-	size_t sz = file->dataSource->Read(GetBasePos(), W * 64, buf);
+	DataSpan span = file->dataSource->ViewOrRead(GetBasePos(), W * 64, rdbuf);
+	const uint8_t* buf = (const uint8_t*)span.data;
+	size_t sz = span.size;
 
 	float fh = contentFont.size + 4;
 	float x = GetFinalRect().x0 + 2 + ui::GetTextWidth(font, contentFont.size, "0") * 8;
@@ -752,3 +764,157 @@ ui::UIRect HexViewer::GetByteRect(uint64_t pos)
 
 	return { x0, y0, x0 + 16, y0 + fh };
 }
+
+
+static ui::Color4f LerpColor(const ui::Color4f& a, const ui::Color4f& b, float q)
+{
+	return { a.r + (b.r - a.r) * q, a.g + (b.g - a.g) * q, a.b + (b.b - a.b) * q, a.a + (b.a - a.a) * q };
+}
+
+// padding (zeroes) = black, text = green, compressed/encrypted (entropy close to 8 bits) = red,
+// anything else = blue, brighter with more entropy
+static ui::Color4f GetByteStatsColor(const ByteStats& bs)
+{
+	float t = bs.entropy / 8;
+	ui::Color4f col(0.1f + 0.3f * t, 0.15f + 0.35f * t, 0.3f + 0.6f * t);
+	col = LerpColor(col, ui::Color4f(0.9f, 0.25f, 0.2f), ui::min(ui::max((t - 0.85f) / 0.1f, 0.0f), 1.0f));
+	// random data is ~38% printable
+	col = LerpColor(col, ui::Color4f(0.3f, 0.8f, 0.3f), ui::max((bs.printableRatio - 0.6f) / 0.4f, 0.0f));
+	col = LerpColor(col, ui::Color4f(0.05f, 0.05f, 0.05f), bs.zeroRatio);
+	return col;
+}
+
+// marks the rows of [from, to) in `cov` (one more than the rows) with +1 at the first row and -1 after the last one
+static void AddCoverage(std::vector<int>& cov, uint64_t from, uint64_t to, uint64_t size)
+{
+	size_t numRows = cov.size() - 1;
+	if (from >= size || to <= from)
+		return;
+	to = ui::min(to, size);
+	size_t a = ui::min(size_t(double(from) / size * numRows), numRows - 1);
+	size_t b = ui::min(ui::max(size_t(ceil(double(to) / size * numRows)), a + 1), numRows);
+	cov[a]++;
+	cov[b]--;
+}
+
+static void DrawCoverage(const std::vector<int>& cov, float x0, float y0, float x1, ui::Color4f col)
+{
+	int level = 0;
+	size_t start = 0;
+	for (size_t i = 0; i + 1 < cov.size(); i++)
+	{
+		bool wasCovered = level > 0;
+		level += cov[i];
+		if (level > 0 && !wasCovered)
+			start = i;
+		else if (level <= 0 && wasCovered)
+			ui::draw::RectCol(x0, y0 + start, x1, y0 + i, col);
+	}
+	if (level > 0)
+		ui::draw::RectCol(x0, y0 + start, x1, y0 + cov.size() - 1, col);
+}
+
+void HexViewerMinimap::OnEvent(ui::Event& e)
+{
+	if (e.type == ui::EventType::ButtonDown && e.GetButton() == ui::MouseButton::Left)
+	{
+		state->minimapMouseDown = true;
+		_ScrollTo(e.position.y);
+	}
+	else if (e.type == ui::EventType::ButtonUp && e.GetButton() == ui::MouseButton::Left)
+	{
+		state->minimapMouseDown = false;
+	}
+	else if (e.type == ui::EventType::MouseLeave)
+	{
+		// the button may be released outside the minimap
+		state->minimapMouseDown = false;
+	}
+	else if (e.type == ui::EventType::MouseMove && state->minimapMouseDown)
+	{
+		_ScrollTo(e.position.y);
+	}
+}
+
+void HexViewerMinimap::OnPaint(const ui::UIPaintContext& ctx)
+{
+	auto r = GetFinalRect();
+	ui::draw::RectCol(r.x0, r.y0, r.x1, r.y1, ui::Color4f(0.05f, 0.05f, 0.05f));
+
+	size_t numRows = size_t(ui::max(r.GetHeight(), 0.0f));
+	uint64_t size = file->dataSource->GetSize();
+	if (numRows == 0 || size == 0)
+		return;
+
+	// the statistics are on the left, then the markers and then the struct instances
+	float laneWidth = 3;
+	float xLanes = r.x1 - laneWidth * 2;
+
+	auto* bsm = file->byteStats.get_ptr();
+	if (bsm && bsm->GetState() == ByteStatsMapState::Ready)
+	{
+		_rowStats.resize(numRows);
+		bsm->Sample(0, size, numRows, _rowStats.data());
+		for (size_t i = 0; i < numRows; i++)
+		{
+			if (_rowStats[i].size)
+				ui::draw::RectCol(r.x0, r.y0 + i, xLanes, r.y0 + i + 1, GetByteStatsColor(_rowStats[i]));
+		}
+	}
+	else if (bsm && bsm->GetState() == ByteStatsMapState::Building)
+	{
+		ui::draw::RectCol(r.x0, r.y0, xLanes, r.y0 + r.GetHeight() * bsm->GetBuildProgress(), ui::Color4f(0.25f, 0.25f, 0.25f));
+	}
+
+	_UpdateCoverage(numRows, size);
+	DrawCoverage(_markerCoverage, xLanes, r.y0, xLanes + laneWidth, ui::Color4f(1, 0.85f, 0.2f));
+	DrawCoverage(_instCoverage, xLanes + laneWidth, r.y0, r.x1, colorInst);
+
+	// the part shown by the hex viewer (at least a few pixels tall to stay visible)
+	float y0 = r.y0 + float(double(state->basePos) / size * numRows);
+	float y1 = r.y0 + float(double(state->basePos + uint64_t(state->byteWidth) * 64) / size * numRows);
+	y1 = ui::min(ui::max(y1, y0 + 3), r.y1);
+	ui::Color4f colView(1, 1, 1, 0.8f);
+	ui::draw::LineCol(r.x0, y0, r.x1, y0, 1, colView);
+	ui::draw::LineCol(r.x0, y1, r.x1, y1, 1, colView);
+	ui::draw::LineCol(r.x0, y0, r.x0, y1, 1, colView);
+	ui::draw::LineCol(r.x1, y0, r.x1, y1, 1, colView);
+}
+
+uint64_t HexViewerMinimap::_GetPosAt(float y)
+{
+	auto r = GetFinalRect();
+	uint64_t size = file->dataSource->GetSize();
+	if (size == 0 || r.GetHeight() <= 0)
+		return 0;
+	double q = ui::min(ui::max(double(y - r.y0) / r.GetHeight(), 0.0), 1.0);
+	return ui::min(uint64_t(q * size), size - 1);
+}
+
+void HexViewerMinimap::_UpdateCoverage(size_t numRows, uint64_t size)
+{
+	if (_coverageRows == numRows && _coverageSize == size && _coverageFile == file)
+		return;
+	_coverageRows = numRows;
+	_coverageSize = size;
+	_coverageFile = file;
+
+	_markerCoverage.assign(numRows + 1, 0);
+	for (auto& M : file->markerData.markers)
+		AddCoverage(_markerCoverage, M.at, M.GetEnd(), size);
+
+	_instCoverage.assign(numRows + 1, 0);
+	for (auto* SI : dataDesc->instances)
+	{
+		if (SI->file == file && SI->off >= 0)
+			AddCoverage(_instCoverage, SI->off, SI->off + ui::max(SI->GetSize(true), int64_t(1)), size);
+	}
+}
+
+void HexViewerMinimap::_ScrollTo(float y)
+{
+	// the clicked position ends up in the middle of the hex viewer
+	uint64_t pos = _GetPosAt(y);
+	state->basePos = pos - ui::min(pos, uint64_t(state->byteWidth) * 32);
+	OnHexViewerStateChanged.Call(state);
+}
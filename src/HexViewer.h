@@ -3,6 +3,7 @@
 #include "pch.h"
 #include "FileReaders.h"
 #include "DataDesc.h"
+#include "ByteStats.h"
 
 
 struct Int32Highlight
@@ -99,6 +100,7 @@ struct HexViewerState
 	uint64_t selectionStart = UINT64_MAX;
 	uint64_t selectionEnd = UINT64_MAX;
 	bool mouseDown = false;
+	bool minimapMouseDown = false;
 
 	FoundHighlightList highlightList;
 
@@ -143,3 +145,40 @@ struct HexViewer : ui::FillerElement
 	HexViewerState* state = nullptr;
 	HighlightSettings* highlightSettings = nullptr;
 };
+
+// overview strip of the whole file, one row of pixels = the byte statistics of that part of the file
+// (from the file's ByteStatsMap, so drawing it costs the same no matter how big the file is)
+// with the coverage by markers and struct instances on the side and the range shown by the hex viewer outlined
+// clicking/dragging scrolls the hex viewer there
+struct HexViewerMinimap : ui::FillerElement
+{
+	void OnEvent(ui::Event& e) override;
+	void OnPaint(const ui::UIPaintContext& ctx) override;
+
+	void Init(DataDesc* dd, DDFile* f, HexViewerState* hvs)
+	{
+		dataDesc = dd;
+		file = f;
+		state = hvs;
+	}
+
+	// the marker/instance lanes are only recalculated after this (or when the size changes)
+	void InvalidateCoverage() { _coverageRows = 0; }
+
+	uint64_t _GetPosAt(float y);
+	void _ScrollTo(float y);
+	void _UpdateCoverage(size_t numRows, uint64_t size);
+
+	// input data
+	DataDesc* dataDesc = nullptr;
+	DDFile* file = nullptr;
+	HexViewerState* state = nullptr;
+
+	std::vector<ByteStats> _rowStats;
+	std::vector<int> _markerCoverage;
+	std::vector<int> _instCoverage;
+	// what the coverage was calculated for
+	size_t _coverageRows = 0;
+	uint64_t _coverageSize = 0;
+	const DDFile* _coverageFile = nullptr;
+};
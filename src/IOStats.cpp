@@ -0,0 +1,225 @@
+
+#include "pch.h"
+#include "IOStats.h"
+#include "FileReaders.h"
+
+
+std::atomic_bool g_ioStatsEnabled{ false };
+
+static thread_local IOStats* tls_activeIOStats = nullptr;
+
+// the registry is a function-local static so that sources created during static init can use it
+struct IOStatsRegistry
+{
+	std::mutex mutex;
+	std::vector<IOStats*> live;
+	std::vector<IOStatsSnapshot> retired; // one per type
+};
+
+static IOStatsRegistry& GetIOStatsRegistry()
+{
+	static IOStatsRegistry reg;
+	return reg;
+}
+
+
+void IOStatsSnapshot::Add(const IOStatsSnapshot& o)
+{
+	reads += o.reads;
+	bytes += o.bytes;
+	nonSequential += o.nonSequential;
+	totalNanos += o.totalNanos;
+	for (int i = 0; i < IO_LATENCY_BUCKETS; i++)
+		latency[i] += o.latency[i];
+}
+
+double IOStatsSnapshot::GetAvgMicros() const
+{
+	return reads ? totalNanos * 0.001 / reads : 0;
+}
+
+double IOStatsSnapshot::GetLatencyPercentileMicros(double p) const
+{
+	if (!reads)
+		return 0;
+	uint64_t target = uint64_t(ceil(reads * p));
+	uint64_t sum = 0;
+	for (int i = 0; i < IO_LATENCY_BUCKETS; i++)
+	{
+		sum += latency[i];
+		if (sum >= target && sum)
+			return double(1ULL << i);
+	}
+	return double(1ULL << (IO_LATENCY_BUCKETS - 1));
+}
+
+
+IOStats::IOStats(const char* t) : type(t)
+{
+	auto& reg = GetIOStatsRegistry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	reg.live.push_back(this);
+}
+
+IOStats::~IOStats()
+{
+	IOStatsSnapshot snap;
+	GetSnapshot(snap);
+
+	auto& reg = GetIOStatsRegistry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	reg.live.erase(std::find(reg.live.begin(), reg.live.end(), this));
+
+	if (!snap.reads)
+		return;
+	for (auto& R : reg.retired)
+	{
+		if (R.type == snap.type)
+		{
+			R.Add(snap);
+			return;
+		}
+	}
+	snap.desc = "(destroyed)";
+	snap.live = false;
+	reg.retired.push_back(snap);
+}
+
+static int GetLatencyBucket(uint64_t nanos)
+{
+	uint64_t us = nanos / 1000;
+	int b = 0;
+	while (us && b < IO_LATENCY_BUCKETS - 1)
+	{
+		us >>= 1;
+		b++;
+	}
+	return b;
+}
+
+void IOStats::Record(uint64_t at, uint64_t end, uint64_t size, uint64_t nanos)
+{
+	uint64_t prevEnd = _lastEnd.exchange(end, std::memory_order_relaxed);
+	if (prevEnd != UINT64_MAX && prevEnd != at)
+		_nonSequential.fetch_add(1, std::memory_order_relaxed);
+	_reads.fetch_add(1, std::memory_order_relaxed);
+	_bytes.fetch_add(size, std::memory_order_relaxed);
+	_totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+	_latency[GetLatencyBucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void IOStats::GetSnapshot(IOStatsSnapshot& out)
+{
+	out.type = type;
+	out.desc = desc;
+	out.reads = _reads.load(std::memory_order_relaxed);
+	out.bytes = _bytes.load(std::memory_order_relaxed);
+	out.nonSequential = _nonSequential.load(std::memory_order_relaxed);
+	out.totalNanos = _totalNanos.load(std::memory_order_relaxed);
+	for (int i = 0; i < IO_LATENCY_BUCKETS; i++)
+		out.latency[i] = _latency[i].load(std::memory_order_relaxed);
+}
+
+void IOStats::Reset()
+{
+	_reads = 0;
+	_bytes = 0;
+	_nonSequential = 0;
+	_totalNanos = 0;
+	_lastEnd = UINT64_MAX;
+	for (auto& L : _latency)
+		L = 0;
+}
+
+
+void IOStatsScope::_Begin(IOStats& stats, uint64_t at, uint64_t end, uint64_t size)
+{
+	if (tls_activeIOStats == &stats)
+		return;
+	_stats = &stats;
+	_outer = tls_activeIOStats;
+	tls_activeIOStats = &stats;
+	_at = at;
+	_end = end;
+	_size = size;
+	_start = std::chrono::steady_clock::now();
+}
+
+void IOStatsScope::_BeginBatch(IOStats& stats, const DataReadRequest* reqs, size_t count)
+{
+	if (!count)
+		return;
+	uint64_t size = 0;
+	for (size_t i = 0; i < count; i++)
+		size += reqs[i].size;
+	_Begin(stats, reqs[0].at, reqs[count - 1].at + reqs[count - 1].size, size);
+}
+
+void IOStatsScope::_End()
+{
+	auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+	_stats->Record(_at, _end, _size, uint64_t(nanos));
+	tls_activeIOStats = _outer;
+}
+
+
+void GetAllIOStats(std::vector<IOStatsSnapshot>& out)
+{
+	auto& reg = GetIOStatsRegistry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	out.clear();
+	out.reserve(reg.live.size() + reg.retired.size());
+	for (auto* S : reg.live)
+	{
+		out.emplace_back();
+		S->GetSnapshot(out.back());
+	}
+	for (auto& R : reg.retired)
+		out.push_back(R);
+}
+
+void ResetAllIOStats()
+{
+	auto& reg = GetIOStatsRegistry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	for (auto* S : reg.live)
+		S->Reset();
+	reg.retired.clear();
+}
+
+void WriteIOStatsSummary(FILE* fp)
+{
+	std::vector<IOStatsSnapshot> all;
+	GetAllIOStats(all);
+
+	IOStatsSnapshot total;
+	fprintf(fp, "I/O statistics%s\n", g_ioStatsEnabled ? "" : " (collection disabled)");
+	fprintf(fp, "%-12s %10s %14s %10s %10s %10s %10s  %s\n", "type", "reads", "bytes", "non-seq", "avg us", "p50 us", "p99 us", "description");
+	for (auto& S : all)
+	{
+		if (!S.reads)
+			continue;
+		fprintf(fp, "%-12s %10" PRIu64 " %14" PRIu64 " %10" PRIu64 " %10.1f %10.0f %10.0f  %s\n",
+			S.type.c_str(),
+			S.reads,
+			S.bytes,
+			S.nonSequential,
+			S.GetAvgMicros(),
+			S.GetLatencyPercentileMicros(0.5),
+			S.GetLatencyPercentileMicros(0.99),
+			S.desc.c_str());
+		total.Add(S);
+	}
+
+	// nested sources (e.g. a slice of a file) count the same read at every level
+	fprintf(fp, "latency histogram (all sources):\n");
+	for (int i = 0; i < IO_LATENCY_BUCKETS; i++)
+	{
+		if (!total.latency[i])
+			continue;
+		if (i == IO_LATENCY_BUCKETS - 1)
+			fprintf(fp, "  >= %8llu us: %" PRIu64 "\n", 1ULL << (i - 1), total.latency[i]);
+		else
+			fprintf(fp, "  <  %8llu us: %" PRIu64 "\n", 1ULL << i, total.latency[i]);
+	}
+}
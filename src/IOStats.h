@@ -0,0 +1,98 @@
+#pragma once
+#include "pch.h"
+#include <chrono>
+
+
+struct DataReadRequest;
+
+// read statistics that every data source keeps while they're enabled
+// (when disabled, the only cost is a flag check per read call)
+extern std::atomic_bool g_ioStatsEnabled;
+
+// [0] = under 1 us, [i] = under 2^i us, the last one also counts everything slower
+static const int IO_LATENCY_BUCKETS = 20;
+
+struct IOStatsSnapshot
+{
+	std::string type;
+	std::string desc;
+	bool live = true; // false for the merged totals of destroyed sources
+	uint64_t reads = 0;
+	uint64_t bytes = 0;
+	uint64_t nonSequential = 0; // reads that didn't start where the previous one ended
+	uint64_t totalNanos = 0;
+	uint64_t latency[IO_LATENCY_BUCKETS] = {};
+
+	void Add(const IOStatsSnapshot& o);
+	double GetAvgMicros() const;
+	// upper bound of the histogram bucket containing the percentile `p` (0-1)
+	double GetLatencyPercentileMicros(double p) const;
+};
+
+// registered in a global list for its whole lifetime, the counters are merged into per-type totals on destruction
+struct IOStats
+{
+	IOStats(const char* type = "other");
+	~IOStats();
+	IOStats(const IOStats&) = delete;
+	IOStats& operator = (const IOStats&) = delete;
+
+	// `end` is where the next read has to start to count as sequential
+	void Record(uint64_t at, uint64_t end, uint64_t size, uint64_t nanos);
+	void GetSnapshot(IOStatsSnapshot& out);
+	void Reset();
+
+	// only set these while the owner is being created
+	const char* type;
+	std::string desc;
+
+	std::atomic<uint64_t> _reads{ 0 };
+	std::atomic<uint64_t> _bytes{ 0 };
+	std::atomic<uint64_t> _nonSequential{ 0 };
+	std::atomic<uint64_t> _totalNanos{ 0 };
+	std::atomic<uint64_t> _lastEnd{ UINT64_MAX };
+	std::atomic<uint64_t> _latency[IO_LATENCY_BUCKETS] = {};
+};
+
+// times a read call for its duration
+// calls that re-enter the same source on the same thread (e.g. ReadMany implemented through Read) are only counted once
+struct IOStatsScope
+{
+	UI_FORCEINLINE IOStatsScope(IOStats& stats, uint64_t at, uint64_t size)
+	{
+		if (g_ioStatsEnabled.load(std::memory_order_relaxed))
+			_Begin(stats, at, at + size, size);
+	}
+	UI_FORCEINLINE IOStatsScope(IOStats& stats, uint64_t at, uint64_t end, uint64_t size)
+	{
+		if (g_ioStatsEnabled.load(std::memory_order_relaxed))
+			_Begin(stats, at, end, size);
+	}
+	// a batch counts as one read
+	UI_FORCEINLINE IOStatsScope(IOStats& stats, const DataReadRequest* reqs, size_t count)
+	{
+		if (g_ioStatsEnabled.load(std::memory_order_relaxed))
+			_BeginBatch(stats, reqs, count);
+	}
+	UI_FORCEINLINE ~IOStatsScope()
+	{
+		if (_stats)
+			_End();
+	}
+
+	void _Begin(IOStats& stats, uint64_t at, uint64_t end, uint64_t size);
+	void _BeginBatch(IOStats& stats, const DataReadRequest* reqs, size_t count);
+	void _End();
+
+	IOStats* _stats = nullptr;
+	IOStats* _outer = nullptr;
+	uint64_t _at = 0;
+	uint64_t _end = 0;
+	uint64_t _size = 0;
+	std::chrono::steady_clock::time_point _start;
+};
+
+// live sources first (in creation order), then the totals of destroyed ones by type
+void GetAllIOStats(std::vector<IOStatsSnapshot>& out);
+void ResetAllIOStats();
+void WriteIOStatsSummary(FILE* fp);
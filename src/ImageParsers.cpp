@@ -801,14 +801,17 @@ static void ReadImage_DXT1(ReadImageIO& io, const ImageInfo& info)
 	uint32_t nbx = divup(info.width, 4);
 	uint32_t nby = divup(info.height, 4);
 
+	// one read per row of blocks
+	std::vector<DXT1Block> blocks(nbx);
 	uint64_t at = info.offImg;
 	for (uint32_t by = 0; by < nby; by++)
 	{
+		io.ds->Read(at, sizeof(DXT1Block) * nbx, blocks.data());
+		at += sizeof(DXT1Block) * nbx;
+
 		for (uint32_t bx = 0; bx < nbx; bx++)
 		{
-			DXT1Block block;
-			io.ds->Read(at, sizeof(block), &block);
-			at += sizeof(block);
+			DXT1Block& block = blocks[bx];
 
 			for (uint32_t y = by * 4; y < std::min((by + 1) * 4, info.height); y++)
 			{
@@ -826,17 +829,25 @@ static void ReadImage_DXT3(ReadImageIO& io, const ImageInfo& info)
 	uint32_t nbx = divup(info.width, 4);
 	uint32_t nby = divup(info.height, 4);
 
+	struct DXT3Block
+	{
+		DXT3AlphaBlock alpha;
+		DXT1Block color;
+	};
+	static_assert(sizeof(DXT3Block) == 16, "unexpected padding");
+
+	// one read per row of blocks
+	std::vector<DXT3Block> blocks(nbx);
 	uint64_t at = info.offImg;
 	for (uint32_t by = 0; by < nby; by++)
 	{
+		io.ds->Read(at, sizeof(DXT3Block) * nbx, blocks.data());
+		at += sizeof(DXT3Block) * nbx;
+
 		for (uint32_t bx = 0; bx < nbx; bx++)
 		{
-			DXT1Block block;
-			DXT3AlphaBlock ablock;
-			io.ds->Read(at, sizeof(ablock), &ablock);
-			at += sizeof(ablock);
-			io.ds->Read(at, sizeof(block), &block);
-			at += sizeof(block);
+			DXT1Block& block = blocks[bx].color;
+			DXT3AlphaBlock& ablock = blocks[bx].alpha;
 
 			for (uint32_t y = by * 4; y < std::min((by + 1) * 4, info.height); y++)
 			{
@@ -1,6 +1,7 @@
 
 #include "pch.h"
 #include "Markers.h"
+#include "BulkDecode.h"
 
 
 ui::MulticastDelegate<const Marker*> OnMarkerChange;
@@ -41,6 +42,11 @@ const char* GetDataTypeName(DataType t)
 	return typeNames[t];
 }
 
+size_t GetDataTypeSize(DataType t)
+{
+	return typeSizes[t];
+}
+
 int FindDataTypeByName(ui::StringView name)
 {
 	for (int i = 0; i < DT__COUNT; i++)
@@ -162,11 +168,13 @@ template <class T> AnalysisResult AnalysisFuncImpl(IDataSource* ds, Endianness e
 	bool asceq = true;
 	uint64_t numfound = 0;
 	std::unordered_map<T, uint64_t> counts;
+	T batch[4096];
 	for (uint64_t i = 0; i < count; i++)
 	{
-		T val;
-		ds->Read(off + stride * i, sizeof(val), &val);
-		EndiannessAdjust(val, en);
+		size_t bi = i % 4096;
+		if (bi == 0)
+			ReadDecoded(ds, off + stride * i, stride, size_t(std::min(count - i, uint64_t(4096))), en, batch);
+		T val = batch[bi];
 		ApplyMaskExtend(val, mask);
 		if (excl0 && val == 0)
 			continue;
@@ -267,6 +275,13 @@ static MarkerReadFunc* markerReadFuncs[] =
 	MarkerReadFuncImpl<float, DT_F32>,
 	MarkerReadFuncImpl<double, DT_F64>,
 };
+std::string GetDataValueText(IDataSource* ds, DataType t, Endianness en, uint64_t off)
+{
+	std::string text;
+	markerReadFuncs[t](text, ds, en, off, { UINT64_MAX, 0, 0 });
+	return text;
+}
+
 std::string GetMarkerPreview(const Marker& marker, IDataSource* src, size_t maxLen)
 {
 	std::string text;
@@ -647,16 +662,21 @@ void MarkedItemEditor::Build()
 	ui::Push<ui::StackTopDownLayoutElement>();
 
 	ui::MakeWithText<ui::PaddingElement>("Definition").SetPadding(5);
+	bool changed = false;
 	if (ui::imm::EditStringMultiline(marker->def.c_str(), [this](const char* v) { marker->def = v; }))
 	{
 		BDSScript s;
 		if (s.Parse(marker->def, true))
 			marker->compiled = std::move(s);
+		changed = true;
 	}
 
-	ui::imm::PropEditInt("Offset", marker->at);
-	ui::imm::PropEditInt("Repeats", marker->repeats, { ui::AddLabelTooltip(">1 turns on analysis across repeats instead of packed array") });
-	ui::imm::PropEditInt("Stride", marker->stride, { ui::AddLabelTooltip("Distance in bytes between arrays of elements") });
+	changed |= ui::imm::PropEditInt("Offset", marker->at);
+	changed |= ui::imm::PropEditInt("Repeats", marker->repeats, { ui::AddLabelTooltip(">1 turns on analysis across repeats instead of packed array") });
+	changed |= ui::imm::PropEditInt("Stride", marker->stride, { ui::AddLabelTooltip("Distance in bytes between arrays of elements") });
+	// the range it covers may have changed
+	if (changed)
+		OnMarkerChange.Call(marker);
 	ui::imm::PropEditStringMultiline("Notes", marker->notes.c_str(), [this](const char* v) { marker->notes = v; });
 	ui::Pop();
 	ui::Pop();
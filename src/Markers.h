@@ -23,6 +23,9 @@ enum DataType
 };
 
 const char* GetDataTypeName(DataType t);
+size_t GetDataTypeSize(DataType t);
+// reads one value and formats it the same way as the marker previews
+std::string GetDataValueText(IDataSource* ds, DataType t, Endianness en, uint64_t off);
 
 struct AnalysisResult
 {
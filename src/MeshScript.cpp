@@ -1,6 +1,7 @@
 
 #include "pch.h"
 #include "MeshScript.h"
+#include "BulkDecode.h"
 
 
 ui::MulticastDelegate<const MeshScript*> OnMeshScriptChanged;
@@ -390,14 +391,28 @@ static int g_destComps[4] = { 3, 3, 2, 4 };
 
 template <class T> static void ReadVertexDataT(std::vector<float>& ret, IDataSource* src, int destcomp, int readcomp, int64_t off, int64_t count, int64_t stride)
 {
-	T buf[4];
+	if (count <= 0)
+		return;
 
-	for (int64_t i = 0; i < count; i++, off += stride)
+	std::vector<T> buf(count * readcomp);
+	if (stride >= 0)
+		src->ReadStrided(off, stride, count, sizeof(T) * readcomp, buf.data());
+	else
 	{
-		src->Read(off, sizeof(T) * readcomp, &buf);
-		for (int j = 0; j < readcomp; j++)
-			ret[i * destcomp + j] = float(buf[j]);
+		for (int64_t i = 0; i < count; i++)
+			src->Read(off + i * stride, sizeof(T) * readcomp, &buf[i * readcomp]);
+	}
+
+	if (readcomp == destcomp)
+	{
+		ConvertToFloat(buf.data(), buf.size(), ret.data());
+		return;
 	}
+	std::vector<float> conv(buf.size());
+	ConvertToFloat(buf.data(), buf.size(), conv.data());
+	for (int64_t i = 0; i < count; i++)
+		for (int j = 0; j < readcomp; j++)
+			ret[i * destcomp + j] = conv[i * readcomp + j];
 }
 typedef void ReadVertexDataFn(std::vector<float>& ret, IDataSource* src, int destcomp, int readcomp, int64_t off, int64_t count, int64_t stride);
 
@@ -0,0 +1,27 @@
+#pragma once
+#include "pch.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#  define BDAT_SIMD_X86 1
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#    define BDAT_TARGET_AVX2
+#  else
+#    include <immintrin.h>
+#    define BDAT_TARGET_AVX2 __attribute__((target("avx2")))
+#  endif
+#else
+#  define BDAT_SIMD_X86 0
+#endif
+
+
+// the kernels are picked at runtime, AVX2 ones are compiled with BDAT_TARGET_AVX2 (and only called if it's supported)
+enum class SIMDLevel : uint8_t
+{
+	Scalar,
+	SSE2,
+	AVX2,
+};
+
+const char* SIMDLevelToString(SIMDLevel l);
+SIMDLevel GetSupportedSIMDLevel();
@@ -1,94 +1,753 @@
 
 #include "pch.h"
 #include "Search.h"
+#include "CompactOffsetList.h"
+#include "SearchKernels.h"
+#include "SearchIndex.h"
+#include "ByteRegex.h"
+#include "FileFormats.h"
+#include "Threading.h"
+#include "DataDesc.h"
 
 
-void FragmentSearch::PerformSearch(IDataSource* ds)
+static const size_t SEARCH_CHUNK_SIZE = 8 * 1024 * 1024;
+// per thread, more threads make the chunks bigger
+static const size_t SEARCH_CHUNK_SIZE_PER_THREAD = 1024 * 1024;
+static const size_t MIN_SEARCH_RANGE_SIZE = 64 * 1024;
+// the candidate ranges from an index are split into pieces of at most this many match starts
+static const size_t INDEXED_SEARCH_PIECE_SIZE = 1024 * 1024;
+// how often a background search hands over its results (and progress)
+static const std::chrono::milliseconds SEARCH_UPDATE_INTERVAL(100);
+// regex matches can be up to REGEX_MAX_MATCH_SIZE long, but only this much of each is shown
+static const size_t REGEX_MAX_DISPLAYED_MATCH_SIZE = 256;
+
+
+ui::MulticastDelegate<const BackgroundSearch*> OnBackgroundSearchUpdate;
+
+void BackgroundSearch::Job::Post(std::function<void()>&& fn)
 {
-	ui::StringView frag = textFragment;
-	matchWidth = frag.size();
-	results.clear();
-	resultSource = ds;
+	auto self = shared_from_this();
+	ui::Application::PushEvent([self, fn]()
+	{
+		if (!self->owner)
+			return;
+		fn();
+		OnBackgroundSearchUpdate.Call(self->owner);
+	});
+}
+
+void BackgroundSearch::Start(std::function<void(Job*)>&& fn)
+{
+	Stop();
+	auto job = std::make_shared<Job>();
+	job->owner = this;
+	_job = job;
+	_thread = std::thread([job, fn]()
+	{
+		fn(job.get());
+		// the last event, so all the results are in by the time the search is marked finished
+		job->Post([job]()
+		{
+			job->finished = true;
+			job->owner->_thread.join();
+		});
+	});
+}
 
-	if (frag.empty())
+void BackgroundSearch::Stop()
+{
+	if (!_job)
 		return;
+	_job->cancel = true;
+	// drops any events that are still queued
+	_job->owner = nullptr;
+	if (_thread.joinable())
+		_thread.join();
+	_job = nullptr;
+}
 
-	uint64_t size = ds->GetSize();
-	if (frag.size() > size)
+void BackgroundSearch::ProgressUI(const char* label)
+{
+	if (!IsRunning())
 		return;
+	ui::Push<ui::StackExpandLTRLayoutElement>();
+	ui::MakeWithText<ui::LabelFrame>(ui::Format("%s... %d%%", label, int(GetProgress() * 100)));
+	auto tmpl = ui::StackExpandLTRLayoutElement::GetSlotTemplate();
+	tmpl->DisableScaling();
+	if (ui::imm::Button("Cancel"))
+	{
+		Stop();
+		ui::RebuildCurrent();
+	}
+	ui::Pop();
+}
 
-	// preferred size
-	size_t bufSize = size > SIZE_MAX ? SIZE_MAX : size;
-	if (bufSize > 65536)
-		bufSize = 65536; // don't read the entire file
-	if (bufSize < frag.size() * 2)
-		bufSize = frag.size() * 2; // absolute minimum
+// runs fn on the UI thread for a background search, or right away for one on the calling thread
+static void RunForSearch(BackgroundSearch::Job* job, std::function<void()>&& fn)
+{
+	if (job)
+		job->Post(std::move(fn));
+	else
+		fn();
+}
 
-	std::string buffer;
-	buffer.resize(frag.size() * 100);
+// collects the results of a scan and hands them over to `add` (on the UI thread) in batches
+// without a job (a search on the calling thread), everything is added at the end
+template <class T> struct SearchResultBatcher
+{
+	SearchResultBatcher(BackgroundSearch::Job* j, std::function<void(std::vector<T>&)>&& a) : job(j), add(std::move(a))
+	{
+		_lastFlush = std::chrono::steady_clock::now();
+	}
 
-	if (buffer.size() >= size)
+	// keeps at most `limit` results, the rest are only counted (and the count is stored to *droppedOut on the UI thread)
+	void SetLimit(uint64_t lim, uint64_t* droppedOut)
 	{
-		ds->Read(0, size, &buffer[0]);
+		limit = lim;
+		_droppedOut = droppedOut;
+	}
 
-		ui::StringView buf(buffer.data(), size);
-		size_t off = 0;
-		for (;;)
+	// returns false if the search was cancelled
+	bool Update(double progress)
+	{
+		_ApplyLimit();
+		if (!job)
+			return true;
+		job->progress = float(progress);
+		if (std::chrono::steady_clock::now() - _lastFlush >= SEARCH_UPDATE_INTERVAL)
+			_Flush();
+		return !job->cancel;
+	}
+	void Finish()
+	{
+		_ApplyLimit();
+		if (!job)
 		{
-			size_t loc = buf.find_first_at(frag, off);
-			if (loc == SIZE_MAX)
-				break;
-			results.push_back(loc);
-			off = loc + 1;
+			add(found);
+			if (_droppedOut)
+				*_droppedOut = dropped;
+			return;
 		}
-		return;
+		job->progress = 1;
+		_Flush();
+	}
+	void _ApplyLimit()
+	{
+		size_t added = found.size() - _checked;
+		uint64_t allowed = limit - _kept;
+		if (added > allowed)
+		{
+			dropped += added - allowed;
+			found.erase(found.begin() + _checked + size_t(allowed), found.end());
+		}
+		_kept += found.size() - _checked;
+		_checked = found.size();
+	}
+	void _Flush()
+	{
+		_lastFlush = std::chrono::steady_clock::now();
+		auto addFn = add;
+		auto droppedOut = _droppedOut;
+		uint64_t numDropped = dropped;
+		std::vector<T> batch = std::move(found);
+		found.clear();
+		_checked = 0;
+		job->Post([addFn, droppedOut, numDropped, batch]() mutable
+		{
+			addFn(batch);
+			if (droppedOut)
+				*droppedOut = numDropped;
+		});
 	}
 
-	uint64_t fileoff = 0, readoff = 0;
-	size_t nread = ds->Read(0, buffer.size(), &buffer[0]);
-	size_t bufsize = nread;
-	while (nread)
+	BackgroundSearch::Job* job;
+	std::function<void(std::vector<T>&)> add;
+	std::vector<T> found;
+	uint64_t limit = UINT64_MAX;
+	uint64_t dropped = 0;
+	uint64_t* _droppedOut = nullptr;
+	uint64_t _kept = 0;
+	size_t _checked = 0;
+	std::chrono::steady_clock::time_point _lastFlush;
+};
+
+template <class T> static std::function<void(std::vector<T>&)> AppendResultsTo(std::vector<T>& dest)
+{
+	return [&dest](std::vector<T>& batch)
 	{
-		ui::StringView buf(buffer.data(), bufsize);
-		size_t off = 0;
-		for (;;)
+		dest.insert(dest.end(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+	};
+}
+
+static std::function<void(std::vector<uint64_t>&)> AppendResultsTo(CompactOffsetList& dest)
+{
+	return [&dest](std::vector<uint64_t>& batch)
+	{
+		dest.Append(batch.data(), batch.size());
+	};
+}
+
+// reads the source sequentially in big chunks (cheap for compressed/slow sources too) and splits each one into
+// position ranges that are scanned on the worker pool with scanFn(chunk, from, to, out)
+// the results of the ranges are appended in order, so they come out exactly as from a single-threaded scan
+template <class T, class F> static void ParallelChunkedScan(IDataSource* ds, uint64_t size, size_t overlap, SearchResultBatcher<T>& out, F&& scanFn)
+{
+	auto& pool = GetWorkerPool();
+	size_t numThreads = pool.GetThreadCount();
+	size_t chunkSize = ui::max(SEARCH_CHUNK_SIZE, numThreads * SEARCH_CHUNK_SIZE_PER_THREAD);
+	// a few ranges per thread to even out the load
+	size_t rangeSize = ui::max(chunkSize / (numThreads * 4), MIN_SEARCH_RANGE_SIZE);
+	std::vector<std::vector<T>> rangeResults;
+
+	ReadAheadReader reader(ds, 0, size, chunkSize, overlap);
+	ReadAheadReader::Chunk chunk;
+	while (reader.NextChunk(chunk))
+	{
+		size_t numRanges = (chunk.size + rangeSize - 1) / rangeSize;
+		if (rangeResults.size() < numRanges)
+			rangeResults.resize(numRanges);
+		pool.ParallelFor(numRanges, [&](size_t i)
+		{
+			rangeResults[i].clear();
+			scanFn(chunk, i * rangeSize, ui::min((i + 1) * rangeSize, chunk.size), rangeResults[i]);
+		});
+		for (size_t i = 0; i < numRanges; i++)
+			out.found.insert(out.found.end(), std::make_move_iterator(rangeResults[i].begin()), std::make_move_iterator(rangeResults[i].end()));
+		if (!out.Update(double(chunk.offset + chunk.size) / size))
+			break;
+	}
+}
+
+// only scans the given ranges of match starts (e.g. from a SearchIndex), split into pieces on the worker pool
+// each piece is read with `extra` more bytes (if available) and scanned with scanFn(data, dataSize, numStarts, base, out)
+template <class T, class F> static void ParallelRangeScan(IDataSource* ds, uint64_t size, const std::vector<SearchIndexRange>& ranges, size_t extra, SearchResultBatcher<T>& out, F&& scanFn)
+{
+	struct Piece
+	{
+		uint64_t start;
+		uint64_t end;
+	};
+	std::vector<Piece> pieces;
+	for (const auto& R : ranges)
+	{
+		uint64_t end = ui::min(R.end, size);
+		for (uint64_t at = R.start; at < end; at += INDEXED_SEARCH_PIECE_SIZE)
+			pieces.push_back({ at, ui::min(at + INDEXED_SEARCH_PIECE_SIZE, end) });
+	}
+
+	auto& pool = GetWorkerPool();
+	size_t batchSize = pool.GetThreadCount() * 4;
+	std::vector<std::vector<T>> pieceResults(ui::min(batchSize, pieces.size()));
+	for (size_t first = 0; first < pieces.size(); first += batchSize)
+	{
+		size_t count = ui::min(batchSize, pieces.size() - first);
+		pool.ParallelFor(count, [&](size_t i)
 		{
-			size_t loc = buf.find_first_at(frag, off);
-			if (loc == SIZE_MAX)
-				break;
-			results.push_back(fileoff + loc);
-			off = loc + 1;
+			const Piece& P = pieces[first + i];
+			size_t readSize = size_t(ui::min(P.end + extra, size) - P.start);
+			std::vector<char> buf(readSize);
+			DataSpan span = ds->ViewOrRead(P.start, readSize, buf.data());
+			pieceResults[i].clear();
+			scanFn(static_cast<const char*>(span.data), span.size, ui::min(size_t(P.end - P.start), span.size), P.start, pieceResults[i]);
+		});
+		for (size_t i = 0; i < count; i++)
+			out.found.insert(out.found.end(), std::make_move_iterator(pieceResults[i].begin()), std::make_move_iterator(pieceResults[i].end()));
+		if (!out.Update(double(first + count) / pieces.size()))
+			break;
+	}
+}
+
+
+std::function<void(BackgroundSearch::Job*)> FragmentSearch::_PrepareSearch(IDataSource* ds, SearchIndex* index)
+{
+	search.Stop();
+	matchWidth = textFragment.size();
+	results.Clear();
+	droppedResults = 0;
+	resultPatterns.clear();
+	resultPatternList.clear();
+	patternError.clear();
+	resultSource = ds;
+	resultRegex = nullptr;
+	resultDistances.clear();
+	resultApprox = nullptr;
+	usedIndex = false;
+	searchedBytes = ds->GetSize();
+	if (!useIndex)
+		index = nullptr;
+
+	if (multiPattern)
+		return _PrepareMultiPatternSearch(ds, index);
+	switch (mode)
+	{
+	case FragmentSearchMode::Hex: return _PrepareBytePatternSearch(ds, index);
+	case FragmentSearchMode::Regex: return _PrepareRegexSearch(ds);
+	case FragmentSearchMode::Approximate: return _PrepareApproximateSearch(ds, index);
+	default: return _PrepareTextSearch(ds, index);
+	}
+}
+
+void FragmentSearch::PerformSearch(IDataSource* ds, SearchIndex* index)
+{
+	if (auto fn = _PrepareSearch(ds, index))
+		fn(nullptr);
+}
+
+void FragmentSearch::StartSearch(IDataSource* ds, SearchIndex* index)
+{
+	if (auto fn = _PrepareSearch(ds, index))
+		search.Start(std::move(fn));
+}
+
+void FragmentSearch::_SetUsedIndex(BackgroundSearch::Job* job, const std::vector<SearchIndexRange>& ranges)
+{
+	uint64_t bytes = 0;
+	for (const auto& R : ranges)
+		bytes += R.end - R.start;
+	RunForSearch(job, [this, bytes]()
+	{
+		usedIndex = true;
+		searchedBytes = bytes;
+	});
+}
+
+std::function<void(BackgroundSearch::Job*)> FragmentSearch::_PrepareTextSearch(IDataSource* ds, SearchIndex* index)
+{
+	std::string frag = textFragment;
+	uint64_t size = ds->GetSize();
+	if (frag.empty() || frag.size() > size)
+		return {};
+
+	return [this, ds, index, frag, size, limit = uint64_t(maxResults)](BackgroundSearch::Job* job)
+	{
+		SearchResultBatcher<uint64_t> sink(job, AppendResultsTo(results));
+		sink.SetLimit(limit, &droppedResults);
+		std::vector<SearchIndexRange> ranges;
+		if (index && index->GetCandidateRanges({ { frag, 0 } }, frag.size(), ranges))
+		{
+			_SetUsedIndex(job, ranges);
+			ParallelRangeScan(ds, size, ranges, frag.size() - 1, sink, [&frag](const char* data, size_t dataSize, size_t numStarts, uint64_t base, std::vector<uint64_t>& out)
+			{
+				FindAllOccurrences(data, dataSize, frag.data(), frag.size(), base, out);
+			});
 		}
+		else
+		{
+			// the overlap is shorter than the fragment so matches in it can't have been found in the previous chunk
+			ParallelChunkedScan(ds, size, frag.size() - 1, sink, [&frag](const ReadAheadReader::Chunk& chunk, size_t from, size_t to, std::vector<uint64_t>& out)
+			{
+				// the data for the range extends into the next one, for the matches starting near its end
+				size_t avail = ui::min(to - from + frag.size() - 1, chunk.size - from);
+				FindAllOccurrences(chunk.data + from, avail, frag.data(), frag.size(), chunk.offset + from, out);
+			});
+		}
+		sink.Finish();
+	};
+}
+
+std::function<void(BackgroundSearch::Job*)> FragmentSearch::_PrepareBytePatternSearch(IDataSource* ds, SearchIndex* index)
+{
+	auto pattern = std::make_shared<BytePattern>();
+	if (!pattern->Parse(textFragment, patternError))
+		return {};
+	matchWidth = pattern->GetMinSize();
+
+	uint64_t size = ds->GetSize();
+	return [this, ds, index, pattern, size, limit = uint64_t(maxResults)](BackgroundSearch::Job* job)
+	{
+		const BytePattern& P = *pattern;
+		size_t overlap = P.GetMaxSize() - 1;
+		SearchResultBatcher<uint64_t> sink(job, AppendResultsTo(results));
+		sink.SetLimit(limit, &droppedResults);
 
-		if (frag.size() > 1)
+		// wildcards can't be looked up so only the longest run of exact bytes is
+		SearchIndexLiteral literal;
+		P.GetLongestLiteral(literal.bytes, literal.offset);
+		std::vector<SearchIndexRange> ranges;
+		if (index && index->GetCandidateRanges({ literal }, P.GetMaxSize(), ranges))
 		{
-			// move the unprocessed part to the beginning
-			size_t rem = frag.size() - 1;
-			memmove(&buffer[0], &buffer[nread - rem], rem);
-			readoff += nread;
-			fileoff = readoff - rem;
-			nread = ds->Read(readoff, buffer.size() - rem, &buffer[rem]);
-			bufsize = rem + nread;
+			_SetUsedIndex(job, ranges);
+			ParallelRangeScan(ds, size, ranges, overlap, sink, [&P](const char* data, size_t dataSize, size_t numStarts, uint64_t base, std::vector<uint64_t>& out)
+			{
+				P.FindAll(data, dataSize, numStarts, base, out);
+			});
 		}
 		else
 		{
-			fileoff += nread;
-			nread = ds->Read(fileoff, buffer.size(), &buffer[0]);
+			ParallelChunkedScan(ds, size, overlap, sink, [&P, size, overlap](const ReadAheadReader::Chunk& chunk, size_t from, size_t to, std::vector<uint64_t>& out)
+			{
+				// with gaps, the same start can match at several lengths so each start is only tried in one chunk:
+				// the last one that has all the bytes that a match from it could need
+				bool last = chunk.offset + chunk.size == size;
+				size_t ownedEnd = last ? chunk.size : chunk.size - overlap;
+				if (from < ownedEnd)
+					P.FindAll(chunk.data + from, chunk.size - from, ui::min(to, ownedEnd) - from, chunk.offset + from, out);
+			});
 		}
+		sink.Finish();
+	};
+}
+
+std::function<void(BackgroundSearch::Job*)> FragmentSearch::_PrepareRegexSearch(IDataSource* ds)
+{
+	auto regex = std::make_shared<ByteRegex>();
+	if (!regex->Parse(textFragment, patternError))
+		return {};
+	resultRegex = regex;
+
+	// the index is not used since there's no single literal that every match must contain
+	uint64_t size = ds->GetSize();
+	return [this, ds, regex, size, limit = uint64_t(maxResults)](BackgroundSearch::Job* job)
+	{
+		const ByteRegex& R = *regex;
+		size_t overlap = REGEX_MAX_MATCH_SIZE;
+		SearchResultBatcher<uint64_t> sink(job, AppendResultsTo(results));
+		sink.SetLimit(limit, &droppedResults);
+		ParallelChunkedScan(ds, size, overlap, sink, [&R, size, overlap](const ReadAheadReader::Chunk& chunk, size_t from, size_t to, std::vector<uint64_t>& out)
+		{
+			// as with the byte patterns, each start is only tried in the last chunk that has the bytes for the longest match from it,
+			// and the starts are found by scanning back from the end of the longest match from the last one
+			bool last = chunk.offset + chunk.size == size;
+			size_t ownedEnd = last ? chunk.size : chunk.size - overlap;
+			if (from < ownedEnd)
+			{
+				size_t numStarts = ui::min(to, ownedEnd) - from;
+				R.FindAllStarts(chunk.data + from, ui::min(chunk.size - from, numStarts + overlap), numStarts, chunk.offset + from, out);
+			}
+		});
+		sink.Finish();
+	};
+}
+
+std::function<void(BackgroundSearch::Job*)> FragmentSearch::_PrepareApproximateSearch(IDataSource* ds, SearchIndex* index)
+{
+	auto matcher = std::make_shared<ApproximateMatcher>();
+	if (!matcher->Init(textFragment, distanceType, maxDistance, patternError))
+		return {};
+	resultApprox = matcher;
+
+	std::vector<SearchIndexLiteral> literals;
+	std::vector<std::string> pieces;
+	std::vector<size_t> offsets;
+	if (matcher->GetRequiredLiterals(pieces, offsets))
+	{
+		for (size_t i = 0; i < pieces.size(); i++)
+			literals.push_back({ pieces[i], offsets[i] });
 	}
+
+	uint64_t size = ds->GetSize();
+	return [this, ds, index, matcher, literals, size, limit = uint64_t(maxResults)](BackgroundSearch::Job* job)
+	{
+		const ApproximateMatcher& M = *matcher;
+		SearchResultBatcher<ApproxMatch> sink(job, [this](std::vector<ApproxMatch>& batch)
+		{
+			for (const auto& m : batch)
+			{
+				results.Append(m.offset);
+				resultDistances.push_back(uint8_t(m.distance));
+			}
+		});
+		sink.SetLimit(limit, &droppedResults);
+
+		std::vector<SearchIndexRange> ranges;
+		if (index && !literals.empty() && index->GetCandidateRanges(literals, M.GetMaxMatchSize(), ranges))
+		{
+			// only with the Hamming distance, which doesn't look at the data around the matches
+			_SetUsedIndex(job, ranges);
+			ParallelRangeScan(ds, size, ranges, M.GetMaxMatchSize() - 1, sink, [&M](const char* data, size_t dataSize, size_t numStarts, uint64_t base, std::vector<ApproxMatch>& out)
+			{
+				M.FindAll(data, dataSize, 0, numStarts, base, out);
+			});
+		}
+		else
+		{
+			// the edit distance compares each start with the ones next to it, so a byte more is needed on both sides,
+			// and each start is only tried in the last chunk that has all of that
+			size_t overlap = M.GetMaxMatchSize() + 1;
+			ParallelChunkedScan(ds, size, overlap, sink, [&M, size, overlap](const ReadAheadReader::Chunk& chunk, size_t from, size_t to, std::vector<ApproxMatch>& out)
+			{
+				bool last = chunk.offset + chunk.size == size;
+				size_t ownedEnd = last ? chunk.size : chunk.size - overlap + 1;
+				size_t begin = ui::max(from, size_t(chunk.offset != 0 ? 1 : 0));
+				size_t end = ui::min(to, ownedEnd);
+				if (begin < end)
+				{
+					size_t before = begin > 0 ? 1 : 0;
+					size_t at = begin - before;
+					M.FindAll(chunk.data + at, ui::min(chunk.size - at, end - at + overlap), before, end - at, chunk.offset + at, out);
+				}
+			});
+		}
+		sink.Finish();
+	};
 }
 
-void FragmentSearch::SearchUI(IDataSource* ds)
+std::function<void(BackgroundSearch::Job*)> FragmentSearch::_PrepareMultiPatternSearch(IDataSource* ds, SearchIndex* index)
 {
-	ui::Push<ui::StackExpandLTRLayoutElement>();
-	ui::imm::PropEditString("\bText", textFragment.c_str(), [this](const char* v) { textFragment = v; });
-	auto tmpl = ui::StackExpandLTRLayoutElement::GetSlotTemplate();
-	tmpl->DisableScaling();
-	if (ui::imm::Button("Search"))
+	auto matcher = std::make_shared<MultiPatternMatcher>();
+	matcher->Build(patterns);
+	if (matcher->IsEmpty())
+		return {};
+	resultPatternList = patterns;
+
+	// a match can be of any of the patterns
+	std::vector<SearchIndexLiteral> literals;
+	for (const auto& P : patterns)
+		if (!P.empty())
+			literals.push_back({ P, 0 });
+
+	return [this, ds, index, matcher, literals, limit = uint64_t(maxResults)](BackgroundSearch::Job* job)
+	{
+		const MultiPatternMatcher& M = *matcher;
+		size_t overlap = M.GetMaxPatternSize() - 1;
+		uint64_t size = ds->GetSize();
+		SearchResultBatcher<MultiPatternMatch> sink(job, [this](std::vector<MultiPatternMatch>& batch)
+		{
+			for (const auto& m : batch)
+			{
+				results.Append(m.offset);
+				resultPatterns.push_back(m.pattern);
+			}
+		});
+		sink.SetLimit(limit, &droppedResults);
+
+		std::vector<SearchIndexRange> ranges;
+		if (index && index->GetCandidateRanges(literals, M.GetMaxPatternSize(), ranges))
+		{
+			_SetUsedIndex(job, ranges);
+			ParallelRangeScan(ds, size, ranges, overlap, sink, [&M](const char* data, size_t dataSize, size_t numStarts, uint64_t base, std::vector<MultiPatternMatch>& out)
+			{
+				M.FindAll(data, dataSize, numStarts, base, out);
+			});
+		}
+		else
+		{
+			ParallelChunkedScan(ds, size, overlap, sink, [&M, overlap](const ReadAheadReader::Chunk& chunk, size_t from, size_t to, std::vector<MultiPatternMatch>& out)
+			{
+				M.FindAll(chunk.data + from, chunk.size - from, to - from, chunk.offset + from, out);
+				// unlike with a single pattern, the shorter ones can fit in the overlap, and then they were found in the previous chunk
+				if (chunk.offset != 0 && from < overlap)
+				{
+					out.erase(std::remove_if(out.begin(), out.end(), [&](const MultiPatternMatch& m)
+					{
+						return m.offset - chunk.offset + M.GetPatternSize(m.pattern) <= overlap;
+					}), out.end());
+				}
+			});
+		}
+		sink.Finish();
+	};
+}
+
+size_t FragmentSearch::GetMatchWidth(size_t row)
+{
+	if (row < resultPatterns.size())
+		return resultPatternList[resultPatterns[row]].size();
+	// only the displayed rows are matched again, and the shown text is limited
+	if (resultRegex && row < results.Size())
+		return ui::min(resultRegex->GetLongestMatch(resultSource, results[row]), REGEX_MAX_DISPLAYED_MATCH_SIZE);
+	if (resultApprox && row < resultDistances.size())
 	{
-		PerformSearch(ds);
+		uint64_t off = results[row];
+		size_t readSize = size_t(ui::min(uint64_t(resultApprox->GetMaxMatchSize()), resultSource->GetSize() - off));
+		char buf[APPROX_MAX_PATTERN_SIZE * 2];
+		DataSpan span = resultSource->ViewOrRead(off, readSize, buf);
+		return resultApprox->GetMatchSize(span.data, span.size, resultDistances[row]);
 	}
-	ui::Pop();
+	return matchWidth;
+}
+
+#if 0
+// set BDAT_BENCH_SEARCH_DIR to a directory with a few GB of free space to compare the fragment search kernels
+// (the synthetic file is pseudo-random with the needle planted every 64 KB, so every run must find the same count)
+struct FragmentSearchBenchmark
+{
+	FragmentSearchBenchmark()
+	{
+		if (const char* dir = getenv("BDAT_BENCH_SEARCH_DIR"))
+		{
+			Run(dir);
+			exit(0);
+		}
+	}
+	static double Now()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	void Run(const char* dir)
+	{
+		const uint64_t fileSize = 4ULL * 1024 * 1024 * 1024;
+		const char needle[] = "\x89PNG\r\n\x1a\n";
+		std::string path = ui::to_string(dir, "/bdat_search_bench.bin");
+
+		FILE* fp = fopen(path.c_str(), "wb");
+		if (!fp)
+			return;
+		std::vector<char> block(64 * 1024);
+		uint32_t seed = 1;
+		for (uint64_t off = 0; off < fileSize; off += block.size())
+		{
+			for (auto& c : block)
+			{
+				seed = seed * 1664525 + 1013904223;
+				c = char(seed >> 24);
+			}
+			memcpy(&block[off / block.size() % (block.size() - 16)], needle, sizeof(needle) - 1);
+			fwrite(block.data(), 1, block.size(), fp);
+		}
+		fclose(fp);
+
+		ui::RCHandle<IDataSource> ds(OpenFileDataSource(path.c_str()));
+		FragmentSearch fs;
+		fs.textFragment = std::string(needle, sizeof(needle) - 1);
+		for (SIMDLevel level : { SIMDLevel::Scalar, SIMDLevel::SSE2, SIMDLevel::AVX2 })
+		{
+			if (level > GetSupportedSIMDLevel())
+				continue;
+			g_searchSIMDLevel = level;
+			double t0 = Now();
+			fs.PerformSearch(ds);
+			double t = Now() - t0;
+			printf("%-8s %8.2f s %8.1f MB/s %zu found\n", SIMDLevelToString(level), t, fileSize / t / (1024 * 1024), fs.results.Size());
+		}
+		g_searchSIMDLevel = GetSupportedSIMDLevel();
+		ds = nullptr;
+		remove(path.c_str());
+	}
+}
+gFragmentSearchBenchmark;
+#endif
+
+static void ResultLimitUI(uint32_t& maxResults, size_t numResults, uint64_t droppedResults)
+{
+	ui::imm::PropEditInt("Max. results", maxResults, {}, {}, ui::Range<uint32_t>::AtLeast(1));
+	if (droppedResults)
+		ui::MakeWithText<ui::LabelFrame>(ui::Format("Showing the first %zu matches, %" PRIu64 " more were dropped", numResults, droppedResults));
+}
+
+static std::string GetSearchIndexStateText(SearchIndex* index)
+{
+	switch (index->GetState())
+	{
+	case SearchIndexState::None: return "Index: not built";
+	case SearchIndexState::Building: return ui::Format("Index: building (%d%%)", int(index->GetBuildProgress() * 100));
+	case SearchIndexState::Ready: return "Index: ready";
+	case SearchIndexState::OutOfDate: return "Index: out of date (the file has changed)";
+	case SearchIndexState::Failed: return ui::Format("Index: failed (%s)", index->GetError().c_str());
+	}
+	return {};
+}
+
+void FragmentSearch::SearchUI(DDFile* file)
+{
+	IDataSource* ds = file->dataSource;
+	SearchIndex* index = file->searchIndex;
+	if (index)
+	{
+		ui::Push<ui::StackExpandLTRLayoutElement>();
+		ui::MakeWithText<ui::LabelFrame>(GetSearchIndexStateText(index));
+		auto tmpl = ui::StackExpandLTRLayoutElement::GetSlotTemplate();
+		tmpl->DisableScaling();
+		ui::imm::PropEditBool("\bUse", useIndex);
+		if (index->GetState() == SearchIndexState::Building)
+		{
+			if (ui::imm::Button("Cancel"))
+				index->CancelBuild();
+		}
+		else if (ui::imm::Button(index->GetState() == SearchIndexState::Ready ? "Rebuild index" : "Build index"))
+		{
+			index->StartBuild();
+		}
+		ui::Pop();
+	}
+
+	ui::imm::PropEditBool("Multiple patterns", multiPattern);
+	if (multiPattern)
+	{
+		auto& seqEd = ui::Make<ui::SequenceEditor>();
+		seqEd.SetSequence(ui::BuildAlloc<ui::StdSequence<decltype(patterns)>>(patterns));
+		seqEd.itemUICallback = [](ui::SequenceEditor* se, size_t idx, void* ptr)
+		{
+			auto& P = *static_cast<std::string*>(ptr);
+			ui::imm::PropEditString(nullptr, P.c_str(), [&P](const char* v) { P = v; });
+		};
+
+		ui::Push<ui::StackLTRLayoutElement>();
+		if (ui::imm::Button("Add"))
+		{
+			patterns.push_back({});
+		}
+		if (ui::imm::Button("Load list..."))
+		{
+			ui::FileSelectionWindow fsw;
+			fsw.filters.push_back({ "Text files (*.txt)", "*.txt" });
+			fsw.filters.push_back({ "Any file", "*" });
+			if (fsw.Show(false))
+			{
+				auto file = ui::ReadTextFile(fsw.currentDir + "/" + fsw.selectedFiles[0]);
+				if (file.result == ui::IOResult::Success)
+				{
+					// one pattern per line
+					std::string text = ui::to_string(file.data->GetStringView());
+					for (size_t pos = 0; pos < text.size();)
+					{
+						size_t end = text.find('\n', pos);
+						if (end == std::string::npos)
+							end = text.size();
+						std::string line = text.substr(pos, end - pos);
+						if (!line.empty() && line.back() == '\r')
+							line.pop_back();
+						if (!line.empty())
+							patterns.push_back(std::move(line));
+						pos = end + 1;
+					}
+				}
+			}
+		}
+		if (ui::imm::Button("Clear"))
+		{
+			patterns.clear();
+		}
+		if (ui::imm::Button("Search"))
+		{
+			StartSearch(ds, index);
+		}
+		ui::Pop();
+	}
+	else
+	{
+		ui::Push<ui::StackExpandLTRLayoutElement>();
+		static const char* labels[] = { "\bText", "\bPattern", "\bRegex", "\bText" };
+		ui::imm::PropEditString(labels[int(mode)], textFragment.c_str(), [this](const char* v) { textFragment = v; });
+		auto tmpl = ui::StackExpandLTRLayoutElement::GetSlotTemplate();
+		tmpl->DisableScaling();
+		ui::imm::PropDropdownMenuList("\bMode", mode, ui::BuildAlloc<ui::ZeroSepCStrOptionList>("Text\0Hex\0Regex\0Approximate\0"));
+		if (ui::imm::Button("Search"))
+		{
+			StartSearch(ds, index);
+		}
+		ui::Pop();
+
+		if (mode == FragmentSearchMode::Approximate)
+		{
+			ui::Push<ui::StackExpandLTRLayoutElement>();
+			ui::imm::PropDropdownMenuList("Distance", distanceType, ui::BuildAlloc<ui::ZeroSepCStrOptionList>("Hamming (changed bytes)\0Edit (inserted/removed/changed)\0"));
+			ui::imm::PropEditInt("\bMax.", maxDistance, {}, {}, ui::Range<uint32_t>::AtMost(APPROX_MAX_PATTERN_SIZE - 1));
+			ui::Pop();
+		}
+
+		if (!patternError.empty())
+			ui::MakeWithText<ui::LabelFrame>(ui::Format("Error: %s", patternError.c_str()));
+		else if (mode == FragmentSearchMode::Hex)
+			ui::MakeWithText<ui::LabelFrame>("e.g. 3F 80 ?? ?0 00&F0 [2-8] \"text\"");
+		else if (mode == FragmentSearchMode::Regex)
+			ui::MakeWithText<ui::LabelFrame>("e.g. HDR[\\x00-\\x0f].{4}(ab|cd)+");
+	}
+
+	search.ProgressUI();
+	if (usedIndex && resultSource)
+		ui::MakeWithText<ui::LabelFrame>(ui::Format("Searched %" PRIu64 " of %" PRIu64 " bytes using the index", searchedBytes, resultSource->GetSize()));
+	ResultLimitUI(maxResults, results.Size(), droppedResults);
 
 	ui::Push<ui::StackExpandLTRLayoutElement>();
 	ui::MakeWithText<ui::LabelFrame>("Context bytes");
@@ -102,13 +761,14 @@ enum FS_Cols
 {
 	FS_COL_Offset,
 	FS_COL_Match,
+	FS_COL_Extra, // the pattern of multi-pattern results, the distance of approximate ones
 
 	FS_COL__COUNT,
 };
 
 size_t FragmentSearch::GetNumCols()
 {
-	return FS_COL__COUNT;
+	return resultPatternList.empty() && !resultApprox ? FS_COL_Extra : FS_COL__COUNT;
 }
 
 std::string FragmentSearch::GetColName(size_t col)
@@ -117,6 +777,7 @@ std::string FragmentSearch::GetColName(size_t col)
 	{
 	case FS_COL_Offset: return "Offset";
 	case FS_COL_Match: return "Match";
+	case FS_COL_Extra: return resultApprox ? "Distance" : "Pattern";
 	default: return "???";
 	}
 }
@@ -128,6 +789,7 @@ std::string FragmentSearch::GetText(uintptr_t id, size_t col)
 	case FS_COL_Offset: return std::to_string(results[id]);
 	case FS_COL_Match:
 	{
+		size_t matchWidth = GetMatchWidth(id);
 		std::string tmp;
 		size_t size = bytesBeforeMatch + matchWidth + bytesAfterMatch;
 		tmp.resize(size, ' ');
@@ -144,13 +806,17 @@ std::string FragmentSearch::GetText(uintptr_t id, size_t col)
 		resultSource->GetASCIIText(&tmp[off], size, pos, ' ');
 		return tmp;
 	}
+	case FS_COL_Extra:
+		if (resultApprox)
+			return std::to_string(resultDistances[id]);
+		return ui::Format("%u: %s", unsigned(resultPatterns[id]), resultPatternList[resultPatterns[id]].c_str());
 	default: return "???";
 	}
 }
 
 size_t FragmentSearch::GetNumRows()
 {
-	return results.size();
+	return results.Size();
 }
 
 std::string FragmentSearch::GetRowName(size_t row)
@@ -160,214 +826,109 @@ std::string FragmentSearch::GetRowName(size_t row)
 
 
 
-struct CSString : std::string
-{
-	void add(const std::string& s)
-	{
-		if (!empty())
-			*this += ", ";
-		*this += s;
-	}
-};
-
-struct FileInfo
-{
-	CSString desc;
-	CSString misc;
-	CSString err;
-	uint64_t size = 0;
-};
-
-typedef bool FileFormatCheckFunc(char* bytes);
-typedef void FileFormatDescFunc(IDataSource* ds, uint64_t off, FileInfo& fi);
-struct FileFormatInfo
-{
-	const char* name;
-	const char* ext;
-	size_t prefixBytes;
-	FileFormatCheckFunc* checkFunc;
-	FileFormatDescFunc* descFunc;
-};
-
-static void FileFormatDescFunc_DDS(IDataSource* ds, uint64_t off, FileInfo& fi)
-{
-	using u = unsigned;
-	using DWORD = uint32_t;
-	struct DDS_PIXELFORMAT
-	{
-		DWORD dwSize;
-		DWORD dwFlags;
-		DWORD dwFourCC;
-		DWORD dwRGBBitCount;
-		DWORD dwRBitMask;
-		DWORD dwGBitMask;
-		DWORD dwBBitMask;
-		DWORD dwABitMask;
-	};
-	struct DDS_HEADER
-	{
-		DWORD           dwSize;
-		DWORD           dwFlags;
-		DWORD           dwHeight;
-		DWORD           dwWidth;
-		DWORD           dwPitchOrLinearSize;
-		DWORD           dwDepth;
-		DWORD           dwMipMapCount;
-		DWORD           dwReserved1[11];
-		DDS_PIXELFORMAT ddspf;
-		DWORD           dwCaps;
-		DWORD           dwCaps2;
-		DWORD           dwCaps3;
-		DWORD           dwCaps4;
-		DWORD           dwReserved2;
-	};
-	using DXGI_FORMAT = uint32_t;
-	using D3D10_RESOURCE_DIMENSION = uint32_t;
-	using UINT = uint32_t;
-	struct DDS_HEADER_DXT10
-	{
-		DXGI_FORMAT              dxgiFormat;
-		D3D10_RESOURCE_DIMENSION resourceDimension;
-		UINT                     miscFlag;
-		UINT                     arraySize;
-		UINT                     miscFlags2;
-	};
-
-	DDS_HEADER h;
-	ds->Read(off + 4, sizeof(h), &h);
-
-	char fourcc[4];
-	memcpy(&fourcc, &h.ddspf.dwFourCC, 4);
-
-	fi.desc.add(ui::Format("DDS %ux%ux%u (p/ls=%u, mips=%u) fourcc=%c%c%c%c",
-		u(h.dwWidth), u(h.dwHeight), u(h.dwDepth),
-		u(h.dwPitchOrLinearSize), u(h.dwMipMapCount),
-		fourcc[0], fourcc[1], fourcc[2], fourcc[3]));
-
-	if (h.dwSize != 124)
-		fi.err.add(ui::Format("bad header size: %u (need 124)", u(h.dwSize)));
-}
-
-#define CHECK4(b, c0, c1, c2, c3) (b[0] == c0 && b[1] == c1 && b[2] == c2 && b[3] == c3)
-FileFormatInfo g_formats[] =
-{
-	{ "DDS", ".dds", 4, [](char* b) { return CHECK4(b, 'D', 'D', 'S', ' '); }, FileFormatDescFunc_DDS },
-};
-
 enum FFS_Cols
 {
 	FFS_COL_Offset,
 	FFS_COL_Size,
 	FFS_COL_Desc,
+	FFS_COL_CarvedAs,
 
 	FFS_COL__COUNT,
 };
 
-void FileFormatSearch::PerformSearch(IDataSource* ds)
+std::function<void(BackgroundSearch::Job*)> FileFormatSearch::_PrepareSearch(IDataSource* ds)
 {
+	search.Stop();
 	results.clear();
+	droppedResults = 0;
 	resultSource = ds;
-	size_t minSize = SIZE_MAX;
-	size_t maxSize = 0;
-	for (auto& fmt : g_formats)
-	{
-		minSize = ui::min(minSize, fmt.prefixBytes);
-		maxSize = ui::max(maxSize, fmt.prefixBytes);
-	}
+	selected = SIZE_MAX;
+	auto dispatcher = std::make_shared<FileFormatDispatcher>();
+	dispatcher->Build(formats);
 	// there shouldn't be a single format that is defined by only a single byte
-	assert(maxSize != 1);
+	assert(dispatcher->IsEmpty() || dispatcher->GetMinPrefixBytes() >= 2);
 
-	if (maxSize == 0)
-		return;
+	if (dispatcher->IsEmpty())
+		return {};
 
 	uint64_t size = ds->GetSize();
-	if (minSize > size)
-		return;
+	if (dispatcher->GetMinPrefixBytes() > size)
+		return {};
 
-	// preferred size
-	size_t bufSize = size > SIZE_MAX ? SIZE_MAX : size;
-	if (bufSize > 65536)
-		bufSize = 65536; // don't read the entire file
-	if (bufSize < maxSize * 2)
-		bufSize = maxSize * 2; // absolute minimum
-
-	std::string buffer;
-	buffer.resize(maxSize * 100);
-
-	if (buffer.size() >= size)
+	size_t overlap = dispatcher->GetMaxPrefixBytes() - 1;
+	return [this, ds, dispatcher, size, overlap, limit = uint64_t(maxResults)](BackgroundSearch::Job* job)
 	{
-		ds->Read(0, size, &buffer[0]);
-
-		for (size_t i = 0; i < buffer.size(); i++)
+		const FileFormatDispatcher& D = *dispatcher;
+		SearchResultBatcher<Result> sink(job, AppendResultsTo(results));
+		sink.SetLimit(limit, &droppedResults);
+		ParallelChunkedScan(ds, size, overlap, sink, [ds, &D, overlap](const ReadAheadReader::Chunk& chunk, size_t from, size_t to, std::vector<Result>& out)
 		{
-			for (auto& fmt : g_formats)
+			bool first = chunk.offset == 0;
+			// every format has at least two bytes to look up
+			size_t end = ui::min(to, chunk.size - 1);
+			for (size_t i = from; i < end; i++)
 			{
-				if (i + fmt.prefixBytes <= buffer.size() && fmt.checkFunc(&buffer[i]))
+				size_t count;
+				const uint8_t* candidates = D.GetCandidates(chunk.data + i, count);
+				for (size_t c = 0; c < count; c++)
 				{
-					FileInfo fi;
-					fmt.descFunc(ds, i, fi);
-					Result r;
-					r.offset = i;
-					r.size = fi.size;
-					r.format = &fmt - g_formats;
-					r.desc = std::move(fi.desc);
-					results.push_back(r);
+					const FileFormatInfo& fmt = g_formats[candidates[c]];
+					// prefixes that fit in the overlap were already checked in the previous chunk
+					if ((first || i + fmt.prefixBytes > overlap) &&
+						i + fmt.prefixBytes <= chunk.size && fmt.checkFunc(chunk.data + i))
+					{
+						FileInfo fi;
+						if (!fmt.descFunc(ds, chunk.offset + i, fi))
+							continue;
+						Result r;
+						r.offset = chunk.offset + i;
+						r.size = fi.size;
+						r.decompressedSize = fi.decompressedSize;
+						r.format = candidates[c];
+						if (!fi.misc.empty())
+							fi.desc.add(fi.misc);
+						if (!fi.err.empty())
+							fi.desc.add("error: " + fi.err);
+						r.desc = std::move(fi.desc);
+						out.push_back(r);
+					}
 				}
 			}
-		}
-		return;
-	}
+		});
+		sink.Finish();
+	};
+}
 
-	bool first = true;
-	uint64_t fileoff = 0, readoff = 0;
-	size_t nread = ds->Read(0, buffer.size(), &buffer[0]);
-	size_t bufsize = nread;
-	while (nread)
-	{
-		for (size_t i = 0; i < buffer.size(); i++)
-		{
-			for (auto& fmt : g_formats)
-			{
-				if ((first || i >= maxSize - fmt.prefixBytes) &&
-					i + fmt.prefixBytes <= bufsize && fmt.checkFunc(&buffer[i]))
-				{
-					FileInfo fi;
-					fmt.descFunc(ds, fileoff + i, fi);
-					Result r;
-					r.offset = fileoff + i;
-					r.size = fi.size;
-					r.format = &fmt - g_formats;
-					r.desc = std::move(fi.desc);
-					results.push_back(r);
-				}
-			}
-		}
+void FileFormatSearch::PerformSearch(IDataSource* ds)
+{
+	if (auto fn = _PrepareSearch(ds))
+		fn(nullptr);
+}
 
-		if (maxSize > 1)
-		{
-			// move the unprocessed part to the beginning
-			size_t rem = maxSize - 1;
-			memmove(&buffer[0], &buffer[nread - rem], rem);
-			readoff += nread;
-			fileoff = readoff - rem;
-			nread = ds->Read(readoff, buffer.size() - rem, &buffer[rem]);
-			bufsize = rem + nread;
-		}
-		else
-		{
-			fileoff += nread;
-			nread = ds->Read(fileoff, buffer.size(), &buffer[0]);
-		}
-		first = false;
-	}
+void FileFormatSearch::StartSearch(IDataSource* ds)
+{
+	if (auto fn = _PrepareSearch(ds))
+		search.Start(std::move(fn));
 }
 
 void FileFormatSearch::SearchUI(IDataSource* ds)
 {
+	ui::Push<ui::StackLTRLayoutElement>();
+	ui::MakeWithText<ui::LabelFrame>("Formats:");
+	for (size_t i = 0; i < g_numFormats; i++)
+	{
+		bool on = (formats & (1U << i)) != 0;
+		if (ui::imm::PropEditBool(g_formats[i].name, on))
+			formats ^= 1U << i;
+	}
+	ui::Pop();
+
 	if (ui::imm::Button("Search"))
 	{
-		PerformSearch(ds);
+		StartSearch(ds);
 	}
+	search.ProgressUI();
+	ResultLimitUI(maxResults, results.size(), droppedResults);
 }
 
 size_t FileFormatSearch::GetNumCols()
@@ -382,6 +943,7 @@ std::string FileFormatSearch::GetColName(size_t col)
 	case FFS_COL_Offset: return "Offset";
 	case FFS_COL_Size: return "Size";
 	case FFS_COL_Desc: return "Description";
+	case FFS_COL_CarvedAs: return "Carved as";
 	default: return "???";
 	}
 }
@@ -393,6 +955,7 @@ std::string FileFormatSearch::GetText(uintptr_t id, size_t col)
 	case FFS_COL_Offset: return std::to_string(results[id].offset);
 	case FFS_COL_Size: return std::to_string(results[id].size);
 	case FFS_COL_Desc: return results[id].desc;
+	case FFS_COL_CarvedAs: return results[id].carvedFile ? results[id].carvedFile->name : std::string();
 	default: return "???";
 	}
 }
@@ -406,3 +969,234 @@ std::string FileFormatSearch::GetRowName(size_t row)
 {
 	return std::to_string(row + 1);
 }
+
+void FileFormatSearch::ClearSelection()
+{
+	selected = SIZE_MAX;
+}
+
+bool FileFormatSearch::GetSelectionState(uintptr_t item)
+{
+	return selected == item;
+}
+
+void FileFormatSearch::SetSelectionState(uintptr_t item, bool sel)
+{
+	if (sel)
+		selected = item;
+	else if (GetSelectionState(item))
+		selected = SIZE_MAX;
+}
+
+
+static bool ParseSearchInt(const std::string& s, int64_t& out)
+{
+	char* end = nullptr;
+	errno = 0;
+	out = strtoll(s.c_str(), &end, 0);
+	while (*end == ' ')
+		end++;
+	return end != s.c_str() && *end == 0 && errno != ERANGE;
+}
+
+static bool ParseSearchUInt(const std::string& s, uint64_t& out)
+{
+	// strtoull accepts negative numbers
+	if (s.find('-') != std::string::npos)
+		return false;
+	char* end = nullptr;
+	errno = 0;
+	out = strtoull(s.c_str(), &end, 0);
+	while (*end == ' ')
+		end++;
+	return end != s.c_str() && *end == 0 && errno != ERANGE;
+}
+
+static bool ParseSearchFloat(const std::string& s, double& out)
+{
+	char* end = nullptr;
+	out = strtod(s.c_str(), &end);
+	while (*end == ' ')
+		end++;
+	return end != s.c_str() && *end == 0;
+}
+
+bool ValueSearch::_BuildQuery(ValueRangeQuery& q)
+{
+	q.type = type;
+	q.endianness = endianness;
+	q.alignment = 1U << alignmentLog2;
+
+	const std::string& lo = range ? minValue : value;
+	const std::string& hi = range ? maxValue : value;
+	bool ok = true;
+	bool ordered = true;
+	switch (type)
+	{
+	case DT_F32:
+	case DT_F64:
+		ok = ParseSearchFloat(lo, q.fmin) && ParseSearchFloat(hi, q.fmax);
+		if (ok && !range)
+		{
+			// the value that was meant is the nearest float (e.g. 0.1 is between two of them)
+			if (type == DT_F32)
+				q.fmin = q.fmax = float(q.fmin);
+			q.fmin -= tolerance;
+			q.fmax += tolerance;
+		}
+		ordered = q.fmin <= q.fmax;
+		break;
+	case DT_I8:
+	case DT_I16:
+	case DT_I32:
+	case DT_I64:
+		ok = ParseSearchInt(lo, q.imin) && ParseSearchInt(hi, q.imax);
+		ordered = q.imin <= q.imax;
+		break;
+	default:
+		ok = ParseSearchUInt(lo, q.umin) && ParseSearchUInt(hi, q.umax);
+		ordered = q.umin <= q.umax;
+		break;
+	}
+
+	if (!ok)
+	{
+		error = ui::Format("invalid %s value", GetDataTypeName(type));
+		return false;
+	}
+	if (!ordered)
+	{
+		error = "the minimum is greater than the maximum";
+		return false;
+	}
+	return true;
+}
+
+std::function<void(BackgroundSearch::Job*)> ValueSearch::_PrepareSearch(IDataSource* ds)
+{
+	search.Stop();
+	results.Clear();
+	droppedResults = 0;
+	error.clear();
+	resultSource = ds;
+	resultType = type;
+	resultEndianness = endianness;
+
+	ValueRangeQuery q;
+	if (!_BuildQuery(q))
+		return {};
+
+	size_t valueSize = GetDataTypeSize(type);
+	uint64_t size = ds->GetSize();
+	if (valueSize > size)
+		return {};
+
+	return [this, ds, q, valueSize, size, limit = uint64_t(maxResults)](BackgroundSearch::Job* job)
+	{
+		SearchResultBatcher<uint64_t> sink(job, AppendResultsTo(results));
+		sink.SetLimit(limit, &droppedResults);
+		// as with fragments, the values in the overlap didn't fit in the previous chunk
+		ParallelChunkedScan(ds, size, valueSize - 1, sink, [&q, valueSize](const ReadAheadReader::Chunk& chunk, size_t from, size_t to, std::vector<uint64_t>& out)
+		{
+			size_t avail = ui::min(to - from + valueSize - 1, chunk.size - from);
+			FindValuesInRange(chunk.data + from, avail, to - from, q, chunk.offset + from, out);
+		});
+		sink.Finish();
+	};
+}
+
+void ValueSearch::PerformSearch(IDataSource* ds)
+{
+	if (auto fn = _PrepareSearch(ds))
+		fn(nullptr);
+}
+
+void ValueSearch::StartSearch(IDataSource* ds)
+{
+	if (auto fn = _PrepareSearch(ds))
+		search.Start(std::move(fn));
+}
+
+void ValueSearch::SearchUI(IDataSource* ds)
+{
+	ui::imm::PropDropdownMenuList("Type", type, ui::BuildAlloc<ui::ZeroSepCStrOptionList>("char\0i8\0u8\0i16\0u16\0i32\0u32\0i64\0u64\0f32\0f64\0"));
+	ui::imm::PropDropdownMenuList("Endianness", endianness, ui::BuildAlloc<ui::ZeroSepCStrOptionList>("Little\0Big\0"));
+	ui::imm::PropDropdownMenuList("Alignment", alignmentLog2, ui::BuildAlloc<ui::ZeroSepCStrOptionList>("Any\0" "2\0" "4\0" "8\0"));
+	ui::imm::PropEditBool("Range", range);
+	if (range)
+	{
+		ui::Push<ui::StackExpandLTRLayoutElement>();
+		ui::imm::PropEditString("\bMin", minValue.c_str(), [this](const char* v) { minValue = v; });
+		ui::imm::PropEditString("\bMax", maxValue.c_str(), [this](const char* v) { maxValue = v; });
+		ui::Pop();
+	}
+	else
+	{
+		ui::imm::PropEditString("Value", value.c_str(), [this](const char* v) { value = v; });
+		if (type == DT_F32 || type == DT_F64)
+		{
+			// as text, since it's a double
+			ui::imm::PropEditString("Tolerance", ui::Format("%g", tolerance).c_str(), [this](const char* v)
+			{
+				double t;
+				if (ParseSearchFloat(v, t) && t >= 0)
+					tolerance = t;
+			});
+		}
+	}
+	if (ui::imm::Button("Search"))
+	{
+		StartSearch(ds);
+	}
+	search.ProgressUI();
+	ResultLimitUI(maxResults, results.Size(), droppedResults);
+
+	if (!error.empty())
+		ui::MakeWithText<ui::LabelFrame>(ui::Format("Error: %s", error.c_str()));
+}
+
+enum VS_Cols
+{
+	VS_COL_Offset,
+	VS_COL_DataType,
+	VS_COL_Value,
+
+	VS_COL__COUNT,
+};
+
+size_t ValueSearch::GetNumCols()
+{
+	return VS_COL__COUNT;
+}
+
+std::string ValueSearch::GetColName(size_t col)
+{
+	switch (col)
+	{
+	case VS_COL_Offset: return "Offset";
+	case VS_COL_DataType: return "Data type";
+	case VS_COL_Value: return "Value";
+	default: return "???";
+	}
+}
+
+std::string ValueSearch::GetText(uintptr_t id, size_t col)
+{
+	switch (col)
+	{
+	case VS_COL_Offset: return std::to_string(results[id]);
+	case VS_COL_DataType: return GetDataTypeName(resultType);
+	case VS_COL_Value: return GetDataValueText(resultSource, resultType, resultEndianness, results[id]);
+	default: return "???";
+	}
+}
+
+size_t ValueSearch::GetNumRows()
+{
+	return results.Size();
+}
+
+std::string ValueSearch::GetRowName(size_t row)
+{
+	return std::to_string(row + 1);
+}
@@ -1,22 +1,116 @@
 
 #pragma once
 #include "pch.h"
+#include <memory>
 #include "FileReaders.h"
+#include "Markers.h"
+#include "CompactOffsetList.h"
+#include "SearchKernels.h"
 
 
+struct DDFile;
+struct ByteRegex;
+struct SearchIndex;
+struct SearchIndexLiteral;
+struct SearchIndexRange;
+struct ValueRangeQuery;
+
+
+// runs a search on a background thread, the results are handed over to the UI thread in batches as they're found
+// (so the result tables are only ever changed on the UI thread)
+struct BackgroundSearch
+{
+	struct Job : std::enable_shared_from_this<Job>
+	{
+		std::atomic_bool cancel{ false };
+		std::atomic<float> progress{ 0 };
+		// only used on the UI thread
+		BackgroundSearch* owner = nullptr;
+		bool finished = false;
+
+		// runs fn on the UI thread, unless the search is stopped before that
+		void Post(std::function<void()>&& fn);
+	};
+
+	~BackgroundSearch() { Stop(); }
+
+	// stops the previous search and calls fn(job) on a new thread
+	void Start(std::function<void(Job*)>&& fn);
+	// cancels the search and waits for its thread to exit, the results found until then are kept
+	void Stop();
+	bool IsRunning() const { return _job && !_job->finished; }
+	float GetProgress() const { return _job ? _job->progress.load() : 0.0f; }
+	// the progress and a button for cancelling, while the search is running
+	void ProgressUI(const char* label = "Searching");
+
+	std::shared_ptr<Job> _job;
+	std::thread _thread;
+};
+
+// called on the UI thread whenever a background search adds results or finishes
+extern ui::MulticastDelegate<const BackgroundSearch*> OnBackgroundSearchUpdate;
+
+
+enum class FragmentSearchMode : uint8_t
+{
+	Text,
+	Hex,
+	Regex,
+	Approximate,
+};
+
 struct FragmentSearch : ui::TableDataSource
 {
 	std::string textFragment;
+	// how `textFragment` is parsed: plain text, a BytePattern (hex bytes, wildcards, masks, gaps), a ByteRegex
+	// or text to find with up to `maxDistance` differences
+	FragmentSearchMode mode = FragmentSearchMode::Text;
+	ApproxDistanceType distanceType = ApproxDistanceType::Hamming;
+	uint32_t maxDistance = 1;
+	std::string patternError;
+	// finds all of `patterns` in one pass instead of `textFragment`
+	bool multiPattern = false;
+	std::vector<std::string> patterns;
+	// only search the parts of the data that the file's index can't rule out (if it's ready)
+	bool useIndex = true;
 	uint32_t bytesBeforeMatch = 16;
 	uint32_t bytesAfterMatch = 16;
+	// the matches after this many are only counted
+	uint32_t maxResults = 10000000;
 
-	std::vector<uint64_t> results;
+	CompactOffsetList results;
+	uint64_t droppedResults = 0;
 	size_t matchWidth = 0;
+	// for multi-pattern results: the index of the matched pattern in resultPatternList
+	std::vector<uint32_t> resultPatterns;
+	std::vector<std::string> resultPatternList;
 	ui::RCHandle<IDataSource> resultSource;
+	// for regex results, to find the length of each match when it's displayed
+	std::shared_ptr<ByteRegex> resultRegex;
+	// for approximate results: the distance of each match, and the matcher to find its length
+	std::vector<uint8_t> resultDistances;
+	std::shared_ptr<ApproximateMatcher> resultApprox;
+	bool usedIndex = false;
+	uint64_t searchedBytes = 0;
 
-	void PerformSearch(IDataSource* ds);
+	// declared after everything that the search thread uses, so that it's stopped first
+	BackgroundSearch search;
 
-	void SearchUI(IDataSource* ds);
+	// runs the search on the calling thread
+	void PerformSearch(IDataSource* ds, SearchIndex* index = nullptr);
+	// runs the search in the background, the results are added as they're found
+	void StartSearch(IDataSource* ds, SearchIndex* index = nullptr);
+	// resets the results and returns the search to run (if there's anything to search for)
+	std::function<void(BackgroundSearch::Job*)> _PrepareSearch(IDataSource* ds, SearchIndex* index);
+	std::function<void(BackgroundSearch::Job*)> _PrepareTextSearch(IDataSource* ds, SearchIndex* index);
+	std::function<void(BackgroundSearch::Job*)> _PrepareBytePatternSearch(IDataSource* ds, SearchIndex* index);
+	std::function<void(BackgroundSearch::Job*)> _PrepareRegexSearch(IDataSource* ds);
+	std::function<void(BackgroundSearch::Job*)> _PrepareApproximateSearch(IDataSource* ds, SearchIndex* index);
+	std::function<void(BackgroundSearch::Job*)> _PrepareMultiPatternSearch(IDataSource* ds, SearchIndex* index);
+	void _SetUsedIndex(BackgroundSearch::Job* job, const std::vector<SearchIndexRange>& ranges);
+	size_t GetMatchWidth(size_t row);
+
+	void SearchUI(DDFile* file);
 
 	// GenericGridDataSource(TableDataSource)
 	size_t GetNumCols() override;
@@ -27,22 +121,78 @@ struct FragmentSearch : ui::TableDataSource
 	std::string GetRowName(size_t row) override;
 };
 
-struct FileFormatSearch : ui::TableDataSource
+struct FileFormatSearch : ui::TableDataSource, ui::ISelectionStorage
 {
 	struct Result
 	{
 		uint64_t offset;
 		uint64_t size;
 		uint32_t format;
+		uint64_t decompressedSize; // 0 if it's not a compressed stream or the size isn't known
 		std::string desc;
+		// set once the item is carved into a file of its own
+		DDFile* carvedFile = nullptr;
 	};
 
+	// bit i = search for g_formats[i]
 	uint32_t formats = uint32_t(-1);
+	// lower than for the other searches since every result has a description (and magic bytes are common in big files)
+	uint32_t maxResults = 100000;
 
 	std::vector<Result> results;
+	uint64_t droppedResults = 0;
 	ui::RCHandle<IDataSource> resultSource;
+	size_t selected = SIZE_MAX;
+
+	BackgroundSearch search;
+
+	void PerformSearch(IDataSource* ds);
+	void StartSearch(IDataSource* ds);
+	std::function<void(BackgroundSearch::Job*)> _PrepareSearch(IDataSource* ds);
+
+	void SearchUI(IDataSource* ds);
+
+	// GenericGridDataSource(TableDataSource)
+	size_t GetNumCols() override;
+	std::string GetColName(size_t col) override;
+	std::string GetText(uintptr_t id, size_t col) override;
+	// TableDataSource
+	size_t GetNumRows() override;
+	std::string GetRowName(size_t row) override;
+	// ISelectionStorage
+	void ClearSelection() override;
+	bool GetSelectionState(uintptr_t item) override;
+	void SetSelectionState(uintptr_t item, bool sel) override;
+};
+
+struct ValueSearch : ui::TableDataSource
+{
+	DataType type = DT_I32;
+	Endianness endianness = Endianness::Little;
+	// log2 of the alignment of the value offsets (0 = any offset)
+	uint8_t alignmentLog2 = 0;
+	bool range = false;
+	std::string value;
+	std::string minValue;
+	std::string maxValue;
+	// for floating point equality: values within +-tolerance match
+	double tolerance = 0;
+	uint32_t maxResults = 10000000;
+	std::string error;
+
+	CompactOffsetList results;
+	uint64_t droppedResults = 0;
+	DataType resultType = DT_I32;
+	Endianness resultEndianness = Endianness::Little;
+	ui::RCHandle<IDataSource> resultSource;
+
+	BackgroundSearch search;
 
+	// returns false and sets `error` if the values can't be parsed
+	bool _BuildQuery(ValueRangeQuery& q);
 	void PerformSearch(IDataSource* ds);
+	void StartSearch(IDataSource* ds);
+	std::function<void(BackgroundSearch::Job*)> _PrepareSearch(IDataSource* ds);
 
 	void SearchUI(IDataSource* ds);
 
@@ -0,0 +1,518 @@
+
+#include "pch.h"
+#include "SearchIndex.h"
+#include "DataDesc.h"
+#include "Threading.h"
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+
+// The index is a hashed 4-gram signature (a set of INDEX_ROWS bits) of every block of the data, stored bit-sliced:
+// for each hash value, a bitmap of the blocks that contain a 4-gram with that hash.
+// A query only reads the rows of the pattern's 4-grams, and the size is fixed at INDEX_ROWS / INDEX_BLOCK_SIZE bits
+// per byte of data no matter the content (a list of 4-gram positions would be bigger than the data itself).
+// The bitmaps are split into segments of INDEX_SEGMENT_BLOCKS blocks so that each one can be built in memory.
+// A block's signature has the 4-grams that start in it (the last ones end in the next block), matches across a block
+// boundary are found by splitting the pattern's 4-grams between the two blocks.
+// With twice as many rows as there are 4-grams in a block, even a block of random data only sets ~40% of the bits
+// (at 2 bits per byte of data), so every 4-gram of a query still rules out most blocks.
+static const unsigned INDEX_BLOCK_SIZE_LOG2 = 14;
+static const unsigned INDEX_ROWS_LOG2 = 15;
+static const uint64_t INDEX_BLOCK_SIZE = 1ULL << INDEX_BLOCK_SIZE_LOG2;
+static const size_t INDEX_ROWS = size_t(1) << INDEX_ROWS_LOG2;
+static const uint64_t INDEX_SEGMENT_BLOCKS = 16384;
+// a task builds 8 blocks, one byte of each row
+static const uint64_t INDEX_COLUMN_SIZE = INDEX_BLOCK_SIZE * 8;
+static const size_t INDEX_BUILD_CHUNK_SIZE = 16 * INDEX_COLUMN_SIZE;
+// more 4-grams than this don't narrow the search down much further
+static const size_t INDEX_MAX_QUERY_GRAMS = 64;
+
+static const char g_searchIndexMagic[8] = { 'B', 'D', 'A', 'T', 'N', 'G', 'I', 'X' };
+static const uint32_t SEARCH_INDEX_VERSION = 2;
+
+struct SearchIndexHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint8_t blockSizeLog2;
+	uint8_t rowsLog2;
+	uint16_t reserved;
+	uint64_t segmentBlocks;
+	uint64_t settingsHash;
+	uint64_t fileStamp;
+	uint64_t dataSize;
+};
+
+
+ui::MulticastDelegate<const SearchIndex*> OnSearchIndexStateChanged;
+
+static UI_FORCEINLINE unsigned CountTrailingZeroes64(uint64_t v)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward64(&idx, v);
+	return idx;
+#else
+	return __builtin_ctzll(v);
+#endif
+}
+
+static UI_FORCEINLINE uint32_t HashGram(uint32_t gram)
+{
+	return (gram * 2654435761U) >> (32 - INDEX_ROWS_LOG2);
+}
+
+static uint32_t HashGramAt(const char* p)
+{
+	uint32_t gram;
+	memcpy(&gram, p, 4);
+	return HashGram(gram);
+}
+
+static UI_FORCEINLINE void AddGram(uint32_t gram, uint64_t* sig)
+{
+	uint32_t h = HashGram(gram);
+	sig[h / 64] |= 1ULL << (h % 64);
+}
+
+// sets the bits of the 4-grams that start in the data, `after` has the (up to 3) bytes that follow it
+static void AddBlockGrams(const uint8_t* data, size_t size, const uint8_t* after, size_t afterSize, uint64_t* sig)
+{
+	if (size >= 4)
+	{
+		// the first byte is shifted out by the first iteration
+		uint32_t gram = (data[0] << 8) | (data[1] << 16) | (uint32_t(data[2]) << 24);
+		for (size_t i = 3; i < size; i++)
+		{
+			gram = (gram >> 8) | (uint32_t(data[i]) << 24);
+			AddGram(gram, sig);
+		}
+	}
+
+	// the ones that start in the last 3 bytes
+	uint8_t tail[6];
+	size_t inData = ui::min(size, size_t(3));
+	size_t tailSize = inData + ui::min(afterSize, size_t(3));
+	memcpy(tail, data + size - inData, inData);
+	memcpy(tail + inData, after, tailSize - inData);
+	for (size_t i = 0; i < inData && i + 4 <= tailSize; i++)
+	{
+		uint32_t gram;
+		memcpy(&gram, tail + i, 4);
+		AddGram(gram, sig);
+	}
+}
+
+static uint64_t HashBytes(uint64_t h, const void* data, size_t size)
+{
+	// FNV-1a
+	for (size_t i = 0; i < size; i++)
+		h = (h ^ ((const uint8_t*)data)[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+static uint64_t HashString(uint64_t h, const std::string& s)
+{
+	// with the terminator so that the boundaries between strings matter
+	return HashBytes(h, s.c_str(), s.size() + 1);
+}
+
+template <class T> static uint64_t HashValue(uint64_t h, T v)
+{
+	return HashBytes(h, &v, sizeof(v));
+}
+
+
+SearchIndex::SearchIndex(DDFile* file, IDataSource* uneditedSource) : _file(file), _src(uneditedSource)
+{
+	_path = ui::Format("%s.%08x.ngidx", file->path.c_str(), unsigned(_GetSettingsHash()));
+	_eventTarget = std::make_shared<SearchIndex*>(this);
+}
+
+SearchIndex::~SearchIndex()
+{
+	_StopThread();
+	*_eventTarget = nullptr;
+}
+
+void SearchIndex::Open()
+{
+	_StopThread();
+	_state = SearchIndexState::None;
+
+	FILE* fp = fopen(_path.c_str(), "rb");
+	if (!fp)
+		return;
+	SearchIndexHeader hdr;
+	if (_ReadHeader(fp, hdr))
+	{
+		if (hdr.fileStamp && hdr.fileStamp == _GetFileStampHash())
+		{
+			_fileStamp = hdr.fileStamp;
+			_state = SearchIndexState::Ready;
+		}
+		else
+			_state = SearchIndexState::OutOfDate;
+	}
+	fclose(fp);
+}
+
+void SearchIndex::StartBuild()
+{
+	_StopThread();
+	_SetError({});
+	_fileStamp = _GetFileStampHash();
+	_progress = 0;
+	_SetState(SearchIndexState::Building);
+	_thread = std::thread([this]() { _BuildThreadProc(); });
+}
+
+void SearchIndex::CancelBuild()
+{
+	if (GetState() != SearchIndexState::Building)
+		return;
+	// the previous index file is only replaced at the end, so it may still be usable
+	Open();
+	_SetState(GetState());
+}
+
+SearchIndexState SearchIndex::GetState()
+{
+	return _state;
+}
+
+std::string SearchIndex::GetError()
+{
+	std::lock_guard<std::mutex> lock(_errorMutex);
+	return _error;
+}
+
+bool SearchIndex::IsUsable()
+{
+	if (_state != SearchIndexState::Ready)
+		return false;
+	if (!_fileStamp || _GetFileStampHash() != _fileStamp)
+	{
+		_SetState(SearchIndexState::OutOfDate);
+		return false;
+	}
+	return true;
+}
+
+bool SearchIndex::GetCandidateRanges(const std::vector<SearchIndexLiteral>& literals, size_t maxMatchSize, std::vector<SearchIndexRange>& out)
+{
+	out.clear();
+	if (literals.empty() || !IsUsable())
+		return false;
+	for (const auto& L : literals)
+		if (L.bytes.size() < 4)
+			return false;
+
+	FILE* fp = fopen(_path.c_str(), "rb");
+	if (!fp)
+		return false;
+	SearchIndexHeader hdr;
+	bool ok = _ReadHeader(fp, hdr) && hdr.fileStamp == _fileStamp;
+	std::vector<SearchIndexRange> ranges;
+	for (size_t i = 0; i < literals.size() && ok; i++)
+		ok = _AddLiteralCandidates(fp, hdr, literals[i], ranges);
+	fclose(fp);
+	if (!ok)
+		return false;
+
+	// the edits are not in the index so any match overlapping them has to be checked
+	if (auto* overlay = _file->editOverlay.get_ptr())
+	{
+		std::vector<OverlayDataSource::EditRecord> edits;
+		overlay->GetEditedRanges(edits);
+		uint64_t off = _file->off;
+		for (const auto& E : edits)
+		{
+			if (E.at + E.size <= off || E.at >= off + hdr.dataSize)
+				continue;
+			uint64_t start = E.at > off ? E.at - off : 0;
+			uint64_t end = ui::min(E.at + E.size - off, hdr.dataSize);
+			start = start > maxMatchSize - 1 ? start - (maxMatchSize - 1) : 0;
+			ranges.push_back({ start, end });
+		}
+	}
+
+	std::sort(ranges.begin(), ranges.end(), [](const SearchIndexRange& a, const SearchIndexRange& b) { return a.start < b.start; });
+	for (const auto& R : ranges)
+	{
+		if (!out.empty() && R.start <= out.back().end)
+			out.back().end = ui::max(out.back().end, R.end);
+		else
+			out.push_back(R);
+	}
+	return true;
+}
+
+uint64_t SearchIndex::_GetSettingsHash()
+{
+	// everything that changes which data is indexed, other than the file contents
+	uint64_t h = 0xcbf29ce484222325ULL;
+	h = HashString(h, _file->path);
+	for (const auto& P : _file->moreParts)
+		h = HashString(h, P);
+	h = HashString(h, _file->compression);
+	h = HashValue(h, _file->compOff);
+	h = HashValue(h, _file->compSize);
+	h = HashValue(h, _file->off);
+	h = HashValue(h, _file->size);
+	h = HashValue(h, INDEX_BLOCK_SIZE_LOG2);
+	h = HashValue(h, INDEX_ROWS_LOG2);
+	h = HashValue(h, INDEX_SEGMENT_BLOCKS);
+	return h;
+}
+
+uint64_t SearchIndex::_GetFileStampHash()
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	std::vector<const std::string*> paths = { &_file->path };
+	for (const auto& P : _file->moreParts)
+		paths.push_back(&P);
+	for (const auto* P : paths)
+	{
+		uint64_t size, mtime;
+		if (!GetFileStamp(P->c_str(), size, mtime))
+			return 0;
+		h = HashValue(h, size);
+		h = HashValue(h, mtime);
+	}
+	return h;
+}
+
+bool SearchIndex::_ReadHeader(FILE* fp, SearchIndexHeader& hdr)
+{
+	return ReadFileAt(fp, 0, sizeof(hdr), &hdr) == sizeof(hdr) &&
+		memcmp(hdr.magic, g_searchIndexMagic, sizeof(g_searchIndexMagic)) == 0 &&
+		hdr.version == SEARCH_INDEX_VERSION &&
+		hdr.blockSizeLog2 == INDEX_BLOCK_SIZE_LOG2 &&
+		hdr.rowsLog2 == INDEX_ROWS_LOG2 &&
+		hdr.segmentBlocks == INDEX_SEGMENT_BLOCKS &&
+		hdr.settingsHash == _GetSettingsHash();
+}
+
+void SearchIndex::_StopThread()
+{
+	if (!_thread.joinable())
+		return;
+	_cancel = true;
+	_thread.join();
+	_cancel = false;
+}
+
+void SearchIndex::_SetState(SearchIndexState s)
+{
+	_state = s;
+	// may be called from the build thread, the handlers only run on the UI thread
+	auto target = _eventTarget;
+	ui::Application::PushEvent([target]()
+	{
+		if (*target)
+			OnSearchIndexStateChanged.Call(*target);
+	});
+}
+
+void SearchIndex::_SetError(std::string&& error)
+{
+	std::lock_guard<std::mutex> lock(_errorMutex);
+	_error = std::move(error);
+}
+
+void SearchIndex::_BuildThreadProc()
+{
+	uint64_t size = _src->GetSize();
+	uint64_t numBlocks = (size + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+
+	std::string tmpPath = _path + ".tmp";
+	FILE* fp = fopen(tmpPath.c_str(), "wb");
+	if (!fp)
+	{
+		_SetError(ui::Format("cannot write %s", tmpPath.c_str()));
+		_SetState(SearchIndexState::Failed);
+		return;
+	}
+
+	SearchIndexHeader hdr = {};
+	memcpy(hdr.magic, g_searchIndexMagic, sizeof(g_searchIndexMagic));
+	hdr.version = SEARCH_INDEX_VERSION;
+	hdr.blockSizeLog2 = INDEX_BLOCK_SIZE_LOG2;
+	hdr.rowsLog2 = INDEX_ROWS_LOG2;
+	hdr.segmentBlocks = INDEX_SEGMENT_BLOCKS;
+	hdr.settingsHash = _GetSettingsHash();
+	hdr.fileStamp = _fileStamp;
+	hdr.dataSize = size;
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+	auto& pool = GetWorkerPool();
+	std::vector<uint8_t> bits;
+	int lastPercent = 0;
+	for (uint64_t firstBlock = 0; firstBlock < numBlocks && ok && !_cancel; firstBlock += INDEX_SEGMENT_BLOCKS)
+	{
+		uint64_t segBlocks = ui::min(INDEX_SEGMENT_BLOCKS, numBlocks - firstBlock);
+		size_t rowBytes = size_t((segBlocks + 7) / 8);
+		bits.assign(INDEX_ROWS * rowBytes, 0);
+
+		uint64_t from = firstBlock * INDEX_BLOCK_SIZE;
+		uint64_t to = ui::min(size, (firstBlock + segBlocks) * INDEX_BLOCK_SIZE);
+		ReadAheadReader reader(_src, from, to, INDEX_BUILD_CHUNK_SIZE, 0);
+		ReadAheadReader::Chunk chunk;
+		while (!_cancel && reader.NextChunk(chunk))
+		{
+			// the 4-grams that start at the end of the chunk's last block
+			uint8_t after[3];
+			size_t afterSize = size_t(ui::min(uint64_t(3), size - (chunk.offset + chunk.size)));
+			_src->Read(chunk.offset + chunk.size, afterSize, after);
+
+			size_t firstColumn = size_t((chunk.offset - from) / INDEX_COLUMN_SIZE);
+			size_t numColumns = size_t((chunk.size + INDEX_COLUMN_SIZE - 1) / INDEX_COLUMN_SIZE);
+			pool.ParallelFor(numColumns, [&](size_t i)
+			{
+				uint64_t sig[INDEX_ROWS / 64];
+				uint8_t* column = bits.data() + firstColumn + i;
+				for (unsigned j = 0; j < 8; j++)
+				{
+					size_t start = size_t(i * INDEX_COLUMN_SIZE + j * INDEX_BLOCK_SIZE);
+					if (start >= chunk.size)
+						break;
+					size_t end = ui::min(start + size_t(INDEX_BLOCK_SIZE), chunk.size);
+
+					// collect the hashes first so that repeated 4-grams don't touch the rows again
+					memset(sig, 0, sizeof(sig));
+					const uint8_t* data = (const uint8_t*)chunk.data;
+					if (end < chunk.size)
+						AddBlockGrams(data + start, end - start, data + end, ui::min(chunk.size - end, size_t(3)), sig);
+					else
+						AddBlockGrams(data + start, end - start, after, afterSize, sig);
+					for (size_t w = 0; w < INDEX_ROWS / 64; w++)
+					{
+						for (uint64_t v = sig[w]; v; v &= v - 1)
+							column[(w * 64 + CountTrailingZeroes64(v)) * rowBytes] |= uint8_t(1 << j);
+					}
+				}
+			});
+
+			_progress = float(double(chunk.offset + chunk.size) / size);
+			int percent = int(_progress * 100);
+			if (percent != lastPercent)
+			{
+				lastPercent = percent;
+				_SetState(SearchIndexState::Building);
+			}
+		}
+		ok = !_cancel && fwrite(bits.data(), 1, bits.size(), fp) == bits.size();
+	}
+	ok = fclose(fp) == 0 && ok;
+
+	if (ok)
+	{
+		remove(_path.c_str());
+		ok = rename(tmpPath.c_str(), _path.c_str()) == 0;
+	}
+	if (!ok)
+		remove(tmpPath.c_str());
+
+	if (_cancel)
+		return;
+	if (ok)
+		_SetState(SearchIndexState::Ready);
+	else
+	{
+		_SetError(ui::Format("failed to write %s", _path.c_str()));
+		_SetState(SearchIndexState::Failed);
+	}
+}
+
+bool SearchIndex::_AddLiteralCandidates(FILE* fp, const SearchIndexHeader& hdr, const SearchIndexLiteral& lit, std::vector<SearchIndexRange>& out)
+{
+	// (pattern size is limited so that a match spans at most two blocks)
+	size_t patSize = ui::min(lit.bytes.size(), INDEX_MAX_QUERY_GRAMS + 3);
+	size_t numGrams = patSize - 3;
+	std::vector<uint32_t> hashes(numGrams);
+	for (size_t i = 0; i < numGrams; i++)
+		hashes[i] = HashGramAt(lit.bytes.data() + i);
+
+	uint64_t numBlocks = (hdr.dataSize + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+	std::vector<uint8_t> rowBuf;
+	std::vector<uint64_t> rows;
+	std::vector<uint64_t> prefix; // [k] = blocks with the first k 4-grams
+	std::vector<uint64_t> suffix; // [k] = blocks with the 4-grams from k on
+	std::vector<uint64_t> cand;
+	for (uint64_t firstBlock = 0; firstBlock < numBlocks; firstBlock += INDEX_SEGMENT_BLOCKS)
+	{
+		uint64_t segBlocks = ui::min(INDEX_SEGMENT_BLOCKS, numBlocks - firstBlock);
+		size_t rowBytes = size_t((segBlocks + 7) / 8);
+		size_t words = size_t((segBlocks + 63) / 64);
+		uint64_t segOff = sizeof(hdr) + INDEX_ROWS * (firstBlock / 8);
+
+		rowBuf.assign(words * 8, 0);
+		rows.resize(numGrams * words);
+		for (size_t i = 0; i < numGrams; i++)
+		{
+			size_t same = std::find(hashes.begin(), hashes.begin() + i, hashes[i]) - hashes.begin();
+			if (same < i)
+			{
+				std::copy(&rows[same * words], &rows[same * words] + words, &rows[i * words]);
+				continue;
+			}
+			if (ReadFileAt(fp, segOff + hashes[i] * uint64_t(rowBytes), rowBytes, rowBuf.data()) != rowBytes)
+				return false;
+			for (size_t w = 0; w < words; w++)
+			{
+				uint64_t v;
+				memcpy(&v, &rowBuf[w * 8], 8);
+				rows[i * words + w] = v;
+			}
+		}
+
+		prefix.assign((numGrams + 1) * words, UINT64_MAX);
+		suffix.assign((numGrams + 1) * words, UINT64_MAX);
+		for (size_t k = 1; k <= numGrams; k++)
+			for (size_t w = 0; w < words; w++)
+				prefix[k * words + w] = prefix[(k - 1) * words + w] & rows[(k - 1) * words + w];
+		for (size_t k = numGrams; k-- > 0;)
+			for (size_t w = 0; w < words; w++)
+				suffix[k * words + w] = suffix[(k + 1) * words + w] & rows[k * words + w];
+
+		// a match starting `d` bytes before the end of block b has 4-grams [0, d) starting in b and [d, numGrams) in b + 1
+		cand.assign(&prefix[numGrams * words], &prefix[numGrams * words] + words);
+		for (size_t d = 1; d < numGrams; d++)
+		{
+			const uint64_t* inThis = &prefix[d * words];
+			const uint64_t* inNext = &suffix[d * words];
+			for (size_t w = 0; w < words; w++)
+			{
+				// the block after the segment's last one is in the next segment, which isn't loaded, so assume it matches
+				uint64_t nextBits = (inNext[w] >> 1) | ((w + 1 < words ? inNext[w + 1] : UINT64_MAX) << 63);
+				cand[w] |= inThis[w] & nextBits;
+			}
+		}
+
+		for (size_t w = 0; w < words; w++)
+		{
+			for (uint64_t v = cand[w]; v; v &= v - 1)
+			{
+				uint64_t block = w * 64 + CountTrailingZeroes64(v);
+				if (block >= segBlocks)
+					break;
+				block += firstBlock;
+				uint64_t start = block * INDEX_BLOCK_SIZE;
+				uint64_t end = ui::min(start + INDEX_BLOCK_SIZE, hdr.dataSize);
+				// the ranges are for the literal, convert them to match starts
+				if (end <= lit.offset)
+					continue;
+				start = start > lit.offset ? start - lit.offset : 0;
+				end -= lit.offset;
+				if (!out.empty() && out.back().end == start)
+					out.back().end = end;
+				else
+					out.push_back({ start, end });
+			}
+		}
+	}
+	return true;
+}
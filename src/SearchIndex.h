@@ -0,0 +1,83 @@
+#pragma once
+#include "pch.h"
+#include "FileReaders.h"
+
+
+struct DDFile;
+struct SearchIndex;
+
+extern ui::MulticastDelegate<const SearchIndex*> OnSearchIndexStateChanged;
+
+// bytes that every match must contain at `offset` from its start
+struct SearchIndexLiteral
+{
+	std::string bytes;
+	size_t offset = 0;
+};
+
+// [start, end) of possible match start positions
+struct SearchIndexRange
+{
+	uint64_t start;
+	uint64_t end;
+};
+
+enum class SearchIndexState : uint8_t
+{
+	None,
+	Building,
+	Ready,
+	// the files were changed after the index was built
+	OutOfDate,
+	Failed,
+};
+
+// on-disk 4-gram index of a DDFile's data, used to narrow fragment searches down to the blocks that could have a match
+// stored next to the (first) file as `<path>.<settings hash>.ngidx` and only used while the files' sizes and mtimes match
+// it's built from the data without the edits, and edited ranges are always searched
+struct SearchIndex : ui::RefCountedST
+{
+	SearchIndex(DDFile* file, IDataSource* uneditedSource);
+	~SearchIndex();
+
+	// picks up an existing index file if it matches the data
+	void Open();
+	// builds the index file on a background thread (restarting any ongoing build)
+	void StartBuild();
+	void CancelBuild();
+
+	SearchIndexState GetState();
+	float GetBuildProgress() { return _progress; }
+	const std::string& GetPath() const { return _path; }
+	std::string GetError();
+	// checks whether the files have changed since the index was built (marking it out of date if they have)
+	bool IsUsable();
+
+	// finds the ranges of the data (merged, in order) that may contain a match starting there
+	// a match must contain at least one of the literals, literals under 4 bytes can't be looked up (false is returned then)
+	// `maxMatchSize` is used to include the matches that overlap edited ranges
+	bool GetCandidateRanges(const std::vector<SearchIndexLiteral>& literals, size_t maxMatchSize, std::vector<SearchIndexRange>& out);
+
+	uint64_t _GetSettingsHash();
+	uint64_t _GetFileStampHash();
+	bool _ReadHeader(FILE* fp, struct SearchIndexHeader& hdr);
+	void _StopThread();
+	void _BuildThreadProc();
+	void _SetState(SearchIndexState s);
+	void _SetError(std::string&& error);
+	bool _AddLiteralCandidates(FILE* fp, const struct SearchIndexHeader& hdr, const SearchIndexLiteral& lit, std::vector<SearchIndexRange>& out);
+
+	DDFile* _file;
+	ui::RCHandle<IDataSource> _src;
+	std::string _path;
+	std::string _error; // set by the build thread
+	std::mutex _errorMutex;
+	uint64_t _fileStamp = 0;
+	// the queued state change events can outlive the index, they skip it once it's destroyed
+	std::shared_ptr<SearchIndex*> _eventTarget;
+
+	std::atomic<SearchIndexState> _state{ SearchIndexState::None };
+	std::atomic<float> _progress{ 0 };
+	std::atomic_bool _cancel{ false };
+	std::thread _thread;
+};
@@ -0,0 +1,1167 @@
+
+#include "pch.h"
+#include "SearchKernels.h"
+#include "SIMD.h"
+
+
+SIMDLevel g_searchSIMDLevel = GetSupportedSIMDLevel();
+
+static UI_FORCEINLINE unsigned CountTrailingZeroes(uint32_t v)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward(&idx, v);
+	return idx;
+#else
+	return __builtin_ctz(v);
+#endif
+}
+
+static UI_FORCEINLINE bool VerifyMiddle(const uint8_t* p, const uint8_t* pat, size_t patSize)
+{
+	// the first and last bytes have already been compared
+	return patSize <= 2 || memcmp(p + 1, pat + 1, patSize - 2) == 0;
+}
+
+// the scans below call verify(pos) for the positions in [from, numPos) where data[pos + off1] == v1 and data[pos + off2] == v2
+// (data must have at least numPos + max(off1, off2) bytes)
+template <class F> static void ScanBytePairScalar(const uint8_t* data, size_t from, size_t numPos, size_t off1, uint8_t v1, size_t off2, uint8_t v2, F&& verify)
+{
+	size_t i = from;
+	while (i < numPos)
+	{
+		auto* p = (const uint8_t*)memchr(data + i + off1, v1, numPos - i);
+		if (!p)
+			break;
+		i = p - data - off1;
+		if (data[i + off2] == v2)
+			verify(i);
+		i++;
+	}
+}
+
+#if BDAT_SIMD_X86
+// the vector versions start at 0 and return the number of positions processed
+template <class F> static size_t ScanBytePairSSE2(const uint8_t* data, size_t numPos, size_t off1, uint8_t v1, size_t off2, uint8_t v2, F&& verify)
+{
+	__m128i c1 = _mm_set1_epi8(char(v1));
+	__m128i c2 = _mm_set1_epi8(char(v2));
+	size_t n = numPos / 16 * 16;
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(data + i + off1));
+		__m128i b2 = _mm_loadu_si128((const __m128i*)(data + i + off2));
+		uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(b1, c1), _mm_cmpeq_epi8(b2, c2)));
+		while (mask)
+		{
+			verify(i + CountTrailingZeroes(mask));
+			mask &= mask - 1;
+		}
+	}
+	return n;
+}
+
+template <class F> BDAT_TARGET_AVX2 static size_t ScanBytePairAVX2(const uint8_t* data, size_t numPos, size_t off1, uint8_t v1, size_t off2, uint8_t v2, F&& verify)
+{
+	__m256i c1 = _mm256_set1_epi8(char(v1));
+	__m256i c2 = _mm256_set1_epi8(char(v2));
+	size_t n = numPos / 32 * 32;
+	for (size_t i = 0; i < n; i += 32)
+	{
+		__m256i b1 = _mm256_loadu_si256((const __m256i*)(data + i + off1));
+		__m256i b2 = _mm256_loadu_si256((const __m256i*)(data + i + off2));
+		uint32_t mask = uint32_t(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(b1, c1), _mm256_cmpeq_epi8(b2, c2))));
+		while (mask)
+		{
+			verify(i + CountTrailingZeroes(mask));
+			mask &= mask - 1;
+		}
+	}
+	return n;
+}
+#endif
+
+template <class F> static void ScanBytePair(const uint8_t* data, size_t numPos, size_t off1, uint8_t v1, size_t off2, uint8_t v2, F&& verify)
+{
+	size_t done = 0;
+#if BDAT_SIMD_X86
+	if (g_searchSIMDLevel >= SIMDLevel::AVX2)
+		done = ScanBytePairAVX2(data, numPos, off1, v1, off2, v2, verify);
+	else if (g_searchSIMDLevel >= SIMDLevel::SSE2)
+		done = ScanBytePairSSE2(data, numPos, off1, v1, off2, v2, verify);
+#endif
+	ScanBytePairScalar(data, done, numPos, off1, v1, off2, v2, verify);
+}
+
+void FindAllOccurrences(const void* data, size_t size, const void* pat, size_t patSize, uint64_t base, std::vector<uint64_t>& out)
+{
+	if (patSize == 0 || patSize > size)
+		return;
+
+	auto* d = (const uint8_t*)data;
+	auto* p = (const uint8_t*)pat;
+	// every position that has enough bytes after it for the whole pattern (the vector loads stay within that too)
+	size_t numPos = size - patSize + 1;
+	ScanBytePair(d, numPos, 0, p[0], patSize - 1, p[patSize - 1], [&](size_t pos)
+	{
+		if (VerifyMiddle(d + pos, p, patSize))
+			out.push_back(base + pos);
+	});
+}
+
+void MultiPatternMatcher::Build(const std::vector<std::string>& patterns)
+{
+	_next.clear();
+	_outputStart.clear();
+	_outputs.clear();
+	_patternSizes.clear();
+	_maxPatternSize = 0;
+
+	// trie, with 0 as "no edge" since the root is never a child
+	std::vector<uint32_t> trie(256, 0);
+	std::vector<std::vector<uint32_t>> ends(1);
+	for (uint32_t p = 0; p < patterns.size(); p++)
+	{
+		const auto& P = patterns[p];
+		_patternSizes.push_back(P.size());
+		if (P.empty())
+			continue;
+		_maxPatternSize = ui::max(_maxPatternSize, P.size());
+
+		uint32_t s = 0;
+		for (char c : P)
+		{
+			size_t edge = s * 256 + uint8_t(c);
+			if (!trie[edge])
+			{
+				trie[edge] = uint32_t(ends.size());
+				ends.emplace_back();
+				trie.resize(trie.size() + 256, 0);
+			}
+			s = trie[edge];
+		}
+		ends[s].push_back(p);
+	}
+
+	// turn it into a DFA in breadth-first order, so that each state's suffix link target is finished before it
+	size_t numStates = ends.size();
+	_next = std::move(trie);
+	std::vector<uint32_t> link(numStates, 0);
+	std::vector<uint32_t> queue;
+	queue.reserve(numStates);
+	for (int c = 0; c < 256; c++)
+		if (uint32_t n = _next[c])
+			queue.push_back(n);
+	for (size_t qi = 0; qi < queue.size(); qi++)
+	{
+		uint32_t s = queue[qi];
+		auto& E = ends[s];
+		auto& LE = ends[link[s]];
+		E.insert(E.end(), LE.begin(), LE.end());
+		for (int c = 0; c < 256; c++)
+		{
+			uint32_t& n = _next[s * 256 + c];
+			if (n)
+			{
+				link[n] = _next[link[s] * 256 + c];
+				queue.push_back(n);
+			}
+			else
+				n = _next[link[s] * 256 + c];
+		}
+	}
+
+	_outputStart.reserve(numStates + 1);
+	for (auto& E : ends)
+	{
+		_outputStart.push_back(uint32_t(_outputs.size()));
+		std::sort(E.begin(), E.end());
+		_outputs.insert(_outputs.end(), E.begin(), E.end());
+	}
+	_outputStart.push_back(uint32_t(_outputs.size()));
+}
+
+void MultiPatternMatcher::FindAll(const void* data, size_t size, size_t numStarts, uint64_t base, std::vector<MultiPatternMatch>& out) const
+{
+	if (IsEmpty())
+		return;
+
+	size_t firstOut = out.size();
+	// nothing that starts at or after numStarts can end before this
+	size_t end = ui::min(size, numStarts + _maxPatternSize - 1);
+	auto* d = (const uint8_t*)data;
+	const uint32_t* next = _next.data();
+	uint32_t s = 0;
+	for (size_t i = 0; i < end; i++)
+	{
+		s = next[s * 256 + d[i]];
+		for (uint32_t o = _outputStart[s], oe = _outputStart[s + 1]; o < oe; o++)
+		{
+			uint32_t p = _outputs[o];
+			size_t start = i + 1 - _patternSizes[p];
+			if (start < numStarts)
+				out.push_back({ base + start, p });
+		}
+	}
+
+	// the matches come out by their end position
+	std::sort(out.begin() + firstOut, out.end(), [](const MultiPatternMatch& a, const MultiPatternMatch& b)
+	{
+		return a.offset != b.offset ? a.offset < b.offset : a.pattern < b.pattern;
+	});
+}
+
+
+static const size_t MAX_BYTE_PATTERN_SIZE = 64 * 1024;
+
+static int HexDigitValue(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static bool ParseHexByte(ui::StringView& it, uint8_t& value, uint8_t& mask, bool allowWildcards)
+{
+	if (it.size() < 2)
+		return false;
+	value = 0;
+	mask = 0;
+	for (int i = 0; i < 2; i++)
+	{
+		int shift = i == 0 ? 4 : 0;
+		if (it[i] == '?' && allowWildcards)
+			continue;
+		int v = HexDigitValue(it[i]);
+		if (v < 0)
+			return false;
+		value |= v << shift;
+		mask |= 0xf << shift;
+	}
+	it = it.substr(2);
+	return true;
+}
+
+static bool ParseUInt(ui::StringView& it, uint32_t& out)
+{
+	size_t i = 0;
+	uint64_t v = 0;
+	while (i < it.size() && it[i] >= '0' && it[i] <= '9' && v <= UINT32_MAX)
+		v = v * 10 + (it[i++] - '0');
+	if (i == 0 || v > UINT32_MAX)
+		return false;
+	out = uint32_t(v);
+	it = it.substr(i);
+	return true;
+}
+
+bool BytePattern::Parse(ui::StringView text, std::string& error)
+{
+	segments.clear();
+	segments.emplace_back();
+	error.clear();
+
+	auto addByte = [this](uint8_t value, uint8_t mask)
+	{
+		segments.back().values.push_back(value & mask);
+		segments.back().masks.push_back(mask);
+	};
+
+	ui::StringView it = text;
+	for (;;)
+	{
+		while (!it.empty() && (it[0] == ' ' || it[0] == '\t' || it[0] == ',' || it[0] == '\r' || it[0] == '\n'))
+			it = it.substr(1);
+		if (it.empty())
+			break;
+
+		size_t at = text.size() - it.size();
+		if (it[0] == '"')
+		{
+			it = it.substr(1);
+			for (;;)
+			{
+				if (it.empty())
+				{
+					error = ui::Format("unterminated string starting at %zu", at);
+					return false;
+				}
+				char c = it[0];
+				it = it.substr(1);
+				if (c == '"')
+					break;
+				if (c == '\\' && !it.empty())
+				{
+					c = it[0];
+					it = it.substr(1);
+				}
+				addByte(uint8_t(c), 0xff);
+			}
+		}
+		else if (it[0] == '[')
+		{
+			it = it.substr(1);
+			uint32_t gmin, gmax;
+			if (!ParseUInt(it, gmin))
+			{
+				error = ui::Format("expected gap size at %zu", at + 1);
+				return false;
+			}
+			gmax = gmin;
+			if (!it.empty() && it[0] == '-')
+			{
+				it = it.substr(1);
+				if (!ParseUInt(it, gmax) || gmax < gmin)
+				{
+					error = ui::Format("expected gap maximum (not less than %u) at %zu", gmin, text.size() - it.size());
+					return false;
+				}
+			}
+			if (it.empty() || it[0] != ']')
+			{
+				error = ui::Format("expected ']' at %zu", text.size() - it.size());
+				return false;
+			}
+			it = it.substr(1);
+
+			if (uint64_t(gmax) + GetMaxSize() > MAX_BYTE_PATTERN_SIZE)
+			{
+				error = ui::Format("the pattern can't be longer than %zu bytes", MAX_BYTE_PATTERN_SIZE);
+				return false;
+			}
+			if (gmin == gmax)
+			{
+				for (uint32_t i = 0; i < gmin; i++)
+					addByte(0, 0);
+			}
+			else
+			{
+				if (segments.size() == 1 && segments[0].values.empty())
+				{
+					error = "a pattern can't start with a variable gap";
+					return false;
+				}
+				// two gaps in a row are merged
+				if (!segments.back().values.empty())
+					segments.emplace_back();
+				segments.back().gapMin += gmin;
+				segments.back().gapMax += gmax;
+			}
+		}
+		else
+		{
+			uint8_t value, mask;
+			if (!ParseHexByte(it, value, mask, true))
+			{
+				error = ui::Format("expected a hex byte at %zu", at);
+				return false;
+			}
+			if (!it.empty() && it[0] == '&')
+			{
+				it = it.substr(1);
+				uint8_t bitMask, bitMaskMask;
+				if (!ParseHexByte(it, bitMask, bitMaskMask, false))
+				{
+					error = ui::Format("expected a hex mask at %zu", text.size() - it.size());
+					return false;
+				}
+				mask &= bitMask;
+			}
+			addByte(value, mask);
+		}
+
+		if (GetMaxSize() > MAX_BYTE_PATTERN_SIZE)
+		{
+			error = ui::Format("the pattern can't be longer than %zu bytes", MAX_BYTE_PATTERN_SIZE);
+			return false;
+		}
+	}
+
+	if (segments.back().values.empty())
+	{
+		if (segments.size() > 1)
+			error = "a pattern can't end with a variable gap";
+		else
+			error = "the pattern is empty";
+		segments.clear();
+		return false;
+	}
+
+	_ChooseAnchors();
+	return true;
+}
+
+size_t BytePattern::GetMinSize() const
+{
+	size_t n = 0;
+	for (const auto& S : segments)
+		n += S.gapMin + S.values.size();
+	return n;
+}
+
+size_t BytePattern::GetMaxSize() const
+{
+	size_t n = 0;
+	for (const auto& S : segments)
+		n += S.gapMax + S.values.size();
+	return n;
+}
+
+void BytePattern::GetLongestLiteral(std::string& bytes, size_t& offset) const
+{
+	bytes.clear();
+	offset = 0;
+	if (segments.empty())
+		return;
+	const auto& S = segments[0];
+	for (size_t i = 0; i < S.masks.size();)
+	{
+		size_t end = i;
+		while (end < S.masks.size() && S.masks[end] == 0xff)
+			end++;
+		if (end - i > bytes.size())
+		{
+			bytes.assign((const char*)&S.values[i], end - i);
+			offset = i;
+		}
+		i = end + 1;
+	}
+}
+
+// rough guess of how often each byte value shows up in typical binary files (higher = more common)
+static int GetByteCommonness(uint8_t b)
+{
+	if (b == 0x00)
+		return 100;
+	if (b == 0xff)
+		return 60;
+	if (b < 0x10 || b > 0xf0)
+		return 40;
+	if (b == ' ' || (b >= 'a' && b <= 'z') || (b >= '0' && b <= '9'))
+		return 30;
+	if (b >= 0x20 && b < 0x7f)
+		return 20;
+	return 10;
+}
+
+void BytePattern::_ChooseAnchors()
+{
+	// only the first segment is at a fixed offset from the match start
+	const auto& S = segments[0];
+	std::vector<size_t> literals;
+	for (size_t i = 0; i < S.values.size(); i++)
+		if (S.masks[i] == 0xff)
+			literals.push_back(i);
+	std::stable_sort(literals.begin(), literals.end(), [&S](size_t a, size_t b)
+	{
+		return GetByteCommonness(S.values[a]) < GetByteCommonness(S.values[b]);
+	});
+
+	numAnchors = int(ui::min(literals.size(), size_t(2)));
+	for (int i = 0; i < numAnchors; i++)
+	{
+		anchorOffsets[i] = literals[i];
+		anchorValues[i] = S.values[literals[i]];
+	}
+}
+
+bool BytePattern::_MatchSegmentAt(const uint8_t* data, size_t size, size_t seg, size_t pos) const
+{
+	const auto& S = segments[seg];
+	size_t n = S.values.size();
+	if (pos + n > size)
+		return false;
+	for (size_t i = 0; i < n; i++)
+		if ((data[pos + i] & S.masks[i]) != S.values[i])
+			return false;
+	return true;
+}
+
+bool BytePattern::_MatchAt(const uint8_t* data, size_t size, size_t pos, std::vector<PosRange>& ends, std::vector<PosRange>& next) const
+{
+	if (!_MatchSegmentAt(data, size, 0, pos))
+		return false;
+
+	// the positions where each segment can end are kept as merged ranges, so that every position is only checked once
+	// per segment (trying each length of each gap in turn would take exponential time with several variable gaps)
+	size_t firstEnd = pos + segments[0].values.size();
+	ends.assign(1, { firstEnd, firstEnd });
+	for (size_t seg = 1; seg < segments.size(); seg++)
+	{
+		const auto& S = segments[seg];
+		size_t n = S.values.size();
+		next.clear();
+		// the ends are in order, and so are the starts they lead to, which only need to be skipped where they overlap
+		size_t checkedTo = 0;
+		for (const auto& E : ends)
+		{
+			size_t from = E.from + S.gapMin;
+			size_t to = E.to + S.gapMax;
+			if (checkedTo > from)
+				from = checkedTo;
+			for (size_t p = from; p <= to && p + n <= size; p++)
+			{
+				if (!_MatchSegmentAt(data, size, seg, p))
+					continue;
+				if (!next.empty() && next.back().to + 1 == p + n)
+					next.back().to++;
+				else
+					next.push_back({ p + n, p + n });
+			}
+			checkedTo = ui::max(checkedTo, to + 1);
+		}
+		if (next.empty())
+			return false;
+		std::swap(ends, next);
+	}
+	return true;
+}
+
+void BytePattern::FindAll(const void* data, size_t size, size_t numStarts, uint64_t base, std::vector<uint64_t>& out) const
+{
+	if (segments.empty())
+		return;
+
+	auto* d = (const uint8_t*)data;
+	size_t minSize = GetMinSize();
+	if (minSize > size)
+		return;
+	size_t numPos = ui::min(numStarts, size - minSize + 1);
+
+	std::vector<PosRange> ends, next;
+	auto verify = [&](size_t pos)
+	{
+		if (_MatchAt(d, size, pos, ends, next))
+			out.push_back(base + pos);
+	};
+	if (numAnchors == 0)
+	{
+		for (size_t i = 0; i < numPos; i++)
+			verify(i);
+		return;
+	}
+	// a single anchor is compared twice
+	size_t a = numAnchors - 1;
+	ScanBytePair(d, numPos, anchorOffsets[0], anchorValues[0], anchorOffsets[a], anchorValues[a], verify);
+}
+
+
+bool ApproximateMatcher::Init(ui::StringView pattern, ApproxDistanceType type, unsigned maxDistance, std::string& error)
+{
+	_pattern.assign(pattern.data(), pattern.size());
+	_type = type;
+	_maxDistance = maxDistance;
+	memset(_masks, 0, sizeof(_masks));
+	if (_pattern.empty())
+	{
+		error = "the pattern is empty";
+		return false;
+	}
+	if (_pattern.size() > APPROX_MAX_PATTERN_SIZE)
+	{
+		error = ui::Format("the pattern can be at most %zu bytes long", APPROX_MAX_PATTERN_SIZE);
+		return false;
+	}
+	if (maxDistance >= _pattern.size())
+	{
+		error = "the distance must be less than the size of the pattern";
+		return false;
+	}
+
+	size_t m = _pattern.size();
+	for (size_t i = 0; i < m; i++)
+	{
+		size_t bit = type == ApproxDistanceType::Edit ? m - 1 - i : i;
+		_masks[uint8_t(_pattern[i])] |= uint64_t(1) << bit;
+	}
+	return true;
+}
+
+bool ApproximateMatcher::GetRequiredLiterals(std::vector<std::string>& pieces, std::vector<size_t>& offsets) const
+{
+	// with k mismatches in k+1 pieces, at least one piece is unchanged, and it's still at the same offset
+	// (with edits, it could be moved by up to k bytes)
+	if (_type != ApproxDistanceType::Hamming || _pattern.empty())
+		return false;
+	size_t numPieces = _maxDistance + 1;
+	size_t pieceSize = _pattern.size() / numPieces;
+	for (size_t i = 0; i < numPieces; i++)
+	{
+		size_t start = i * pieceSize;
+		size_t end = i + 1 == numPieces ? _pattern.size() : start + pieceSize;
+		pieces.push_back(_pattern.substr(start, end - start));
+		offsets.push_back(start);
+	}
+	return true;
+}
+
+void ApproximateMatcher::FindAll(const void* data, size_t size, size_t firstStart, size_t numStarts, uint64_t base, std::vector<ApproxMatch>& out) const
+{
+	if (_pattern.empty() || firstStart >= numStarts)
+		return;
+	if (_type == ApproxDistanceType::Edit)
+		_FindAllEdit((const uint8_t*)data, size, firstStart, numStarts, base, out);
+	else
+		_FindAllHamming((const uint8_t*)data, size, firstStart, numStarts, base, out);
+}
+
+void ApproximateMatcher::_FindAllHamming(const uint8_t* data, size_t size, size_t firstStart, size_t numStarts, uint64_t base, std::vector<ApproxMatch>& out) const
+{
+	size_t m = _pattern.size();
+	if (firstStart + m > size)
+		return;
+	size_t end = ui::min(size, numStarts + m - 1);
+	uint64_t last = uint64_t(1) << (m - 1);
+
+	// state[d] bit i = the last i+1 bytes match the start of the pattern with at most d mismatches
+	uint64_t state[APPROX_MAX_PATTERN_SIZE] = {};
+	unsigned k = _maxDistance;
+	for (size_t i = firstStart; i < end; i++)
+	{
+		uint64_t eq = _masks[data[i]];
+		uint64_t prev = state[0];
+		state[0] = ((state[0] << 1) | 1) & eq;
+		for (unsigned d = 1; d <= k; d++)
+		{
+			uint64_t cur = state[d];
+			// matched with d mismatches, or with d-1 and a mismatch here
+			state[d] = (((cur << 1) | 1) & eq) | (prev << 1) | 1;
+			prev = cur;
+		}
+
+		if ((state[k] & last) && i + 1 >= firstStart + m)
+		{
+			unsigned d = 0;
+			while (!(state[d] & last))
+				d++;
+			out.push_back({ base + i + 1 - m, d });
+		}
+	}
+}
+
+void ApproximateMatcher::_FindAllEdit(const uint8_t* data, size_t size, size_t firstStart, size_t numStarts, uint64_t base, std::vector<ApproxMatch>& out) const
+{
+	// the distances are only compared to find the best starts, and anything over k is the same as k+1
+	// so a match can't be longer than m+k (that would take more than k insertions)
+	size_t m = _pattern.size();
+	unsigned k = _maxDistance;
+	unsigned over = k + 1;
+	size_t end = ui::min(size, numStarts + GetMaxMatchSize());
+	size_t first = out.size();
+
+	// Myers: the vertical deltas of the last DP column (Pv = +1, Mv = -1), for the distances of the pattern suffixes
+	// (reversed, so prefixes) to the best substring starting at the current position
+	uint64_t last = uint64_t(1) << (m - 1);
+	uint64_t pv = ~uint64_t(0);
+	uint64_t mv = 0;
+	unsigned score = unsigned(m);
+	// the distances from the next two positions
+	unsigned next = over;
+	unsigned next2 = over;
+	for (size_t i = end; i-- > 0;)
+	{
+		uint64_t eq = _masks[data[i]];
+		uint64_t xv = eq | mv;
+		uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+		uint64_t ph = mv | ~(xh | pv);
+		uint64_t mh = pv & xh;
+		if (ph & last)
+			score++;
+		else if (mh & last)
+			score--;
+		ph <<= 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+
+		unsigned dist = ui::min(score, over);
+		// the start after this one is reported if it's better than this one and no worse than the one after it
+		if (i + 1 >= firstStart && i + 1 < numStarts && next <= k && next < dist && next <= next2)
+			out.push_back({ base + i + 1, next });
+		next2 = next;
+		next = dist;
+		if (i < firstStart)
+			break;
+	}
+	// the first position of the data is only compared with the next one
+	if (firstStart == 0 && next <= k && next <= next2)
+		out.push_back({ base, next });
+	std::reverse(out.begin() + first, out.end());
+}
+
+size_t ApproximateMatcher::GetMatchSize(const void* data, size_t size, unsigned distance) const
+{
+	if (_type == ApproxDistanceType::Hamming)
+		return _pattern.size();
+
+	// the edit distances from the pattern prefixes to the data read so far
+	auto* d = (const uint8_t*)data;
+	size_t m = _pattern.size();
+	size_t maxSize = ui::min(size, GetMaxMatchSize());
+	std::vector<unsigned> col(m + 1);
+	for (size_t i = 0; i <= m; i++)
+		col[i] = unsigned(i);
+	for (size_t j = 0; j < maxSize; j++)
+	{
+		unsigned diag = col[0];
+		col[0] = unsigned(j + 1);
+		for (size_t i = 1; i <= m; i++)
+		{
+			unsigned up = col[i];
+			col[i] = ui::min(ui::min(col[i - 1], up) + 1, diag + (uint8_t(_pattern[i - 1]) != d[j]));
+			diag = up;
+		}
+		if (col[m] <= distance)
+			return j + 1;
+	}
+	return m;
+}
+
+
+// the value positions are every `align`-th one relative to the data source, starting from the first one in the data
+static size_t GetFirstAlignedPos(uint64_t base, unsigned align)
+{
+	return size_t((align - base % align) % align);
+}
+
+// a bit for every `step`-th byte of a `width`-byte vector
+static uint32_t GetEveryNthBitMask(unsigned step, unsigned width)
+{
+	uint32_t mask = 0;
+	for (unsigned i = 0; i < width; i += step)
+		mask |= 1U << i;
+	return mask;
+}
+
+static UI_FORCEINLINE void AddMaskPositions(uint32_t mask, size_t i, size_t numStarts, uint64_t base, std::vector<uint64_t>& out)
+{
+	while (mask)
+	{
+		size_t pos = i + CountTrailingZeroes(mask);
+		if (pos >= numStarts)
+			break;
+		out.push_back(base + pos);
+		mask &= mask - 1;
+	}
+}
+
+template <class T> static void ScanValueRangeScalar(const uint8_t* data, size_t size, size_t numStarts, size_t i, unsigned align, Endianness e, T lo, T hi, uint64_t base, std::vector<uint64_t>& out)
+{
+	for (; i < numStarts && i + sizeof(T) <= size; i += align)
+	{
+		T v;
+		memcpy(&v, data + i, sizeof(T));
+		EndiannessAdjust(v, e);
+		if (v >= lo && v <= hi)
+			out.push_back(base + i);
+	}
+}
+
+#if BDAT_SIMD_X86
+// kernels for the vector loops: Match(p) returns the movemask of the lanes at `p` that are in range (all bytes of a lane set)
+// integers are compared as signed, the unsigned ones after flipping the sign bit (`bias`) of the values and the limits
+
+template <int S> __m128i Set1SSE2(uint64_t v);
+template <> UI_FORCEINLINE __m128i Set1SSE2<1>(uint64_t v) { return _mm_set1_epi8(char(v)); }
+template <> UI_FORCEINLINE __m128i Set1SSE2<2>(uint64_t v) { return _mm_set1_epi16(short(v)); }
+template <> UI_FORCEINLINE __m128i Set1SSE2<4>(uint64_t v) { return _mm_set1_epi32(int(v)); }
+template <> UI_FORCEINLINE __m128i Set1SSE2<8>(uint64_t v) { return _mm_set1_epi64x(int64_t(v)); }
+
+template <int S> __m128i CmpGtSSE2(__m128i a, __m128i b);
+template <> UI_FORCEINLINE __m128i CmpGtSSE2<1>(__m128i a, __m128i b) { return _mm_cmpgt_epi8(a, b); }
+template <> UI_FORCEINLINE __m128i CmpGtSSE2<2>(__m128i a, __m128i b) { return _mm_cmpgt_epi16(a, b); }
+template <> UI_FORCEINLINE __m128i CmpGtSSE2<4>(__m128i a, __m128i b) { return _mm_cmpgt_epi32(a, b); }
+template <> UI_FORCEINLINE __m128i CmpGtSSE2<8>(__m128i a, __m128i b)
+{
+	// no 64-bit compare before SSE4.2: compare the high halves as signed, and if equal, the low halves as unsigned
+	__m128i flipLow = _mm_set_epi32(0, int(0x80000000), 0, int(0x80000000));
+	a = _mm_xor_si128(a, flipLow);
+	b = _mm_xor_si128(b, flipLow);
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	__m128i eq = _mm_cmpeq_epi32(a, b);
+	__m128i r = _mm_or_si128(gt, _mm_and_si128(eq, _mm_shuffle_epi32(gt, _MM_SHUFFLE(2, 2, 0, 0))));
+	return _mm_shuffle_epi32(r, _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+template <int S> __m128i ByteSwapSSE2(__m128i v);
+template <> UI_FORCEINLINE __m128i ByteSwapSSE2<1>(__m128i v) { return v; }
+template <> UI_FORCEINLINE __m128i ByteSwapSSE2<2>(__m128i v) { return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)); }
+template <> UI_FORCEINLINE __m128i ByteSwapSSE2<4>(__m128i v)
+{
+	v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+	return ByteSwapSSE2<2>(v);
+}
+template <> UI_FORCEINLINE __m128i ByteSwapSSE2<8>(__m128i v)
+{
+	v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+	return ByteSwapSSE2<2>(v);
+}
+
+template <int S> struct IntRangeSSE2
+{
+	enum { SIZE = S };
+	__m128i lo, hi, bias;
+	bool big;
+
+	IntRangeSSE2(uint64_t lo_, uint64_t hi_, uint64_t bias_, bool big_) :
+		lo(Set1SSE2<S>(lo_ ^ bias_)), hi(Set1SSE2<S>(hi_ ^ bias_)), bias(Set1SSE2<S>(bias_)), big(big_) {}
+	UI_FORCEINLINE uint32_t Match(const uint8_t* p) const
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		if (big)
+			v = ByteSwapSSE2<S>(v);
+		v = _mm_xor_si128(v, bias);
+		__m128i out = _mm_or_si128(CmpGtSSE2<S>(lo, v), CmpGtSSE2<S>(v, hi));
+		return ~uint32_t(_mm_movemask_epi8(out)) & 0xffff;
+	}
+};
+
+struct F32RangeSSE2
+{
+	enum { SIZE = 4 };
+	__m128 lo, hi;
+	bool big;
+
+	F32RangeSSE2(float lo_, float hi_, bool big_) : lo(_mm_set1_ps(lo_)), hi(_mm_set1_ps(hi_)), big(big_) {}
+	UI_FORCEINLINE uint32_t Match(const uint8_t* p) const
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		if (big)
+			v = ByteSwapSSE2<4>(v);
+		__m128 f = _mm_castsi128_ps(v);
+		// false for NaNs
+		return _mm_movemask_epi8(_mm_castps_si128(_mm_and_ps(_mm_cmpge_ps(f, lo), _mm_cmple_ps(f, hi))));
+	}
+};
+
+struct F64RangeSSE2
+{
+	enum { SIZE = 8 };
+	__m128d lo, hi;
+	bool big;
+
+	F64RangeSSE2(double lo_, double hi_, bool big_) : lo(_mm_set1_pd(lo_)), hi(_mm_set1_pd(hi_)), big(big_) {}
+	UI_FORCEINLINE uint32_t Match(const uint8_t* p) const
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		if (big)
+			v = ByteSwapSSE2<8>(v);
+		__m128d f = _mm_castsi128_pd(v);
+		return _mm_movemask_epi8(_mm_castpd_si128(_mm_and_pd(_mm_cmpge_pd(f, lo), _mm_cmple_pd(f, hi))));
+	}
+};
+
+template <int S> __m256i Set1AVX2(uint64_t v);
+template <> BDAT_TARGET_AVX2 UI_FORCEINLINE __m256i Set1AVX2<1>(uint64_t v) { return _mm256_set1_epi8(char(v)); }
+template <> BDAT_TARGET_AVX2 UI_FORCEINLINE __m256i Set1AVX2<2>(uint64_t v) { return _mm256_set1_epi16(short(v)); }
+template <> BDAT_TARGET_AVX2 UI_FORCEINLINE __m256i Set1AVX2<4>(uint64_t v) { return _mm256_set1_epi32(int(v)); }
+template <> BDAT_TARGET_AVX2 UI_FORCEINLINE __m256i Set1AVX2<8>(uint64_t v) { return _mm256_set1_epi64x(int64_t(v)); }
+
+template <int S> __m256i CmpGtAVX2(__m256i a, __m256i b);
+template <> BDAT_TARGET_AVX2 UI_FORCEINLINE __m256i CmpGtAVX2<1>(__m256i a, __m256i b) { return _mm256_cmpgt_epi8(a, b); }
+template <> BDAT_TARGET_AVX2 UI_FORCEINLINE __m256i CmpGtAVX2<2>(__m256i a, __m256i b) { return _mm256_cmpgt_epi16(a, b); }
+template <> BDAT_TARGET_AVX2 UI_FORCEINLINE __m256i CmpGtAVX2<4>(__m256i a, __m256i b) { return _mm256_cmpgt_epi32(a, b); }
+template <> BDAT_TARGET_AVX2 UI_FORCEINLINE __m256i CmpGtAVX2<8>(__m256i a, __m256i b) { return _mm256_cmpgt_epi64(a, b); }
+
+// the byte order within each S-byte lane reversed (the same in both 128-bit halves), nullptr for no swapping
+static const char* GetByteSwapShuffleAVX2(int size)
+{
+	static const char swap2[32] = { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 };
+	static const char swap4[32] = { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+	static const char swap8[32] = { 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 };
+	switch (size)
+	{
+	case 2: return swap2;
+	case 4: return swap4;
+	case 8: return swap8;
+	default: return nullptr;
+	}
+}
+
+struct ByteSwapLoaderAVX2
+{
+	__m256i shuffle;
+	bool enabled;
+
+	BDAT_TARGET_AVX2 ByteSwapLoaderAVX2(int size, bool big)
+	{
+		const char* s = GetByteSwapShuffleAVX2(size);
+		enabled = big && s;
+		shuffle = enabled ? _mm256_loadu_si256((const __m256i*)s) : _mm256_setzero_si256();
+	}
+	BDAT_TARGET_AVX2 UI_FORCEINLINE __m256i Load(const uint8_t* p) const
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		return enabled ? _mm256_shuffle_epi8(v, shuffle) : v;
+	}
+};
+
+template <int S> struct IntRangeAVX2
+{
+	enum { SIZE = S };
+	__m256i lo, hi, bias;
+	ByteSwapLoaderAVX2 swap;
+
+	BDAT_TARGET_AVX2 IntRangeAVX2(uint64_t lo_, uint64_t hi_, uint64_t bias_, bool big) :
+		lo(Set1AVX2<S>(lo_ ^ bias_)), hi(Set1AVX2<S>(hi_ ^ bias_)), bias(Set1AVX2<S>(bias_)), swap(S, big) {}
+	BDAT_TARGET_AVX2 UI_FORCEINLINE uint32_t Match(const uint8_t* p) const
+	{
+		__m256i v = _mm256_xor_si256(swap.Load(p), bias);
+		__m256i out = _mm256_or_si256(CmpGtAVX2<S>(lo, v), CmpGtAVX2<S>(v, hi));
+		return ~uint32_t(_mm256_movemask_epi8(out));
+	}
+};
+
+struct F32RangeAVX2
+{
+	enum { SIZE = 4 };
+	__m256 lo, hi;
+	ByteSwapLoaderAVX2 swap;
+
+	BDAT_TARGET_AVX2 F32RangeAVX2(float lo_, float hi_, bool big) : lo(_mm256_set1_ps(lo_)), hi(_mm256_set1_ps(hi_)), swap(4, big) {}
+	BDAT_TARGET_AVX2 UI_FORCEINLINE uint32_t Match(const uint8_t* p) const
+	{
+		__m256 f = _mm256_castsi256_ps(swap.Load(p));
+		__m256 in = _mm256_and_ps(_mm256_cmp_ps(f, lo, _CMP_GE_OQ), _mm256_cmp_ps(f, hi, _CMP_LE_OQ));
+		return uint32_t(_mm256_movemask_epi8(_mm256_castps_si256(in)));
+	}
+};
+
+struct F64RangeAVX2
+{
+	enum { SIZE = 8 };
+	__m256d lo, hi;
+	ByteSwapLoaderAVX2 swap;
+
+	BDAT_TARGET_AVX2 F64RangeAVX2(double lo_, double hi_, bool big) : lo(_mm256_set1_pd(lo_)), hi(_mm256_set1_pd(hi_)), swap(8, big) {}
+	BDAT_TARGET_AVX2 UI_FORCEINLINE uint32_t Match(const uint8_t* p) const
+	{
+		__m256d f = _mm256_castsi256_pd(swap.Load(p));
+		__m256d in = _mm256_and_pd(_mm256_cmp_pd(f, lo, _CMP_GE_OQ), _mm256_cmp_pd(f, hi, _CMP_LE_OQ));
+		return uint32_t(_mm256_movemask_epi8(_mm256_castpd_si256(in)));
+	}
+};
+
+// the vector loops check the values starting at each `align`-th byte of a value (the phase) at once,
+// taking the first byte of each lane from the mask of every phase, and return the position they stopped at
+template <class K> static size_t ScanValueRangeSSE2(const K& kernel, const uint8_t* data, size_t size, size_t numStarts, size_t i, unsigned align, uint64_t base, std::vector<uint64_t>& out)
+{
+	const unsigned S = K::SIZE;
+	uint32_t laneStarts = GetEveryNthBitMask(S, 16);
+	uint32_t alignMask = GetEveryNthBitMask(align, 16);
+	for (; i < numStarts && i + S - 1 + 16 <= size; i += 16)
+	{
+		uint32_t mask = 0;
+		for (unsigned k = 0; k < S; k += align)
+			mask |= (kernel.Match(data + i + k) & laneStarts) << k;
+		AddMaskPositions(mask & alignMask, i, numStarts, base, out);
+	}
+	return i;
+}
+
+template <class K> BDAT_TARGET_AVX2 static size_t ScanValueRangeAVX2(const K& kernel, const uint8_t* data, size_t size, size_t numStarts, size_t i, unsigned align, uint64_t base, std::vector<uint64_t>& out)
+{
+	const unsigned S = K::SIZE;
+	uint32_t laneStarts = GetEveryNthBitMask(S, 32);
+	uint32_t alignMask = GetEveryNthBitMask(align, 32);
+	for (; i < numStarts && i + S - 1 + 32 <= size; i += 32)
+	{
+		uint32_t mask = 0;
+		for (unsigned k = 0; k < S; k += align)
+			mask |= (kernel.Match(data + i + k) & laneStarts) << k;
+		AddMaskPositions(mask & alignMask, i, numStarts, base, out);
+	}
+	return i;
+}
+
+template <class T> static size_t ScanValueRangeVector(const uint8_t* data, size_t size, size_t numStarts, size_t i, unsigned align, bool big, T lo, T hi, uint64_t base, std::vector<uint64_t>& out)
+{
+	const int S = sizeof(T);
+	uint64_t bias = std::is_signed<T>::value ? 0 : 1ULL << (S * 8 - 1);
+	if (g_searchSIMDLevel >= SIMDLevel::AVX2)
+		return ScanValueRangeAVX2(IntRangeAVX2<S>(uint64_t(lo), uint64_t(hi), bias, big), data, size, numStarts, i, align, base, out);
+	if (g_searchSIMDLevel >= SIMDLevel::SSE2)
+		return ScanValueRangeSSE2(IntRangeSSE2<S>(uint64_t(lo), uint64_t(hi), bias, big), data, size, numStarts, i, align, base, out);
+	return i;
+}
+
+static size_t ScanValueRangeVector(const uint8_t* data, size_t size, size_t numStarts, size_t i, unsigned align, bool big, float lo, float hi, uint64_t base, std::vector<uint64_t>& out)
+{
+	if (g_searchSIMDLevel >= SIMDLevel::AVX2)
+		return ScanValueRangeAVX2(F32RangeAVX2(lo, hi, big), data, size, numStarts, i, align, base, out);
+	if (g_searchSIMDLevel >= SIMDLevel::SSE2)
+		return ScanValueRangeSSE2(F32RangeSSE2(lo, hi, big), data, size, numStarts, i, align, base, out);
+	return i;
+}
+
+static size_t ScanValueRangeVector(const uint8_t* data, size_t size, size_t numStarts, size_t i, unsigned align, bool big, double lo, double hi, uint64_t base, std::vector<uint64_t>& out)
+{
+	if (g_searchSIMDLevel >= SIMDLevel::AVX2)
+		return ScanValueRangeAVX2(F64RangeAVX2(lo, hi, big), data, size, numStarts, i, align, base, out);
+	if (g_searchSIMDLevel >= SIMDLevel::SSE2)
+		return ScanValueRangeSSE2(F64RangeSSE2(lo, hi, big), data, size, numStarts, i, align, base, out);
+	return i;
+}
+#endif
+
+template <class T> static void ScanValueRange(const uint8_t* data, size_t size, size_t numStarts, unsigned align, Endianness e, T lo, T hi, uint64_t base, std::vector<uint64_t>& out)
+{
+	if (!(lo <= hi))
+		return;
+	size_t i = GetFirstAlignedPos(base, align);
+#if BDAT_SIMD_X86
+	i = ScanValueRangeVector(data, size, numStarts, i, align, e == Endianness::Big, lo, hi, base, out);
+#endif
+	ScanValueRangeScalar(data, size, numStarts, i, align, e, lo, hi, base, out);
+}
+
+template <class T> static void ClampToType(int64_t min, int64_t max, T& lo, T& hi)
+{
+	using L = std::numeric_limits<T>;
+	lo = min < int64_t(L::min()) ? L::min() : min > int64_t(L::max()) ? L::max() : T(min);
+	hi = max > int64_t(L::max()) ? L::max() : max < int64_t(L::min()) ? L::min() : T(max);
+	// the range is empty if it doesn't overlap the type's
+	if (min > int64_t(L::max()) || max < int64_t(L::min()))
+		lo = L::max(), hi = L::min();
+}
+
+template <class T> static void ClampToTypeUnsigned(uint64_t min, uint64_t max, T& lo, T& hi)
+{
+	using L = std::numeric_limits<T>;
+	lo = min > uint64_t(L::max()) ? L::max() : T(min);
+	hi = max > uint64_t(L::max()) ? L::max() : T(max);
+	if (min > uint64_t(L::max()))
+		lo = L::max(), hi = L::min();
+}
+
+// the smallest float >= v / the largest float <= v, so that comparing floats gives the same result as comparing them as doubles
+static float RoundUpToFloat(double v)
+{
+	using L = std::numeric_limits<float>;
+	if (v > L::max())
+		return L::infinity();
+	if (v < -L::max())
+		return v == -L::infinity() ? -L::infinity() : -L::max();
+	float f = float(v);
+	return double(f) < v ? nextafterf(f, L::infinity()) : f;
+}
+
+static float RoundDownToFloat(double v)
+{
+	using L = std::numeric_limits<float>;
+	if (v < -L::max())
+		return -L::infinity();
+	if (v > L::max())
+		return v == L::infinity() ? L::infinity() : L::max();
+	float f = float(v);
+	return double(f) > v ? nextafterf(f, -L::infinity()) : f;
+}
+
+template <class T> static void FindSignedValuesInRange(const uint8_t* data, size_t size, size_t numStarts, const ValueRangeQuery& q, uint64_t base, std::vector<uint64_t>& out)
+{
+	T lo, hi;
+	ClampToType(q.imin, q.imax, lo, hi);
+	ScanValueRange(data, size, numStarts, q.alignment, q.endianness, lo, hi, base, out);
+}
+
+template <class T> static void FindUnsignedValuesInRange(const uint8_t* data, size_t size, size_t numStarts, const ValueRangeQuery& q, uint64_t base, std::vector<uint64_t>& out)
+{
+	T lo, hi;
+	ClampToTypeUnsigned(q.umin, q.umax, lo, hi);
+	ScanValueRange(data, size, numStarts, q.alignment, q.endianness, lo, hi, base, out);
+}
+
+void FindValuesInRange(const void* data, size_t size, size_t numStarts, const ValueRangeQuery& q, uint64_t base, std::vector<uint64_t>& out)
+{
+	auto* d = (const uint8_t*)data;
+	switch (q.type)
+	{
+	case DT_I8: FindSignedValuesInRange<int8_t>(d, size, numStarts, q, base, out); break;
+	case DT_I16: FindSignedValuesInRange<int16_t>(d, size, numStarts, q, base, out); break;
+	case DT_I32: FindSignedValuesInRange<int32_t>(d, size, numStarts, q, base, out); break;
+	case DT_I64: FindSignedValuesInRange<int64_t>(d, size, numStarts, q, base, out); break;
+	case DT_CHAR:
+	case DT_U8: FindUnsignedValuesInRange<uint8_t>(d, size, numStarts, q, base, out); break;
+	case DT_U16: FindUnsignedValuesInRange<uint16_t>(d, size, numStarts, q, base, out); break;
+	case DT_U32: FindUnsignedValuesInRange<uint32_t>(d, size, numStarts, q, base, out); break;
+	case DT_U64: FindUnsignedValuesInRange<uint64_t>(d, size, numStarts, q, base, out); break;
+	case DT_F32: ScanValueRange(d, size, numStarts, q.alignment, q.endianness, RoundUpToFloat(q.fmin), RoundDownToFloat(q.fmax), base, out); break;
+	case DT_F64: ScanValueRange(d, size, numStarts, q.alignment, q.endianness, q.fmin, q.fmax, base, out); break;
+	default: break;
+	}
+}
+
+
+static UI_FORCEINLINE void CountByteValues8(uint64_t v, uint32_t (&tables)[4][256])
+{
+	tables[0][v & 0xff]++;
+	tables[1][(v >> 8) & 0xff]++;
+	tables[2][(v >> 16) & 0xff]++;
+	tables[3][(v >> 24) & 0xff]++;
+	tables[0][(v >> 32) & 0xff]++;
+	tables[1][(v >> 40) & 0xff]++;
+	tables[2][(v >> 48) & 0xff]++;
+	tables[3][v >> 56]++;
+}
+
+#if BDAT_SIMD_X86
+static UI_FORCEINLINE bool IsRunOf64SSE2(const uint8_t* p)
+{
+	__m128i c = _mm_set1_epi8(char(p[0]));
+	__m128i eq = _mm_and_si128(
+		_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), c), _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), c)),
+		_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), c), _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), c)));
+	return _mm_movemask_epi8(eq) == 0xffff;
+}
+#endif
+
+static UI_FORCEINLINE bool IsRunOf64Scalar(const uint8_t* p)
+{
+	uint64_t first;
+	memcpy(&first, p, 8);
+	if (first != (p[0] * 0x0101010101010101ULL))
+		return false;
+	for (size_t i = 8; i < 64; i += 8)
+	{
+		uint64_t v;
+		memcpy(&v, p + i, 8);
+		if (v != first)
+			return false;
+	}
+	return true;
+}
+
+void CountByteValues(const void* data, size_t size, uint32_t hist[256])
+{
+	auto* d = (const uint8_t*)data;
+	uint32_t tables[4][256] = {};
+#if BDAT_SIMD_X86
+	bool sse2 = g_searchSIMDLevel >= SIMDLevel::SSE2;
+#endif
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64)
+	{
+#if BDAT_SIMD_X86
+		bool run = sse2 ? IsRunOf64SSE2(d + i) : IsRunOf64Scalar(d + i);
+#else
+		bool run = IsRunOf64Scalar(d + i);
+#endif
+		if (run)
+		{
+			tables[0][d[i]] += 64;
+			continue;
+		}
+		for (size_t j = 0; j < 64; j += 8)
+		{
+			uint64_t v;
+			memcpy(&v, d + i + j, 8);
+			CountByteValues8(v, tables);
+		}
+	}
+	for (; i < size; i++)
+		tables[i & 3][d[i]]++;
+
+	for (int v = 0; v < 256; v++)
+		hist[v] += tables[0][v] + tables[1][v] + tables[2][v] + tables[3][v];
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include "pch.h"
+#include "BulkDecode.h"
+#include "Markers.h"
+
+
+// low-level scanning routines used by the searches, working on in-memory chunks
+
+// the kernels used by the functions below (defaults to the supported level, can be lowered to test the fallbacks)
+extern SIMDLevel g_searchSIMDLevel;
+
+// appends `base + position` of every occurrence of `pat` in `data` (including overlapping ones) to `out`, in order
+// candidates are found by comparing the first and last bytes of the pattern 16/32 positions at a time, and then verified
+void FindAllOccurrences(const void* data, size_t size, const void* pat, size_t patSize, uint64_t base, std::vector<uint64_t>& out);
+
+struct MultiPatternMatch
+{
+	uint64_t offset;
+	uint32_t pattern;
+};
+
+// Aho-Corasick automaton for finding any number of patterns in one pass
+// (the transitions are stored as a full table, one row of 256 per state, so each byte costs one lookup)
+struct MultiPatternMatcher
+{
+	// empty patterns are ignored but still take up their index
+	void Build(const std::vector<std::string>& patterns);
+	bool IsEmpty() const { return _maxPatternSize == 0; }
+	size_t GetMaxPatternSize() const { return _maxPatternSize; }
+	size_t GetPatternSize(uint32_t pattern) const { return _patternSizes[pattern]; }
+
+	// appends every occurrence (including overlapping ones) that is fully inside `data` and starts before `numStarts`
+	// to `out`, sorted by offset and then pattern index
+	void FindAll(const void* data, size_t size, size_t numStarts, uint64_t base, std::vector<MultiPatternMatch>& out) const;
+
+	std::vector<uint32_t> _next; // state * 256 + byte -> state
+	std::vector<uint32_t> _outputStart; // state -> first in _outputs, one more than states
+	std::vector<uint32_t> _outputs; // pattern indices matched on entering each state (including via suffix links)
+	std::vector<size_t> _patternSizes;
+	size_t _maxPatternSize = 0;
+};
+
+// byte pattern with wildcards, masks and gaps, written as e.g. `3F 80 ?? ?0 00&F0 [2-8] "abc" [4] FF`:
+// - `3F` = literal byte, `?0`/`3?` = one nibble can be anything, `??` = any byte
+// - `XX&MM` = only compare the bits set in MM
+// - `"text"` = literal bytes (`\"` and `\\` for the quote and backslash)
+// - `[n]` = n bytes of anything, `[n-m]` = between n and m bytes of anything (not allowed at the start or end)
+struct BytePattern
+{
+	struct Segment
+	{
+		uint32_t gapMin = 0; // before this segment
+		uint32_t gapMax = 0;
+		std::vector<uint8_t> values; // already masked
+		std::vector<uint8_t> masks;
+	};
+	// [from, to] (inclusive) of positions in the data
+	struct PosRange
+	{
+		size_t from;
+		size_t to;
+	};
+
+	// returns false and sets `error` if the pattern could not be parsed
+	bool Parse(ui::StringView text, std::string& error);
+	size_t GetMinSize() const;
+	size_t GetMaxSize() const;
+	// the longest run of fully specified bytes in the first segment (where its offset from the start of a match is fixed)
+	void GetLongestLiteral(std::string& bytes, size_t& offset) const;
+
+	// appends the offsets of all matches starting before `numStarts` (once per offset, even if several gap lengths fit)
+	// matches that would need data past `size` are not found
+	void FindAll(const void* data, size_t size, size_t numStarts, uint64_t base, std::vector<uint64_t>& out) const;
+
+	void _ChooseAnchors();
+	bool _MatchSegmentAt(const uint8_t* data, size_t size, size_t seg, size_t pos) const;
+	// `ends` and `next` are scratch space
+	bool _MatchAt(const uint8_t* data, size_t size, size_t pos, std::vector<PosRange>& ends, std::vector<PosRange>& next) const;
+
+	std::vector<Segment> segments;
+	// the rarest fully specified bytes of the first segment, for prefiltering
+	int numAnchors = 0;
+	size_t anchorOffsets[2] = {};
+	uint8_t anchorValues[2] = {};
+};
+
+enum class ApproxDistanceType : uint8_t
+{
+	Hamming, // only changed bytes
+	Edit, // inserted, removed or changed bytes (Levenshtein)
+};
+
+struct ApproxMatch
+{
+	uint64_t offset;
+	uint32_t distance;
+};
+
+// the patterns are kept in one machine word, a bit per byte
+static const size_t APPROX_MAX_PATTERN_SIZE = 64;
+
+// finds the places where a pattern is at most `maxDistance` bytes different, bit-parallel (so each byte costs a few
+// word operations, independent of the pattern size):
+// - Hamming: every window of the pattern's size with that many mismatches (Shift-And with a state for each count)
+// - Edit: the starts of the closest substrings (Myers' algorithm, run backwards with the reversed pattern)
+struct ApproximateMatcher
+{
+	// returns false and sets `error` if the pattern is empty, too long, or would match anything at this distance
+	bool Init(ui::StringView pattern, ApproxDistanceType type, unsigned maxDistance, std::string& error);
+	size_t GetPatternSize() const { return _pattern.size(); }
+	// the most data that a match can span
+	size_t GetMaxMatchSize() const { return _pattern.size() + (_type == ApproxDistanceType::Edit ? _maxDistance : 0); }
+	// the pieces of the pattern, at least one of which must be in every match (for the Hamming distance only)
+	bool GetRequiredLiterals(std::vector<std::string>& pieces, std::vector<size_t>& offsets) const;
+
+	// appends the matches starting from `firstStart` until `numStarts`, in order
+	// matches that would need data past `size` are not found
+	// for the edit distance, neighbouring starts would mostly be the same match with a byte more or less, so a start is
+	// only reported if it's closer than the one before it (using the data before `firstStart`) and not further than the next
+	void FindAll(const void* data, size_t size, size_t firstStart, size_t numStarts, uint64_t base, std::vector<ApproxMatch>& out) const;
+	// the size of the shortest data from data[0] that is at most `distance` from the pattern
+	size_t GetMatchSize(const void* data, size_t size, unsigned distance) const;
+
+	void _FindAllHamming(const uint8_t* data, size_t size, size_t firstStart, size_t numStarts, uint64_t base, std::vector<ApproxMatch>& out) const;
+	void _FindAllEdit(const uint8_t* data, size_t size, size_t firstStart, size_t numStarts, uint64_t base, std::vector<ApproxMatch>& out) const;
+
+	std::string _pattern;
+	ApproxDistanceType _type = ApproxDistanceType::Hamming;
+	unsigned _maxDistance = 0;
+	// byte -> the pattern positions that have it (reversed for the edit distance)
+	uint64_t _masks[256] = {};
+};
+
+// an inclusive range of numbers to look for
+struct ValueRangeQuery
+{
+	DataType type = DT_I32;
+	Endianness endianness = Endianness::Little;
+	// of the value offsets in the data source, 1/2/4/8
+	unsigned alignment = 1;
+	// the limits for signed/unsigned/floating point types (clamped to the range of the type)
+	int64_t imin = 0;
+	int64_t imax = 0;
+	uint64_t umin = 0;
+	uint64_t umax = 0;
+	double fmin = 0;
+	double fmax = 0;
+};
+
+// appends `base + position` of every value in the range that starts before `numStarts` and ends within `size`, in order
+// the values are compared 16/32 bytes at a time, once for each possible starting byte within a value
+void FindValuesInRange(const void* data, size_t size, size_t numStarts, const ValueRangeQuery& q, uint64_t base, std::vector<uint64_t>& out);
+
+// adds the number of each byte value in `data` to `hist`
+// runs of 64 equal bytes (padding, fills) are counted at once, the rest goes to 4 interleaved tables
+// so that repeats of the same value don't wait on each other's increments
+void CountByteValues(const void* data, size_t size, uint32_t hist[256]);
@@ -0,0 +1,131 @@
+
+#include "pch.h"
+#include "TabDiagnostics.h"
+#include "FileReaders.h"
+
+
+enum COLS_IOStats
+{
+	IOS_COL_Type,
+	IOS_COL_Desc,
+	IOS_COL_Reads,
+	IOS_COL_Bytes,
+	IOS_COL_NonSequential,
+	IOS_COL_AvgLatency,
+	IOS_COL_P50Latency,
+	IOS_COL_P99Latency,
+
+	IOS_COL__COUNT,
+};
+
+void IOStatsTable::Refresh()
+{
+	GetAllIOStats(rows);
+	// sources that were never read from are only noise
+	rows.erase(std::remove_if(rows.begin(), rows.end(), [](const IOStatsSnapshot& S) { return S.reads == 0; }), rows.end());
+}
+
+size_t IOStatsTable::GetNumCols()
+{
+	return IOS_COL__COUNT;
+}
+
+std::string IOStatsTable::GetColName(size_t col)
+{
+	switch (col)
+	{
+	case IOS_COL_Type: return "Type";
+	case IOS_COL_Desc: return "Description";
+	case IOS_COL_Reads: return "Reads";
+	case IOS_COL_Bytes: return "Bytes";
+	case IOS_COL_NonSequential: return "Non-seq.";
+	case IOS_COL_AvgLatency: return "Avg. us";
+	case IOS_COL_P50Latency: return "p50 us";
+	case IOS_COL_P99Latency: return "p99 us";
+	default: return "???";
+	}
+}
+
+std::string IOStatsTable::GetText(uintptr_t id, size_t col)
+{
+	const auto& S = rows[id];
+	switch (col)
+	{
+	case IOS_COL_Type: return S.type;
+	case IOS_COL_Desc: return S.desc;
+	case IOS_COL_Reads: return std::to_string(S.reads);
+	case IOS_COL_Bytes: return std::to_string(S.bytes);
+	case IOS_COL_NonSequential: return std::to_string(S.nonSequential);
+	case IOS_COL_AvgLatency: return ui::Format("%.1f", S.GetAvgMicros());
+	case IOS_COL_P50Latency: return ui::Format("%.0f", S.GetLatencyPercentileMicros(0.5));
+	case IOS_COL_P99Latency: return ui::Format("%.0f", S.GetLatencyPercentileMicros(0.99));
+	default: return "???";
+	}
+}
+
+size_t IOStatsTable::GetNumRows()
+{
+	return rows.size();
+}
+
+std::string IOStatsTable::GetRowName(size_t row)
+{
+	return std::to_string(row + 1);
+}
+
+
+static float hsplitDiagnosticsTab1[1] = { 0.7f };
+
+void TabDiagnostics::Build()
+{
+	ioStatsTable.Refresh();
+
+	ui::Push<ui::SplitPane>().Init(ui::Direction::Horizontal, hsplitDiagnosticsTab1);
+	{
+		ui::Push<ui::EdgeSliceLayoutElement>();
+
+		ui::MakeWithText<ui::LabelFrame>("I/O by data source");
+
+		auto& tv = ui::Make<ui::TableView>();
+		tv.enableRowHeader = false;
+		tv.SetDataSource(&ioStatsTable);
+		tv.CalculateColumnWidths();
+
+		ui::Pop();
+
+		ui::Push<ui::StackTopDownLayoutElement>();
+		ui::MakeWithText<ui::Header>("I/O statistics");
+
+		bool enabled = g_ioStatsEnabled;
+		if (ui::imm::PropEditBool("Collect", enabled))
+			g_ioStatsEnabled = enabled;
+		// clicking any of these rebuilds the tab, which takes a new snapshot
+		ui::imm::Button("Refresh");
+		if (ui::imm::Button("Reset"))
+			ResetAllIOStats();
+
+		// nested sources (e.g. a slice of a file) count the same read at every level
+		IOStatsSnapshot total;
+		for (const auto& S : ioStatsTable.rows)
+			total.Add(S);
+
+		ui::MakeWithText<ui::Header>("Latency (all sources)");
+		for (int i = 0; i < IO_LATENCY_BUCKETS; i++)
+		{
+			if (!total.latency[i])
+				continue;
+			std::string label = i == IO_LATENCY_BUCKETS - 1 ?
+				ui::Format(">= %llu us", 1ULL << (i - 1)) :
+				ui::Format("< %llu us", 1ULL << i);
+			ui::imm::PropText(label.c_str(), std::to_string(total.latency[i]).c_str());
+		}
+
+		ui::MakeWithText<ui::Header>("Files");
+		uint64_t maxMappedMB = g_maxMappedFileSize / (1024 * 1024);
+		if (ui::imm::PropEditInt("Map files up to (MB)", maxMappedMB))
+			g_maxMappedFileSize = maxMappedMB * 1024 * 1024;
+
+		ui::Pop();
+	}
+	ui::Pop();
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "pch.h"
+#include "IOStats.h"
+
+
+struct IOStatsTable : ui::TableDataSource
+{
+	std::vector<IOStatsSnapshot> rows;
+
+	void Refresh();
+
+	// GenericGridDataSource(TableDataSource)
+	size_t GetNumCols() override;
+	std::string GetColName(size_t col) override;
+	std::string GetText(uintptr_t id, size_t col) override;
+	// TableDataSource
+	size_t GetNumRows() override;
+	std::string GetRowName(size_t row) override;
+};
+
+struct TabDiagnostics : ui::Buildable
+{
+	void Build() override;
+
+	IOStatsTable ioStatsTable;
+};
@@ -3,12 +3,20 @@
 #include "TabFragmentSearch.h"
 
 #include "Workspace.h"
+#include "SearchIndex.h"
 
 
 static float hsplitFragmentSearchTab1[1] = { 0.6f };
 
 void TabFragmentSearch::Build()
 {
+	ui::BuildMulticastDelegateAddNoArgs(OnSearchIndexStateChanged, [this]() { Rebuild(); });
+	ui::BuildMulticastDelegateAdd(OnBackgroundSearchUpdate, [this](const BackgroundSearch* s)
+	{
+		if (s == &of->fragSearch.search)
+			Rebuild();
+	});
+
 	ui::Push<ui::SplitPane>().Init(ui::Direction::Horizontal, hsplitFragmentSearchTab1);
 	{
 		ui::Push<ui::EdgeSliceLayoutElement>();
@@ -36,7 +44,48 @@ void TabFragmentSearch::Build()
 		ui::Pop();
 
 		ui::Push<ui::StackTopDownLayoutElement>();
-		of->fragSearch.SearchUI(of->ddFile->dataSource);
+		of->fragSearch.SearchUI(of->ddFile);
+		ui::Pop();
+	}
+	ui::Pop();
+}
+
+
+static float hsplitValueSearchTab1[1] = { 0.6f };
+
+void TabValueSearch::Build()
+{
+	ui::BuildMulticastDelegateAdd(OnBackgroundSearchUpdate, [this](const BackgroundSearch* s)
+	{
+		if (s == &of->valueSearch.search)
+			Rebuild();
+	});
+
+	ui::Push<ui::SplitPane>().Init(ui::Direction::Horizontal, hsplitValueSearchTab1);
+	{
+		ui::Push<ui::EdgeSliceLayoutElement>();
+
+		ui::MakeWithText<ui::LabelFrame>("Found items");
+
+		auto& tv = ui::Make<ui::TableView>();
+		curTable = &tv;
+		tv.enableRowHeader = false;
+		tv.SetDataSource(&of->valueSearch);
+		tv.CalculateColumnWidths();
+		tv.HandleEvent(&tv, ui::EventType::Click) = [this, &tv](ui::Event& e)
+		{
+			size_t row = tv.GetHoverRow();
+			if (row != SIZE_MAX && e.GetButton() == ui::MouseButton::Left && e.numRepeats == 2)
+			{
+				auto off = of->valueSearch.results[row];
+				of->hexViewerState.GoToPos(off);
+			}
+		};
+
+		ui::Pop();
+
+		ui::Push<ui::StackTopDownLayoutElement>();
+		of->valueSearch.SearchUI(of->ddFile->dataSource);
 		ui::Pop();
 	}
 	ui::Pop();
@@ -47,6 +96,12 @@ static float hsplitFileFormatSearchTab1[1] = { 0.6f };
 
 void TabFileFormatSearch::Build()
 {
+	ui::BuildMulticastDelegateAdd(OnBackgroundSearchUpdate, [this](const BackgroundSearch* s)
+	{
+		if (s == &of->fileFmtSearch.search)
+			Rebuild();
+	});
+
 	ui::Push<ui::SplitPane>().Init(ui::Direction::Horizontal, hsplitFileFormatSearchTab1);
 	{
 		ui::Push<ui::EdgeSliceLayoutElement>();
@@ -57,8 +112,8 @@ void TabFileFormatSearch::Build()
 		curTable = &tv;
 		tv.enableRowHeader = false;
 		tv.SetDataSource(&of->fileFmtSearch);
-		//tv.SetSelectionStorage(&of->fileFmtSearch.highlightList);
-		//tv.SetSelectionMode(ui::SelectionMode::Single);
+		tv.SetSelectionStorage(&of->fileFmtSearch);
+		tv.SetSelectionMode(ui::SelectionMode::Single);
 		tv.CalculateColumnWidths();
 		tv.HandleEvent(&tv, ui::EventType::Click) = [this, &tv](ui::Event& e)
 		{
@@ -74,6 +129,39 @@ void TabFileFormatSearch::Build()
 
 		ui::Push<ui::StackTopDownLayoutElement>();
 		of->fileFmtSearch.SearchUI(of->ddFile->dataSource);
+
+		auto& ffs = of->fileFmtSearch;
+		auto& hvs = of->hexViewerState;
+		bool hasSel = hvs.selectionStart != UINT64_MAX && hvs.selectionEnd != UINT64_MAX;
+		ui::Push<ui::StackLTRLayoutElement>();
+		ui::MakeWithText<ui::LabelFrame>("Carve into files:");
+		if (ui::imm::Button("Selected", { ui::Enable(ffs.selected < ffs.results.size()) }))
+		{
+			size_t idx = ffs.selected;
+			workspace->CarveFiles(of, &idx, 1);
+			if (auto* F = ffs.results[idx].carvedFile)
+				workspace->OpenFileTab(F);
+		}
+		if (ui::imm::Button("All"))
+		{
+			std::vector<size_t> indices;
+			for (size_t i = 0; i < ffs.results.size(); i++)
+				indices.push_back(i);
+			workspace->CarveFiles(of, indices.data(), indices.size());
+			Rebuild();
+		}
+		if (ui::imm::Button("Starting in the selection", { ui::Enable(hasSel) }))
+		{
+			uint64_t selMin = ui::min(hvs.selectionStart, hvs.selectionEnd);
+			uint64_t selMax = ui::max(hvs.selectionStart, hvs.selectionEnd);
+			std::vector<size_t> indices;
+			for (size_t i = 0; i < ffs.results.size(); i++)
+				if (ffs.results[i].offset >= selMin && ffs.results[i].offset <= selMax)
+					indices.push_back(i);
+			workspace->CarveFiles(of, indices.data(), indices.size());
+			Rebuild();
+		}
+		ui::Pop();
 		ui::Pop();
 	}
 	ui::Pop();
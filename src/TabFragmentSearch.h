@@ -6,6 +6,7 @@
 
 
 struct OpenedFile;
+struct Workspace;
 
 
 struct TabFragmentSearch : ui::Buildable, TableWithOffsets
@@ -15,9 +16,17 @@ struct TabFragmentSearch : ui::Buildable, TableWithOffsets
 	OpenedFile* of = nullptr;
 };
 
+struct TabValueSearch : ui::Buildable, TableWithOffsets
+{
+	void Build() override;
+
+	OpenedFile* of = nullptr;
+};
+
 struct TabFileFormatSearch : ui::Buildable, TableWithOffsets
 {
 	void Build() override;
 
+	Workspace* workspace = nullptr;
 	OpenedFile* of = nullptr;
 };
@@ -4,6 +4,7 @@
 
 #include "HexViewer.h"
 #include "Workspace.h"
+#include "FileReaders.h"
 
 
 static float hsplitInspectTab1[1] = { 0.5f };
@@ -15,6 +16,11 @@ void TabInspect::Build()
 		if (s == &of->hexViewerState)
 			Rebuild();
 	});
+	ui::BuildMulticastDelegateAdd(OnBackgroundSearchUpdate, [this](const BackgroundSearch* s)
+	{
+		if (s == &of->saveJob)
+			Rebuild();
+	});
 
 	ui::Push<ui::SplitPane>().Init(ui::Direction::Horizontal, hsplitInspectTab1);
 	{
@@ -68,7 +74,131 @@ void TabInspect::Build()
 
 		of->ddFile->offModRanges.Edit();
 
+		DataCacheStats cs;
+		if (of->ddFile->origDataSource->GetCacheStats(cs))
+		{
+			ui::MakeWithText<ui::Header>("Data cache");
+			ui::imm::PropText("Hits", std::to_string(cs.hits).c_str());
+			ui::imm::PropText("Misses", std::to_string(cs.misses).c_str());
+			ui::imm::PropText("Bytes read", std::to_string(cs.bytesRead).c_str());
+			ui::imm::PropText("Memory used", ui::Format("%zu / %zu KB", cs.memoryUsed / 1024, cs.memoryBudget / 1024).c_str());
+		}
+
+		EditUI();
+
 		ui::Pop();
 	}
 	ui::Pop();
 }
+
+static const size_t EDIT_BYTE_COUNT = 16;
+
+static size_t ParseHexBytes(const char* s, uint8_t* out, size_t maxCount)
+{
+	size_t n = 0;
+	int hi = -1;
+	for (; *s && n < maxCount; s++)
+	{
+		char c = *s;
+		int v;
+		if (c >= '0' && c <= '9') v = c - '0';
+		else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+		else if (c == ' ' && hi < 0) continue;
+		else break;
+
+		if (hi < 0)
+			hi = v;
+		else
+		{
+			out[n++] = uint8_t(hi * 16 + v);
+			hi = -1;
+		}
+	}
+	return n;
+}
+
+void TabInspect::EditUI()
+{
+	auto* F = of->ddFile;
+	auto* ov = F->editOverlay.get_ptr();
+	if (!ov)
+		return;
+
+	ui::MakeWithText<ui::Header>("Edit");
+
+	// edits go to the shared data in the original file's offsets
+	auto pos = of->hexViewerState.GetInspectPos();
+	uint64_t size = F->dataSource->GetSize();
+	size_t count = pos < size ? size_t(ui::min(uint64_t(EDIT_BYTE_COUNT), size - pos)) : 0;
+
+	uint8_t bytes[EDIT_BYTE_COUNT];
+	F->dataSource->Read(pos, count, bytes);
+	char txt_hex[EDIT_BYTE_COUNT * 3 + 1] = {};
+	for (size_t i = 0; i < count; i++)
+		snprintf(txt_hex + i * 3, 4, i + 1 < count ? "%02X " : "%02X", bytes[i]);
+
+	ui::imm::PropEditString("Bytes", txt_hex, [this, F, ov, pos, count](const char* v)
+	{
+		uint8_t nb[EDIT_BYTE_COUNT];
+		size_t n = ParseHexBytes(v, nb, count);
+		if (!n)
+			return;
+		ov->Write(F->off + pos, nb, n);
+		workspace->desc.OnDataEdited(F->origDataSource, F->off + pos, n);
+	});
+
+	ui::imm::PropText("Edited ranges", std::to_string(ov->GetEditedRangeCount()).c_str());
+	if (ui::imm::Button("Revert these bytes"))
+	{
+		ov->Revert(F->off + pos, count);
+		workspace->desc.OnDataEdited(F->origDataSource, F->off + pos, count);
+	}
+	if (ui::imm::Button("Revert all edits"))
+	{
+		ov->RevertAll();
+		workspace->desc.OnDataEdited(F->origDataSource, 0, ov->GetSize());
+	}
+	if (of->saveJob.IsRunning())
+		of->saveJob.ProgressUI("Saving");
+	else if (ui::imm::Button("Save edited copy..."))
+	{
+		ui::FileSelectionWindow fsw;
+		fsw.filters.push_back({ "Any file", "*" });
+		if (fsw.Show(true))
+			SaveEditedCopy(fsw.currentDir + "/" + fsw.selectedFiles[0]);
+	}
+	if (!of->saveStatus.empty())
+		ui::imm::PropText("Saved copy", of->saveStatus.c_str());
+}
+
+void TabInspect::SaveEditedCopy(const std::string& path)
+{
+	// the edits are only an overlay so the files it reads from must stay intact (they can also be mapped)
+	for (auto* F : workspace->desc.files)
+	{
+		bool open = IsSameFile(path.c_str(), F->path.c_str());
+		for (auto& part : F->moreParts)
+			open = open || IsSameFile(path.c_str(), part.c_str());
+		if (open)
+		{
+			of->saveStatus = "can't overwrite a file that's open in the workspace: " + path;
+			return;
+		}
+	}
+
+	// later edits don't change what's being saved
+	auto* snapshot = of->ddFile->editOverlay->CreateSnapshot();
+	of->saveSnapshot = snapshot;
+	of->saveStatus.clear();
+	auto* ofile = of;
+	of->saveJob.Start([ofile, snapshot, path](BackgroundSearch::Job* job)
+	{
+		bool ok = snapshot->SaveToFile(path.c_str(), &job->progress, &job->cancel);
+		job->Post([ofile, path, ok]()
+		{
+			ofile->saveStatus = (ok ? "saved to " : "failed to save to ") + path;
+			ofile->saveSnapshot = nullptr;
+		});
+	});
+}
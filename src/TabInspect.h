@@ -2,6 +2,7 @@
 #pragma once
 #include "pch.h"
 
+struct Workspace;
 struct OpenedFile;
 
 
@@ -9,5 +10,9 @@ struct TabInspect : ui::Buildable
 {
 	void Build() override;
 
+	void EditUI();
+	void SaveEditedCopy(const std::string& path);
+
+	Workspace* workspace = nullptr;
 	OpenedFile* of = nullptr;
 };
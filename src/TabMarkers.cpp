@@ -52,6 +52,7 @@ void TabMarkers::Build()
 				{
 					f->markerData.markers.erase(f->markerData.markers.begin() + f->mdSrc.selected);
 					f->mdSrc.selected = SIZE_MAX;
+					OnMarkerListChange.Call(&f->markerData);
 					e.current->Rebuild();
 				}
 			}
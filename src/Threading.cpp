@@ -0,0 +1,100 @@
+#include "pch.h"
+#include "Threading.h"
+
+
+static thread_local bool tls_isWorkerThread = false;
+
+WorkerPool::WorkerPool(unsigned numThreads)
+{
+	if (numThreads == 0)
+	{
+		unsigned hw = std::thread::hardware_concurrency();
+		numThreads = hw > 1 ? hw - 1 : 0;
+	}
+	for (unsigned i = 0; i < numThreads; i++)
+		_threads.emplace_back([this]() { _ThreadProc(); });
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_cond.notify_all();
+	for (auto& T : _threads)
+		T.join();
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+	if (count == 0)
+		return;
+	if (count == 1 || _threads.empty() || tls_isWorkerThread)
+	{
+		for (size_t i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+
+	std::lock_guard<std::mutex> jobLock(_jobMutex);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_fn = &fn;
+		_count = count;
+		_next = 0;
+		_jobID++;
+	}
+	_cond.notify_all();
+
+	_RunItems(&fn, count);
+
+	// every item has been claimed, wait for the workers that are still running theirs
+	std::unique_lock<std::mutex> lock(_mutex);
+	_doneCond.wait(lock, [this]() { return _activeWorkers == 0; });
+	_fn = nullptr;
+	_count = 0;
+}
+
+void WorkerPool::_RunItems(const std::function<void(size_t)>* fn, size_t count)
+{
+	for (;;)
+	{
+		size_t i = _next++;
+		if (i >= count)
+			break;
+		(*fn)(i);
+	}
+}
+
+void WorkerPool::_ThreadProc()
+{
+	tls_isWorkerThread = true;
+	uint64_t lastJobID = 0;
+	for (;;)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_cond.wait(lock, [this, lastJobID]() { return _stop || _jobID != lastJobID; });
+		if (_stop)
+			return;
+		lastJobID = _jobID;
+		if (!_fn)
+			continue;
+		auto* fn = _fn;
+		size_t count = _count;
+		_activeWorkers++;
+		lock.unlock();
+
+		_RunItems(fn, count);
+
+		lock.lock();
+		if (--_activeWorkers == 0)
+			_doneCond.notify_all();
+	}
+}
+
+WorkerPool& GetWorkerPool()
+{
+	static WorkerPool pool;
+	return pool;
+}
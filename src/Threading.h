@@ -0,0 +1,33 @@
+#pragma once
+#include "pch.h"
+
+
+struct WorkerPool
+{
+	// 0 = one thread per hardware thread (minus the caller's)
+	WorkerPool(unsigned numThreads = 0);
+	~WorkerPool();
+
+	// runs fn(i) for every i in [0, count) on the workers and the calling thread, returns when all are done
+	// (nested calls from inside a job run serially on the worker that made them)
+	void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+	unsigned GetThreadCount() { return unsigned(_threads.size()) + 1; }
+
+	void _RunItems(const std::function<void(size_t)>* fn, size_t count);
+	void _ThreadProc();
+
+	std::vector<std::thread> _threads;
+	std::mutex _jobMutex; // one ParallelFor at a time
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::condition_variable _doneCond;
+	const std::function<void(size_t)>* _fn = nullptr;
+	size_t _count = 0;
+	std::atomic<size_t> _next{ 0 };
+	unsigned _activeWorkers = 0;
+	uint64_t _jobID = 0;
+	bool _stop = false;
+};
+
+// shared by all CPU-bound jobs (searches, analysis)
+WorkerPool& GetWorkerPool();
@@ -1,11 +1,45 @@
 
 #include "pch.h"
 #include "Workspace.h"
+#include "CompressedDataSource.h"
+#include "FileFormats.h"
+#include "SearchIndex.h"
 
 
 ui::MulticastDelegate<OpenedFile*> OnCurrentFileChanged;
 
 
+void OpenDDFileDataSources(DDFile* F, const char* compressionIndexPath)
+{
+	IDataSource* src = OpenFileDataSource(F->path.c_str());
+	if (!F->moreParts.empty())
+	{
+		std::vector<IDataSource*> parts = { src };
+		for (const auto& P : F->moreParts)
+			parts.push_back(OpenFileDataSource(P.c_str()));
+		src = new ConcatDataSource(parts.data(), parts.size());
+	}
+	if (!F->compression.empty())
+	{
+		auto fmt = CompressionFormatFromString(F->compression);
+		F->decompressor = new CompressedDataSource(src, F->compOff, F->compSize, fmt, compressionIndexPath);
+		src = F->decompressor;
+	}
+	F->editOverlay = new OverlayDataSource(src);
+	F->origDataSource = F->editOverlay.get_ptr();
+	F->dataSource = GetSlice(F->origDataSource, F->off, F->size);
+	F->mdSrc.dataSource = F->dataSource;
+	F->searchIndex = new SearchIndex(F, GetSlice(src, F->off, F->size));
+	F->searchIndex->Open();
+}
+
+// the decompression checkpoints are stored next to the workspace so that reopening it doesn't decompress everything again
+static std::string GetCompressionIndexPath(ui::StringView wsPath, const DDFile* F)
+{
+	return ui::Format("%s.%" PRIu64 ".zidx", ui::to_string(wsPath).c_str(), F->id);
+}
+
+
 void OpenedFile::Load(NamedTextSerializeReader& r)
 {
 	r.BeginDict("");
@@ -28,7 +62,7 @@ void OpenedFile::Save(NamedTextSerializeWriter& w)
 	w.EndDict();
 }
 
-void Workspace::Load(NamedTextSerializeReader& r)
+void Workspace::Load(NamedTextSerializeReader& r, ui::StringView path)
 {
 	Clear();
 	r.BeginDict("workspace");
@@ -36,11 +70,11 @@ void Workspace::Load(NamedTextSerializeReader& r)
 	desc.Load("desc", r);
 	for (auto* F : desc.files)
 	{
-		std::string path = F->path;
 		// TODO workspace-relative paths?
-		F->origDataSource = GetFileDataSource(path.c_str());
-		F->dataSource = GetSlice(F->origDataSource, F->off, F->size);
-		F->mdSrc.dataSource = F->dataSource;
+		std::string indexPath;
+		if (!F->compression.empty() && !path.empty())
+			indexPath = GetCompressionIndexPath(path, F);
+		OpenDDFileDataSources(F, indexPath.empty() ? nullptr : indexPath.c_str());
 	}
 
 	r.BeginArray("openedFiles");
@@ -83,7 +117,7 @@ bool Workspace::LoadFromFile(ui::StringView path)
 	NamedTextSerializeReader ntsr;
 	bool parsed = ntsr.Parse(data.data->GetStringView());
 	printf("parsed: %s\n", parsed ? "yes" : "no");
-	Load(ntsr);
+	Load(ntsr, path);
 	return true;
 }
 
@@ -91,5 +125,90 @@ bool Workspace::SaveToFile(ui::StringView path)
 {
 	NamedTextSerializeWriter ntsw;
 	Save(ntsw);
-	return ui::WriteTextFile(path, ntsw.data);
+	if (!ui::WriteTextFile(path, ntsw.data))
+		return false;
+
+	for (auto* F : desc.files)
+	{
+		if (F->decompressor)
+			F->decompressor->SaveIndex(GetCompressionIndexPath(path, F).c_str());
+	}
+	return true;
+}
+
+OpenedFile* Workspace::OpenFileTab(DDFile* F)
+{
+	for (size_t i = 0; i < openedFiles.size(); i++)
+	{
+		if (openedFiles[i]->ddFile == F)
+		{
+			curOpenedFile = int(i);
+			OnCurrentFileChanged.Call(openedFiles[i]);
+			return openedFiles[i];
+		}
+	}
+
+	auto* nof = new OpenedFile;
+	nof->ddFile = F;
+	nof->fileID = F->id;
+	openedFiles.push_back(nof);
+	curOpenedFile = openedFiles.size() - 1;
+	OnCurrentFileChanged.Call(nof);
+	return nof;
+}
+
+size_t Workspace::CarveFiles(OpenedFile* of, const size_t* indices, size_t count)
+{
+	auto* srcf = of->ddFile;
+	auto& results = of->fileFmtSearch.results;
+	// the search may have been started before the file was changed
+	if (of->fileFmtSearch.resultSource.get_ptr() != srcf->dataSource.get_ptr())
+		return 0;
+
+	size_t numCarved = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		auto& R = results[indices[i]];
+		if (R.size == 0 || R.carvedFile)
+			continue;
+
+		auto* F = desc.CreateNewFile();
+		F->path = srcf->path;
+		F->moreParts = srcf->moreParts;
+
+		// the offset of a compressed stream can only be saved if it's in the file itself
+		auto fmt = srcf->compression.empty() ? DetectCompressionFormat(srcf->dataSource, R.offset) : CompressionFormat::Unknown;
+		if (fmt != CompressionFormat::Unknown)
+		{
+			F->name = ui::Format("%s@%" PRIu64 " (%s)", srcf->name.c_str(), R.offset, CompressionFormatToString(fmt));
+			F->compression = CompressionFormatToString(fmt);
+			F->compOff = srcf->off + R.offset;
+			F->compSize = R.size;
+			// the stream is decoded from the unedited file, as it is when the workspace is reopened
+			// (its index would go stale if the compressed bytes were edited under it)
+			// with the size from the search, nothing is decompressed until the file is viewed
+			F->decompressor = new CompressedDataSource(srcf->editOverlay->_src, F->compOff, F->compSize, fmt, nullptr,
+				R.decompressedSize ? R.decompressedSize : UINT64_MAX);
+			F->editOverlay = new OverlayDataSource(F->decompressor);
+			F->origDataSource = F->editOverlay.get_ptr();
+		}
+		else
+		{
+			F->name = ui::Format("%s@%" PRIu64 "%s", srcf->name.c_str(), R.offset, g_formats[R.format].ext);
+			F->off = srcf->off + R.offset;
+			F->size = R.size;
+			F->compression = srcf->compression;
+			F->compOff = srcf->compOff;
+			F->compSize = srcf->compSize;
+			F->origDataSource = srcf->origDataSource;
+			F->editOverlay = srcf->editOverlay;
+			F->decompressor = srcf->decompressor;
+		}
+		F->dataSource = GetSlice(F->origDataSource, F->off, F->size);
+		F->mdSrc.dataSource = F->dataSource;
+
+		R.carvedFile = F;
+		numCarved++;
+	}
+	return numCarved;
 }
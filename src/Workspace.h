@@ -16,6 +16,8 @@ enum class SubtabType
 	Markers = 2,
 	Structures = 3,
 	Images = 4,
+	Diagnostics = 7,
+	ValueSearch = 8,
 };
 
 struct OpenedFile
@@ -29,10 +31,18 @@ struct OpenedFile
 	HighlightSettings highlightSettings;
 	FragmentSearch fragSearch;
 	FileFormatSearch fileFmtSearch;
+	ValueSearch valueSearch;
+	// "Save edited copy" writes a snapshot of the edits in the background (the job is stopped before the snapshot is freed)
+	ui::RCHandle<IDataSource> saveSnapshot;
+	BackgroundSearch saveJob;
+	std::string saveStatus;
 };
 
 extern ui::MulticastDelegate<OpenedFile*> OnCurrentFileChanged;
 
+// sets up the data sources for the file's path/range/compression
+void OpenDDFileDataSources(DDFile* F, const char* compressionIndexPath = nullptr);
+
 struct Workspace
 {
 	Workspace()
@@ -53,11 +63,19 @@ struct Workspace
 		openedFiles.clear();
 	}
 
-	void Load(NamedTextSerializeReader& r);
+	void Load(NamedTextSerializeReader& r, ui::StringView path = {});
 	void Save(NamedTextSerializeWriter& w);
 	bool LoadFromFile(ui::StringView path);
 	bool SaveToFile(ui::StringView path);
 
+	// switches to the file's tab, opening one if there isn't any
+	OpenedFile* OpenFileTab(DDFile* F);
+	// creates a file for each of the found items that has a known size and wasn't carved yet
+	// the files share the data of the searched file (nothing is copied) and zlib/gzip streams are opened decompressed
+	// no tabs are opened and nothing is rebuilt, so that any number of items can be carved at once
+	// returns the number of created files
+	size_t CarveFiles(OpenedFile* of, const size_t* indices, size_t count);
+
 	std::vector<OpenedFile*> openedFiles;
 	int curOpenedFile = 0;
 	SubtabType curSubtab = SubtabType::Markers;
@@ -7,6 +7,7 @@
 #include "HexViewer.h"
 #include "ImageParsers.h"
 #include "Workspace.h"
+#include "CompressedDataSource.h"
 #include "FileView.h"
 #include "ImageEditor.h"
 #include "MeshEditor.h"
@@ -18,6 +19,7 @@
 #include "TabMarkers.h"
 #include "TabStructures.h"
 #include "TabImages.h"
+#include "TabDiagnostics.h"
 
 
 static float hsplitHexView[1] = { 0.3f };
@@ -136,6 +138,7 @@ struct MainWindow : ui::NativeMainWindow
 		ui::Make<ui::DefaultOverlayBuilder>();
 
 		ui::BuildMulticastDelegateAddNoArgs(OnCurrentFileChanged, [this]() { Rebuild(); });
+		ui::BuildMulticastDelegateAddNoArgs(OnCompressedIndexingProgress, [this]() { Rebuild(); });
 		auto& tpFiles = ui::Push<ui::TabbedPanel>();
 		tpFiles.showCloseButton = true;
 		{
@@ -143,7 +146,9 @@ struct MainWindow : ui::NativeMainWindow
 			for (auto* f : workspace.openedFiles)
 			{
 				std::string text = f->ddFile->name;
-				if (f->ddFile->off > 0 || f->ddFile->size < f->ddFile->origDataSource->GetSize())
+				// the size of compressed data is only known once it's indexed
+				auto* D = f->ddFile->decompressor.get_ptr();
+				if (f->ddFile->off > 0 || (f->ddFile->size != UINT64_MAX && (!D || D->IsIndexed()) && f->ddFile->size < f->ddFile->origDataSource->GetSize()))
 					text += ui::Format("[%" PRIu64 "-%" PRIu64 "]", f->ddFile->off, f->ddFile->off + f->ddFile->size);
 				tpFiles.AddTextTab(text, uintptr_t(nf++));
 			}
@@ -167,6 +172,15 @@ struct MainWindow : ui::NativeMainWindow
 				if (workspace.curOpenedFile != nf++)
 					continue;
 
+				// the views need the size of the data, which is unknown until compressed data is decoded once
+				auto* D = of->ddFile->decompressor.get_ptr();
+				if (D && !D->IsIndexed())
+				{
+					D->StartIndexing();
+					ui::MakeWithText<ui::LabelFrame>(ui::Format("Decompressing... %d%%", int(D->GetIndexingProgress() * 100)));
+					continue;
+				}
+
 				{
 					//ui::Push<ui::FrameElement>().SetDefaultStyle(ui::DefaultFrameStyle::GroupBox);
 					{
@@ -185,10 +199,12 @@ struct MainWindow : ui::NativeMainWindow
 								tp.AddEnumTab("Inspect", SubtabType::Inspect);
 								tp.AddEnumTab("Highlights", SubtabType::Highlights);
 								tp.AddEnumTab("Search (fragments)", SubtabType::FragmentSearch);
+								tp.AddEnumTab("Search (values)", SubtabType::ValueSearch);
 								tp.AddEnumTab("Search (files)", SubtabType::FileFormatSearch);
 								tp.AddEnumTab("Markers", SubtabType::Markers);
 								tp.AddEnumTab("Structures", SubtabType::Structures);
 								tp.AddEnumTab("Images", SubtabType::Images);
+								tp.AddEnumTab("Diagnostics", SubtabType::Diagnostics);
 
 								tp.SetActiveTabByUID(uintptr_t(workspace.curSubtab));
 								tp.HandleEvent(&tp, ui::EventType::SelectionChange) = [this, &tp](ui::Event&)
@@ -198,7 +214,9 @@ struct MainWindow : ui::NativeMainWindow
 
 								if (workspace.curSubtab == SubtabType::Inspect)
 								{
-									ui::Make<TabInspect>().of = of;
+									auto& ti = ui::Make<TabInspect>();
+									ti.workspace = &workspace;
+									ti.of = of;
 								}
 
 								if (workspace.curSubtab == SubtabType::Highlights)
@@ -215,9 +233,17 @@ struct MainWindow : ui::NativeMainWindow
 									curTable = &th;
 								}
 
+								if (workspace.curSubtab == SubtabType::ValueSearch)
+								{
+									auto& th = ui::Make<TabValueSearch>();
+									th.of = of;
+									curTable = &th;
+								}
+
 								if (workspace.curSubtab == SubtabType::FileFormatSearch)
 								{
 									auto& th = ui::Make<TabFileFormatSearch>();
+									th.workspace = &workspace;
 									th.of = of;
 									curTable = &th;
 								}
@@ -240,6 +266,11 @@ struct MainWindow : ui::NativeMainWindow
 								{
 									ui::Make<TabImages>().workspace = &workspace;
 								}
+
+								if (workspace.curSubtab == SubtabType::Diagnostics)
+								{
+									ui::Make<TabDiagnostics>();
+								}
 							}
 							ui::Pop();
 						}
@@ -318,9 +349,10 @@ struct MainWindow : ui::NativeMainWindow
 			auto* F = workspace.desc.CreateNewFile();
 			F->name = ui::to_string(ui::StringView(path).after_last("/"));
 			F->path = path;
-			F->origDataSource = GetFileDataSource(path.c_str());
-			F->dataSource = GetSlice(F->origDataSource, F->off, F->size);
-			F->mdSrc.dataSource = F->dataSource;
+			F->moreParts = FindNumberedFileParts(path);
+			if (!F->moreParts.empty())
+				F->name += ui::Format(" (+%zu parts)", F->moreParts.size());
+			OpenDDFileDataSources(F);
 
 			auto* of = new OpenedFile;
 			of->ddFile = F;
@@ -343,14 +375,63 @@ struct MainWindow : ui::NativeMainWindow
 	WindowT<MeshEditorWindowNode>* curMeshEditor = nullptr;
 };
 
+// usage: bdat [--io-stats[=<file>]] [--headless] [<workspace>]
+// --io-stats collects I/O statistics from the start and writes a summary on exit (to stdout if no file is given)
+// --headless loads the workspace and expands all of its struct instances instead of showing the window
 int uimain(int argc, char* argv[])
 {
-	ui::Application app(argc, argv);
-	MainWindow mw;
-	if (argc == 2)
+	const char* workspacePath = nullptr;
+	const char* ioStatsPath = nullptr;
+	bool ioStats = false;
+	bool headless = false;
+	for (int i = 1; i < argc; i++)
+	{
+		ui::StringView arg = argv[i];
+		if (arg == "--io-stats")
+			ioStats = true;
+		else if (arg.starts_with("--io-stats="))
+		{
+			ioStats = true;
+			ioStatsPath = argv[i] + strlen("--io-stats=");
+		}
+		else if (arg == "--headless")
+			headless = true;
+		else
+			workspacePath = argv[i];
+	}
+	if (ioStats)
+		g_ioStatsEnabled = true;
+
+	int ret = 0;
+	if (headless)
+	{
+		Workspace workspace;
+		if (workspacePath && workspace.LoadFromFile(workspacePath))
+			workspace.desc.ExpandAllInstances();
+		else
+			ret = 1;
+	}
+	else
 	{
-		mw.LoadFile(argv[1]);
+		ui::Application app(argc, argv);
+		MainWindow mw;
+		if (workspacePath)
+		{
+			mw.LoadFile(workspacePath);
+		}
+		mw.SetVisible(true);
+		ret = app.Run();
+	}
+
+	if (ioStats)
+	{
+		FILE* fp = ioStatsPath ? fopen(ioStatsPath, "w") : stdout;
+		if (fp)
+		{
+			WriteIOStatsSummary(fp);
+			if (fp != stdout)
+				fclose(fp);
+		}
 	}
-	mw.SetVisible(true);
-	return app.Run();
+	return ret;
 }
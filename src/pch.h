@@ -4,9 +4,15 @@
 #pragma warning(disable:4996)
 #include <vector>
 #include <algorithm>
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include <sstream>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <functional>
 #include "GUI.h"
 
 